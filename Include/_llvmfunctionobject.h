@@ -19,15 +19,22 @@ extern "C" {
 typedef struct _LlvmFunction _LlvmFunction;
 
 /* Really takes an llvm::Function*, and wraps it into a new'ed
-   _LlvmFunction. */
+   _LlvmFunction.  llvm_function must live in global_data's module; the
+   _LlvmFunction remembers global_data so it can free the function under
+   the right compile lock, whichever thread it's freed on. */
 PyAPI_FUNC(_LlvmFunction *) _LlvmFunction_New(
+    struct PyGlobalLlvmData *global_data,
     void *llvm_function);
 
 /* JIT compiles the llvm function.  Note that once the function has
    been translated to machine code once, it will never be
-   re-translated even if the underlying IR function changes. */
+   re-translated even if the underlying IR function changes.  This takes
+   the PyGlobalLlvmData explicitly because the compile threads call it
+   without holding the GIL.  It must be the one llvm_function was created
+   with. */
 typedef PyObject *(*PyEvalFrameFunction)(struct _frame *);
 PyAPI_FUNC(PyEvalFrameFunction) _LlvmFunction_Jit(
+    struct PyGlobalLlvmData *global_data,
     _LlvmFunction *llvm_function);
 
 // Forwards to global_data->Optimize(llvm_function->lf_function, level);
@@ -37,6 +44,19 @@ PyAPI_FUNC(int) _LlvmFunction_Optimize(struct PyGlobalLlvmData *global_data,
 
 PyAPI_FUNC(void) _LlvmFunction_Dealloc(_LlvmFunction *functionobj);
 
+/* Machine code that's been replaced or invalidated may still be running in
+   some frame, so we can't free it until its code object dies.  Retire()
+   adds functionobj to the list headed by *retired, and DeallocRetired()
+   frees everything on such a list. */
+PyAPI_FUNC(void) _LlvmFunction_Retire(_LlvmFunction **retired,
+                                      _LlvmFunction *functionobj);
+PyAPI_FUNC(void) _LlvmFunction_DeallocRetired(_LlvmFunction *retired);
+
+/* Bytes of machine code emitted for functionobj, or 0 if it hasn't been
+   JITted.  The Retired variant adds up a list built by Retire(). */
+PyAPI_FUNC(size_t) _LlvmFunction_GetCodeSize(_LlvmFunction *functionobj);
+PyAPI_FUNC(size_t) _LlvmFunction_GetRetiredCodeSize(_LlvmFunction *retired);
+
 
 /*
 _llvmfunction exposes an llvm::Function instance to Python code.  Only the
@@ -22,7 +22,8 @@ typedef enum {
 #endif
 
 
-/* Bytecode object.  Keep this in sync with Util/PyTypeBuilder.h. */
+/* Bytecode object.  Keep this in sync with JIT/PyTypeBuilder.h, and with
+   the code object's size in SizeofTest in Lib/test/test_sys.py. */
 typedef struct PyCodeObject {
     PyObject_HEAD
     int co_argcount;		/* #arguments, except *args */
@@ -61,26 +62,74 @@ typedef struct PyCodeObject {
     int co_optimization;
     /* There are two kinds of guard failures: fatal failures (machine code is
        invalid, requires recompilation) and non-fatal failures (unexpected
-       branch taken, machine code is still valid). If fatal guards are failing
-       repeatedly in the same code object, we shouldn't waste time repeatedly
-       recompiling this code. */
+       branch taken, machine code is still valid). After each fatal failure,
+       the code has to get hot all over again before we recompile it, and
+       each time it has to get twice as hot; see _PyCode_HotnessThreshold().
+       If fatal guards keep failing in the same code object, we stop
+       wasting time recompiling it. */
     int co_fatalbailcount;
     /* Measure of how hot this code object is. This is used to decide
        which code objects are worth sending through LLVM. */
     long co_hotness;
     /* Keep track of which dicts this code object is watching. */
     PyObject **co_watching;
+    /* Parallel to co_watching: for each watched dict, a tuple of the keys
+       the machine code depends on, or NULL or Py_None if it depends on the
+       whole dict.  Writes to other keys leave the machine code valid. */
+    PyObject **co_watched_keys;
+    /* True while this code object sits in the background compile queue or
+       is being compiled by the compile thread.  Left set if background
+       compilation failed outright, so we don't keep retrying.  See
+       JIT/compile_thread.h. */
+    char co_compile_queued;
+    /* Machine code that was invalidated, or replaced by a recompile at a
+       higher optimization level.  Frames may still be running it, so it
+       lives as long as the code object.  See _LlvmFunction_Retire(). */
+    _LlvmFunction *co_retired_llvm_functions;
+    /* The value of _PyCodeBudget_Clock when co_native_function was last
+       entered, so -Xjitbudget can evict the least recently used machine
+       code first.  See JIT/code_budget.h. */
+    unsigned long co_native_last_used;
+    /* Calls left before the next one records runtime feedback, when
+       Py_JitFeedbackInterval > 1. */
+    int co_feedback_countdown;
+    /* How many times the sampling profiler caught this code running.  See
+       JIT/sampling_profiler.h. */
+    long co_samples;
 #endif
+    /* A copy of co_code in which the eval loop has replaced some
+       instructions with specialized ones, or NULL until the code has been
+       run Py_QuickenThreshold times.  It has the same length and layout as
+       co_code, so f_lasti, jump targets and line numbers mean the same in
+       both.  See quicken_code() in Python/eval.cc. */
+    unsigned char *co_quickened;
+    /* The inline caches of the specialized instructions in co_quickened. */
+    struct _PyInlineCache *co_inline_caches;
+    /* How many times the eval loop has started running this code since it
+       last tried to quicken it. */
+    int co_quicken_count;
 } PyCodeObject;
 
 /* If co_fatalbailcount >= PY_MAX_FATAL_BAIL_COUNT, force this code to use the
    eval loop forever after. See the comment on the co_fatalbailcount field
    for more details. */
-#define PY_MAX_FATALBAILCOUNT 1
+#define PY_MAX_FATALBAILCOUNT 5
 
 /* The threshold for co_hotness before the code object is considered "hot". */
 #define PY_HOTNESS_THRESHOLD 100000
 
+/* The threshold for co_hotness before code that has had its machine code
+   invalidated co_fatalbailcount times is hot enough to compile again.
+   _PyCode_InvalidateMachineCode() resets co_hotness, so the code has to
+   prove itself again under whatever changed. */
+#define _PyCode_HotnessThreshold(co) \
+    ((long)PY_HOTNESS_THRESHOLD << (co)->co_fatalbailcount)
+
+/* With tiered compilation (Py_JitTiered), code first compiled at
+   Py_BASELINE_JIT_OPT_LEVEL is recompiled at the full level once co_hotness
+   passes this threshold. */
+#define PY_TIER_UP_THRESHOLD (10 * PY_HOTNESS_THRESHOLD)
+
 /* Masks for co_flags above.  If you update these, consider updating the
  * fast_function fast path in eval.cc.  */
 #define CO_OPTIMIZED    (1 << 0)
@@ -174,6 +223,10 @@ PyAPI_FUNC(PyObject*) PyCode_Optimize(PyObject *code, PyObject* consts,
    http://code.google.com/p/unladen-swallow/issues/detail?id=41. */
 PyAPI_FUNC(int) _PyCode_ToOptimizedLlvmIr(PyCodeObject *code, int opt_level);
 
+/* Returns 1 if code is eligible for compilation to LLVM IR, or 0 if
+   _PyCode_ToOptimizedLlvmIr() would refuse it. */
+PyAPI_FUNC(int) _PyCode_CanCompileToLlvm(PyCodeObject *code);
+
 /* Register a code object to receive updates if its globals or builtins change.
    If the globals or builtins change, co_use_jit will be set to 0; this causes
    the machine code to bail back to the interpreter to continue execution.
@@ -186,6 +239,18 @@ PyAPI_FUNC(int) _PyCode_ToOptimizedLlvmIr(PyCodeObject *code, int opt_level);
 PyAPI_FUNC(int) _PyCode_WatchDict(PyCodeObject *code, ReasonWatched reason,
                                   PyObject *dict);
 
+/* Narrow a watch set up by _PyCode_WatchDict() to writes of the given keys,
+   a tuple of exact strings, or pass Py_None to keep watching the whole dict.
+   Keys added by successive calls accumulate until the dict stops being
+   watched.  Returns 0 on success, -1 on failure. */
+PyAPI_FUNC(int) _PyCode_AddWatchedKeys(PyCodeObject *code,
+                                       ReasonWatched reason, PyObject *keys);
+
+/* Returns 1 if writing key in dict may invalidate code's machine code, or 0 if
+   the machine code does not depend on that key.  key may be any object. */
+PyAPI_FUNC(int) _PyCode_DependsOnDictKey(PyCodeObject *code, PyObject *dict,
+                                         PyObject *key);
+
 /* Stop watching a dict for changes. Returns 0 on success, -1 on failure. */
 PyAPI_FUNC(int) _PyCode_IgnoreDict(PyCodeObject *code, ReasonWatched reason);
 
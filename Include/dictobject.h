@@ -89,6 +89,14 @@ struct _dictobject {
 	PyDictEntry *(*ma_lookup)(PyDictObject *mp, PyObject *key, long hash);
 	PyDictEntry ma_smalltable[PyDict_MINSIZE];
 
+	/* Changes whenever a key is added or removed, but not when a value is
+	 * replaced.  Versions come from a single counter, so no two dicts, and
+	 * no two key sets of one dict, ever share one.  The eval loop's
+	 * LOAD_GLOBAL_CACHED uses this to know that a name it found in the
+	 * builtins is still missing from the globals.
+	 */
+	unsigned PY_LONG_LONG ma_keys_version;
+
 #ifdef WITH_LLVM
 	/* When the dict changes, tell any dependent code objects that whatever
 	 * assumptions they may have had about the state of the dict may be
@@ -96,7 +104,9 @@ struct _dictobject {
 	 * access to globals and builtins. If ma_watchers is NULL, no code
 	 * objects depend on this dictionary; this keeps updates to non-globals/
 	 * non-builtins dicts fast. Use _PyDict_AddWatcher() and 
-	 * _PyDict_DropWatcher() to modify this.
+	 * _PyDict_DropWatcher() to modify this. A code object that only
+	 * depends on some keys (see _PyCode_AddWatchedKeys()) is left alone
+	 * when other keys are written.
 	 */
 	struct PySmallPtrSet *ma_watchers;
 #endif
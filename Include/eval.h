@@ -178,12 +178,22 @@ PyAPI_FUNC(PyObject *) _PyEval_CallTracing(PyObject *func, PyObject *args);
    impact performance. */
 PyAPI_FUNC(void) _PyEval_RecordFatalBail(PyCodeObject *code);
 
+/* Record that a given code object was compiled to machine code again after
+   failing a fatal guard. */
+PyAPI_FUNC(void) _PyEval_RecordRecompile(PyCodeObject *code);
+
 /* Record how many watchers a given dict has. This is used to track how many
    watchers the globals/builtins dicts are accumulating. */
 PyAPI_FUNC(void) _PyEval_RecordWatcherCount(size_t watcher_count);
+
+/* Record whether a write to a watched dict invalidated a watching code object,
+   or left it alone because the code doesn't depend on the key written. */
+PyAPI_FUNC(void) _PyEval_RecordWatcherNotification(int invalidated);
 #else
 #define _PyEval_RecordFatalBail(code)
+#define _PyEval_RecordRecompile(code)
 #define _PyEval_RecordWatcherCount(watcher_count)
+#define _PyEval_RecordWatcherNotification(invalidated)
 #endif  /* Py_WITH_INSTRUMENTATION */
 
 
@@ -217,6 +227,12 @@ PyAPI_FUNC(void) _PyEval_RaiseForUnboundFreeVar(struct _frame *, int);
 
 PyAPI_FUNC(PyObject *) _PyEval_CallFunction(PyObject **, int, int);
 PyAPI_FUNC(PyObject *) _PyEval_CallFunctionVarKw(PyObject **, int, int, int);
+#ifdef WITH_LLVM
+PyAPI_FUNC(struct _frame *) _PyEval_EnterInlinedFrame(PyObject *func,
+                                                      PyObject **args);
+PyAPI_FUNC(void) _PyEval_LeaveInlinedFrame(struct _frame *);
+PyAPI_FUNC(void) _PyEval_ReleaseInlinedFrame(struct _frame *);
+#endif
 
 PyAPI_FUNC(PyObject *) _PyEval_ApplySlice(PyObject *, PyObject *, PyObject *);
 PyAPI_FUNC(int) _PyEval_AssignSlice(PyObject *, PyObject *,
@@ -98,6 +98,8 @@ enum _PyFrameGuardType {
     _PYGUARD_STORE_SUBSCR,
     _PYGUARD_LOAD_METHOD,
     _PYGUARD_CALL_METHOD,
+    _PYGUARD_PYFUNC,
+    _PYGUARD_FOR_ITER,
 };
 
 /* Standard object interface */
@@ -153,6 +153,13 @@ enum _Py_opcode {
 
 /* Support for opargs more than 16 bits long */
     EXTENDED_ARG =	143,
+
+/* Specialized instructions that the eval loop substitutes into a code
+   object's co_quickened.  They never appear in co_code.  The argument of
+   those that have one is the index of their inline cache. */
+    BINARY_ADD_INT =	69,
+    LOAD_ATTR_INSTANCE_DICT =	144,
+    LOAD_GLOBAL_CACHED =	145,
 };
 
 enum cmp_op {PyCmp_LT=Py_LT, PyCmp_LE=Py_LE, PyCmp_EQ=Py_EQ, PyCmp_NE=Py_NE, PyCmp_GT=Py_GT, PyCmp_GE=Py_GE,
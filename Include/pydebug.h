@@ -42,6 +42,54 @@ typedef enum {
 /* Defaults to PY_JIT_WHENHOT. */
 PyAPI_DATA(Py_JitOpts) Py_JitControl;
 
+/* If true, hot functions are compiled on a background thread instead of by
+   the thread that made them hot (-Xjitcompile=background).  Defaults to 0.
+   See JIT/compile_thread.h. */
+PyAPI_DATA(int) Py_JitBackgroundCompile;
+
+/* The most threads that compile hot functions in the background
+   (-Xjitthreads=N).  Defaults to 1.  See JIT/compile_thread.h. */
+PyAPI_DATA(int) Py_JitCompileThreads;
+
+/* If true, hot functions are first compiled at Py_BASELINE_JIT_OPT_LEVEL,
+   and only recompiled at the full level on the background compile thread if
+   they stay hot (-Xjitopt=tiered).  Defaults to 0, which compiles hot
+   functions at the full level right away. */
+PyAPI_DATA(int) Py_JitTiered;
+
+/* If not NULL, the file where we remember which code objects were worth
+   compiling across runs (-Xjitcache=PATH).  See JIT/code_cache.h. */
+PyAPI_DATA(const char *) Py_JitCacheFile;
+
+/* If not NULL, the file where we keep runtime feedback and hotness across
+   runs (-Xjitprofile=PATH).  See JIT/feedback_profile.h. */
+PyAPI_DATA(const char *) Py_JitProfileFile;
+
+/* If positive, the most machine code, in bytes, the JIT keeps before it
+   starts evicting the least recently used (-Xjitbudget=SIZE).  Defaults to
+   0, which means no limit.  See JIT/code_budget.h. */
+PyAPI_DATA(Py_ssize_t) Py_JitCodeBudget;
+
+/* Only every Py_JitFeedbackInterval'th call of a function records runtime
+   feedback in the eval loop (-Xjitsample=N).  Defaults to 1, every call.
+   Frames that bailed from machine code always record. */
+PyAPI_DATA(int) Py_JitFeedbackInterval;
+
+/* Functions don't record runtime feedback until their co_hotness is this
+   percentage of the way to _PyCode_HotnessThreshold() (-Xjitwarmup=P).
+   Defaults to 0. */
+PyAPI_DATA(int) Py_JitFeedbackWarmup;
+
+/* If true, co_hotness measures CPU time, through the sampling profiler,
+   rather than calls and loop backedges (-Xjithotness=time).  Defaults to
+   0.  See JIT/sampling_profiler.h. */
+PyAPI_DATA(int) Py_JitTimeHotness;
+
+/* The eval loop specializes a code object's bytecode once it has run this
+   many times (-Xquicken=N, sys.setquickenthreshold()).  Defaults to 8; 0
+   turns quickening off.  See quicken_code() in Python/eval.cc. */
+PyAPI_DATA(int) Py_QuickenThreshold;
+
 /* Converts strings to and from enum values.  */
 PyAPI_FUNC(int) Py_JitControlStrToEnum(const char *str, Py_JitOpts *flag);
 PyAPI_FUNC(const char *) Py_JitControlEnumToStr(Py_JitOpts flag);
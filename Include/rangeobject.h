@@ -22,6 +22,18 @@ PyAPI_DATA(PyTypeObject) PyRange_Type;
 
 #define PyRange_Check(op) (Py_TYPE(op) == &PyRange_Type)
 
+/* Exposed so the JIT can inline iteration over xranges.  Yields
+   start + index * step while index < len. */
+typedef struct {
+	PyObject_HEAD
+	long	index;
+	long	start;
+	long	step;
+	long	len;
+} PyRangeIterObject;
+
+PyAPI_DATA(PyTypeObject) PyRangeIter_Type;
+
 #ifdef __cplusplus
 }
 #endif
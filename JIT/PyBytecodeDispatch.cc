@@ -657,4 +657,11 @@ PyBytecodeDispatch::UNPACK_SEQUENCE(int size)
     cont.UNPACK_SEQUENCE(size);
 }
 
+void
+PyBytecodeDispatch::UNPACK_BUILT_SEQUENCE(int size)
+{
+    OpcodeContainer cont(fbuilder_);
+    cont.UNPACK_BUILT_SEQUENCE(size);
+}
+
 }
@@ -149,6 +149,8 @@ public:
     void BUILD_SLICE_TWO();
     void BUILD_SLICE_THREE();
     void UNPACK_SEQUENCE(int size);
+    // BUILD_TUPLE or BUILD_LIST immediately followed by UNPACK_SEQUENCE.
+    void UNPACK_BUILT_SEQUENCE(int size);
 
     void LOAD_GLOBAL(int index);
     void STORE_GLOBAL(int index);
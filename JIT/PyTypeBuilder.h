@@ -647,6 +647,7 @@ typedef PyTypeBuilder<PyObject> ObjectTy;
 typedef PyTypeBuilder<PyVarObject> VarObjectTy;
 typedef PyTypeBuilder<PyStringObject> StringTy;
 typedef PyTypeBuilder<PyIntObject> IntTy;
+typedef PyTypeBuilder<PyFloatObject> FloatTy;
 typedef PyTypeBuilder<PyTupleObject> TupleTy;
 typedef PyTypeBuilder<PyListObject> ListTy;
 typedef PyTypeBuilder<PyTypeObject> TypeTy;
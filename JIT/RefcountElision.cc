@@ -0,0 +1,443 @@
+#include "Python.h"
+
+#include "JIT/RefcountElision.h"
+#include "JIT/global_llvm_data.h"
+
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/BasicBlock.h"
+#include "llvm/Function.h"
+#include "llvm/Instructions.h"
+#include "llvm/Module.h"
+#include "llvm/Support/CallSite.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+#include <vector>
+
+namespace {
+
+using llvm::AliasAnalysis;
+using llvm::BasicBlock;
+using llvm::CallInst;
+using llvm::CallSite;
+using llvm::Function;
+using llvm::FunctionPass;
+using llvm::GetElementPtrInst;
+using llvm::Instruction;
+using llvm::LoadInst;
+using llvm::Pass;
+using llvm::ReversePostOrderTraversal;
+using llvm::StoreInst;
+using llvm::TerminatorInst;
+using llvm::Value;
+using llvm::dyn_cast;
+using llvm::errs;
+using llvm::isa;
+
+#ifdef Py_WITH_INSTRUMENTATION
+class RefcountElisionStats {
+public:
+    RefcountElisionStats()
+        : increfs(0), elided(0), sunk(0), forwarded(0) {
+    }
+
+    ~RefcountElisionStats() {
+        errs() << "\nRefcount elision:\n";
+        errs() << "Increfs seen: " << this->increfs << "\n";
+        errs() << "Incref/decref pairs removed: " << this->elided << "\n";
+        errs() << "Increfs sunk into successors: " << this->sunk << "\n";
+        errs() << "Stack loads forwarded: " << this->forwarded << "\n";
+    }
+
+    // Number of incref calls the pass looked at.
+    unsigned increfs;
+    // Number of incref/decref pairs deleted.
+    unsigned elided;
+    // Number of increfs moved past a conditional branch.
+    unsigned sunk;
+    // Number of loads we matched up with an earlier store.
+    unsigned forwarded;
+};
+
+static llvm::ManagedStatic<RefcountElisionStats> refcount_stats;
+
+#define REFCOUNT_INC_STATS(field) refcount_stats->field++
+#else
+#define REFCOUNT_INC_STATS(field)
+#endif  /* Py_WITH_INSTRUMENTATION */
+
+// The IR we generate increfs every value as it's pushed onto the
+// value stack and decrefs it when the consuming opcode is done with
+// it.  When nothing between those two points can drop a reference or
+// look at the refcount, the pair is a no-op.  This pass finds those
+// pairs and deletes them.  It runs before _PyLlvm_WrapIncref and
+// friends are inlined, so it only has to recognize calls.
+//
+// Values travel between opcodes through the frame's value stack, so
+// the decref usually sees a different SSA value from the incref: a
+// load from the stack slot the incref'd value was stored to.  We
+// first match such loads up with their stores, within each chain of
+// single-predecessor blocks, and compare refcounted values after
+// that mapping.
+//
+// Type-feedback fast paths put a guard between the incref and the
+// decref.  When an incref is followed only by a branch and one of the
+// successors starts with the matching decref, we move the incref into
+// every successor (splitting critical edges as needed) so that it
+// cancels on the fast path and survives unchanged on the others.
+class PyRefcountElisionPass : public FunctionPass {
+public:
+    static char ID;
+    PyRefcountElisionPass(PyGlobalLlvmData &global_data);
+
+    PyRefcountElisionPass()
+        : FunctionPass(&ID), llvm_data_(NULL), incref_(NULL), decref_(NULL),
+          xdecref_(NULL), aa_(NULL)
+    {}
+
+    virtual void getAnalysisUsage(llvm::AnalysisUsage &usage) const {
+        usage.addRequired<AliasAnalysis>();
+    }
+
+    virtual bool runOnFunction(Function&);
+
+private:
+    void addSafeCall(const char *name);
+    // Returns true if 'call' can't release a reference or read a
+    // refcount.
+    bool isTransparentCall(CallInst *call) const;
+    bool isDecref(const Instruction *inst) const;
+    // Returns the value a refcounting call operates on, looking
+    // through casts and forwarded stack loads.
+    Value *getRefcountedValue(CallInst *call) const;
+    Value *resolve(Value *value) const;
+
+    void forwardStores(Function &f);
+    void forwardStoresInBlock(BasicBlock *bb, std::vector<StoreInst*> &avail);
+
+    // Scans forward from 'start' for a decref of 'value', skipping
+    // instructions that can't affect refcounts.  Returns the decref,
+    // or NULL if a barrier or the end of the block comes first.
+    CallInst *findMatchingDecref(BasicBlock::iterator start, Value *value,
+                                 bool *reached_terminator) const;
+    // Either deletes 'incref' along with its decref, sinks it into the
+    // successors of its block, or leaves it alone.  New increfs created
+    // by sinking are appended to 'worklist'.
+    bool processIncref(CallInst *incref, std::vector<CallInst*> &worklist);
+    bool sinkIncref(CallInst *incref, Value *value,
+                    std::vector<CallInst*> &worklist);
+
+    const PyGlobalLlvmData *const llvm_data_;
+    Function *incref_;
+    Function *decref_;
+    Function *xdecref_;
+    llvm::SmallPtrSet<const Function*, 8> safe_calls_;
+
+    AliasAnalysis *aa_;
+    // Maps loads from the value stack to the value last stored there.
+    llvm::DenseMap<Value*, Value*> forwarded_;
+};
+
+// The address of this variable identifies the pass.  See
+// http://llvm.org/docs/WritingAnLLVMPass.html#basiccode.
+char PyRefcountElisionPass::ID = 0;
+
+// Register this pass.
+static llvm::RegisterPass<PyRefcountElisionPass>
+X("python-refcount-elision", "Python-specific refcount elision pass",
+  false, false);
+
+PyRefcountElisionPass::PyRefcountElisionPass(PyGlobalLlvmData &global_data)
+    : FunctionPass(&ID), llvm_data_(&global_data),
+      incref_(NULL), decref_(NULL), xdecref_(NULL), aa_(NULL)
+{
+}
+
+void
+PyRefcountElisionPass::addSafeCall(const char *name)
+{
+    Function *func = this->llvm_data_->module()->getFunction(name);
+    if (func != NULL)
+        this->safe_calls_.insert(func);
+}
+
+bool
+PyRefcountElisionPass::isTransparentCall(CallInst *call) const
+{
+    if (call->onlyReadsMemory())
+        return true;
+    Function *called = call->getCalledFunction();
+    if (called == NULL)
+        return false;
+    return called == this->incref_ || this->safe_calls_.count(called);
+}
+
+bool
+PyRefcountElisionPass::isDecref(const Instruction *inst) const
+{
+    const CallInst *call = dyn_cast<CallInst>(inst);
+    if (call == NULL)
+        return false;
+    const Function *called = call->getCalledFunction();
+    // An incref'd value can't be NULL, so an xdecref of it is a decref.
+    return called != NULL &&
+        (called == this->decref_ || called == this->xdecref_);
+}
+
+Value *
+PyRefcountElisionPass::resolve(Value *value) const
+{
+    value = value->stripPointerCasts();
+    llvm::DenseMap<Value*, Value*>::const_iterator it =
+        this->forwarded_.find(value);
+    if (it != this->forwarded_.end())
+        return it->second;
+    return value;
+}
+
+Value *
+PyRefcountElisionPass::getRefcountedValue(CallInst *call) const
+{
+    CallSite site(call);
+    return this->resolve(site.getArgument(0));
+}
+
+// Returns true if the two pointers are computed the same way, which
+// is how Push() and Pop() address the same stack slot.
+static bool
+isSameAddress(Value *a, Value *b)
+{
+    a = a->stripPointerCasts();
+    b = b->stripPointerCasts();
+    if (a == b)
+        return true;
+    GetElementPtrInst *gep_a = dyn_cast<GetElementPtrInst>(a);
+    GetElementPtrInst *gep_b = dyn_cast<GetElementPtrInst>(b);
+    if (gep_a == NULL || gep_b == NULL ||
+        gep_a->getNumOperands() != gep_b->getNumOperands())
+        return false;
+    for (unsigned i = 0, e = gep_a->getNumOperands(); i != e; ++i) {
+        if (gep_a->getOperand(i) != gep_b->getOperand(i))
+            return false;
+    }
+    return true;
+}
+
+void
+PyRefcountElisionPass::forwardStoresInBlock(BasicBlock *bb,
+                                            std::vector<StoreInst*> &avail)
+{
+    for (BasicBlock::iterator inst = bb->begin(); inst != bb->end(); ++inst) {
+        if (LoadInst *load = dyn_cast<LoadInst>(inst)) {
+            Value *addr = load->getPointerOperand();
+            for (size_t i = avail.size(); i-- > 0;) {
+                if (isSameAddress(avail[i]->getPointerOperand(), addr) &&
+                    avail[i]->getOperand(0)->getType() == load->getType()) {
+                    this->forwarded_[load] =
+                        this->resolve(avail[i]->getOperand(0));
+                    REFCOUNT_INC_STATS(forwarded);
+                    break;
+                }
+            }
+        }
+        else if (StoreInst *store = dyn_cast<StoreInst>(inst)) {
+            // Forget every store this one might overwrite.  What's left
+            // in 'avail' never aliases anything else in it.
+            Value *addr = store->getPointerOperand();
+            unsigned size = this->aa_->getTypeStoreSize(
+                store->getOperand(0)->getType());
+            size_t kept = 0;
+            for (size_t i = 0; i != avail.size(); ++i) {
+                Value *other = avail[i]->getPointerOperand();
+                unsigned other_size = this->aa_->getTypeStoreSize(
+                    avail[i]->getOperand(0)->getType());
+                if (this->aa_->alias(addr, size, other, other_size) ==
+                    AliasAnalysis::NoAlias)
+                    avail[kept++] = avail[i];
+            }
+            avail.resize(kept);
+            if (!store->isVolatile())
+                avail.push_back(store);
+        }
+        else if (CallInst *call = dyn_cast<CallInst>(inst)) {
+            // Calls like _PyEval_CallFunction() pop their arguments off
+            // the stack themselves.
+            if (!call->onlyReadsMemory() &&
+                call->getCalledFunction() != this->incref_)
+                avail.clear();
+        }
+    }
+}
+
+void
+PyRefcountElisionPass::forwardStores(Function &f)
+{
+    // Walk in reverse post-order so a block's single predecessor has
+    // always been visited before the block itself.
+    llvm::DenseMap<BasicBlock*, std::vector<StoreInst*> > at_end;
+    ReversePostOrderTraversal<Function*> rpot(&f);
+    for (ReversePostOrderTraversal<Function*>::rpo_iterator
+             bb = rpot.begin(), e = rpot.end(); bb != e; ++bb) {
+        std::vector<StoreInst*> avail;
+        BasicBlock *pred = (*bb)->getSinglePredecessor();
+        if (pred != NULL && pred != *bb) {
+            llvm::DenseMap<BasicBlock*, std::vector<StoreInst*> >::iterator
+                it = at_end.find(pred);
+            if (it != at_end.end())
+                avail = it->second;
+        }
+        this->forwardStoresInBlock(*bb, avail);
+        at_end[*bb].swap(avail);
+    }
+}
+
+CallInst *
+PyRefcountElisionPass::findMatchingDecref(BasicBlock::iterator inst,
+                                          Value *value,
+                                          bool *reached_terminator) const
+{
+    *reached_terminator = false;
+    for (;; ++inst) {
+        if (isa<TerminatorInst>(inst)) {
+            *reached_terminator = true;
+            return NULL;
+        }
+        CallInst *call = dyn_cast<CallInst>(inst);
+        if (call == NULL)
+            continue;
+        if (this->isDecref(call)) {
+            if (this->getRefcountedValue(call) == value)
+                return call;
+            // Decrefing anything else can run arbitrary code.
+            return NULL;
+        }
+        if (!this->isTransparentCall(call))
+            return NULL;
+    }
+}
+
+bool
+PyRefcountElisionPass::processIncref(CallInst *incref,
+                                     std::vector<CallInst*> &worklist)
+{
+    Value *value = this->getRefcountedValue(incref);
+    BasicBlock::iterator next = incref;
+    ++next;
+    bool reached_terminator;
+    CallInst *decref = this->findMatchingDecref(next, value,
+                                                &reached_terminator);
+    if (decref != NULL) {
+        decref->eraseFromParent();
+        incref->eraseFromParent();
+        REFCOUNT_INC_STATS(elided);
+        return true;
+    }
+    if (reached_terminator)
+        return this->sinkIncref(incref, value, worklist);
+    return false;
+}
+
+bool
+PyRefcountElisionPass::sinkIncref(CallInst *incref, Value *value,
+                                  std::vector<CallInst*> &worklist)
+{
+    BasicBlock *bb = incref->getParent();
+    TerminatorInst *term = bb->getTerminator();
+    if (!isa<llvm::BranchInst>(term) && !isa<llvm::SwitchInst>(term))
+        return false;
+    unsigned num_succ = term->getNumSuccessors();
+    if (num_succ < 2)
+        return false;
+
+    // Only sink if it pays off on at least one path, and don't bother
+    // with odd shapes like loops back to this block or repeated
+    // successors.
+    bool profitable = false;
+    llvm::SmallPtrSet<BasicBlock*, 4> seen;
+    for (unsigned i = 0; i != num_succ; ++i) {
+        BasicBlock *succ = term->getSuccessor(i);
+        if (succ == bb || !seen.insert(succ))
+            return false;
+        // An incref sunk into a block with other predecessors lands in
+        // a new block of its own, where it can't cancel anything.
+        if (succ->getSinglePredecessor() != bb)
+            continue;
+        bool reached_terminator;
+        if (this->findMatchingDecref(succ->getFirstNonPHI(), value,
+                                     &reached_terminator) != NULL)
+            profitable = true;
+    }
+    if (!profitable)
+        return false;
+
+    Value *arg = CallSite(incref).getArgument(0);
+    for (unsigned i = 0; i != num_succ; ++i) {
+        // Gives the edge its own block if the successor has other
+        // predecessors, so the incref only runs on paths through 'bb'.
+        llvm::SplitCriticalEdge(term, i, this);
+        BasicBlock *succ = term->getSuccessor(i);
+        CallInst *sunk = CallInst::Create(this->incref_, arg, "",
+                                          succ->getFirstNonPHI());
+        worklist.push_back(sunk);
+    }
+    incref->eraseFromParent();
+    REFCOUNT_INC_STATS(sunk);
+    return true;
+}
+
+bool
+PyRefcountElisionPass::runOnFunction(Function &f)
+{
+    if (this->incref_ == NULL) {
+        const llvm::Module *module = this->llvm_data_->module();
+        this->incref_ = module->getFunction("_PyLlvm_WrapIncref");
+        this->decref_ = module->getFunction("_PyLlvm_WrapDecref");
+        this->xdecref_ = module->getFunction("_PyLlvm_WrapXDecref");
+        // These allocate a new object, but never release a reference
+        // or call back into Python code.
+        this->addSafeCall("PyInt_FromLong");
+        this->addSafeCall("PyInt_FromSsize_t");
+        this->addSafeCall("PyBool_FromLong");
+        this->addSafeCall("PyFloat_FromDouble");
+    }
+    if (this->incref_ == NULL || this->decref_ == NULL)
+        return false;
+
+    this->aa_ = &getAnalysis<AliasAnalysis>();
+    this->forwarded_.clear();
+    this->forwardStores(f);
+
+    std::vector<CallInst*> worklist;
+    for (Function::iterator bb = f.begin(), e = f.end(); bb != e; ++bb) {
+        for (BasicBlock::iterator inst = bb->begin(); inst != bb->end();
+             ++inst) {
+            CallInst *call = dyn_cast<CallInst>(inst);
+            if (call != NULL && call->getCalledFunction() == this->incref_)
+                worklist.push_back(call);
+        }
+    }
+
+    bool changed = false;
+    // Entries are only ever erased by processIncref() on themselves,
+    // so the rest of the worklist stays valid.
+    while (!worklist.empty()) {
+        CallInst *incref = worklist.back();
+        worklist.pop_back();
+        REFCOUNT_INC_STATS(increfs);
+        changed |= this->processIncref(incref, worklist);
+    }
+    this->forwarded_.clear();
+    return changed;
+}
+
+}  // anonymous namespace
+
+Pass *
+CreatePyRefcountElisionPass(PyGlobalLlvmData &global_data)
+{
+    return new PyRefcountElisionPass(global_data);
+}
@@ -0,0 +1,15 @@
+// -*- C++ -*-
+#ifndef UTIL_REFCOUNTELISION_H
+#define UTIL_REFCOUNTELISION_H
+
+#ifndef __cplusplus
+#error This header expects to be included only in C++ source
+#endif
+
+#include "llvm/Pass.h"
+
+// A Pass to remove incref/decref pairs that cancel out.  This must run
+// before the _PyLlvm_Wrap{Incref,Decref,XDecref} calls are inlined.
+llvm::Pass *CreatePyRefcountElisionPass(struct PyGlobalLlvmData &global_data);
+
+#endif  // UTIL_REFCOUNTELISION_H
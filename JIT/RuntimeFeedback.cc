@@ -1,4 +1,5 @@
 #include "Python.h"
+#include "opcode.h"
 #include "JIT/RuntimeFeedback.h"
 
 #include "llvm/ADT/PointerIntPair.h"
@@ -90,6 +91,25 @@ PyLimitedFeedback::IncCounter(unsigned counter_id)
     }
 }
 
+void
+PyLimitedFeedback::IncCounterBy(unsigned counter_id, uintptr_t amount)
+{
+    assert(this->InCounterMode());
+    assert(counter_id < (unsigned)PyLimitedFeedback::NUM_POINTERS);
+    this->SetFlagBit(COUNTER_MODE_BIT, true);
+
+    uintptr_t shift = PointerLikeTypeTraits<PyObject*>::NumLowBitsAvailable;
+    uintptr_t old_value =
+        reinterpret_cast<uintptr_t>(this->data_[counter_id].getPointer());
+    uintptr_t max_value = ~(uintptr_t)0 << shift;
+    uintptr_t new_value;
+    if (amount > (max_value - old_value) >> shift)
+        new_value = max_value;  // Saturate.
+    else
+        new_value = old_value + (amount << shift);
+    this->data_[counter_id].setPointer(reinterpret_cast<void*>(new_value));
+}
+
 uintptr_t
 PyLimitedFeedback::GetCounter(unsigned counter_id) const
 {
@@ -100,6 +120,18 @@ PyLimitedFeedback::GetCounter(unsigned counter_id) const
     return reinterpret_cast<uintptr_t>(counter_as_pointer) >> shift;
 }
 
+PyFeedbackKind
+PyLimitedFeedback::GetKind() const
+{
+    if (this->GetFlagBit(OBJECT_MODE_BIT))
+        return PY_FDO_KIND_OBJECTS;
+    if (this->GetFlagBit(FUNC_MODE_BIT))
+        return PY_FDO_KIND_FUNCS;
+    if (this->GetFlagBit(COUNTER_MODE_BIT))
+        return PY_FDO_KIND_COUNTERS;
+    return PY_FDO_KIND_EMPTY;
+}
+
 void
 PyLimitedFeedback::Clear()
 {
@@ -171,13 +203,27 @@ PyLimitedFeedback::AddFuncSeen(PyObject *obj)
 
     // Record the type of the function, and the methoddef if it's a call to a C
     // function.
-    PyTypeObject *type = Py_TYPE(obj);
     PyMethodDef *ml = NULL;
     if (PyCFunction_Check(obj)) {
         ml = PyCFunction_GET_METHODDEF(obj);
     } else if (PyMethodDescr_Check(obj)) {
         ml = ((PyMethodDescrObject *)obj)->d_method;
     }
+    this->AddTypeMethodSeen(Py_TYPE(obj), ml);
+}
+
+void
+PyLimitedFeedback::AddTypeMethodSeen(PyTypeObject *type, PyMethodDef *ml)
+{
+    assert(this->InFuncMode());
+    this->SetFlagBit(FUNC_MODE_BIT, true);
+
+    if (this->GetFlagBit(SAW_MORE_THAN_THREE_OBJS_BIT))
+        return;
+    if (type == NULL) {
+        this->SetFlagBit(SAW_A_NULL_OBJECT_BIT, true);
+        return;
+    }
 
     PyTypeObject *old_type = (PyTypeObject *)this->data_[0].getPointer();
     PyMethodDef *old_ml = (PyMethodDef *)this->data_[1].getPointer();
@@ -329,6 +375,14 @@ PyFullFeedback::AddFuncSeen(PyObject *obj)
             ml = ((PyMethodDescrObject *)obj)->d_method;
         }
     }
+    this->AddTypeMethodSeen(type, ml);
+}
+
+void
+PyFullFeedback::AddTypeMethodSeen(PyTypeObject *type, PyMethodDef *ml)
+{
+    assert(this->InFuncMode());
+    this->usage_ = FuncMode;
 
     for (ObjSet::const_iterator it = this->data_.begin(),
             end = this->data_.end(); it != end; ++it) {
@@ -369,6 +423,20 @@ PyFullFeedback::IncCounter(unsigned counter_id)
     }
 }
 
+void
+PyFullFeedback::IncCounterBy(unsigned counter_id, uintptr_t amount)
+{
+    assert(this->InCounterMode());
+    assert(counter_id < llvm::array_lengthof(this->counters_));
+    this->usage_ = CounterMode;
+
+    uintptr_t old_value = this->counters_[counter_id];
+    uintptr_t new_value = old_value + amount;
+    if (new_value < old_value)
+        new_value = ~(uintptr_t)0;  // Saturate.
+    this->counters_[counter_id] = new_value;
+}
+
 uintptr_t
 PyFullFeedback::GetCounter(unsigned counter_id) const
 {
@@ -377,10 +445,26 @@ PyFullFeedback::GetCounter(unsigned counter_id) const
     return this->counters_[counter_id];
 }
 
+PyFeedbackKind
+PyFullFeedback::GetKind() const
+{
+    switch (this->usage_) {
+    case ObjectMode:
+        return PY_FDO_KIND_OBJECTS;
+    case FuncMode:
+        return PY_FDO_KIND_FUNCS;
+    case CounterMode:
+        return PY_FDO_KIND_COUNTERS;
+    case UnknownMode:
+        break;
+    }
+    return PY_FDO_KIND_EMPTY;
+}
+
 PyFeedbackMap *
-PyFeedbackMap_New()
+PyFeedbackMap_New(PyObject *co_code)
 {
-    return new PyFeedbackMap;
+    return new PyFeedbackMap(co_code);
 }
 
 void
@@ -395,29 +479,233 @@ PyFeedbackMap_Clear(PyFeedbackMap *map)
     map->Clear();
 }
 
+void
+PyFeedbackMap_ClearKeepingMegamorphic(PyFeedbackMap *map)
+{
+    map->ClearKeepingMegamorphic();
+}
+
+size_t
+PyFeedbackMap_GetMemoryUsage(PyFeedbackMap *map)
+{
+    return map->GetMemoryUsage();
+}
+
+unsigned
+PyFeedbackMap::NumSlotsFor(int opcode, int oparg)
+{
+    switch (opcode) {
+    case UNARY_POSITIVE:
+    case UNARY_NEGATIVE:
+    case UNARY_NOT:
+    case UNARY_CONVERT:
+    case UNARY_INVERT:
+    case UNPACK_SEQUENCE:
+    case STORE_ATTR:
+    case DELETE_ATTR:
+    case STORE_MAP:
+    case LOAD_ATTR:
+    case GET_ITER:
+    case FOR_ITER:
+    case IMPORT_NAME:
+    case CALL_METHOD:
+    case POP_JUMP_IF_FALSE:
+    case POP_JUMP_IF_TRUE:
+    case JUMP_IF_FALSE_OR_POP:
+    case JUMP_IF_TRUE_OR_POP:
+        return 1;
+
+    case BINARY_POWER:
+    case BINARY_MULTIPLY:
+    case BINARY_DIVIDE:
+    case BINARY_TRUE_DIVIDE:
+    case BINARY_FLOOR_DIVIDE:
+    case BINARY_MODULO:
+    case BINARY_ADD:
+    case BINARY_SUBTRACT:
+    case BINARY_SUBSCR:
+    case BINARY_LSHIFT:
+    case BINARY_RSHIFT:
+    case BINARY_AND:
+    case BINARY_XOR:
+    case BINARY_OR:
+    case INPLACE_POWER:
+    case INPLACE_MULTIPLY:
+    case INPLACE_DIVIDE:
+    case INPLACE_TRUE_DIVIDE:
+    case INPLACE_FLOOR_DIVIDE:
+    case INPLACE_MODULO:
+    case INPLACE_ADD:
+    case INPLACE_SUBTRACT:
+    case INPLACE_LSHIFT:
+    case INPLACE_RSHIFT:
+    case INPLACE_AND:
+    case INPLACE_XOR:
+    case INPLACE_OR:
+    case LIST_APPEND:
+    case STORE_SUBSCR:
+    case DELETE_SUBSCR:
+    case COMPARE_OP:
+    case LOAD_METHOD:
+        return 2;
+
+    case SLICE_NONE:
+    case SLICE_LEFT:
+    case SLICE_RIGHT:
+    case SLICE_BOTH:
+    case STORE_SLICE_NONE:
+    case STORE_SLICE_LEFT:
+    case STORE_SLICE_RIGHT:
+    case STORE_SLICE_BOTH:
+    case DELETE_SLICE_NONE:
+    case DELETE_SLICE_LEFT:
+    case DELETE_SLICE_RIGHT:
+    case DELETE_SLICE_BOTH:
+    case RAISE_VARARGS_ZERO:
+    case RAISE_VARARGS_ONE:
+    case RAISE_VARARGS_TWO:
+    case RAISE_VARARGS_THREE:
+        return 3;
+
+    case CALL_FUNCTION: {
+        // Calls with keyword arguments record nothing.  Otherwise we record
+        // the function, then either the type of each argument or the
+        // callee's code object.
+        int num_args = oparg & 0xff;
+        int num_kwargs = (oparg >> 8) & 0xff;
+        if (num_kwargs != 0)
+            return 0;
+        return 1 + std::max(num_args, 1);
+    }
+
+    default:
+        return 0;
+    }
+}
+
+PyFeedbackMap::PyFeedbackMap(PyObject *co_code)
+    : generation_(0)
+{
+    const unsigned char *code =
+        (const unsigned char *)PyString_AS_STRING(co_code);
+    Py_ssize_t code_size = PyString_GET_SIZE(co_code);
+    if (code_size == 0)
+        return;
+
+    // While the eval loop runs an EXTENDED_ARG instruction, f_lasti points
+    // at the EXTENDED_ARG, so that's where its slots go.
+    std::vector<uint16_t> slot_starts(code_size + 1);
+    unsigned num_slots = 0;
+    for (Py_ssize_t i = 0; i < code_size; ) {
+        Py_ssize_t start = i;
+        int opcode = code[i++];
+        int oparg = 0;
+        if (opcode == EXTENDED_ARG && i + 2 < code_size) {
+            oparg = (code[i + 1] << 24) | (code[i] << 16);
+            i += 2;
+            opcode = code[i++];
+        }
+        if (HAS_ARG(opcode) && i + 1 < code_size) {
+            oparg |= (code[i + 1] << 8) | code[i];
+            i += 2;
+        }
+        slot_starts[start] = num_slots;
+        num_slots += NumSlotsFor(opcode, oparg);
+        if (num_slots > 0xffff) {
+            // Leave everything to the side map.
+            return;
+        }
+        for (Py_ssize_t j = start + 1; j <= i && j <= code_size; ++j)
+            slot_starts[j] = num_slots;
+    }
+    this->slot_starts_.swap(slot_starts);
+    this->slots_.resize(num_slots);
+}
+
 const PyRuntimeFeedback *
 PyFeedbackMap::GetFeedbackEntry(unsigned opcode_index, unsigned arg_index) const
 {
-    llvm::DenseMap<std::pair<unsigned, unsigned>,
-                   PyRuntimeFeedback>::const_iterator result =
-        this->entries_.find(std::make_pair(opcode_index, arg_index));
-    if (result == this->entries_.end())
+    if (opcode_index + 1 < this->slot_starts_.size()) {
+        unsigned slot = this->slot_starts_[opcode_index] + arg_index;
+        if (slot < this->slot_starts_[opcode_index + 1])
+            return &this->slots_[slot];
+    }
+    FeedbackMap::const_iterator result =
+        this->overflow_.find(std::make_pair(opcode_index, arg_index));
+    if (result == this->overflow_.end())
         return NULL;
     return &result->second;
 }
 
-PyRuntimeFeedback &
-PyFeedbackMap::GetOrCreateFeedbackEntry(
-    unsigned opcode_index, unsigned arg_index)
+void
+PyFeedbackMap::GetEntriesInto(EntryList &result) const
 {
-    return this->entries_[std::make_pair(opcode_index, arg_index)];
+    result.clear();
+    for (unsigned i = 0; i + 1 < this->slot_starts_.size(); ++i) {
+        for (unsigned slot = this->slot_starts_[i];
+             slot < this->slot_starts_[i + 1]; ++slot) {
+            FeedbackKey key(i, slot - this->slot_starts_[i]);
+            result.push_back(std::make_pair(key, &this->slots_[slot]));
+        }
+    }
+    for (FeedbackMap::const_iterator it = this->overflow_.begin(),
+             end = this->overflow_.end(); it != end; ++it) {
+        result.push_back(std::make_pair(it->first, &it->second));
+    }
+}
+
+size_t
+PyFeedbackMap::GetMemoryUsage() const
+{
+    return sizeof(*this) +
+        this->slot_starts_.capacity() * sizeof(this->slot_starts_[0]) +
+        this->slots_.capacity() * sizeof(this->slots_[0]) +
+        this->overflow_.size() * sizeof(FeedbackMap::value_type);
 }
 
 void
 PyFeedbackMap::Clear()
 {
-    for (FeedbackMap::iterator it = this->entries_.begin(),
-            end = this->entries_.end(); it != end; ++it) {
+    for (std::vector<PyRuntimeFeedback>::iterator it = this->slots_.begin(),
+            end = this->slots_.end(); it != end; ++it) {
+        it->Clear();
+    }
+    for (FeedbackMap::iterator it = this->overflow_.begin(),
+            end = this->overflow_.end(); it != end; ++it) {
         it->second.Clear();
     }
+    ++this->generation_;
+}
+
+// Clears feedback unless it overflowed.
+static void
+clear_unless_megamorphic(PyRuntimeFeedback &feedback)
+{
+    switch (feedback.GetKind()) {
+    case PY_FDO_KIND_OBJECTS:
+        if (feedback.ObjectsOverflowed())
+            return;
+        break;
+    case PY_FDO_KIND_FUNCS:
+        if (feedback.FuncsOverflowed())
+            return;
+        break;
+    default:
+        break;
+    }
+    feedback.Clear();
+}
+
+void
+PyFeedbackMap::ClearKeepingMegamorphic()
+{
+    for (std::vector<PyRuntimeFeedback>::iterator it = this->slots_.begin(),
+            end = this->slots_.end(); it != end; ++it) {
+        clear_unless_megamorphic(*it);
+    }
+    for (FeedbackMap::iterator it = this->overflow_.begin(),
+            end = this->overflow_.end(); it != end; ++it) {
+        clear_unless_megamorphic(it->second);
+    }
+    ++this->generation_;
 }
@@ -28,7 +28,10 @@
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/PointerIntPair.h"
 #include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/DataTypes.h"
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace llvm {
 template<typename, unsigned> class SmallVector;
@@ -44,6 +47,14 @@ enum { PY_FDO_JUMP_TRUE = 0, PY_FDO_JUMP_FALSE, PY_FDO_JUMP_NON_BOOLEAN };
 // These are the counters used for feedback in the LOAD_METHOD opcode.
 enum { PY_FDO_LOADMETHOD_METHOD = 0, PY_FDO_LOADMETHOD_OTHER };
 
+// What a feedback entry has been used to record, if anything.
+enum PyFeedbackKind {
+    PY_FDO_KIND_EMPTY = 0,
+    PY_FDO_KIND_OBJECTS,
+    PY_FDO_KIND_FUNCS,
+    PY_FDO_KIND_COUNTERS
+};
+
 class PyLimitedFeedback {
 public:
     PyLimitedFeedback();
@@ -60,6 +71,8 @@ public:
 
     // Record that a given function was called.
     void AddFuncSeen(PyObject *obj);
+    // Like AddFuncSeen(), for a function of the given type and methoddef.
+    void AddTypeMethodSeen(PyTypeObject *type, PyMethodDef *ml);
     // Clears result and fills it with the set of observed types and
     // PyMethodDefs.
     void GetSeenFuncsInto(llvm::SmallVector<PyTypeMethodPair, 3> &result) const;
@@ -71,8 +84,11 @@ public:
     // overlaps with the object record, so you can't use both.  They
     // saturate rather than wrapping on overflow.
     void IncCounter(unsigned counter_id);
+    void IncCounterBy(unsigned counter_id, uintptr_t amount);
     uintptr_t GetCounter(unsigned counter_id) const;
 
+    PyFeedbackKind GetKind() const;
+
     // Clears out the collected objects, functions and counters.
     void Clear();
 
@@ -139,14 +155,18 @@ public:
 
     // Record that a given function was called.
     void AddFuncSeen(PyObject *obj);
+    void AddTypeMethodSeen(PyTypeObject *type, PyMethodDef *ml);
     // Clears result and fills it with the set of observed types and
     // PyMethodDefs.
     void GetSeenFuncsInto(llvm::SmallVector<PyTypeMethodPair, 3> &result) const;
     bool FuncsOverflowed() const { return false; }
 
     void IncCounter(unsigned counter_id);
+    void IncCounterBy(unsigned counter_id, uintptr_t amount);
     uintptr_t GetCounter(unsigned counter_id) const;
 
+    PyFeedbackKind GetKind() const;
+
     // Clears out the collected objects and counters.
     void Clear();
 
@@ -186,21 +206,78 @@ private:
 typedef PyLimitedFeedback PyRuntimeFeedback;
 
 // "struct" to make C and VC++ happy at the same time.
+//
+// Feedback lives in a flat array, with a slot for each argument that each
+// instruction records feedback on.  We find those instructions by scanning
+// the bytecode once, when the map is created.  slot_starts_ runs parallel
+// to co_code and holds the first slot of the instruction at each offset, so
+// the eval loop finds an entry with two adjacent loads: no hashing, and no
+// rehashing as the map fills up.  Anything the scan didn't predict, like an
+// entry loaded from a profile of older bytecode, goes in a DenseMap on the
+// side.
 struct PyFeedbackMap {
+    // A map without slots, which keeps every entry on the side.
+    PyFeedbackMap() : generation_(0) {}
+    // Gives a slot to every argument that co_code, a str, records feedback
+    // on.
+    explicit PyFeedbackMap(PyObject *co_code);
+
     PyRuntimeFeedback &GetOrCreateFeedbackEntry(
-        unsigned opcode_index, unsigned arg_index);
+        unsigned opcode_index, unsigned arg_index)
+    {
+        if (opcode_index + 1 < this->slot_starts_.size()) {
+            unsigned slot = this->slot_starts_[opcode_index] + arg_index;
+            if (slot < this->slot_starts_[opcode_index + 1])
+                return this->slots_[slot];
+        }
+        return this->overflow_[std::make_pair(opcode_index, arg_index)];
+    }
 
     const PyRuntimeFeedback *GetFeedbackEntry(
         unsigned opcode_index, unsigned arg_index) const;
 
     void Clear();
 
-private:
+    // Like Clear(), but leaves alone the entries that have seen more
+    // objects or functions than they can hold.  Code that was invalidated
+    // starts collecting feedback over again, but sites that were
+    // megamorphic before will probably be megamorphic again, and
+    // specializing them on a few fresh observations isn't worth the guard
+    // failures.
+    void ClearKeepingMegamorphic();
+
+    // Incremented every time the map is cleared.  Code compiled against
+    // an older generation was specialized for feedback that no longer
+    // exists.
+    unsigned GetGeneration() const { return this->generation_; }
+
+    // Bytes of memory the map holds, not counting the side map's empty
+    // buckets.
+    size_t GetMemoryUsage() const;
+
     // The key is a (opcode_index, arg_index) pair.
     typedef std::pair<unsigned, unsigned> FeedbackKey;
+    typedef std::vector<std::pair<FeedbackKey, const PyRuntimeFeedback *> >
+        EntryList;
+
+    // Fills result with every entry and its key, including empty ones.
+    void GetEntriesInto(EntryList &result) const;
+
+    // The number of feedback slots that instructions with the given opcode
+    // and argument record into, or 0 if they don't record feedback.  Must
+    // agree with the RECORD_* macros in eval.cc.
+    static unsigned NumSlotsFor(int opcode, int oparg);
+
+private:
     typedef llvm::DenseMap<FeedbackKey, PyRuntimeFeedback> FeedbackMap;
 
-    FeedbackMap entries_;
+    // The instruction at offset i owns slots_[slot_starts_[i]] up to, but
+    // not including, slots_[slot_starts_[i + 1]].  Empty if there's no
+    // bytecode, or it needs more slots than fit in 16 bits.
+    std::vector<uint16_t> slot_starts_;
+    std::vector<PyRuntimeFeedback> slots_;
+    FeedbackMap overflow_;
+    unsigned generation_;
 };
 
 #endif  // UTIL_RUNTIMEFEEDBACK_H
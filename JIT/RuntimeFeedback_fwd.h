@@ -7,9 +7,12 @@ extern "C" {
 
 struct PyFeedbackMap;
 
-struct PyFeedbackMap *PyFeedbackMap_New(void);
+/* co_code is the bytecode the map will hold feedback for. */
+struct PyFeedbackMap *PyFeedbackMap_New(PyObject *co_code);
 void PyFeedbackMap_Del(struct PyFeedbackMap *);
 PyAPI_FUNC(void) PyFeedbackMap_Clear(struct PyFeedbackMap *);
+void PyFeedbackMap_ClearKeepingMegamorphic(struct PyFeedbackMap *);
+size_t PyFeedbackMap_GetMemoryUsage(struct PyFeedbackMap *);
 
 #ifdef __cplusplus
 }  /* extern "C" */
@@ -0,0 +1,134 @@
+// Implements -Xjitbudget.  See code_budget.h for an overview.
+
+#include "Python.h"
+#include "code.h"
+#include "frameobject.h"
+#include "_llvmfunctionobject.h"
+
+#include "JIT/code_budget.h"
+#include "JIT/global_llvm_data.h"
+
+#include "llvm/ADT/SmallPtrSet.h"
+
+#include <algorithm>
+#include <set>
+#include <utility>
+#include <vector>
+
+unsigned long _PyCodeBudget_Clock = 0;
+
+// Every code object that has been given machine code and hasn't died or been
+// evicted since.  Its machine code may since have been invalidated, but
+// that leaves it on co_retired_llvm_functions.
+static std::set<PyCodeObject *> *compiled_code = NULL;
+
+static Py_ssize_t eviction_count = 0;
+
+// Collects the code of every frame on every thread's stack.  Some of those
+// frames are in the eval loop, but telling which are running machine code
+// (their own, or inlined into a caller's) isn't worth the trouble.
+static void
+find_running_code(llvm::SmallPtrSet<PyCodeObject *, 32> &running)
+{
+    for (PyInterpreterState *interp = PyInterpreterState_Head();
+         interp != NULL; interp = PyInterpreterState_Next(interp)) {
+        for (PyThreadState *tstate = PyInterpreterState_ThreadHead(interp);
+             tstate != NULL; tstate = PyThreadState_Next(tstate)) {
+            for (PyFrameObject *f = tstate->frame; f != NULL; f = f->f_back)
+                running.insert(f->f_code);
+        }
+    }
+}
+
+// Sends code back to the eval loop until it gets hot again.  code must not
+// have a frame on any stack.
+static void
+evict(PyCodeObject *code)
+{
+    code->co_use_jit = 0;
+    code->co_native_function = NULL;
+    if (code->co_llvm_function != NULL) {
+        _LlvmFunction_Dealloc(code->co_llvm_function);
+        code->co_llvm_function = NULL;
+    }
+    _LlvmFunction_DeallocRetired(code->co_retired_llvm_functions);
+    code->co_retired_llvm_functions = NULL;
+    code->co_optimization = -1;
+    code->co_hotness = std::min(code->co_hotness / 2,
+                                _PyCode_HotnessThreshold(code) / 2);
+    ++eviction_count;
+}
+
+// Evicts machine code, least recently used first, until the live machine
+// code fits in Py_JitCodeBudget or there's nothing left we can evict.
+// Leaves keep alone.
+static void
+enforce_budget(PyCodeObject *keep)
+{
+    if (Py_JitCodeBudget <= 0 || compiled_code == NULL)
+        return;
+    PyGlobalLlvmData *global_data = PyGlobalLlvmData::Get();
+    const size_t budget = (size_t)Py_JitCodeBudget;
+    if (global_data->GetLiveCodeBytes() <= budget)
+        return;
+
+    llvm::SmallPtrSet<PyCodeObject *, 32> running;
+    find_running_code(running);
+    std::vector<std::pair<unsigned long, PyCodeObject *> > candidates;
+    for (std::set<PyCodeObject *>::const_iterator it = compiled_code->begin(),
+             end = compiled_code->end(); it != end; ++it) {
+        PyCodeObject *code = *it;
+        if (code != keep && !running.count(code))
+            candidates.push_back(std::make_pair(code->co_native_last_used,
+                                                code));
+    }
+    std::sort(candidates.begin(), candidates.end());
+
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        if (global_data->GetLiveCodeBytes() <= budget)
+            break;
+        PyCodeObject *code = candidates[i].second;
+        evict(code);
+        compiled_code->erase(code);
+    }
+}
+
+void
+_PyCodeBudget_RecordCompiled(PyCodeObject *code)
+{
+    if (compiled_code == NULL)
+        compiled_code = new std::set<PyCodeObject *>;
+    compiled_code->insert(code);
+    _PyCodeBudget_MarkUsed(code);
+    enforce_budget(code);
+}
+
+void
+_PyCodeBudget_Forget(PyCodeObject *code)
+{
+    if (compiled_code != NULL)
+        compiled_code->erase(code);
+}
+
+void
+_PyCodeBudget_SetBudget(Py_ssize_t budget)
+{
+    Py_JitCodeBudget = budget;
+    enforce_budget(NULL);
+}
+
+size_t
+_PyCodeBudget_GetCodeSize(PyCodeObject *code)
+{
+    size_t size =
+        _LlvmFunction_GetRetiredCodeSize(code->co_retired_llvm_functions);
+    if (code->co_llvm_function != NULL)
+        size += _LlvmFunction_GetCodeSize(code->co_llvm_function);
+    return size;
+}
+
+Py_ssize_t
+_PyCodeBudget_GetEvictionCount(void)
+{
+    return eviction_count;
+}
@@ -0,0 +1,65 @@
+/* Bounding the machine code the JIT keeps (-Xjitbudget=SIZE).
+
+   Otherwise every code object that ever got hot keeps its machine code,
+   and any machine code retired by invalidation or tiered recompilation,
+   until the code object dies.  With a budget, each time code is compiled
+   we compare _llvm.get_live_code_bytes() against Py_JitCodeBudget, and
+   while it's over we evict machine code, least recently entered first.
+
+   Evicting a code object frees its co_llvm_function and retired
+   functions and sends it back to the eval loop, as if it had never been
+   compiled.  Its co_hotness is cut to at most half of
+   _PyCode_HotnessThreshold(), so it gets compiled again if it heats up
+   again, but not on its next call.  Nothing else changes: it keeps its
+   feedback, and keeps watching its globals and builtins, since callers
+   may have inlined it.  We never evict code that has a frame on any
+   thread's stack, since that frame may be running the machine code.
+
+   _llvm.set_code_budget() changes the budget at runtime.
+   _llvm.get_code_size() reports the machine code a code object holds, and
+   _llvm.get_code_evictions() how often we had to evict. */
+#ifndef PYTHON_CODE_BUDGET_H
+#define PYTHON_CODE_BUDGET_H
+
+#include "Python.h"
+#include "code.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef WITH_LLVM
+/* Bumped each time machine code is entered, to order code objects by how
+   recently their machine code ran. */
+PyAPI_DATA(unsigned long) _PyCodeBudget_Clock;
+
+/* Call each time code's co_native_function is entered. */
+#define _PyCodeBudget_MarkUsed(code) \
+    ((code)->co_native_last_used = ++_PyCodeBudget_Clock)
+
+/* Called when code gets new machine code.  Starts accounting for it, and
+   evicts other machine code if that puts us over budget.  Never evicts
+   code itself. */
+void _PyCodeBudget_RecordCompiled(PyCodeObject *code);
+
+/* Called when code dies. */
+void _PyCodeBudget_Forget(PyCodeObject *code);
+
+/* Changes Py_JitCodeBudget, and evicts machine code until we're under the
+   new budget.  0 means unlimited. */
+PyAPI_FUNC(void) _PyCodeBudget_SetBudget(Py_ssize_t budget);
+
+/* Returns the bytes of machine code held by code, including retired
+   machine code. */
+PyAPI_FUNC(size_t) _PyCodeBudget_GetCodeSize(PyCodeObject *code);
+
+/* Returns the number of code objects whose machine code has been evicted
+   so far. */
+PyAPI_FUNC(Py_ssize_t) _PyCodeBudget_GetEvictionCount(void);
+#endif  /* WITH_LLVM */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* PYTHON_CODE_BUDGET_H */
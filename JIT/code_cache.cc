@@ -0,0 +1,239 @@
+// Implements the -Xjitcache file.  See code_cache.h for an overview.
+//
+// The file is plain text.  The first line identifies the interpreter build;
+// every other line is a record of the form
+//
+//   <status> <opt level> <hash> <first line number> <filename>
+//
+// where <status> is 'C' for code that was compiled at <opt level>, 'I' for
+// code whose machine code was invalidated at least once, or 'F' for code
+// that used up its fatal bails.  The filename runs to the end of the line.
+// Code marked 'I' is left to get hot on its own in the next process, since
+// whatever invalidated it will probably happen again.
+
+#include "Python.h"
+#include "code.h"
+
+#include "JIT/code_cache.h"
+
+#include "llvm/ADT/StringMap.h"
+
+#include <stdio.h>
+#include <string>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+namespace {
+struct PyJitCacheRecord {
+    PyJitCacheRecord() : opt_level(-1), invalidated(false), fatal(false) {}
+
+    char status() const
+    {
+        return this->fatal ? 'F' : this->invalidated ? 'I' : 'C';
+    }
+
+    int opt_level;
+    bool invalidated;
+    bool fatal;
+};
+}  // anonymous namespace
+
+typedef llvm::StringMap<PyJitCacheRecord> PyJitCacheMap;
+
+// Everything here is protected by the GIL.
+
+// What the cache file said when we started, loaded on first use.
+static PyJitCacheMap *loaded_records;
+// What we've learned since.
+static PyJitCacheMap *new_records;
+
+// Code compiled by one build says nothing about another, if only because
+// the hotness threshold and the compiler may have changed.
+std::string
+PyJitCache_GetBuildTag()
+{
+    std::string tag = PY_VERSION " ";
+    tag += Py_GetBuildInfo();
+    tag += " ";
+    tag += Py_GetCompiler();
+    for (std::string::iterator it = tag.begin(); it != tag.end(); ++it) {
+        if (*it == '\n')
+            *it = ' ';
+    }
+    return tag;
+}
+
+static std::string
+file_header()
+{
+    return "unladen-jit-cache 1 " + PyJitCache_GetBuildTag();
+}
+
+// Reads one line, without its newline, into line.  Returns false at EOF.
+static bool
+read_line(FILE *file, std::string &line)
+{
+    line.clear();
+    int c;
+    while ((c = getc(file)) != EOF) {
+        if (c == '\n')
+            return true;
+        line += (char)c;
+    }
+    return !line.empty();
+}
+
+bool
+PyJitCache_GetCodeKey(PyCodeObject *code, std::string &key)
+{
+    // code_hash() only fails if a constant is unhashable, which the
+    // compiler never produces.
+    long hash = PyObject_Hash((PyObject *)code);
+    if (hash == -1) {
+        PyErr_Clear();
+        return false;
+    }
+    const char *filename = PyString_AS_STRING(code->co_filename);
+    if (strchr(filename, '\n') != NULL)
+        return false;
+    char prefix[64];
+    PyOS_snprintf(prefix, sizeof(prefix), "%lx %d ",
+                  (unsigned long)hash, code->co_firstlineno);
+    key = prefix;
+    key += filename;
+    return true;
+}
+
+// Adds the records in the cache file to records.  A missing file, or one
+// written by another build, is treated as empty.
+static void
+read_cache_file(PyJitCacheMap &records)
+{
+    FILE *file = fopen(Py_JitCacheFile, "r");
+    if (file == NULL)
+        return;
+    std::string line;
+    if (!read_line(file, line) || line != file_header()) {
+        fclose(file);
+        return;
+    }
+    while (read_line(file, line)) {
+        char status;
+        int opt_level, consumed;
+        if (sscanf(line.c_str(), "%c %d %n", &status, &opt_level,
+                   &consumed) < 2)
+            continue;
+        if (status != 'C' && status != 'I' && status != 'F')
+            continue;
+        PyJitCacheRecord &record = records[line.substr(consumed)];
+        record.opt_level = opt_level;
+        record.invalidated = (status != 'C');
+        record.fatal = (status == 'F');
+    }
+    fclose(file);
+}
+
+static PyJitCacheMap &
+get_loaded_records()
+{
+    if (loaded_records == NULL) {
+        loaded_records = new PyJitCacheMap;
+        read_cache_file(*loaded_records);
+    }
+    return *loaded_records;
+}
+
+static PyJitCacheRecord *
+record_for(PyCodeObject *code)
+{
+    if (Py_JitCacheFile == NULL || PyErr_Occurred())
+        return NULL;
+    std::string key;
+    if (!PyJitCache_GetCodeKey(code, key))
+        return NULL;
+    if (new_records == NULL)
+        new_records = new PyJitCacheMap;
+    return &(*new_records)[key];
+}
+
+void
+_PyJitCache_ApplyTo(PyCodeObject *code)
+{
+    if (Py_JitCacheFile == NULL || PyErr_Occurred())
+        return;
+    PyJitCacheMap &records = get_loaded_records();
+    if (records.empty())
+        return;
+    std::string key;
+    if (!PyJitCache_GetCodeKey(code, key))
+        return;
+    PyJitCacheMap::const_iterator it = records.find(key);
+    if (it == records.end())
+        return;
+    if (it->second.fatal)
+        code->co_fatalbailcount = PY_MAX_FATALBAILCOUNT;
+    else if (!it->second.invalidated &&
+             code->co_hotness < PY_HOTNESS_THRESHOLD - PY_JIT_CACHE_WARMUP)
+        code->co_hotness = PY_HOTNESS_THRESHOLD - PY_JIT_CACHE_WARMUP;
+}
+
+void
+_PyJitCache_RecordCompiled(PyCodeObject *code)
+{
+    PyJitCacheRecord *record = record_for(code);
+    if (record == NULL)
+        return;
+    record->opt_level = code->co_optimization;
+}
+
+void
+_PyJitCache_RecordFatalBail(PyCodeObject *code)
+{
+    PyJitCacheRecord *record = record_for(code);
+    if (record == NULL)
+        return;
+    record->invalidated = true;
+    if (code->co_fatalbailcount >= PY_MAX_FATALBAILCOUNT)
+        record->fatal = true;
+}
+
+int
+_PyJitCache_Save(void)
+{
+    if (Py_JitCacheFile == NULL || new_records == NULL)
+        return 0;
+
+    // Other processes may have updated the file since we loaded it, so
+    // merge into what's there now.
+    PyJitCacheMap records;
+    read_cache_file(records);
+    for (PyJitCacheMap::const_iterator it = new_records->begin(),
+             end = new_records->end(); it != end; ++it) {
+        records[it->getKey()] = it->getValue();
+    }
+
+    // Write to a private file and rename it into place, so concurrent
+    // readers never see a partial cache.
+    char suffix[32];
+    PyOS_snprintf(suffix, sizeof(suffix), ".%ld.tmp", (long)getpid());
+    std::string temp_name = std::string(Py_JitCacheFile) + suffix;
+    FILE *file = fopen(temp_name.c_str(), "w");
+    if (file == NULL) {
+        perror(temp_name.c_str());
+        return -1;
+    }
+    fprintf(file, "%s\n", file_header().c_str());
+    for (PyJitCacheMap::const_iterator it = records.begin(),
+             end = records.end(); it != end; ++it) {
+        const PyJitCacheRecord &record = it->getValue();
+        fprintf(file, "%c %d %s\n", record.status(),
+                record.opt_level, it->getKey().str().c_str());
+    }
+    if (fclose(file) != 0 || rename(temp_name.c_str(), Py_JitCacheFile) != 0) {
+        perror(Py_JitCacheFile);
+        remove(temp_name.c_str());
+        return -1;
+    }
+    return 0;
+}
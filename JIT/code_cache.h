@@ -0,0 +1,75 @@
+/* Persistent cache of JIT compilation outcomes (-Xjitcache=PATH).
+
+   Otherwise every new process has to rediscover which code is hot by
+   running it through the eval loop until it reaches PY_HOTNESS_THRESHOLD,
+   and which code can't stay in machine code by compiling it and failing
+   its guards.  With a cache file, we record both outcomes as they happen and
+   write them out at exit.  When a later process creates a code object with
+   the same key, we either mark it as having used up its fatal bails (so
+   it's never compiled), or start it PY_JIT_CACHE_WARMUP short of the
+   hotness threshold.  In the second case it's compiled after about a
+   hundred calls or a thousand loop iterations, rather than ten thousand
+   calls.  We don't compile it on its first call, because the eval loop
+   hasn't recorded any runtime feedback by then, and the machine code
+   would stay unspecialized for the rest of the process.  With
+   -Xjitprofile, the feedback profile can supply that feedback instead,
+   and then the code is compiled on its first call; see
+   feedback_profile.h.  Code whose machine code was invalidated, but which
+   hadn't used up its fatal bails, has to get hot again the usual way.
+
+   A code object's key is its co_filename, co_firstlineno and hash.  The
+   hash covers its bytecode, constants and names; see code_hash().  The file
+   also records the interpreter version and build, and a file written by a
+   different build is ignored.
+
+   We don't cache IR or machine code.  Generated code embeds the addresses
+   of the objects it was specialized on (types, constants, globals, cached
+   methods), none of which survive into another process, so all it could
+   save is the compile time we spend anyway. */
+#ifndef PYTHON_CODE_CACHE_H
+#define PYTHON_CODE_CACHE_H
+
+#include "Python.h"
+#include "code.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef WITH_LLVM
+/* How far short of PY_HOTNESS_THRESHOLD the cache starts code that was
+   compiled before, so it can record some runtime feedback first. */
+#define PY_JIT_CACHE_WARMUP (PY_HOTNESS_THRESHOLD / 100)
+
+/* Called by PyCode_New().  If the cache knows code, marks it nearly hot or
+   uncompilable.  A no-op without -Xjitcache. */
+void _PyJitCache_ApplyTo(PyCodeObject *code);
+
+/* Record that code was compiled to machine code, or that its machine code
+   was invalidated.  No-ops without -Xjitcache. */
+void _PyJitCache_RecordCompiled(PyCodeObject *code);
+void _PyJitCache_RecordFatalBail(PyCodeObject *code);
+
+/* Merges what this process recorded into the cache file.  Called from
+   Py_Finalize().  Returns 0 on success or -1 on an I/O error; I/O errors
+   are reported on stderr, since there's nobody to raise them to. */
+int _PyJitCache_Save(void);
+#endif  /* WITH_LLVM */
+
+#ifdef __cplusplus
+}
+
+#ifdef WITH_LLVM
+#include <string>
+
+// Sets key to a string that identifies code across processes: its hash,
+// co_firstlineno and co_filename.  Returns false if code has no usable key.
+// Also used by the feedback profile (feedback_profile.h).
+bool PyJitCache_GetCodeKey(PyCodeObject *code, std::string &key);
+
+// Describes the interpreter build, for file headers.
+std::string PyJitCache_GetBuildTag();
+#endif  // WITH_LLVM
+#endif  // __cplusplus
+
+#endif  /* PYTHON_CODE_CACHE_H */
@@ -0,0 +1,582 @@
+// Implements the background compile thread.  See compile_thread.h for an
+// overview.
+
+#include "Python.h"
+#include "code.h"
+#include "_llvmfunctionobject.h"
+
+#include "JIT/code_budget.h"
+#include "JIT/code_cache.h"
+#include "JIT/compile_thread.h"
+#include "JIT/global_llvm_data.h"
+#include "JIT/jit_stats.h"
+#include "JIT/llvm_compile.h"
+#include "JIT/RuntimeFeedback.h"
+#include "Util/EventTimer.h"
+
+#ifdef WITH_THREAD
+#include "pythread.h"
+
+#include "llvm/System/Threading.h"
+#endif
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#ifdef WITH_THREAD
+
+PyRecursiveLock::PyRecursiveLock()
+    : lock_(PyThread_allocate_lock()), owner_(0), depth_(0)
+{
+    if (this->lock_ == NULL)
+        Py_FatalError("can't allocate a compile lock");
+}
+
+PyRecursiveLock::~PyRecursiveLock()
+{
+    PyThread_free_lock(this->lock_);
+}
+
+void
+PyRecursiveLock::Acquire()
+{
+    long me = PyThread_get_thread_ident();
+    if (this->depth_ > 0 && this->owner_ == me) {
+        ++this->depth_;
+        return;
+    }
+    PyThread_acquire_lock(this->lock_, WAIT_LOCK);
+    this->owner_ = me;
+    this->depth_ = 1;
+}
+
+void
+PyRecursiveLock::Release()
+{
+    assert(this->depth_ > 0 &&
+           this->owner_ == PyThread_get_thread_ident() &&
+           "Released a compile lock we don't hold");
+    if (--this->depth_ == 0)
+        PyThread_release_lock(this->lock_);
+}
+
+void
+PyRecursiveLock::ReInitAfterFork()
+{
+    // Like PyEval_ReInitThreads(), we leak the old lock rather than risk
+    // freeing a lock that's held.
+    this->lock_ = PyThread_allocate_lock();
+    this->depth_ = 0;
+}
+
+#else  /* !WITH_THREAD */
+
+PyRecursiveLock::PyRecursiveLock() {}
+PyRecursiveLock::~PyRecursiveLock() {}
+void PyRecursiveLock::Acquire() {}
+void PyRecursiveLock::Release() {}
+void PyRecursiveLock::ReInitAfterFork() {}
+
+#endif  /* WITH_THREAD */
+
+PyLlvmCompileLock::PyLlvmCompileLock()
+    : lock_(PyGlobalLlvmData::Get()->compile_lock())
+{
+    this->lock_.Acquire();
+}
+
+PyLlvmCompileLock::PyLlvmCompileLock(PyGlobalLlvmData *global_data)
+    : lock_(global_data->compile_lock())
+{
+    this->lock_.Acquire();
+}
+
+void
+_PyLlvm_AcquireCompileLock(void)
+{
+    PyGlobalLlvmData::Get()->compile_lock().Acquire();
+}
+
+void
+_PyLlvm_ReleaseCompileLock(void)
+{
+    PyGlobalLlvmData::Get()->compile_lock().Release();
+}
+
+int
+_PyLlvm_CanCompileInParallel(void)
+{
+#ifdef Py_WITH_INSTRUMENTATION
+    return 0;
+#else
+    return llvm::llvm_is_multithreaded();
+#endif
+}
+
+#ifdef WITH_THREAD
+
+// Everything below is protected by the GIL.
+
+// One per running compile thread.
+struct PyCompileThread {
+    // What this thread compiles with.  Outlives the thread; see
+    // PyGlobalLlvmData::NewCompileThreadData().
+    PyGlobalLlvmData *llvm_data;
+    // The code object this thread is working on, or NULL.
+    PyCodeObject *compiling_code;
+};
+
+// Code objects waiting to be compiled.  We hold a reference to each of them.
+static std::deque<PyCodeObject *> compile_queue;
+static std::vector<PyCompileThread *> compile_threads;
+// Left behind by compile threads that exited, for the next ones to reuse.
+static std::vector<PyGlobalLlvmData *> spare_llvm_data;
+// Number of code objects queued or being compiled.
+static Py_ssize_t outstanding_compiles;
+static bool compile_threads_stopping;
+
+// Released to wake up one compile thread.  work_signaled tracks whether
+// it's currently released, since releasing an unlocked lock is an error.
+static PyThread_type_lock work_lock;
+static bool work_signaled;
+// Held whenever outstanding_compiles > 0; _PyLlvm_WaitForCompileQueue()
+// blocks on it.
+static PyThread_type_lock idle_lock;
+// Held for as long as any compile thread is running.
+static PyThread_type_lock exit_lock;
+
+
+// The state that a code object's machine code depends on.  We record it
+// right after generating the IR, and check it again before publishing the
+// machine code; if anything changed in between, the machine code may be
+// making assumptions that no longer hold.
+class PyCompileSnapshot {
+public:
+    explicit PyCompileSnapshot(PyCodeObject *code)
+        : fatalbailcount_(code->co_fatalbailcount),
+          feedback_(code->co_runtime_feedback),
+          feedback_generation_(feedback_ ? feedback_->GetGeneration() : 0)
+    {
+        for (int i = 0; i < NUM_WATCHING_REASONS; ++i) {
+            this->watching_[i] =
+                code->co_watching ? code->co_watching[i] : NULL;
+        }
+    }
+
+    bool StillValid(PyCodeObject *code) const
+    {
+        // _PyCode_InvalidateMachineCode() bumps co_fatalbailcount, so this
+        // catches any watched dict or type that changed under us.
+        if (code->co_fatalbailcount != this->fatalbailcount_)
+            return false;
+        if (code->co_runtime_feedback != this->feedback_)
+            return false;
+        if (this->feedback_ &&
+            this->feedback_->GetGeneration() != this->feedback_generation_)
+            return false;
+        for (int i = 0; i < NUM_WATCHING_REASONS; ++i) {
+            PyObject *watched =
+                code->co_watching ? code->co_watching[i] : NULL;
+            if (watched != this->watching_[i])
+                return false;
+        }
+        return true;
+    }
+
+private:
+    int fatalbailcount_;
+    const PyFeedbackMap *feedback_;
+    unsigned feedback_generation_;
+    PyObject *watching_[NUM_WATCHING_REASONS];
+};
+
+
+// True if code already has machine code optimized to at least opt_level.
+static bool
+has_machine_code(PyCodeObject *code, int opt_level)
+{
+    return code->co_native_function != NULL &&
+        code->co_optimization >= opt_level;
+}
+
+// Translates code to IR, optimizes it and emits machine code, dropping the
+// GIL for the expensive parts.  Called on a compile thread with the GIL
+// held; returns with the GIL held.  PyGlobalLlvmData::Get() returns the
+// thread's own PyGlobalLlvmData, so everything here only takes its compile
+// lock.
+static void
+compile_in_background(PyCodeObject *code)
+{
+    int opt_level = std::max(Py_DEFAULT_JIT_OPT_LEVEL, Py_OptimizeFlag);
+
+    // The code may have been compiled by someone else or invalidated while
+    // it sat in the queue.  Code that already has machine code at a lower
+    // level is here to be recompiled; see maybe_tier_up() in eval.cc.
+    if (has_machine_code(code, opt_level) ||
+        code->co_fatalbailcount >= PY_MAX_FATALBAILCOUNT ||
+        Py_JitControl == PY_JIT_NEVER) {
+        code->co_compile_queued = 0;
+        return;
+    }
+
+    PyGlobalLlvmData *global_data = PyGlobalLlvmData::Get();
+
+    double compile_start = _PyJitStats_Now();
+    PY_LOG_TSC_EVENT(LLVM_COMPILE_START);
+    _LlvmFunction *function = _PyCode_ToLlvmIr(code);
+    PY_LOG_TSC_EVENT(LLVM_COMPILE_END);
+    if (function == NULL) {
+        // There's nobody to report this to.  Leave co_compile_queued set so
+        // we don't keep retrying.
+        PyErr_WriteUnraisable((PyObject *)code);
+        return;
+    }
+    PyCompileSnapshot snapshot(code);
+
+    PyEvalFrameFunction native_function = NULL;
+    // Stop the clock before waiting for the GIL.
+    double compile_seconds = 0;
+    Py_BEGIN_ALLOW_THREADS
+    if (PyGlobalLlvmData_Optimize(global_data, function, opt_level) == 0) {
+        PY_LOG_TSC_EVENT(JIT_START);
+        native_function = _LlvmFunction_Jit(global_data, function);
+        PY_LOG_TSC_EVENT(JIT_END);
+    }
+    compile_seconds = _PyJitStats_Now() - compile_start;
+    Py_END_ALLOW_THREADS
+
+    if (native_function == NULL) {
+        // As above, don't retry.
+        _LlvmFunction_Dealloc(function);
+        return;
+    }
+    if (has_machine_code(code, opt_level) || !snapshot.StillValid(code)) {
+        // Either someone else beat us to it, or the machine code is
+        // already stale.  If it was stale, we'll try again the next time
+        // maybe_compile() finds the code hot.
+        _LlvmFunction_Dealloc(function);
+        code->co_compile_queued = 0;
+        return;
+    }
+
+    // Publish.  Threads only look at these fields with the GIL held, so
+    // nobody can observe a partially-installed function.
+    if (code->co_native_function != NULL) {
+        // We're replacing baseline machine code, which frames further up
+        // the stack, or suspended in other threads, may still be running.
+        _LlvmFunction_Retire(&code->co_retired_llvm_functions,
+                             code->co_llvm_function);
+    }
+    else if (code->co_llvm_function != NULL) {
+        _LlvmFunction_Dealloc(code->co_llvm_function);
+    }
+    code->co_llvm_function = function;
+    code->co_optimization = opt_level;
+    code->co_native_function = native_function;
+    code->co_use_jit = 1;
+    code->co_compile_queued = 0;
+    _PyJitCache_RecordCompiled(code);
+    _PyEval_RecordRecompile(code);
+    _PyCodeBudget_RecordCompiled(code);
+    _PyJitStats_RecordCompile(code, compile_seconds);
+}
+
+static void
+finish_compile(void)
+{
+    assert(outstanding_compiles > 0);
+    if (--outstanding_compiles == 0)
+        PyThread_release_lock(idle_lock);
+}
+
+static void
+drop_compile_queue(void)
+{
+    while (!compile_queue.empty()) {
+        PyCodeObject *code = compile_queue.front();
+        compile_queue.pop_front();
+        code->co_compile_queued = 0;
+        Py_DECREF(code);
+        finish_compile();
+    }
+}
+
+static void
+signal_compile_thread(void)
+{
+    if (!work_signaled) {
+        work_signaled = true;
+        PyThread_release_lock(work_lock);
+    }
+}
+
+// The most compile threads we'll run.
+static size_t
+compile_thread_limit(void)
+{
+    if (!_PyLlvm_CanCompileInParallel())
+        return 1;
+    return std::max(Py_JitCompileThreads, 1);
+}
+
+static bool
+too_many_compile_threads(void)
+{
+    return compile_threads.size() > compile_thread_limit();
+}
+
+static void
+compile_thread_main(void *arg)
+{
+    PyCompileThread *self = (PyCompileThread *)arg;
+    PyGILState_STATE gil_state = PyGILState_Ensure();
+    if (self->llvm_data == NULL) {
+        PyGlobalLlvmData *interp_data = PyGlobalLlvmData::Get();
+        self->llvm_data = _PyLlvm_CanCompileInParallel() ?
+            interp_data->NewCompileThreadData() : interp_data;
+    }
+    PyGlobalLlvmData::SetForThisThread(self->llvm_data);
+
+    while (true) {
+        while (compile_queue.empty() && !compile_threads_stopping &&
+               !too_many_compile_threads()) {
+            Py_BEGIN_ALLOW_THREADS
+            PyThread_acquire_lock(work_lock, WAIT_LOCK);
+            Py_END_ALLOW_THREADS
+            work_signaled = false;
+        }
+        if (compile_threads_stopping || too_many_compile_threads())
+            break;
+
+        self->compiling_code = compile_queue.front();
+        compile_queue.pop_front();
+        // Let another compile thread start on the rest of the queue.
+        if (!compile_queue.empty())
+            signal_compile_thread();
+        compile_in_background(self->compiling_code);
+        Py_DECREF(self->compiling_code);
+        self->compiling_code = NULL;
+        finish_compile();
+    }
+
+    compile_threads.erase(std::find(compile_threads.begin(),
+                                    compile_threads.end(), self));
+    spare_llvm_data.push_back(self->llvm_data);
+    delete self;
+    bool last_thread = compile_threads.empty();
+    // Other compile threads may need to wake up and exit too.
+    signal_compile_thread();
+    PyGlobalLlvmData::SetForThisThread(NULL);
+    PyGILState_Release(gil_state);
+    if (last_thread)
+        PyThread_release_lock(exit_lock);
+}
+
+static int
+start_compile_thread(void)
+{
+    PyEval_InitThreads();
+    if (idle_lock == NULL)
+        idle_lock = PyThread_allocate_lock();
+    if (work_lock == NULL) {
+        work_lock = PyThread_allocate_lock();
+        // Compile threads sleep on work_lock until there's something in
+        // the queue.
+        if (work_lock != NULL)
+            PyThread_acquire_lock(work_lock, WAIT_LOCK);
+        work_signaled = false;
+    }
+    if (exit_lock == NULL)
+        exit_lock = PyThread_allocate_lock();
+    if (idle_lock == NULL || work_lock == NULL || exit_lock == NULL) {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "can't allocate compile thread locks");
+        return -1;
+    }
+
+    PyCompileThread *thread = new PyCompileThread;
+    // Reuse the module of a thread that exited, if we can, rather than
+    // leave it sitting around.  Otherwise the thread makes its own.
+    thread->llvm_data = NULL;
+    if (!spare_llvm_data.empty()) {
+        thread->llvm_data = spare_llvm_data.back();
+        spare_llvm_data.pop_back();
+    }
+    thread->compiling_code = NULL;
+    if (compile_threads.empty())
+        PyThread_acquire_lock(exit_lock, WAIT_LOCK);
+    compile_threads.push_back(thread);
+    if (PyThread_start_new_thread(compile_thread_main, thread) == -1) {
+        compile_threads.pop_back();
+        if (thread->llvm_data != NULL)
+            spare_llvm_data.push_back(thread->llvm_data);
+        delete thread;
+        if (compile_threads.empty())
+            PyThread_release_lock(exit_lock);
+        PyErr_SetString(PyExc_RuntimeError, "can't start compile thread");
+        return -1;
+    }
+    return 0;
+}
+
+int
+_PyLlvm_QueueCompile(PyCodeObject *code)
+{
+    if (code->co_compile_queued || compile_threads_stopping)
+        return 0;
+    if (compile_threads.empty() && start_compile_thread() < 0)
+        return -1;
+
+    Py_INCREF(code);
+    code->co_compile_queued = 1;
+    compile_queue.push_back(code);
+    // idle_lock is free whenever outstanding_compiles is 0, so this won't
+    // block.
+    if (outstanding_compiles++ == 0)
+        PyThread_acquire_lock(idle_lock, WAIT_LOCK);
+    // Start another thread if every one we have is busy.  If we can't,
+    // the ones we have will get to this code eventually.
+    if (compile_threads.size() < compile_thread_limit() &&
+        (Py_ssize_t)compile_threads.size() < outstanding_compiles &&
+        start_compile_thread() < 0)
+        PyErr_Clear();
+    signal_compile_thread();
+    return 0;
+}
+
+void
+_PyLlvm_WaitForCompileQueue(void)
+{
+    while (outstanding_compiles > 0) {
+        Py_BEGIN_ALLOW_THREADS
+        PyThread_acquire_lock(idle_lock, WAIT_LOCK);
+        PyThread_release_lock(idle_lock);
+        Py_END_ALLOW_THREADS
+    }
+}
+
+Py_ssize_t
+_PyLlvm_CompileQueueSize(void)
+{
+    return outstanding_compiles;
+}
+
+int
+_PyLlvm_CompileThreadCount(void)
+{
+    return (int)compile_threads.size();
+}
+
+void
+_PyLlvm_SetCompileThreads(int threads)
+{
+    Py_JitCompileThreads = threads;
+    // Idle threads we no longer want exit when they wake up; busy ones
+    // exit after their current compile.
+    if (too_many_compile_threads())
+        signal_compile_thread();
+}
+
+void
+_PyLlvm_StopCompileThread(void)
+{
+    if (compile_threads.empty())
+        return;
+    // Anything that gets hot from here on is compiled in the foreground;
+    // the objects the compile threads would need are about to go away.
+    Py_JitBackgroundCompile = 0;
+    compile_threads_stopping = true;
+    drop_compile_queue();
+    signal_compile_thread();
+
+    // Let the compile threads finish whatever they're working on.
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(exit_lock, WAIT_LOCK);
+    PyThread_release_lock(exit_lock);
+    Py_END_ALLOW_THREADS
+
+    PyThread_free_lock(work_lock);
+    PyThread_free_lock(exit_lock);
+    work_lock = exit_lock = NULL;
+    compile_threads_stopping = false;
+}
+
+void
+_PyLlvm_ReInitCompileThread(void)
+{
+    // Whoever held the compile locks in the parent doesn't exist in the
+    // child.
+    PyGlobalLlvmData *global_data = PyGlobalLlvmData_GET();
+    if (global_data != NULL)
+        global_data->ReInitAfterFork();
+    if (compile_threads.empty())
+        return;
+
+    // Like PyEval_ReInitThreads(), we leak the old locks rather than risk
+    // freeing a lock that's held.
+    idle_lock = work_lock = exit_lock = NULL;
+    outstanding_compiles = 0;
+    for (size_t i = 0; i < compile_threads.size(); ++i) {
+        PyCompileThread *thread = compile_threads[i];
+        if (thread->compiling_code != NULL) {
+            // The compile thread's reference is gone with the thread.
+            thread->compiling_code->co_compile_queued = 0;
+        }
+        if (thread->llvm_data != NULL)
+            spare_llvm_data.push_back(thread->llvm_data);
+        delete thread;
+    }
+    compile_threads.clear();
+    while (!compile_queue.empty()) {
+        PyCodeObject *code = compile_queue.front();
+        compile_queue.pop_front();
+        code->co_compile_queued = 0;
+        Py_DECREF(code);
+    }
+}
+
+#else  /* !WITH_THREAD */
+
+int
+_PyLlvm_QueueCompile(PyCodeObject *code)
+{
+    PyErr_SetString(PyExc_RuntimeError,
+                    "background compilation requires thread support");
+    return -1;
+}
+
+void
+_PyLlvm_WaitForCompileQueue(void)
+{
+}
+
+Py_ssize_t
+_PyLlvm_CompileQueueSize(void)
+{
+    return 0;
+}
+
+int
+_PyLlvm_CompileThreadCount(void)
+{
+    return 0;
+}
+
+void
+_PyLlvm_SetCompileThreads(int threads)
+{
+    Py_JitCompileThreads = threads;
+}
+
+void
+_PyLlvm_StopCompileThread(void)
+{
+}
+
+void
+_PyLlvm_ReInitCompileThread(void)
+{
+}
+
+#endif  /* WITH_THREAD */
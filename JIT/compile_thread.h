@@ -0,0 +1,142 @@
+/* Background compilation of hot code objects.
+
+   By default, maybe_compile() in eval.cc translates, optimizes and JITs a
+   code object on whichever thread happens to push it over the hotness
+   threshold.  When Py_JitBackgroundCompile is set (-Xjitcompile=background
+   or _llvm.set_background_compile(True)), hot code objects are instead
+   handed to _PyLlvm_QueueCompile().  A pool of compile threads then takes
+   code objects off the queue, and for each one:
+
+   1. translates the bytecode to LLVM IR with the GIL held, since that reads
+      the code object, its runtime feedback and its globals;
+   2. releases the GIL, optimizes the IR and emits machine code;
+   3. reacquires the GIL, checks that the code object's watched dicts and
+      runtime feedback haven't changed underneath it, and only then installs
+      co_llvm_function and co_native_function.
+
+   Until step 3 completes, the code object keeps running in the eval loop.
+   If the revalidation fails, the new machine code is thrown away.
+
+   With tiered compilation (Py_JitTiered), the compile threads also
+   recompile code that stays hot after getting baseline machine code.  In
+   that case the code keeps running its baseline machine code until step 3
+   swaps in the new code.  The baseline code moves to
+   co_retired_llvm_functions, since frames may still be running it.
+
+   There are at most Py_JitCompileThreads compile threads
+   (-Xjitthreads=N or _llvm.set_compile_threads()); we start them as the
+   queue fills up.  Each one compiles into its own PyGlobalLlvmData, with
+   its own LLVMContext, module and execution engine, so step 2 runs on all
+   of them in parallel.  Only step 1, which needs the GIL anyway, is
+   serialized.  If LLVM wasn't built thread-safe, we only run one compile
+   thread, and it shares the interpreter's PyGlobalLlvmData.
+
+   Since step 2 touches a module without the GIL, every other user of that
+   module, like _LlvmFunction_Dealloc(), must hold its compile lock; see
+   _PyLlvm_AcquireCompileLock(). */
+#ifndef PYTHON_COMPILE_THREAD_H
+#define PYTHON_COMPILE_THREAD_H
+
+#include "Python.h"
+#include "code.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef WITH_LLVM
+/* Adds code to the compile queue, starting the compile thread if needed.
+   Queuing a code object that's already queued is a no-op.  Must be called
+   with the GIL held.  Returns 0 on success, -1 with an exception set on
+   failure. */
+PyAPI_FUNC(int) _PyLlvm_QueueCompile(PyCodeObject *code);
+
+/* Blocks until every queued code object has either been published or
+   discarded.  Must be called with the GIL held; the GIL is released while
+   waiting. */
+PyAPI_FUNC(void) _PyLlvm_WaitForCompileQueue(void);
+
+/* Returns the number of code objects queued or currently being compiled. */
+PyAPI_FUNC(Py_ssize_t) _PyLlvm_CompileQueueSize(void);
+
+/* Returns the number of compile threads currently running. */
+PyAPI_FUNC(int) _PyLlvm_CompileThreadCount(void);
+
+/* Changes Py_JitCompileThreads.  Extra compile threads exit once they
+   finish what they're compiling. */
+PyAPI_FUNC(void) _PyLlvm_SetCompileThreads(int threads);
+
+/* Returns true if compile threads can each use their own
+   PyGlobalLlvmData.  False if LLVM isn't thread-safe, or in
+   --with-instrumentation builds, whose statistics aren't. */
+PyAPI_FUNC(int) _PyLlvm_CanCompileInParallel(void);
+
+/* Stops the compile threads and drops anything still queued.  Called from
+   Py_Finalize() while the interpreter is still intact. */
+void _PyLlvm_StopCompileThread(void);
+
+/* The compile threads don't survive fork(); called from PyOS_AfterFork()
+   to forget about them and reset the compile locks. */
+void _PyLlvm_ReInitCompileThread(void);
+
+/* Serializes access to the LLVM module and execution engine that
+   PyGlobalLlvmData::Get() returns, between the compile thread that owns it
+   and threads holding the GIL.  The lock is recursive, so code that
+   already holds it may call into other users of the module.  Threads
+   holding the GIL may take a compile lock, but a compile thread never
+   waits for the GIL while holding one. */
+PyAPI_FUNC(void) _PyLlvm_AcquireCompileLock(void);
+PyAPI_FUNC(void) _PyLlvm_ReleaseCompileLock(void);
+#endif  /* WITH_LLVM */
+
+#ifdef __cplusplus
+}
+
+#ifdef WITH_LLVM
+struct PyGlobalLlvmData;
+
+// A lock the thread holding it can take again.  Each PyGlobalLlvmData has
+// one as its compile lock.
+class PyRecursiveLock {
+public:
+    PyRecursiveLock();
+    ~PyRecursiveLock();
+
+    void Acquire();
+    void Release();
+
+    // Whoever held the lock in the parent doesn't exist in the child, so
+    // forget about them.  Called after fork().
+    void ReInitAfterFork();
+
+private:
+    PyRecursiveLock(const PyRecursiveLock &);  // DO NOT IMPLEMENT
+    void operator=(const PyRecursiveLock &);  // DO NOT IMPLEMENT
+
+#ifdef WITH_THREAD
+    // A PyThread_type_lock.  owner_ and depth_ are only written by the
+    // thread holding it.
+    void *lock_;
+    volatile long owner_;
+    volatile int depth_;
+#endif
+};
+
+// Holds a compile lock for the lifetime of the object: by default, the one
+// for PyGlobalLlvmData::Get().
+class PyLlvmCompileLock {
+public:
+    PyLlvmCompileLock();
+    explicit PyLlvmCompileLock(PyGlobalLlvmData *global_data);
+    ~PyLlvmCompileLock() { this->lock_.Release(); }
+
+private:
+    PyRecursiveLock &lock_;
+
+    PyLlvmCompileLock(const PyLlvmCompileLock &);  // DO NOT IMPLEMENT
+    void operator=(const PyLlvmCompileLock &);  // DO NOT IMPLEMENT
+};
+#endif  // WITH_LLVM
+#endif  // __cplusplus
+
+#endif  /* PYTHON_COMPILE_THREAD_H */
@@ -0,0 +1,719 @@
+// Implements the -Xjitprofile file.  See feedback_profile.h for an overview.
+//
+// The file is plain text.  The first line identifies the interpreter build.
+// Each code object starts with a line
+//
+//   code <hotness> <hash> <first line number> <filename>
+//
+// followed by one line per feedback entry:
+//
+//   <opcode index> <arg index> counters <count> <count> <count>
+//   <opcode index> <arg index> objects <object>...
+//   <opcode index> <arg index> funcs <type> <method>...
+//
+// Objects and types are written as "null", "type:@<tp_name>" (for the core
+// types in get_core_types()), "type:<module>:<name>" or "module:<name>".
+// Methods are written as "-" (no PyMethodDef), "cfunc:<module>:<name>" or
+// "mdescr:<type>:<name>".
+
+#include "Python.h"
+#include "code.h"
+
+#include "JIT/code_cache.h"
+#include "JIT/feedback_profile.h"
+#include "JIT/RuntimeFeedback.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <set>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+using llvm::SmallVector;
+
+namespace {
+// A feedback entry as it appears in the file.
+struct PyProfileEntry {
+    unsigned opcode_index;
+    unsigned arg_index;
+    std::string kind;
+    std::vector<std::string> values;
+};
+
+struct PyProfileRecord {
+    PyProfileRecord() : hotness(0) {}
+
+    long hotness;
+    std::vector<PyProfileEntry> entries;
+};
+}  // anonymous namespace
+
+typedef llvm::StringMap<PyProfileRecord> PyProfileMap;
+
+// Everything here is protected by the GIL.
+
+// Profiles loaded so far, by code key.
+static PyProfileMap *loaded_profile;
+// Code objects with a co_runtime_feedback.
+static std::set<PyCodeObject *> *tracked_code;
+
+static std::string
+file_header()
+{
+    return "unladen-jit-profile 1 " + PyJitCache_GetBuildTag();
+}
+
+// Fills types with the static types we write by tp_name, since most of
+// them can't be found through their __module__.
+static void
+get_core_types(SmallVector<PyTypeObject *, 48> &types)
+{
+    PyTypeObject *core_types[] = {
+        &PyBaseObject_Type, &PyType_Type, &PyBool_Type, &PyInt_Type,
+        &PyLong_Type, &PyFloat_Type, &PyComplex_Type, &PyBaseString_Type,
+        &PyString_Type, &PyUnicode_Type, &PyByteArray_Type, &PyBuffer_Type,
+        &PyTuple_Type, &PyList_Type, &PyDict_Type, &PySet_Type,
+        &PyFrozenSet_Type, &PySlice_Type, &PyRange_Type, &PyEnum_Type,
+        &PyReversed_Type, &PyFile_Type, &PyModule_Type, &PyCode_Type,
+        &PyFrame_Type, &PyFunction_Type, &PyMethod_Type, &PyCFunction_Type,
+        &PyClass_Type, &PyInstance_Type, &PyMethodDescr_Type,
+        &PyWrapperDescr_Type, &PyGetSetDescr_Type, &PyMemberDescr_Type,
+        &PyProperty_Type, &PyClassMethod_Type, &PyStaticMethod_Type,
+        &PySuper_Type, &PyGen_Type, &PyCell_Type, &PySeqIter_Type,
+        &PyCallIter_Type, &PyEllipsis_Type, &PyDictProxy_Type,
+        Py_TYPE(Py_None), Py_TYPE(Py_NotImplemented),
+    };
+    types.clear();
+    types.append(core_types,
+                 core_types + sizeof(core_types) / sizeof(core_types[0]));
+}
+
+// Returns a borrowed reference to sys.modules[module_name].name, or NULL.
+// Doesn't set an exception.
+static PyObject *
+find_module_attr(const std::string &module_name, const std::string &name)
+{
+    PyObject *module = PyDict_GetItemString(PyImport_GetModuleDict(),
+                                            module_name.c_str());
+    if (module == NULL || !PyModule_Check(module))
+        return NULL;
+    return PyDict_GetItemString(PyModule_GetDict(module), name.c_str());
+}
+
+// Returns a borrowed reference to the type named by desc, or NULL.
+static PyTypeObject *
+resolve_type(const std::string &desc)
+{
+    if (desc.compare(0, 5, "type:") != 0)
+        return NULL;
+    if (desc.compare(5, 1, "@") == 0) {
+        SmallVector<PyTypeObject *, 48> core_types;
+        get_core_types(core_types);
+        for (unsigned i = 0; i < core_types.size(); ++i) {
+            if (desc.compare(6, std::string::npos,
+                             core_types[i]->tp_name) == 0)
+                return core_types[i];
+        }
+        return NULL;
+    }
+    std::string::size_type colon = desc.rfind(':');
+    if (colon <= 5)
+        return NULL;
+    PyObject *type = find_module_attr(desc.substr(5, colon - 5),
+                                      desc.substr(colon + 1));
+    if (type == NULL || !PyType_Check(type))
+        return NULL;
+    return (PyTypeObject *)type;
+}
+
+// Returns a borrowed reference to the object named by desc, or NULL.  Sets
+// *is_null for "null".
+static PyObject *
+resolve_object(const std::string &desc, bool *is_null)
+{
+    *is_null = (desc == "null");
+    if (*is_null)
+        return NULL;
+    if (desc.compare(0, 7, "module:") == 0) {
+        PyObject *module = PyDict_GetItemString(PyImport_GetModuleDict(),
+                                                desc.c_str() + 7);
+        if (module == NULL || !PyModule_Check(module))
+            return NULL;
+        return module;
+    }
+    return (PyObject *)resolve_type(desc);
+}
+
+// Sets *ml to the PyMethodDef named by desc.  Returns false if there's no
+// such methoddef.
+static bool
+resolve_method(const std::string &desc, PyMethodDef **ml)
+{
+    *ml = NULL;
+    if (desc == "-")
+        return true;
+    std::string::size_type colon = desc.rfind(':');
+    if (colon == std::string::npos)
+        return false;
+    std::string name = desc.substr(colon + 1);
+    if (desc.compare(0, 6, "cfunc:") == 0 && colon > 6) {
+        PyObject *func = find_module_attr(desc.substr(6, colon - 6), name);
+        if (func == NULL || !PyCFunction_Check(func))
+            return false;
+        *ml = PyCFunction_GET_METHODDEF(func);
+        return true;
+    }
+    if (desc.compare(0, 7, "mdescr:") == 0 && colon > 7) {
+        PyTypeObject *owner = resolve_type(desc.substr(7, colon - 7));
+        if (owner == NULL || owner->tp_dict == NULL)
+            return false;
+        PyObject *descr = PyDict_GetItemString(owner->tp_dict, name.c_str());
+        if (descr == NULL || !PyMethodDescr_Check(descr))
+            return false;
+        *ml = ((PyMethodDescrObject *)descr)->d_method;
+        return true;
+    }
+    return false;
+}
+
+namespace {
+// Names objects for the file.  Every name is checked by looking it up again,
+// so we never write a name that resolves to something else.
+class PyProfileWriter {
+public:
+    PyProfileWriter() : indexed_cfuncs_(false) {}
+
+    bool DescribeType(PyTypeObject *type, std::string &desc);
+    bool DescribeObject(PyObject *obj, std::string &desc);
+    bool DescribeMethod(PyTypeObject *type, PyMethodDef *ml,
+                        std::string &desc);
+
+    // Appends the entries of code's feedback that we can describe.
+    void DescribeFeedback(PyCodeObject *code,
+                          std::vector<PyProfileEntry> &entries);
+
+private:
+    void IndexCFunctions();
+
+    bool indexed_cfuncs_;
+    llvm::DenseMap<PyMethodDef *, std::string> cfuncs_;
+};
+}  // anonymous namespace
+
+bool
+PyProfileWriter::DescribeType(PyTypeObject *type, std::string &desc)
+{
+    SmallVector<PyTypeObject *, 48> core_types;
+    get_core_types(core_types);
+    for (unsigned i = 0; i < core_types.size(); ++i) {
+        if (core_types[i] == type) {
+            desc = "type:@";
+            desc += type->tp_name;
+            return true;
+        }
+    }
+
+    PyObject *module = PyObject_GetAttrString((PyObject *)type, "__module__");
+    PyObject *name = PyObject_GetAttrString((PyObject *)type, "__name__");
+    bool ok = false;
+    if (module != NULL && name != NULL &&
+        PyString_Check(module) && PyString_Check(name)) {
+        desc = "type:";
+        desc += PyString_AS_STRING(module);
+        desc += ":";
+        desc += PyString_AS_STRING(name);
+        ok = (desc.find(' ') == std::string::npos &&
+              resolve_type(desc) == type);
+    }
+    Py_XDECREF(module);
+    Py_XDECREF(name);
+    PyErr_Clear();
+    return ok;
+}
+
+bool
+PyProfileWriter::DescribeObject(PyObject *obj, std::string &desc)
+{
+    if (obj == NULL) {
+        desc = "null";
+        return true;
+    }
+    if (PyType_Check(obj))
+        return this->DescribeType((PyTypeObject *)obj, desc);
+    if (PyModule_Check(obj)) {
+        const char *name = PyModule_GetName(obj);
+        if (name == NULL) {
+            PyErr_Clear();
+            return false;
+        }
+        desc = "module:";
+        desc += name;
+        bool is_null;
+        return (desc.find(' ') == std::string::npos &&
+                resolve_object(desc, &is_null) == obj);
+    }
+    return false;
+}
+
+void
+PyProfileWriter::IndexCFunctions()
+{
+    this->indexed_cfuncs_ = true;
+    PyObject *modules = PyImport_GetModuleDict();
+    Py_ssize_t pos = 0;
+    PyObject *module_name, *module;
+    while (PyDict_Next(modules, &pos, &module_name, &module)) {
+        if (!PyString_Check(module_name) || !PyModule_Check(module))
+            continue;
+        Py_ssize_t attr_pos = 0;
+        PyObject *attr_name, *value;
+        while (PyDict_Next(PyModule_GetDict(module), &attr_pos,
+                           &attr_name, &value)) {
+            if (!PyString_Check(attr_name) || !PyCFunction_Check(value))
+                continue;
+            PyMethodDef *ml = PyCFunction_GET_METHODDEF(value);
+            if (this->cfuncs_.count(ml))
+                continue;
+            std::string desc = "cfunc:";
+            desc += PyString_AS_STRING(module_name);
+            desc += ":";
+            desc += PyString_AS_STRING(attr_name);
+            if (desc.find(' ') == std::string::npos)
+                this->cfuncs_[ml] = desc;
+        }
+    }
+}
+
+bool
+PyProfileWriter::DescribeMethod(PyTypeObject *type, PyMethodDef *ml,
+                                std::string &desc)
+{
+    if (ml == NULL) {
+        desc = "-";
+        return true;
+    }
+    if (type == &PyCFunction_Type) {
+        if (!this->indexed_cfuncs_)
+            this->IndexCFunctions();
+        llvm::DenseMap<PyMethodDef *, std::string>::const_iterator it =
+            this->cfuncs_.find(ml);
+        if (it == this->cfuncs_.end())
+            return false;
+        desc = it->second;
+        return true;
+    }
+    if (type == &PyMethodDescr_Type) {
+        // ml lives in its owner's tp_methods.
+        SmallVector<PyTypeObject *, 48> core_types;
+        get_core_types(core_types);
+        for (unsigned i = 0; i < core_types.size(); ++i) {
+            PyMethodDef *methods = core_types[i]->tp_methods;
+            if (methods == NULL)
+                continue;
+            for (; methods->ml_name != NULL; ++methods) {
+                if (methods != ml)
+                    continue;
+                desc = "mdescr:type:@";
+                desc += core_types[i]->tp_name;
+                desc += ":";
+                desc += ml->ml_name;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void
+PyProfileWriter::DescribeFeedback(PyCodeObject *code,
+                                  std::vector<PyProfileEntry> &entries)
+{
+    PyFeedbackMap::EntryList map_entries;
+    code->co_runtime_feedback->GetEntriesInto(map_entries);
+    for (PyFeedbackMap::EntryList::const_iterator it = map_entries.begin(),
+             end = map_entries.end(); it != end; ++it) {
+        const PyRuntimeFeedback &feedback = *it->second;
+        PyProfileEntry entry;
+        entry.opcode_index = it->first.first;
+        entry.arg_index = it->first.second;
+        bool ok = true;
+        switch (feedback.GetKind()) {
+        case PY_FDO_KIND_EMPTY:
+            ok = false;
+            break;
+        case PY_FDO_KIND_COUNTERS:
+            entry.kind = "counters";
+            for (unsigned i = 0; i < 3; ++i) {
+                char count[32];
+                PyOS_snprintf(count, sizeof(count), "%lu",
+                              (unsigned long)feedback.GetCounter(i));
+                entry.values.push_back(count);
+            }
+            break;
+        case PY_FDO_KIND_OBJECTS: {
+            // Overflowed entries are no more useful to the compiler than
+            // missing ones.
+            if (feedback.ObjectsOverflowed()) {
+                ok = false;
+                break;
+            }
+            entry.kind = "objects";
+            SmallVector<PyObject *, 3> objects;
+            feedback.GetSeenObjectsInto(objects);
+            for (unsigned i = 0; ok && i < objects.size(); ++i) {
+                std::string desc;
+                ok = this->DescribeObject(objects[i], desc);
+                entry.values.push_back(desc);
+            }
+            break;
+        }
+        case PY_FDO_KIND_FUNCS: {
+            if (feedback.FuncsOverflowed()) {
+                ok = false;
+                break;
+            }
+            entry.kind = "funcs";
+            SmallVector<PyTypeMethodPair, 3> funcs;
+            feedback.GetSeenFuncsInto(funcs);
+            for (unsigned i = 0; ok && i < funcs.size(); ++i) {
+                std::string type_desc, method_desc;
+                ok = this->DescribeObject((PyObject *)funcs[i].first,
+                                          type_desc) &&
+                    this->DescribeMethod(funcs[i].first, funcs[i].second,
+                                         method_desc);
+                entry.values.push_back(type_desc);
+                entry.values.push_back(method_desc);
+            }
+            break;
+        }
+        }
+        if (ok)
+            entries.push_back(entry);
+    }
+}
+
+// Seeds feedback from entry.  Returns false, leaving feedback alone, if
+// entry mentions anything we can't find.
+static bool
+apply_entry(const PyProfileEntry &entry, PyRuntimeFeedback &feedback)
+{
+    if (feedback.GetKind() != PY_FDO_KIND_EMPTY)
+        return false;
+    if (entry.kind == "counters") {
+        if (entry.values.size() != 3)
+            return false;
+        for (unsigned i = 0; i < 3; ++i) {
+            feedback.IncCounterBy(
+                i, strtoul(entry.values[i].c_str(), NULL, 10));
+        }
+        return true;
+    }
+    if (entry.kind == "objects") {
+        SmallVector<PyObject *, 3> objects;
+        for (unsigned i = 0; i < entry.values.size(); ++i) {
+            bool is_null;
+            PyObject *obj = resolve_object(entry.values[i], &is_null);
+            if (obj == NULL && !is_null)
+                return false;
+            objects.push_back(obj);
+        }
+        for (unsigned i = 0; i < objects.size(); ++i)
+            feedback.AddObjectSeen(objects[i]);
+        return true;
+    }
+    if (entry.kind == "funcs") {
+        if (entry.values.size() % 2 != 0)
+            return false;
+        SmallVector<PyTypeMethodPair, 3> funcs;
+        for (unsigned i = 0; i < entry.values.size(); i += 2) {
+            bool is_null;
+            PyObject *type = resolve_object(entry.values[i], &is_null);
+            if (type == NULL && !is_null)
+                return false;
+            if (type != NULL && !PyType_Check(type))
+                return false;
+            PyMethodDef *ml;
+            if (!resolve_method(entry.values[i + 1], &ml))
+                return false;
+            funcs.push_back(PyTypeMethodPair((PyTypeObject *)type, ml));
+        }
+        for (unsigned i = 0; i < funcs.size(); ++i)
+            feedback.AddTypeMethodSeen(funcs[i].first, funcs[i].second);
+        return true;
+    }
+    return false;
+}
+
+// Returns code's record in the loaded profile, or NULL.  Doesn't set an
+// exception.
+static const PyProfileRecord *
+find_record(PyCodeObject *code)
+{
+    if (loaded_profile == NULL || loaded_profile->empty())
+        return NULL;
+    std::string key;
+    if (!PyJitCache_GetCodeKey(code, key))
+        return NULL;
+    PyProfileMap::const_iterator it = loaded_profile->find(key);
+    if (it == loaded_profile->end())
+        return NULL;
+    return &it->second;
+}
+
+static void
+apply_hotness(const PyProfileRecord &record, PyCodeObject *code)
+{
+    if (record.hotness > code->co_hotness)
+        code->co_hotness = std::min(record.hotness, (long)INT_MAX);
+}
+
+void
+_PyFeedbackProfile_ApplyTo(PyCodeObject *code)
+{
+    if (PyErr_Occurred())
+        return;
+    const PyProfileRecord *record = find_record(code);
+    if (record != NULL)
+        apply_hotness(*record, code);
+}
+
+void
+_PyFeedbackProfile_Track(PyCodeObject *code)
+{
+    if (tracked_code == NULL)
+        tracked_code = new std::set<PyCodeObject *>;
+    tracked_code->insert(code);
+
+    if (loaded_profile == NULL || loaded_profile->empty())
+        return;
+    // We may be called while an exception is being thrown into a
+    // generator.
+    PyObject *type, *value, *traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    const PyProfileRecord *record = find_record(code);
+    if (record != NULL) {
+        // Only needed for code created before the profile was loaded.
+        apply_hotness(*record, code);
+        unsigned code_size = PyString_GET_SIZE(code->co_code);
+        for (std::vector<PyProfileEntry>::const_iterator
+                 entry = record->entries.begin(),
+                 end = record->entries.end(); entry != end; ++entry) {
+            if (entry->opcode_index >= code_size)
+                continue;
+            PyRuntimeFeedback &feedback =
+                code->co_runtime_feedback->GetOrCreateFeedbackEntry(
+                    entry->opcode_index, entry->arg_index);
+            apply_entry(*entry, feedback);
+        }
+    }
+    PyErr_Restore(type, value, traceback);
+}
+
+void
+_PyFeedbackProfile_Untrack(PyCodeObject *code)
+{
+    if (tracked_code != NULL)
+        tracked_code->erase(code);
+}
+
+// Reads one line, without its newline, into line.  Returns false at EOF.
+static bool
+read_line(FILE *file, std::string &line)
+{
+    line.clear();
+    int c;
+    while ((c = getc(file)) != EOF) {
+        if (c == '\n')
+            return true;
+        line += (char)c;
+    }
+    return !line.empty();
+}
+
+static void
+split(const std::string &line, std::vector<std::string> &words)
+{
+    words.clear();
+    std::string::size_type start = 0;
+    while (start < line.size()) {
+        std::string::size_type space = line.find(' ', start);
+        if (space == std::string::npos)
+            space = line.size();
+        if (space > start)
+            words.push_back(line.substr(start, space - start));
+        start = space + 1;
+    }
+}
+
+static Py_ssize_t
+load_profile(const char *path, bool missing_ok)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        if (missing_ok && errno == ENOENT)
+            return 0;
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)path);
+        return -1;
+    }
+    std::string line;
+    if (!read_line(file, line) || line != file_header()) {
+        fclose(file);
+        return 0;
+    }
+
+    PyProfileMap profile;
+    PyProfileRecord *record = NULL;
+    std::vector<std::string> words;
+    int line_number = 1;
+    while (read_line(file, line)) {
+        ++line_number;
+        if (line.compare(0, 5, "code ") == 0) {
+            long hotness;
+            int consumed;
+            if (sscanf(line.c_str(), "code %ld %n", &hotness,
+                       &consumed) < 1)
+                goto malformed;
+            record = &profile[line.substr(consumed)];
+            record->hotness = hotness;
+            record->entries.clear();
+            continue;
+        }
+        split(line, words);
+        if (record == NULL || words.size() < 3)
+            goto malformed;
+        PyProfileEntry entry;
+        char *end;
+        entry.opcode_index = strtoul(words[0].c_str(), &end, 10);
+        if (*end != '\0')
+            goto malformed;
+        entry.arg_index = strtoul(words[1].c_str(), &end, 10);
+        if (*end != '\0')
+            goto malformed;
+        entry.kind = words[2];
+        entry.values.assign(words.begin() + 3, words.end());
+        record->entries.push_back(entry);
+    }
+    fclose(file);
+
+    if (loaded_profile == NULL)
+        loaded_profile = new PyProfileMap;
+    for (PyProfileMap::const_iterator it = profile.begin(),
+             end = profile.end(); it != end; ++it) {
+        (*loaded_profile)[it->getKey()] = it->getValue();
+    }
+    return profile.size();
+
+malformed:
+    fclose(file);
+    PyErr_Format(PyExc_ValueError, "%s:%d: malformed feedback profile",
+                 path, line_number);
+    return -1;
+}
+
+Py_ssize_t
+_PyFeedbackProfile_Load(const char *path)
+{
+    return load_profile(path, false);
+}
+
+static void
+write_record(FILE *file, const std::string &key,
+             const PyProfileRecord &record)
+{
+    fprintf(file, "code %ld %s\n", record.hotness, key.c_str());
+    for (std::vector<PyProfileEntry>::const_iterator
+             entry = record.entries.begin(),
+             end = record.entries.end(); entry != end; ++entry) {
+        fprintf(file, "%u %u %s", entry->opcode_index, entry->arg_index,
+                entry->kind.c_str());
+        for (unsigned i = 0; i < entry->values.size(); ++i)
+            fprintf(file, " %s", entry->values[i].c_str());
+        fprintf(file, "\n");
+    }
+}
+
+Py_ssize_t
+_PyFeedbackProfile_Dump(const char *path)
+{
+    // Write to a private file and rename it into place, so concurrent
+    // readers never see a partial profile.
+    char suffix[32];
+    PyOS_snprintf(suffix, sizeof(suffix), ".%ld.tmp", (long)getpid());
+    std::string temp_name = std::string(path) + suffix;
+    FILE *file = fopen(temp_name.c_str(), "w");
+    if (file == NULL) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError,
+                                       (char *)temp_name.c_str());
+        return -1;
+    }
+    fprintf(file, "%s\n", file_header().c_str());
+
+    Py_ssize_t written = 0;
+    llvm::StringMap<bool> written_keys;
+    PyProfileWriter writer;
+    // Describing feedback can run arbitrary code, which might free code
+    // objects, so hold on to them.
+    std::vector<PyCodeObject *> codes;
+    if (tracked_code != NULL)
+        codes.assign(tracked_code->begin(), tracked_code->end());
+    for (unsigned i = 0; i < codes.size(); ++i)
+        Py_INCREF(codes[i]);
+    for (unsigned i = 0; i < codes.size(); ++i) {
+        PyCodeObject *code = codes[i];
+        std::string key;
+        if (!PyJitCache_GetCodeKey(code, key) || written_keys.count(key))
+            continue;
+        PyProfileRecord record;
+        record.hotness = code->co_hotness;
+        writer.DescribeFeedback(code, record.entries);
+        write_record(file, key, record);
+        written_keys[key] = true;
+        ++written;
+    }
+    for (unsigned i = 0; i < codes.size(); ++i)
+        Py_DECREF(codes[i]);
+    // Keep what we loaded about code that hasn't run this time.
+    if (loaded_profile != NULL) {
+        for (PyProfileMap::const_iterator it = loaded_profile->begin(),
+                 end = loaded_profile->end(); it != end; ++it) {
+            if (written_keys.count(it->getKey()))
+                continue;
+            write_record(file, it->getKey().str(), it->getValue());
+            ++written;
+        }
+    }
+
+    if (fclose(file) != 0 || rename(temp_name.c_str(), path) != 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)path);
+        remove(temp_name.c_str());
+        return -1;
+    }
+    return written;
+}
+
+void
+_PyFeedbackProfile_Init(void)
+{
+    if (Py_JitProfileFile == NULL)
+        return;
+    // The first run won't have a profile yet.
+    if (load_profile(Py_JitProfileFile, true) < 0)
+        PyErr_Print();
+}
+
+void
+_PyFeedbackProfile_Fini(void)
+{
+    if (Py_JitProfileFile == NULL)
+        return;
+    if (_PyFeedbackProfile_Dump(Py_JitProfileFile) < 0)
+        PyErr_Print();
+}
@@ -0,0 +1,66 @@
+/* Saving and restoring runtime feedback across runs (-Xjitprofile=PATH).
+
+   A fresh process runs everything through the eval loop until code gets
+   hot, and only then compiles it using the feedback the eval loop
+   recorded in co_runtime_feedback.  A profile file holds each code
+   object's hotness and feedback as of the end of an earlier run.  When a
+   code object first records feedback in a later run, we seed its
+   PyFeedbackMap and co_hotness from the profile.  Code that was hot
+   before then compiles on its next call, specialized for the types it saw
+   before.
+
+   Code objects are matched as in the JIT code cache; see
+   PyJitCache_GetCodeKey() in code_cache.h.  Feedback refers to objects,
+   which are written out by name: types (through their __module__ or, for
+   the core builtin types, tp_name), modules, C functions (through the
+   module that holds them) and method descriptors (through their type).
+   An entry that mentions anything else, or anything we can't find again,
+   is dropped.  That's safe because missing feedback only makes the
+   compiler more conservative.
+
+   _llvm.dump_feedback() and _llvm.load_feedback() expose the same
+   operations to Python code. */
+#ifndef PYTHON_FEEDBACK_PROFILE_H
+#define PYTHON_FEEDBACK_PROFILE_H
+
+#include "Python.h"
+#include "code.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef WITH_LLVM
+/* Reads a profile written by _PyFeedbackProfile_Dump(), adding to any
+   profile already loaded.  A profile written by a different interpreter
+   build is ignored.  Returns the number of code objects read, or -1 with
+   an exception set. */
+PyAPI_FUNC(Py_ssize_t) _PyFeedbackProfile_Load(const char *path);
+
+/* Writes the hotness and feedback of every live code object that has
+   recorded feedback.  Returns the number of code objects written, or -1
+   with an exception set. */
+PyAPI_FUNC(Py_ssize_t) _PyFeedbackProfile_Dump(const char *path);
+
+/* Called from PyCode_New().  Restores code's hotness from the loaded
+   profile, so code that was hot before is compiled on its first call. */
+void _PyFeedbackProfile_ApplyTo(PyCodeObject *code);
+
+/* Called when code's co_runtime_feedback is created or destroyed.  The
+   first seeds the new feedback map from the loaded profile.  The eval loop
+   creates the map before it decides whether to compile hot code, so
+   restored code is compiled with its restored feedback. */
+void _PyFeedbackProfile_Track(PyCodeObject *code);
+void _PyFeedbackProfile_Untrack(PyCodeObject *code);
+
+/* Loads Py_JitProfileFile at startup, and writes it back at exit.  Errors
+   are reported on stderr. */
+void _PyFeedbackProfile_Init(void);
+void _PyFeedbackProfile_Fini(void);
+#endif  /* WITH_LLVM */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* PYTHON_FEEDBACK_PROFILE_H */
@@ -3,15 +3,19 @@
 
 #include "osdefs.h"
 #undef MAXPATHLEN  /* Conflicts with definition in LLVM's config.h */
+#include "JIT/compile_thread.h"
 #include "JIT/ConstantMirror.h"
 #include "JIT/DeadGlobalElim.h"
 #include "JIT/global_llvm_data.h"
+#include "JIT/perf_map.h"
 #include "JIT/PyAliasAnalysis.h"
 #include "JIT/PyTBAliasAnalysis.h"
+#include "JIT/RefcountElision.h"
 #include "JIT/SingleFunctionInliner.h"
 #include "Util/Stats.h"
 #include "_llvmfunctionobject.h"
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/Analysis/DebugInfo.h"
 #include "llvm/Analysis/Verifier.h"
 #include "llvm/Bitcode/ReaderWriter.h"
@@ -29,6 +33,8 @@
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/ValueHandle.h"
 #include "llvm/System/Path.h"
+#include "llvm/System/ThreadLocal.h"
+#include "llvm/System/Threading.h"
 #include "llvm/Target/TargetData.h"
 #include "llvm/Target/TargetSelect.h"
 #include "llvm/Transforms/Scalar.h"
@@ -39,6 +45,47 @@ using llvm::MDString;
 using llvm::Module;
 using llvm::StringRef;
 
+// Keeps a running total of the machine code engine_ has emitted and not
+// freed.  Only called with the compile lock held, but live_bytes() may be
+// read without it.
+class PyCodeSizeListener : public llvm::JITEventListener {
+public:
+    PyCodeSizeListener() : live_bytes_(0) {}
+
+    virtual void NotifyFunctionEmitted(const llvm::Function &function,
+                                       void *code, size_t size,
+                                       const EmittedFunctionDetails &details)
+    {
+        size_t &recorded = this->sizes_[code];
+        this->live_bytes_ += size - recorded;
+        recorded = size;
+    }
+
+    virtual void NotifyFreeingMachineCode(void *old_code)
+    {
+        llvm::DenseMap<void*, size_t>::iterator it =
+            this->sizes_.find(old_code);
+        if (it == this->sizes_.end())
+            return;
+        this->live_bytes_ -= it->second;
+        this->sizes_.erase(it);
+    }
+
+    size_t live_bytes() const { return this->live_bytes_; }
+
+    size_t size_of(void *code) const
+    {
+        llvm::DenseMap<void*, size_t>::const_iterator it =
+            this->sizes_.find(code);
+        return it == this->sizes_.end() ? 0 : it->second;
+    }
+
+private:
+    // Maps the start of each function's machine code to its size.
+    llvm::DenseMap<void*, size_t> sizes_;
+    volatile size_t live_bytes_;
+};
+
 PyGlobalLlvmData *
 PyGlobalLlvmData_New()
 {
@@ -57,12 +104,24 @@ PyGlobalLlvmData_Free(PyGlobalLlvmData * global_data)
     delete global_data;
 }
 
+// Set on compile threads; see compile_thread.h.
+static llvm::sys::ThreadLocal<PyGlobalLlvmData> thread_llvm_data;
+
 PyGlobalLlvmData *
 PyGlobalLlvmData::Get()
 {
+    PyGlobalLlvmData *global_data = thread_llvm_data.get();
+    if (global_data != NULL)
+        return global_data;
     return PyThreadState_GET()->interp->global_llvm_data;
 }
 
+void
+PyGlobalLlvmData::SetForThisThread(PyGlobalLlvmData *global_data)
+{
+    thread_llvm_data.set(global_data);
+}
+
 #define STRINGIFY(X) STRINGIFY2(X)
 #define STRINGIFY2(X) #X
 // The basename of the bitcode file holding the standard library.
@@ -105,8 +164,46 @@ find_stdlib_bc()
 
 PyGlobalLlvmData::PyGlobalLlvmData()
     : optimized_ops(),
+      parent_(NULL),
+      context_(&llvm::getGlobalContext()),
+      optimizations_(3, (FunctionPassManager*)NULL),
+      num_globals_after_last_gc_(0)
+{
+    this->perf_listener_.reset(new PyPerfJitEventListener);
+    this->Init();
+}
+
+PyGlobalLlvmData::PyGlobalLlvmData(PyGlobalLlvmData *parent)
+    : owned_context_(new llvm::LLVMContext),
+      optimized_ops(),
+      parent_(parent),
+      context_(owned_context_.get()),
       optimizations_(3, (FunctionPassManager*)NULL),
       num_globals_after_last_gc_(0)
+{
+    this->Init();
+}
+
+PyGlobalLlvmData *
+PyGlobalLlvmData::NewCompileThreadData()
+{
+    assert(this->parent_ == NULL &&
+           "Compile threads can't have compile threads");
+    PyGlobalLlvmData *global_data = new PyGlobalLlvmData(this);
+    this->compile_thread_data_.push_back(global_data);
+    return global_data;
+}
+
+void
+PyGlobalLlvmData::ReInitAfterFork()
+{
+    this->compile_lock_.ReInitAfterFork();
+    for (size_t i = 0; i < this->compile_thread_data_.size(); ++i)
+        this->compile_thread_data_[i]->compile_lock_.ReInitAfterFork();
+}
+
+void
+PyGlobalLlvmData::Init()
 {
     std::string error;
     llvm::MemoryBuffer *stdlib_file = find_stdlib_bc();
@@ -135,6 +232,9 @@ PyGlobalLlvmData::PyGlobalLlvmData()
     }
 
     engine_->RegisterJITEventListener(llvm::createOProfileJITEventListener());
+    engine_->RegisterJITEventListener(&this->perf_listener());
+    this->code_size_listener_.reset(new PyCodeSizeListener);
+    engine_->RegisterJITEventListener(this->code_size_listener_.get());
 
     // When we ask to JIT a function, we should also JIT other
     // functions that function depends on.  This lets us JIT in a
@@ -205,6 +305,10 @@ PyGlobalLlvmData::InitializeOptimizations()
     optimizations_[2] = O2;
     O2->add(new llvm::TargetData(*engine_->getTargetData()));
     O2->add(llvm::createCFGSimplificationPass());
+    // Refcount elision looks for calls to _PyLlvm_WrapIncref and
+    // _PyLlvm_WrapDecref, so it has to run before they're inlined.
+    this->AddPythonAliasAnalyses(O2);
+    O2->add(CreatePyRefcountElisionPass(*this));
     O2->add(PyCreateSingleFunctionInliningPass());
     O2->add(CreatePyTypeMarkingPass(*this));
     O2->add(llvm::createJumpThreadingPass());
@@ -284,6 +388,9 @@ PyGlobalLlvmData::InitializeTBAA()
 
 PyGlobalLlvmData::~PyGlobalLlvmData()
 {
+    // Their engines share our perf listener.
+    for (size_t i = 0; i < this->compile_thread_data_.size(); ++i)
+        delete this->compile_thread_data_[i];
     this->bitcode_gvs_.clear();  // Stop asserting values aren't destroyed.
     this->constant_mirror_->python_shutting_down_ = true;
     for (size_t i = 0; i < this->optimizations_.size(); ++i) {
@@ -297,6 +404,7 @@ PyGlobalLlvmData::Optimize(llvm::Function &f, int level)
 {
     if (level < 0 || (size_t)level >= this->optimizations_.size())
         return -1;
+    PyLlvmCompileLock lock(this);
     FunctionPassManager *opts_pm = this->optimizations_[level];
     assert(opts_pm != NULL && "Optimization was NULL");
     assert(this->module_ == f.getParent() &&
@@ -351,6 +459,7 @@ PyGlobalLlvmData::MaybeCollectUnusedGlobals()
 void
 PyGlobalLlvmData::CollectUnusedGlobals()
 {
+    PyLlvmCompileLock lock(this);
 #if Py_WITH_INSTRUMENTATION
     unsigned num_globals = this->module_->getGlobalList().size() +
         this->module_->getFunctionList().size();
@@ -373,6 +482,63 @@ void
 PyGlobalLlvmData_CollectUnusedGlobals(struct PyGlobalLlvmData *global_data)
 {
     global_data->CollectUnusedGlobals();
+    const std::vector<PyGlobalLlvmData *> &compile_thread_data =
+        global_data->compile_thread_data();
+    for (size_t i = 0; i < compile_thread_data.size(); ++i)
+        compile_thread_data[i]->CollectUnusedGlobals();
+}
+
+size_t
+PyGlobalLlvmData::GetLiveCodeBytes() const
+{
+    if (this->parent_ != NULL)
+        return this->parent_->GetLiveCodeBytes();
+    size_t live_bytes = this->code_size_listener_->live_bytes();
+    for (size_t i = 0; i < this->compile_thread_data_.size(); ++i) {
+        live_bytes +=
+            this->compile_thread_data_[i]->code_size_listener_->live_bytes();
+    }
+    return live_bytes;
+}
+
+size_t
+PyGlobalLlvmData_GetLiveCodeBytes(struct PyGlobalLlvmData *global_data)
+{
+    return global_data->GetLiveCodeBytes();
+}
+
+size_t
+PyGlobalLlvmData::GetMachineCodeSize(void *code) const
+{
+    PyLlvmCompileLock lock(const_cast<PyGlobalLlvmData *>(this));
+    return this->code_size_listener_->size_of(code);
+}
+
+size_t
+PyGlobalLlvmData::CountIrInstructions() const
+{
+    PyLlvmCompileLock lock(const_cast<PyGlobalLlvmData *>(this));
+    size_t count = 0;
+    for (Module::const_iterator function = this->module_->begin(),
+             function_end = this->module_->end();
+         function != function_end; ++function) {
+        for (llvm::Function::const_iterator bb = function->begin(),
+                 bb_end = function->end(); bb != bb_end; ++bb) {
+            count += bb->size();
+        }
+    }
+    return count;
+}
+
+size_t
+PyGlobalLlvmData_CountIrInstructions(struct PyGlobalLlvmData *global_data)
+{
+    size_t count = global_data->CountIrInstructions();
+    const std::vector<PyGlobalLlvmData *> &compile_thread_data =
+        global_data->compile_thread_data();
+    for (size_t i = 0; i < compile_thread_data.size(); ++i)
+        count += compile_thread_data[i]->CountIrInstructions();
+    return count;
 }
 
 llvm::Value *
@@ -414,6 +580,10 @@ _PyLlvm_Init()
         return 0;
 
     llvm::cl::ParseEnvironmentOptions("python", "PYTHONLLVMFLAGS", "", true);
+    // Lets each compile thread use its own LLVMContext.  Fails harmlessly
+    // if LLVM was built without thread support; see
+    // _PyLlvm_CanCompileInParallel().
+    llvm::llvm_start_multithreaded();
 
     return 1;
 }
@@ -10,6 +10,7 @@
 #endif
 
 #ifdef WITH_LLVM
+#include "JIT/compile_thread.h"
 #include "JIT/global_llvm_data_fwd.h"
 
 #include "llvm/LLVMContext.h"
@@ -24,6 +25,7 @@
 #include "llvm/Instruction.h"
 
 #include <string>
+#include <vector>
 
 namespace llvm {
 class DIFactory;
@@ -35,7 +37,9 @@ class Module;
 class Value;
 }
 
+class PyCodeSizeListener;
 class PyConstantMirror;
+class PyPerfJitEventListener;
 
 class PyTBAAType {
     unsigned pytbaa_kind_;
@@ -251,13 +255,45 @@ private:
 
 
 struct PyGlobalLlvmData {
+private:
+    // Only set for a compile thread's PyGlobalLlvmData; the interpreter's
+    // uses getGlobalContext().  Declared first so that it outlives
+    // everything that refers to it.
+    llvm::OwningPtr<llvm::LLVMContext> owned_context_;
+
 public:
-    // Retrieves the PyGlobalLlvmData out of the interpreter state.
+    // Retrieves the PyGlobalLlvmData this thread compiles with: the one
+    // passed to SetForThisThread(), or else the interpreter's.
     static PyGlobalLlvmData *Get();
 
+    // Makes Get() return global_data on the calling thread.  Only compile
+    // threads call this.
+    static void SetForThisThread(PyGlobalLlvmData *global_data);
+
     PyGlobalLlvmData();
     ~PyGlobalLlvmData();
 
+    // Creates a PyGlobalLlvmData for a compile thread, with its own
+    // LLVMContext, module and execution engine, so it can compile without
+    // waiting for anyone else's compile lock.  This keeps it, and deletes
+    // it when this is deleted, since code objects keep using the machine
+    // code it emits.  Must be called on the interpreter's PyGlobalLlvmData,
+    // with the GIL held.
+    PyGlobalLlvmData *NewCompileThreadData();
+
+    // The PyGlobalLlvmData of each compile thread we've had.
+    const std::vector<PyGlobalLlvmData *> &compile_thread_data() const
+    {
+        return this->compile_thread_data_;
+    }
+
+    // Protects module_ and engine_; see _PyLlvm_AcquireCompileLock().
+    PyRecursiveLock &compile_lock() { return this->compile_lock_; }
+
+    // Resets our compile lock and those of our compile threads' data.
+    // Called in the child after fork().
+    void ReInitAfterFork();
+
     // Optimize f to a particular level. Currently, levels from 0 to 2
     // are valid.
     //
@@ -267,10 +303,9 @@ public:
 
     llvm::ExecutionEngine *getExecutionEngine() { return this->engine_; }
 
-    // Use this accessor for the LLVMContext rather than
-    // getGlobalContext() directly so that we can more easily add new
-    // contexts later.
-    llvm::LLVMContext &context() const { return llvm::getGlobalContext(); }
+    // Everything in module_ lives in this context.  Use this accessor
+    // rather than getGlobalContext(), since compile threads have their own.
+    llvm::LLVMContext &context() const { return *this->context_; }
 
     llvm::Module *module() const { return this->module_; }
 
@@ -279,6 +314,29 @@ public:
         return *this->constant_mirror_; 
     }
 
+    // Writes perf map and jitdump entries for the functions engine_ emits.
+    // Compile threads share the interpreter's.
+    PyPerfJitEventListener &perf_listener() const
+    {
+        if (this->parent_ != NULL)
+            return this->parent_->perf_listener();
+        return *this->perf_listener_;
+    }
+
+    // Bytes of machine code emitted and not yet freed, by engine_ and the
+    // engines of every compile thread.  Doesn't take any compile lock, so
+    // it may miss a function a compile thread is emitting right now.
+    size_t GetLiveCodeBytes() const;
+
+    // Bytes of machine code emitted for the function starting at code, or 0
+    // if engine_ didn't emit it or has freed it.  Takes the compile lock.
+    size_t GetMachineCodeSize(void *code) const;
+
+    // Instructions in the bodies of all the functions in module_, including
+    // the runtime helpers loaded from the stdlib bitcode.  This walks the
+    // whole module, so it isn't cheap.  Takes the compile lock.
+    size_t CountIrInstructions() const;
+
     /// Can be used to add debug info to LLVM functions.
     llvm::DIFactory &DebugInfo() { return *this->debug_info_; }
 
@@ -327,6 +385,13 @@ public:
     OptimizedOps optimized_ops;
 
 private:
+    // Creates a compile thread's PyGlobalLlvmData; see
+    // NewCompileThreadData().
+    explicit PyGlobalLlvmData(PyGlobalLlvmData *parent);
+
+    // Sets up everything but context_ and parent_.
+    void Init();
+
     // We use Clang to compile a number of C functions to LLVM IR. Install
     // those functions and set up any special calling conventions or attributes
     // we may want.
@@ -340,9 +405,19 @@ private:
 
     void AddPythonAliasAnalyses(llvm::FunctionPassManager *mngr);
 
-    // We have a single global module that holds all compiled code.
-    // Any cached global object that function definitions use will be
-    // stored in here.  These are owned by engine_.
+    // The interpreter's PyGlobalLlvmData if this one belongs to a compile
+    // thread, or NULL.
+    PyGlobalLlvmData *const parent_;
+    llvm::LLVMContext *context_;
+
+    // Owned by this.  Empty for compile threads' data.
+    std::vector<PyGlobalLlvmData *> compile_thread_data_;
+
+    PyRecursiveLock compile_lock_;
+
+    // A single module holds all the code compiled with this
+    // PyGlobalLlvmData.  Any cached global object that function definitions
+    // use will be stored in here.  These are owned by engine_.
     llvm::Module *module_;
     llvm::OwningPtr<llvm::DIFactory> debug_info_;
 
@@ -360,6 +435,11 @@ private:
 
     llvm::OwningPtr<PyConstantMirror> constant_mirror_;
 
+    // Deleted after engine_, which may still notify it.  NULL for compile
+    // threads' data.
+    llvm::OwningPtr<PyPerfJitEventListener> perf_listener_;
+    llvm::OwningPtr<PyCodeSizeListener> code_size_listener_;
+
     unsigned num_globals_after_last_gc_;
 
     // The MetadataKind we register our type information with
@@ -19,6 +19,8 @@ void PyGlobalLlvmData_Free(struct PyGlobalLlvmData *);
 
 #define Py_MIN_LLVM_OPT_LEVEL 0
 #define Py_DEFAULT_JIT_OPT_LEVEL 2
+/* Where tiered compilation starts hot code; see Py_JitTiered. */
+#define Py_BASELINE_JIT_OPT_LEVEL 0
 #define Py_MAX_LLVM_OPT_LEVEL 3
 
 /* See global_llvm_data.h:PyGlobalLlvmData::Optimize for documentation. */
@@ -28,6 +30,13 @@ PyAPI_FUNC(int) PyGlobalLlvmData_Optimize(struct PyGlobalLlvmData *,
 PyAPI_FUNC(void) PyGlobalLlvmData_CollectUnusedGlobals(
     struct PyGlobalLlvmData *);
 
+/* See global_llvm_data.h:PyGlobalLlvmData::GetLiveCodeBytes. */
+PyAPI_FUNC(size_t) PyGlobalLlvmData_GetLiveCodeBytes(
+    struct PyGlobalLlvmData *);
+/* See global_llvm_data.h:PyGlobalLlvmData::CountIrInstructions. */
+PyAPI_FUNC(size_t) PyGlobalLlvmData_CountIrInstructions(
+    struct PyGlobalLlvmData *);
+
 /* Initializes LLVM and all of the LLVM wrapper types. */
 int _PyLlvm_Init(void);
 
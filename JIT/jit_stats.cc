@@ -0,0 +1,284 @@
+// Implements _llvm.get_jit_stats().  See jit_stats.h for an overview.
+
+#include "Python.h"
+#include "code.h"
+#include "frameobject.h"
+
+#include "JIT/code_budget.h"
+#include "JIT/global_llvm_data.h"
+#include "JIT/jit_stats.h"
+#include "JIT/RuntimeFeedback.h"
+
+#include <algorithm>
+#include <map>
+#include <utility>
+
+#ifdef HAVE_GETTIMEOFDAY
+#include <sys/time.h>
+#endif
+
+namespace {
+
+// Indexed by _PyFrameBailReason; _PYFRAME_NO_BAIL is never recorded.
+const char *const bail_reason_names[] = {
+    "no_bail",
+    "trace_on_entry",
+    "line_trace",
+    "backedge_trace",
+    "call_profile",
+    "fatal_guard_fail",
+    "guard_fail",
+};
+const int NUM_BAIL_REASONS =
+    sizeof(bail_reason_names) / sizeof(bail_reason_names[0]);
+
+// Indexed by _PyFrameGuardType.
+const char *const guard_type_names[] = {
+    "default",
+    "binop",
+    "attr",
+    "cfunc",
+    "branch",
+    "store_subscr",
+    "load_method",
+    "call_method",
+    "pyfunc",
+    "for_iter",
+};
+const int NUM_GUARD_TYPES =
+    sizeof(guard_type_names) / sizeof(guard_type_names[0]);
+
+struct PyJitCounters {
+    PyJitCounters() : compiles(0), compile_seconds(0), invalidations(0)
+    {
+        std::fill(this->bails, this->bails + NUM_BAIL_REASONS, 0);
+        std::fill(this->guard_fails, this->guard_fails + NUM_GUARD_TYPES, 0);
+    }
+
+    unsigned long compiles;
+    double compile_seconds;
+    unsigned long invalidations;
+    unsigned long bails[NUM_BAIL_REASONS];
+    unsigned long guard_fails[NUM_GUARD_TYPES];
+};
+
+struct PyCodeJitStats : PyJitCounters {
+    // Maps (opcode index, bail reason) to the number of bails.
+    typedef std::map<std::pair<int, int>, unsigned long> BailSites;
+    BailSites bail_sites;
+};
+
+typedef std::map<PyCodeObject *, PyCodeJitStats> PyCodeStatsMap;
+
+}  // anonymous namespace
+
+static PyJitCounters *totals = NULL;
+static PyCodeStatsMap *code_stats = NULL;
+
+static PyCodeJitStats &
+stats_for(PyCodeObject *code)
+{
+    if (totals == NULL) {
+        totals = new PyJitCounters;
+        code_stats = new PyCodeStatsMap;
+    }
+    return (*code_stats)[code];
+}
+
+double
+_PyJitStats_Now(void)
+{
+#ifdef HAVE_GETTIMEOFDAY
+    struct timeval tv;
+#ifdef GETTIMEOFDAY_NO_TZ
+    gettimeofday(&tv);
+#else
+    gettimeofday(&tv, 0);
+#endif
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+#else
+    return 0;
+#endif
+}
+
+void
+_PyJitStats_RecordCompile(PyCodeObject *code, double seconds)
+{
+    PyCodeJitStats &stats = stats_for(code);
+    ++stats.compiles;
+    stats.compile_seconds += seconds;
+    ++totals->compiles;
+    totals->compile_seconds += seconds;
+}
+
+void
+_PyJitStats_RecordBail(PyFrameObject *frame, _PyFrameBailReason reason)
+{
+    assert(reason > _PYFRAME_NO_BAIL && reason < NUM_BAIL_REASONS);
+    PyCodeJitStats &stats = stats_for(frame->f_code);
+    ++stats.bails[reason];
+    ++totals->bails[reason];
+    if (reason == _PYFRAME_GUARD_FAIL && frame->f_guard_type < NUM_GUARD_TYPES) {
+        ++stats.guard_fails[frame->f_guard_type];
+        ++totals->guard_fails[frame->f_guard_type];
+    }
+    ++stats.bail_sites[std::make_pair(frame->f_lasti + 1, (int)reason)];
+}
+
+void
+_PyJitStats_RecordInvalidation(PyCodeObject *code)
+{
+    ++stats_for(code).invalidations;
+    ++totals->invalidations;
+}
+
+void
+_PyJitStats_Forget(PyCodeObject *code)
+{
+    if (code_stats != NULL)
+        code_stats->erase(code);
+}
+
+void
+_PyJitStats_Clear(void)
+{
+    if (totals == NULL)
+        return;
+    *totals = PyJitCounters();
+    code_stats->clear();
+}
+
+// Sets dict[key] to value, stealing the reference to value.  Returns -1 on
+// error.
+static int
+set_item(PyObject *dict, const char *key, PyObject *value)
+{
+    if (value == NULL)
+        return -1;
+    int result = PyDict_SetItemString(dict, key, value);
+    Py_DECREF(value);
+    return result;
+}
+
+// Returns a new dict mapping each name to its count, leaving out zeros.
+static PyObject *
+counts_to_dict(const char *const names[], const unsigned long counts[],
+               int num_counts)
+{
+    PyObject *dict = PyDict_New();
+    if (dict == NULL)
+        return NULL;
+    for (int i = 0; i < num_counts; ++i) {
+        if (counts[i] != 0 &&
+            set_item(dict, names[i], PyLong_FromUnsignedLong(counts[i])) < 0) {
+            Py_DECREF(dict);
+            return NULL;
+        }
+    }
+    return dict;
+}
+
+// Fills dict with the fields shared by the totals and each code object.
+static int
+fill_counters(PyObject *dict, const PyJitCounters &counters)
+{
+    if (set_item(dict, "compiles",
+                 PyLong_FromUnsignedLong(counters.compiles)) < 0 ||
+        set_item(dict, "compile_seconds",
+                 PyFloat_FromDouble(counters.compile_seconds)) < 0 ||
+        set_item(dict, "invalidations",
+                 PyLong_FromUnsignedLong(counters.invalidations)) < 0 ||
+        set_item(dict, "bails",
+                 counts_to_dict(bail_reason_names, counters.bails,
+                                NUM_BAIL_REASONS)) < 0 ||
+        set_item(dict, "guard_fails",
+                 counts_to_dict(guard_type_names, counters.guard_fails,
+                                NUM_GUARD_TYPES)) < 0)
+        return -1;
+    return 0;
+}
+
+// Returns a new dict describing one code object.
+static PyObject *
+code_stats_to_dict(PyCodeObject *code, const PyCodeJitStats &stats)
+{
+    PyObject *dict = PyDict_New();
+    if (dict == NULL)
+        return NULL;
+    if (fill_counters(dict, stats) < 0 ||
+        set_item(dict, "code_size",
+                 PyInt_FromSize_t(_PyCodeBudget_GetCodeSize(code))) < 0 ||
+        set_item(dict, "feedback_bytes",
+                 PyInt_FromSize_t(code->co_runtime_feedback ?
+                     code->co_runtime_feedback->GetMemoryUsage() : 0)) < 0)
+        goto error;
+
+    {
+        PyObject *sites = PyDict_New();
+        if (set_item(dict, "bail_sites", sites) < 0)
+            goto error;
+        for (PyCodeJitStats::BailSites::const_iterator
+                 it = stats.bail_sites.begin(), end = stats.bail_sites.end();
+             it != end; ++it) {
+            PyObject *key = Py_BuildValue("(is)", it->first.first,
+                                          bail_reason_names[it->first.second]);
+            PyObject *count = PyLong_FromUnsignedLong(it->second);
+            int result = -1;
+            if (key != NULL && count != NULL)
+                result = PyDict_SetItem(sites, key, count);
+            Py_XDECREF(key);
+            Py_XDECREF(count);
+            if (result < 0)
+                goto error;
+        }
+    }
+    return dict;
+
+error:
+    Py_DECREF(dict);
+    return NULL;
+}
+
+PyObject *
+_PyJitStats_Get(void)
+{
+    PyObject *result = PyDict_New();
+    if (result == NULL)
+        return NULL;
+    PyObject *per_code = NULL;
+    PyGlobalLlvmData *global_data = PyGlobalLlvmData::Get();
+
+    if (fill_counters(result, totals ? *totals : PyJitCounters()) < 0 ||
+        set_item(result, "evictions",
+                 PyInt_FromSsize_t(_PyCodeBudget_GetEvictionCount())) < 0 ||
+        set_item(result, "live_code_bytes",
+                 PyInt_FromSize_t(global_data->GetLiveCodeBytes())) < 0)
+        goto error;
+
+    per_code = PyDict_New();
+    if (per_code == NULL)
+        goto error;
+    if (code_stats != NULL) {
+        for (PyCodeStatsMap::const_iterator it = code_stats->begin(),
+                 end = code_stats->end(); it != end; ++it) {
+            PyObject *code_dict = code_stats_to_dict(it->first, it->second);
+            if (code_dict == NULL)
+                goto error;
+            int err = PyDict_SetItem(per_code, (PyObject *)it->first,
+                                     code_dict);
+            Py_DECREF(code_dict);
+            if (err < 0)
+                goto error;
+        }
+    }
+    if (set_item(result, "code", per_code) < 0) {
+        per_code = NULL;
+        goto error;
+    }
+    return result;
+
+error:
+    Py_XDECREF(per_code);
+    Py_DECREF(result);
+    return NULL;
+}
@@ -0,0 +1,53 @@
+/* Always-on JIT statistics, for _llvm.get_jit_stats().
+
+   The --with-instrumentation build can say much more, but only at exit and
+   at a cost we can't pay in production.  These counters only cost anything
+   when something rare happens: code is compiled, bails to the eval loop or
+   has its machine code invalidated.  We keep them for the whole process and
+   for each code object, and count bails per opcode, so a service stuck
+   recompiling or bailing from the same code can be found while it runs.
+
+   Everything here is called with the GIL held. */
+#ifndef PYTHON_JIT_STATS_H
+#define PYTHON_JIT_STATS_H
+
+#include "Python.h"
+#include "code.h"
+#include "frameobject.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef WITH_LLVM
+/* Returns the current time in seconds, for timing compiles. */
+double _PyJitStats_Now(void);
+
+/* Record that code was given machine code, which took seconds to compile,
+   from generating IR to emitting machine code. */
+void _PyJitStats_RecordCompile(PyCodeObject *code, double seconds);
+
+/* Record that frame bailed from machine code to the eval loop.  The opcode
+   it bailed at is f_lasti + 1; see PyEval_EvalFrame(). */
+void _PyJitStats_RecordBail(PyFrameObject *frame,
+                            _PyFrameBailReason reason);
+
+/* Record that code's machine code was invalidated. */
+void _PyJitStats_RecordInvalidation(PyCodeObject *code);
+
+/* Called when code dies. */
+void _PyJitStats_Forget(PyCodeObject *code);
+
+/* Returns a new dict describing everything recorded so far; see
+   _llvm.get_jit_stats(). */
+PyAPI_FUNC(PyObject *) _PyJitStats_Get(void);
+
+/* Forgets everything recorded so far. */
+PyAPI_FUNC(void) _PyJitStats_Clear(void);
+#endif  /* WITH_LLVM */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* PYTHON_JIT_STATS_H */
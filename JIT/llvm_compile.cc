@@ -4,8 +4,10 @@
 #include "global_llvm_data.h"
 #include "opcode.h"
 
+#include "JIT/compile_thread.h"
 #include "JIT/llvm_compile.h"
 #include "JIT/llvm_fbuilder.h"
+#include "JIT/perf_map.h"
 #include "JIT/PyBytecodeDispatch.h"
 #include "JIT/PyBytecodeIterator.h"
 
@@ -18,7 +20,9 @@
 using llvm::BasicBlock;
 
 struct InstrInfo {
-    InstrInfo() : line_number_(0), block_(NULL), backedge_block_(NULL) {}
+    InstrInfo()
+        : line_number_(0), block_(NULL), backedge_block_(NULL),
+          is_jump_target_(false) {}
     // The line this instruction falls on.
     int line_number_;
     // If this instruction starts a new basic block, this is the
@@ -28,6 +32,9 @@ struct InstrInfo {
     // control flow graph, this block implements the necessary
     // line tracing and then branches to the main block.
     BasicBlock *backedge_block_;
+    // True if any jump goes to this instruction, rather than only falling
+    // through from the previous one.
+    bool is_jump_target_;
 };
 
 // Uses *code to fill line numbers into instr_info.  Assumes that
@@ -176,6 +183,60 @@ error:
 }
 
 
+// Returns true if the implementation of opcode understands unboxed values
+// on the stack and in locals; see LlvmFunctionBuilder::UnboxedValue.  All
+// other opcodes only see boxes.
+static bool
+opcode_handles_unboxed_values(int opcode)
+{
+    switch (opcode) {
+    case NOP:
+    case LOAD_CONST:
+    case LOAD_FAST:
+    case STORE_FAST:
+    case BINARY_ADD:
+    case BINARY_SUBTRACT:
+    case BINARY_MULTIPLY:
+    case BINARY_DIVIDE:
+    case BINARY_TRUE_DIVIDE:
+    case INPLACE_ADD:
+    case INPLACE_SUBTRACT:
+    case INPLACE_MULTIPLY:
+    case INPLACE_DIVIDE:
+    case INPLACE_TRUE_DIVIDE:
+    case COMPARE_OP:
+    case POP_JUMP_IF_FALSE:
+    case POP_JUMP_IF_TRUE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+// Returns true if the BUILD_TUPLE or BUILD_LIST at iter is directly followed
+// by an UNPACK_SEQUENCE of the same size in the same basic block.  The pair
+// only reverses the top of the stack, and nothing between them can bail or
+// raise, so we can skip building the sequence.  The peephole optimizer does
+// this for up to three items, and only in functions with short line tables.
+static bool
+is_unpacked_immediately(const PyBytecodeIterator &iter,
+                        const std::vector<InstrInfo> &instr_info)
+{
+    PyBytecodeIterator next(iter);
+    next.Advance();
+    if (next.Error()) {
+        // The main loop will find the same error.
+        PyErr_Clear();
+        return false;
+    }
+    return (!next.Done() &&
+            next.Opcode() == UNPACK_SEQUENCE &&
+            next.Oparg() == iter.Oparg() &&
+            instr_info[next.CurIndex()].block_ == NULL);
+}
+
+
 // Find the "addresses" of each opcode in the bytecode stream. This is used to
 // validate that jump instructions are jumping to opcodes, rather than opcode
 // arguments. Modifies opcodes in-place. Returns 0 on success, -1 on failure.
@@ -300,6 +361,7 @@ find_basic_blocks(PyObject *bytecode, py::LlvmFunctionBuilder &fbuilder,
             instr_info[target_index].block_ =
                 fbuilder.state()->CreateBasicBlock(target_name);
         }
+        instr_info[target_index].is_jump_target_ = true;
         if (target_index < iter.NextIndex() &&  // This is a backedge.
             instr_info[target_index].backedge_block_ == NULL) {
             instr_info[target_index].backedge_block_ =
@@ -312,8 +374,13 @@ find_basic_blocks(PyObject *bytecode, py::LlvmFunctionBuilder &fbuilder,
     return 0;
 }
 
-extern "C" _LlvmFunction *
-_PyCode_ToLlvmIr(PyCodeObject *code)
+// Translates code to a new IR function, or returns NULL with an exception
+// set.  If for_inlining is true, the function is going to be spliced into
+// another function's IR rather than replacing code's own machine code; see
+// _PyCode_ToInlinableLlvmIr().  If counts_hotness is true, the machine code
+// adds its loop backedges to co_hotness; see _PyCode_ToBaselineLlvmIr().
+static llvm::Function *
+code_to_llvm_ir(PyCodeObject *code, bool for_inlining, bool counts_hotness)
 {
     if (!PyCode_Check(code)) {
         PyErr_Format(PyExc_TypeError, "Expected code object, not '%.500s'",
@@ -326,11 +393,14 @@ _PyCode_ToLlvmIr(PyCodeObject *code)
         return NULL;
     }
 
+    // The compile thread may be optimizing another function in the same
+    // module.
+    PyLlvmCompileLock lock;
     PyGlobalLlvmData *global_data = PyGlobalLlvmData::Get();
     global_data->MaybeCollectUnusedGlobals();
 
     py::LlvmFunctionState fstate(global_data, code);
-    py::LlvmFunctionBuilder fbuilder(&fstate, code);
+    py::LlvmFunctionBuilder fbuilder(&fstate, code, counts_hotness);
     if (fbuilder.Error()) {
         return NULL;
     }
@@ -351,10 +421,28 @@ _PyCode_ToLlvmIr(PyCodeObject *code)
 
     py::PyBytecodeDispatch dispatch(&fbuilder);
     PyBytecodeIterator iter(code->co_code);
+    int prev_opcode = -1;
     for (; !iter.Done() && !iter.Error(); iter.Advance()) {
         fbuilder.SetLasti(iter.CurIndex());
-        if (instr_info[iter.CurIndex()].block_ != NULL) {
-            fbuilder.FallThroughTo(instr_info[iter.CurIndex()].block_);
+        const InstrInfo &info = instr_info[iter.CurIndex()];
+        if (info.block_ != NULL) {
+            // Unboxed values don't survive across basic blocks, except into
+            // the body of a for loop: only FOR_ITER's fallthrough edge
+            // enters it, so what FOR_ITER left unboxed is still valid.
+            bool keep_unboxed = (prev_opcode == FOR_ITER &&
+                                 !info.is_jump_target_);
+            if (!keep_unboxed) {
+                fbuilder.MaterializeUnboxedValues();
+            }
+            fbuilder.FallThroughTo(info.block_);
+            if (!keep_unboxed) {
+                fbuilder.ForgetUnboxedLocals();
+            }
+        }
+        prev_opcode = iter.Opcode();
+        if (!opcode_handles_unboxed_values(iter.Opcode())) {
+            fbuilder.MaterializeUnboxedValues();
+            fbuilder.ForgetUnboxedLocals();
         }
         // Must call SetLineNumber *after* selecting the new insert block
         // (above), or the line-number-setting LLVM IR might get added after
@@ -461,8 +549,6 @@ _PyCode_ToLlvmIr(PyCodeObject *code)
         OPCODE_WITH_ARG(DELETE_GLOBAL)
         OPCODE_WITH_ARG(LOAD_CONST)
         OPCODE_WITH_ARG(LOAD_NAME)
-        OPCODE_WITH_ARG(BUILD_TUPLE)
-        OPCODE_WITH_ARG(BUILD_LIST)
         OPCODE_WITH_ARG(BUILD_MAP)
         OPCODE_WITH_ARG(LOAD_ATTR)
         OPCODE_WITH_ARG(COMPARE_OP)
@@ -482,6 +568,20 @@ _PyCode_ToLlvmIr(PyCodeObject *code)
         OPCODE_WITH_ARG(CALL_FUNCTION_VAR_KW)
 #undef OPCODE_WITH_ARG
 
+        case BUILD_TUPLE:
+        case BUILD_LIST:
+            if (is_unpacked_immediately(iter, instr_info)) {
+                dispatch.UNPACK_BUILT_SEQUENCE(iter.Oparg());
+                iter.Advance();  // Skip the UNPACK_SEQUENCE.
+            }
+            else if (iter.Opcode() == BUILD_TUPLE) {
+                dispatch.BUILD_TUPLE(iter.Oparg());
+            }
+            else {
+                dispatch.BUILD_LIST(iter.Oparg());
+            }
+            break;
+
 #define ABS iter.Oparg()
 #define REL iter.NextIndex() + iter.Oparg()
 #define NO_OPINDEX target
@@ -536,6 +636,7 @@ _PyCode_ToLlvmIr(PyCodeObject *code)
     }
     // Make sure the last block has a terminator, even though it should
     // be unreachable.
+    fbuilder.ForgetUnboxedValues();
     fbuilder.FallThroughTo(fbuilder.unreachable_block());
 
     for (size_t i = 0; i < instr_info.size(); ++i) {
@@ -550,6 +651,11 @@ _PyCode_ToLlvmIr(PyCodeObject *code)
             fbuilder.FillBackedgeLanding(info.backedge_block_, info.block_,
                                          backedge_is_to_start_of_line,
                                          info.line_number_);
+            // The eval loop enters through the loop header itself: it has
+            // already done the backedge's hotness and line-tracing work.
+            if (fbuilder.supports_osr()) {
+                fbuilder.AddOsrEntryBB(i, info.block_);
+            }
         }
     }
 
@@ -560,12 +666,41 @@ _PyCode_ToLlvmIr(PyCodeObject *code)
 
     // Now that we know that there were no errors, register invalidation
     // callbacks for the code object.
-    if (fbuilder.FinishFunction() < 0) {
+    if (fbuilder.FinishFunction(!for_inlining) < 0) {
         return NULL;
     }
 
+    if (!for_inlining) {
+        global_data->perf_listener().NameFunction(fbuilder.function(), code);
+    }
+    return fbuilder.function();
+}
+
+static _LlvmFunction *
+to_llvm_function(llvm::Function *function)
+{
+    if (function == NULL) {
+        return NULL;
+    }
     // Make sure the function survives global optimizations.
-    fbuilder.function()->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    function->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    return _LlvmFunction_New(PyGlobalLlvmData::Get(), function);
+}
 
-    return _LlvmFunction_New(fbuilder.function());
+extern "C" _LlvmFunction *
+_PyCode_ToLlvmIr(PyCodeObject *code)
+{
+    return to_llvm_function(code_to_llvm_ir(code, false, false));
+}
+
+extern "C" _LlvmFunction *
+_PyCode_ToBaselineLlvmIr(PyCodeObject *code)
+{
+    return to_llvm_function(code_to_llvm_ir(code, false, true));
+}
+
+llvm::Function *
+_PyCode_ToInlinableLlvmIr(PyCodeObject *code)
+{
+    return code_to_llvm_ir(code, true, false);
 }
@@ -8,10 +8,27 @@ extern "C" {
 
 #ifdef WITH_LLVM
 PyAPI_FUNC(_LlvmFunction *) _PyCode_ToLlvmIr(PyCodeObject *code);
+
+/* Like _PyCode_ToLlvmIr(), but the machine code keeps adding to co_hotness
+   on loop backedges the way the eval loop does, so we can tell whether code
+   compiled at Py_BASELINE_JIT_OPT_LEVEL stays hot (see Py_JitTiered). */
+PyAPI_FUNC(_LlvmFunction *) _PyCode_ToBaselineLlvmIr(PyCodeObject *code);
 #endif
 
 #ifdef __cplusplus
 }
-#endif
+
+#ifdef WITH_LLVM
+namespace llvm {
+class Function;
+}
+
+// Like _PyCode_ToLlvmIr(), but for IR that will be spliced into another
+// code object's function, so it returns the bare llvm::Function; the caller
+// must erase it once it's done.  code keeps watching every dict its
+// existing machine code may depend on.
+llvm::Function *_PyCode_ToInlinableLlvmIr(PyCodeObject *code);
+#endif  // WITH_LLVM
+#endif  // __cplusplus
 
 #endif // PYTHON_LLVM_COMPILE_H
@@ -28,6 +28,7 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Type.h"
 
+#include <algorithm>
 #include <vector>
 
 #ifndef DW_LANG_Python
@@ -143,6 +144,29 @@ find_stack_top(PyBytecodeIterator iter,
     return 0;
 }
 
+// Returns true if the bytecode contains any backward jumps.  Those jump to
+// loop headers, which the eval loop may ask us to enter through on-stack
+// replacement.
+static bool
+has_backedges(PyCodeObject *code_object)
+{
+    PyBytecodeIterator iter(code_object->co_code);
+    for (; !iter.Done() && !iter.Error(); iter.Advance()) {
+        switch (iter.Opcode()) {
+        case JUMP_IF_FALSE_OR_POP:
+        case JUMP_IF_TRUE_OR_POP:
+        case POP_JUMP_IF_FALSE:
+        case POP_JUMP_IF_TRUE:
+        case JUMP_ABSOLUTE:
+        case CONTINUE_LOOP:
+            if ((size_t)iter.Oparg() < iter.NextIndex())
+                return true;
+            break;
+        }
+    }
+    return false;
+}
+
 static llvm::StringRef
 pystring_to_stringref(const PyObject* str)
 {
@@ -151,7 +175,7 @@ pystring_to_stringref(const PyObject* str)
 }
 
 LlvmFunctionBuilder::LlvmFunctionBuilder(
-    LlvmFunctionState *state, PyCodeObject *code_object)
+    LlvmFunctionState *state, PyCodeObject *code_object, bool counts_hotness)
     : state_(state),
       llvm_data_(state->llvm_data()),
       code_object_(code_object),
@@ -179,8 +203,14 @@ LlvmFunctionBuilder::LlvmFunctionBuilder(
                             false,   // Not local to unit.
                             true)),  // Is definition.
       stack_info_(0),
+      guarded_args_(0),
+      unboxed_stack_(code_object->co_stacksize),
+      unboxed_locals_(code_object->co_nlocals),
+      have_unboxed_stack_(false),
       error_(false),
       is_generator_(code_object->co_flags & CO_GENERATOR),
+      supports_osr_(!is_generator_ && has_backedges(code_object)),
+      counts_hotness_(counts_hotness),
       uses_delete_fast_(false)
 {
     Function::arg_iterator args = this->function_->arg_begin();
@@ -247,7 +277,35 @@ LlvmFunctionBuilder::LlvmFunctionBuilder(
         // pointer, block stack and locals from the frame.
         this->CopyFromFrameObject();
     } else {
-        // If this isn't a generator, the stack pointer always starts at
+        BasicBlock *call_entry =
+            this->state()->CreateBasicBlock("call_entry");
+        BasicBlock *frame_copied =
+            this->state()->CreateBasicBlock("frame_copied");
+        if (this->supports_osr_) {
+            // The eval loop may hand us a frame that's already in the
+            // middle of a loop (on-stack replacement).  In that case
+            // f_lasti names the loop header, and the stack pointer, block
+            // stack and locals all have to come from the frame, just like
+            // when resuming a generator.
+            BasicBlock *osr_entry =
+                this->state()->CreateBasicBlock("osr_entry");
+            Value *entry_lasti = this->builder_.CreateLoad(
+                FrameTy::f_lasti(this->builder_, this->frame_),
+                "entry_lasti");
+            this->builder_.CreateCondBr(
+                this->builder_.CreateICmpEQ(
+                    entry_lasti, this->state()->GetSigned<int>(-1)),
+                call_entry, osr_entry);
+
+            this->builder_.SetInsertPoint(osr_entry);
+            this->CopyFromFrameObject();
+            this->builder_.CreateBr(frame_copied);
+        } else {
+            this->builder_.CreateBr(call_entry);
+        }
+
+        this->builder_.SetInsertPoint(call_entry);
+        // Entering through a call, the stack pointer always starts at
         // the bottom of the stack.
         this->builder_.CreateStore(this->stack_bottom_,
                                    this->stack_pointer_addr_);
@@ -261,7 +319,10 @@ LlvmFunctionBuilder::LlvmFunctionBuilder(
             this->num_blocks_addr_);
 
         // If this isn't a generator, we only need to copy the locals.
-        this->CopyLocalsFromFrameObject();
+        this->CopyLocalsFromFrameObject(false);
+        this->builder_.CreateBr(frame_copied);
+
+        this->builder_.SetInsertPoint(frame_copied);
     }
 
     Value *use_tracing = this->builder_.CreateLoad(
@@ -286,7 +347,8 @@ LlvmFunctionBuilder::LlvmFunctionBuilder(
     Value *frame_code = this->builder_.CreateLoad(
         FrameTy::f_code(this->builder_, this->frame_),
         "frame->f_code");
-    this->use_jit_addr_ = CodeTy::co_use_jit(this->builder_, frame_code);
+    this->fatalbailcount_addr_ =
+        CodeTy::co_fatalbailcount(this->builder_, frame_code);
 #ifndef NDEBUG
     // Assert that the code object we pull out of the frame is the
     // same as the one passed into this object.
@@ -353,9 +415,12 @@ LlvmFunctionBuilder::LlvmFunctionBuilder(
       PropagateException();
 
       this->builder_.SetInsertPoint(continue_generator_or_start_func);
+    }
+    if (this->is_generator_ || this->supports_osr_) {
       Value *resume_block = this->builder_.CreateLoad(
           this->f_lasti_addr_, "resume_block");
-      // Each use of a YIELD_VALUE opcode will add a new case to this
+      // Each use of a YIELD_VALUE opcode, and each loop header we can
+      // enter through on-stack replacement, will add a new case to this
       // switch.  eval.cc just assigns the new IP, allowing wild jumps,
       // but LLVM won't let us do that so we default to jumping to the
       // unreachable block.
@@ -366,7 +431,8 @@ LlvmFunctionBuilder::LlvmFunctionBuilder(
           ConstantInt::getSigned(PyTypeBuilder<int>::get(this->context_), -1),
           start);
     } else {
-      // This function is not a generator, so we just jump to the start.
+      // This function can only be entered at the top, so we just jump to
+      // the start.
       this->builder_.CreateBr(start);
     }
 
@@ -953,7 +1019,7 @@ LlvmFunctionBuilder::CopyFromFrameObject()
             FrameTy::f_blockstack(this->builder_, this->frame_), 0),
         num_blocks);
 
-    this->CopyLocalsFromFrameObject();
+    this->CopyLocalsFromFrameObject(true);
 }
 
 int
@@ -966,16 +1032,17 @@ LlvmFunctionBuilder::GetParamCount() const
 
 
 // Rules for copying locals from the frame:
-// - If this is a generator, copy everything from the frame.
-// - If this is a regular function, only copy the function's parameters; these
-//   can never be NULL. Set all other locals to NULL explicitly. This gives
-//   LLVM's optimizers more information.
+// - If we're resuming a generator or entering a loop through on-stack
+//   replacement, copy everything from the frame.
+// - If we're entering a regular function through a call, only copy the
+//   function's parameters; these can never be NULL. Set all other locals to
+//   NULL explicitly. This gives LLVM's optimizers more information.
 //
 // TODO(collinwinter): when LLVM's metadata supports it, mark all parameters
 // as "not-NULL" so that constant propagation can have more information to work
 // with.
 void
-LlvmFunctionBuilder::CopyLocalsFromFrameObject()
+LlvmFunctionBuilder::CopyLocalsFromFrameObject(bool copy_all_locals)
 {
     const Type *int_type = Type::getInt32Ty(this->context_);
     Value *locals =
@@ -992,7 +1059,7 @@ LlvmFunctionBuilder::CopyLocalsFromFrameObject()
         PyObject *pyname =
             PyTuple_GET_ITEM(this->code_object_->co_varnames, i);
 
-        if (this->is_generator_ || i < param_count) {
+        if (copy_all_locals || i < param_count) {
             Value *local_slot = this->builder_.CreateLoad(
                 this->builder_.CreateGEP(
                     locals, ConstantInt::get(int_type, i)),
@@ -1011,6 +1078,7 @@ LlvmFunctionBuilder::SetLasti(int current_instruction_index)
 {
     this->f_lasti_ = current_instruction_index;
     this->stack_top_ = this->stack_info_[current_instruction_index];
+    this->guarded_args_ = 0;
 }
 
 void
@@ -1044,6 +1112,20 @@ LlvmFunctionBuilder::FillBackedgeLanding(BasicBlock *backedge_landing,
     }
 
     this->builder_.SetInsertPoint(backedge_landing);
+    if (this->counts_hotness_) {
+        // Like UPDATE_HOTNESS_JABS() in the eval loop.  eval.cc notices
+        // when the code gets hot enough to recompile.
+        Value *frame_code = this->builder_.CreateLoad(
+            FrameTy::f_code(this->builder_, this->frame_),
+            "frame->f_code");
+        Value *hotness_addr = CodeTy::co_hotness(this->builder_, frame_code);
+        Value *hotness = this->builder_.CreateLoad(hotness_addr, "hotness");
+        this->builder_.CreateStore(
+            this->builder_.CreateAdd(
+                hotness,
+                ConstantInt::get(hotness->getType(), 1)),
+            hotness_addr);
+    }
     this->CheckPyTicker(continue_backedge);
 
     if (!to_start_of_line) {
@@ -1173,6 +1255,8 @@ LlvmFunctionBuilder::GetFeedback(unsigned arg_index) const
 void
 LlvmFunctionBuilder::CreateBailPoint(unsigned bail_idx, char reason)
 {
+    // The interpreter only understands boxes.
+    this->StoreUnboxedValuesToStack();
     this->builder_.CreateStore(
         // -1 so that next_instr gets set right in EvalFrame.
         this->state()->GetSigned<int>(bail_idx - 1),
@@ -1209,6 +1293,7 @@ LlvmFunctionBuilder::Push(Value *value)
         ConstantInt::get(Type::getInt32Ty(this->context_), this->stack_top_));
     this->builder_.CreateStore(value, from_bottom);
     this->llvm_data_->tbaa_stack.MarkInstruction(from_bottom);
+    this->unboxed_stack_[this->stack_top_] = UnboxedValue();
     ++this->stack_top_;
 }
 
@@ -1284,6 +1369,7 @@ void
 LlvmFunctionBuilder::SetOpcodeArgsWithGuard(int amount)
 {
     this->stack_top_ -= amount;
+    this->guarded_args_ = amount;
 }
 
 void
@@ -1296,6 +1382,7 @@ LlvmFunctionBuilder::BeginOpcodeImpl()
     this->llvm_data_->tbaa_stack.MarkInstruction(from_bottom);
     this->builder_.CreateStore(from_bottom,
                                this->stack_pointer_addr_);
+    this->guarded_args_ = 0;
 }
 
 Value *
@@ -1327,6 +1414,7 @@ LlvmFunctionBuilder::SetOpcodeResult(int i, llvm::Value *value)
                          this->stack_top_ + i));
     this->builder_.CreateStore(value, from_bottom);
     this->llvm_data_->tbaa_stack.MarkInstruction(from_bottom);
+    this->unboxed_stack_[this->stack_top_ + i] = UnboxedValue();
 }
 
 void
@@ -1335,6 +1423,197 @@ LlvmFunctionBuilder::FinishOpcodeImpl(int i)
     this->stack_top_ += i;
 }
 
+const LlvmFunctionBuilder::UnboxedValue &
+LlvmFunctionBuilder::PeekUnboxed(int depth) const
+{
+    return this->unboxed_stack_[this->stack_top_ - 1 - depth];
+}
+
+const LlvmFunctionBuilder::UnboxedValue &
+LlvmFunctionBuilder::GetUnboxedArg(int i) const
+{
+    return this->unboxed_stack_[this->stack_top_ + i];
+}
+
+LlvmFunctionBuilder::UnboxedValue::Kind
+LlvmFunctionBuilder::PredictUnboxedKind(int depth, unsigned arg_index) const
+{
+    const UnboxedValue &known = this->PeekUnboxed(depth);
+    if (known.kind == UnboxedValue::INT || known.kind == UnboxedValue::FLOAT)
+        return known.kind;
+    if (known.kind != UnboxedValue::NONE)
+        return UnboxedValue::NONE;
+
+    const PyTypeObject *type = this->GetTypeFeedback(arg_index);
+    if (type == &PyInt_Type)
+        return UnboxedValue::INT;
+    if (type == &PyFloat_Type)
+        return UnboxedValue::FLOAT;
+    return UnboxedValue::NONE;
+}
+
+Value *
+LlvmFunctionBuilder::UnboxOpcodeArg(int i, UnboxedValue::Kind kind,
+                                    BasicBlock *bail_block)
+{
+    const UnboxedValue &known = this->GetUnboxedArg(i);
+    if (known.kind == kind)
+        return known.raw;
+    assert(known.kind == UnboxedValue::NONE &&
+           "Asked for the wrong kind of unboxed value");
+
+    PyTypeObject *type;
+    switch (kind) {
+    case UnboxedValue::INT:
+        type = &PyInt_Type;
+        break;
+    case UnboxedValue::FLOAT:
+        type = &PyFloat_Type;
+        break;
+    default:
+        assert(0 && "Can only unbox ints and floats");
+        return NULL;
+    }
+
+    Value *box = this->GetOpcodeArg(i);
+    BasicBlock *is_right_type =
+        this->state()->CreateBasicBlock("UnboxOpcodeArg_right_type");
+    Value *actual_type = this->builder_.CreateLoad(
+        ObjectTy::ob_type(this->builder_, box));
+    this->builder_.CreateCondBr(
+        this->builder_.CreateICmpEQ(
+            actual_type, this->state()->EmbedPointer<PyTypeObject*>(type)),
+        is_right_type, bail_block);
+
+    this->builder_.SetInsertPoint(is_right_type);
+    if (kind == UnboxedValue::INT) {
+        Value *int_box = this->builder_.CreateBitCast(
+            box, PyTypeBuilder<PyIntObject*>::get(this->context_));
+        return this->builder_.CreateLoad(
+            IntTy::ob_ival(this->builder_, int_box), "unboxed_int");
+    }
+    Value *float_box = this->builder_.CreateBitCast(
+        box, PyTypeBuilder<PyFloatObject*>::get(this->context_));
+    return this->builder_.CreateLoad(
+        FloatTy::ob_fval(this->builder_, float_box), "unboxed_float");
+}
+
+void
+LlvmFunctionBuilder::DecRefOpcodeArg(int i)
+{
+    if (!this->GetUnboxedArg(i).is_virtual)
+        this->state()->DecRef(this->GetOpcodeArg(i));
+}
+
+void
+LlvmFunctionBuilder::SetUnboxedResult(int i, UnboxedValue::Kind kind,
+                                      Value *raw)
+{
+    this->SetOpcodeResult(i, this->state()->GetNull<PyObject*>());
+    this->unboxed_stack_[this->stack_top_ + i] =
+        UnboxedValue(kind, raw, true);
+    this->have_unboxed_stack_ = true;
+}
+
+void
+LlvmFunctionBuilder::PushKnownUnboxed(Value *value, UnboxedValue::Kind kind,
+                                      Value *raw)
+{
+    this->Push(value);
+    this->unboxed_stack_[this->stack_top_ - 1] =
+        UnboxedValue(kind, raw, false);
+    this->have_unboxed_stack_ = true;
+}
+
+Value *
+LlvmFunctionBuilder::BoxUnboxedValue(const UnboxedValue &value)
+{
+    switch (value.kind) {
+    case UnboxedValue::INT: {
+        Value *box = this->state()->CreateCall(
+            this->state()->GetGlobalFunction<PyObject *(long)>(
+                "PyInt_FromLong"),
+            value.raw, "boxed_int");
+        this->PropagateExceptionOnNull(box);
+        return box;
+    }
+    case UnboxedValue::FLOAT: {
+        Value *box = this->state()->CreateCall(
+            this->state()->GetGlobalFunction<PyObject *(double)>(
+                "PyFloat_FromDouble"),
+            value.raw, "boxed_float");
+        this->PropagateExceptionOnNull(box);
+        return box;
+    }
+    case UnboxedValue::BOOL: {
+        Value *box = this->builder_.CreateSelect(
+            value.raw,
+            this->state()->GetGlobalVariableFor((PyObject*)&_Py_TrueStruct),
+            this->state()->GetGlobalVariableFor((PyObject*)&_Py_ZeroStruct),
+            "boxed_bool");
+        this->state()->IncRef(box);
+        return box;
+    }
+    case UnboxedValue::NONE:
+        break;
+    }
+    assert(0 && "Tried to box an unknown value");
+    return NULL;
+}
+
+void
+LlvmFunctionBuilder::SetUnboxedLocal(int i, const UnboxedValue &value)
+{
+    assert(!value.is_virtual && "Locals always hold a box");
+    this->unboxed_locals_[i] = value;
+}
+
+void
+LlvmFunctionBuilder::ForgetUnboxedLocals()
+{
+    std::fill(this->unboxed_locals_.begin(), this->unboxed_locals_.end(),
+              UnboxedValue());
+}
+
+void
+LlvmFunctionBuilder::StoreUnboxedValuesToStack()
+{
+    if (!this->have_unboxed_stack_)
+        return;
+    int live_top = this->stack_top_ + this->guarded_args_;
+    for (int i = 0; i < live_top; ++i) {
+        const UnboxedValue &value = this->unboxed_stack_[i];
+        if (!value.is_virtual)
+            continue;
+        Value *box = this->BoxUnboxedValue(value);
+        Value *slot = this->builder_.CreateGEP(
+            this->stack_bottom_,
+            ConstantInt::get(Type::getInt32Ty(this->context_), i));
+        this->builder_.CreateStore(box, slot);
+        this->llvm_data_->tbaa_stack.MarkInstruction(slot);
+    }
+}
+
+void
+LlvmFunctionBuilder::MaterializeUnboxedValues()
+{
+    if (!this->have_unboxed_stack_)
+        return;
+    assert(this->builder_.GetInsertBlock()->getTerminator() == NULL &&
+           "Unboxed values live at the end of a terminated block");
+    assert(this->guarded_args_ == 0);
+    this->StoreUnboxedValuesToStack();
+    this->ForgetUnboxedValues();
+}
+
+void
+LlvmFunctionBuilder::ForgetUnboxedValues()
+{
+    std::fill(this->unboxed_stack_.begin(), this->unboxed_stack_.end(),
+              UnboxedValue());
+    this->have_unboxed_stack_ = false;
+}
+
 void
 LlvmFunctionBuilder::CheckPyTicker(BasicBlock *next_block)
 {
@@ -1482,18 +1761,27 @@ LlvmFunctionBuilder::WatchType(PyTypeObject *type)
 }
 
 void
-LlvmFunctionBuilder::WatchDict(int reason)
+LlvmFunctionBuilder::WatchDict(int reason, PyObject *key)
 {
     this->uses_watched_dicts_.set(reason);
+    if (key == NULL)
+        this->watches_whole_dict_.set(reason);
+    else
+        this->watched_keys_[reason].push_back(key);
 }
 
 
 Value *
-LlvmFunctionBuilder::GetUseJitCond()
+LlvmFunctionBuilder::GetMachineCodeValidCond()
 {
-    Value *use_jit = this->builder_.CreateLoad(this->use_jit_addr_,
-                                               "co_use_jit");
-    return this->state()->IsNonZero(use_jit);
+    // _PyCode_InvalidateMachineCode() bumps co_fatalbailcount.  Testing it,
+    // rather than co_use_jit, keeps frames still running this code from
+    // trusting it again once the code object has been recompiled.
+    Value *fatalbailcount = this->builder_.CreateLoad(
+        this->fatalbailcount_addr_, "co_fatalbailcount");
+    return this->builder_.CreateICmpEQ(
+        fatalbailcount,
+        this->state()->GetSigned<int>(this->code_object_->co_fatalbailcount));
 }
 
 void
@@ -1503,17 +1791,50 @@ LlvmFunctionBuilder::AddYieldResumeBB(llvm::ConstantInt *number,
     this->yield_resume_switch_->addCase(number, block);
 }
 
+void
+LlvmFunctionBuilder::AddOsrEntryBB(int opcode_index, llvm::BasicBlock *block)
+{
+    assert(this->supports_osr_ && "No OSR entry switch in this function");
+    this->AddYieldResumeBB(
+        ConstantInt::getSigned(PyTypeBuilder<int>::get(this->context_),
+                               opcode_index),
+        block);
+}
+
 int
-LlvmFunctionBuilder::FinishFunction()
+LlvmFunctionBuilder::FinishFunction(bool ignore_unused_dicts)
 {
     // If the code object doesn't need to watch any dicts, it shouldn't be
     // invalidated when those dicts change.
+    // Otherwise, only writes to the keys we depend on should invalidate it.
     PyCodeObject *code = this->code_object_;
     if (code->co_watching) {
         for (unsigned i = 0; i < NUM_WATCHING_REASONS; ++i) {
             if (!this->uses_watched_dicts_.test(i)) {
-                _PyCode_IgnoreDict(code, (ReasonWatched)i);
+                if (ignore_unused_dicts)
+                    _PyCode_IgnoreDict(code, (ReasonWatched)i);
+                continue;
+            }
+            PyObject *keys;
+            if (this->watches_whole_dict_.test(i)) {
+                keys = Py_None;
+                Py_INCREF(keys);
+            }
+            else {
+                const std::vector<PyObject *> &watched_keys =
+                    this->watched_keys_[i];
+                keys = PyTuple_New(watched_keys.size());
+                if (keys == NULL)
+                    return -1;
+                for (size_t j = 0; j < watched_keys.size(); ++j) {
+                    Py_INCREF(watched_keys[j]);
+                    PyTuple_SET_ITEM(keys, j, watched_keys[j]);
+                }
             }
+            int result = _PyCode_AddWatchedKeys(code, (ReasonWatched)i, keys);
+            Py_DECREF(keys);
+            if (result < 0)
+                return -1;
         }
     }
 
@@ -24,6 +24,7 @@
 
 #include <bitset>
 #include <string>
+#include <vector>
 
 struct PyCodeObject;
 struct PyGlobalLlvmData;
@@ -39,7 +40,10 @@ class LlvmFunctionBuilder {
     void operator=(const LlvmFunctionBuilder &);  // Not implemented.
 
 public:
-    LlvmFunctionBuilder(LlvmFunctionState *state, PyCodeObject *code);
+    /// If counts_hotness is true, taken loop backedges add to the code
+    /// object's co_hotness, as they do in the eval loop.
+    LlvmFunctionBuilder(LlvmFunctionState *state, PyCodeObject *code,
+                        bool counts_hotness = false);
 
     llvm::Function *function() { return function_; }
     typedef llvm::IRBuilder<true, llvm::TargetFolder> BuilderT;
@@ -90,6 +94,9 @@ public:
     llvm::Value *fastlocals() const { return this->fastlocals_; }
     
     bool is_generator() const { return this->is_generator_; }
+    /// True if the function has loops that can be entered through
+    /// on-stack replacement.
+    bool supports_osr() const { return this->supports_osr_; }
 
     llvm::Value *GetLocal(int i) const { return this->locals_[i]; }
 
@@ -127,8 +134,11 @@ public:
     void FallThroughTo(llvm::BasicBlock *next_block);
 
     /// Register callbacks that might invalidate native code based on the
-    /// optimizations performed in the generated code.
-    int FinishFunction();
+    /// optimizations performed in the generated code.  If
+    /// ignore_unused_dicts is true, also stop watching dicts that the
+    /// generated code doesn't depend on; leave it false when other machine
+    /// code for the same code object may still depend on them.
+    int FinishFunction(bool ignore_unused_dicts = true);
 
     /// These two push or pop a value onto or off of the stack. The
     /// behavior is undefined if the Value's type isn't PyObject* or a
@@ -176,6 +186,89 @@ public:
     /// until it gets there, decref'ing as it goes.
     void PopAndDecrefTo(llvm::Value *target_stack_pointer);
 
+    /// Unboxed ints, floats and bools.
+    ///
+    /// When type feedback says the operands of an arithmetic or comparison
+    /// opcode are ints or floats, we compute on raw machine values, and
+    /// only box the result when something needs a PyObject*.  To do that,
+    /// we track at compile time what we know about each stack slot and
+    /// local:
+    ///
+    /// - A virtual stack slot has no PyObject* at all.  Its memory holds
+    ///   NULL, so unwinding the stack after an exception skips it.
+    /// - Other stack slots and locals may hold a box whose raw value we
+    ///   also know, which lets later opcodes skip the type check and the
+    ///   unboxing load.
+    ///
+    /// Only the opcodes listed in opcode_handles_unboxed_values() in
+    /// llvm_compile.cc understand this state.  Before any other opcode, and
+    /// at the end of each basic block, MaterializeUnboxedValues() boxes
+    /// the virtual slots.  Bail points box them into the frame on the
+    /// way out to the interpreter.
+    struct UnboxedValue {
+        enum Kind { NONE, INT, FLOAT, BOOL };
+
+        UnboxedValue() : kind(NONE), raw(NULL), is_virtual(false) {}
+        UnboxedValue(Kind kind, llvm::Value *raw, bool is_virtual)
+            : kind(kind), raw(raw), is_virtual(is_virtual) {}
+
+        Kind kind;
+        // A long for INT, a double for FLOAT and an i1 for BOOL.
+        llvm::Value *raw;
+        bool is_virtual;
+    };
+
+    /// Returns what we know about the value depth slots below the top of
+    /// the stack, before SetOpcodeArguments() has been called.
+    const UnboxedValue &PeekUnboxed(int depth) const;
+    /// Returns what we know about opcode argument i.  Must be called after
+    /// SetOpcodeArguments() or SetOpcodeArgsWithGuard().
+    const UnboxedValue &GetUnboxedArg(int i) const;
+    /// Predicts whether the value depth slots below the top of the stack
+    /// is an int or a float, from what we know about it or else from the
+    /// type feedback for the current opcode's argument arg_index.  Returns
+    /// NONE if it's neither.
+    UnboxedValue::Kind PredictUnboxedKind(int depth,
+                                          unsigned arg_index) const;
+    /// Returns the raw value of opcode argument i, which must be of the
+    /// given kind.  If we don't already know it, this emits a type check
+    /// that jumps to bail_block on failure, and loads the raw value from
+    /// the box.
+    llvm::Value *UnboxOpcodeArg(int i, UnboxedValue::Kind kind,
+                                llvm::BasicBlock *bail_block);
+    /// Releases the reference held by opcode argument i, unless it's
+    /// virtual.
+    void DecRefOpcodeArg(int i);
+    /// Like SetOpcodeResult(), but leaves the result unboxed.
+    void SetUnboxedResult(int i, UnboxedValue::Kind kind, llvm::Value *raw);
+    /// Like Push(), but records that value, a new reference, is a box
+    /// holding raw.
+    void PushKnownUnboxed(llvm::Value *value, UnboxedValue::Kind kind,
+                          llvm::Value *raw);
+    /// Returns a new reference to a box holding value, or NULL with an
+    /// exception set.
+    llvm::Value *BoxUnboxedValue(const UnboxedValue &value);
+
+    /// What we know about locals.  Locals always hold a box; we only
+    /// remember the raw values they hold until the end of the basic block
+    /// or the next opcode that doesn't understand unboxed values.
+    const UnboxedValue &GetUnboxedLocal(int i) const {
+        return this->unboxed_locals_[i];
+    }
+    void SetUnboxedLocal(int i, const UnboxedValue &value);
+    void ForgetUnboxedLocal(int i) {
+        this->unboxed_locals_[i] = UnboxedValue();
+    }
+    void ForgetUnboxedLocals();
+
+    /// Boxes all virtual stack slots into the stack, propagating an
+    /// exception if that fails, and forgets everything we know about the
+    /// stack.  Cheap no-op if nothing is known.
+    void MaterializeUnboxedValues();
+    /// Forgets everything we know about the stack without emitting any
+    /// code.  Only for use where the current point is unreachable.
+    void ForgetUnboxedValues();
+
     /// The PyFrameObject holds several values, like the block stack
     /// and stack pointer, that we store in allocas inside this
     /// function.  When we suspend or resume a generator, or bail out
@@ -185,8 +278,9 @@ public:
     void CopyFromFrameObject();
 
     /// We copy the function's locals into an LLVM alloca so that LLVM can
-    /// better reason about them.
-    void CopyLocalsFromFrameObject();
+    /// better reason about them.  If copy_all_locals is false, only the
+    /// parameters are copied and the other locals start out NULL.
+    void CopyLocalsFromFrameObject(bool copy_all_locals);
 
     /// Returns the difference between the current stack pointer and
     /// the base of the stack.
@@ -307,14 +401,23 @@ public:
     // Add a Type to the watch list.
     void WatchType(PyTypeObject *type);
 
-    void WatchDict(int reason);
+    // Record that the machine code depends on key in the dict watched for
+    // reason, or on the whole dict if key is NULL.  FinishFunction() passes
+    // this on to _PyCode_AddWatchedKeys().  key is borrowed and must live as
+    // long as the code object, eg. a name from co_names.
+    void WatchDict(int reason, PyObject *key = NULL);
 
-    // Return a i1 which is true when the use_jit field is set in the
-    // code object
-    llvm::Value *GetUseJitCond();
+    // Return an i1 which is true as long as the machine code we're building
+    // is still valid, i.e. the code object hasn't been invalidated since.
+    llvm::Value *GetMachineCodeValidCond();
 
     void AddYieldResumeBB(llvm::ConstantInt *number, llvm::BasicBlock *block);
 
+    /// Lets the eval loop enter this function at opcode_index, which must be
+    /// the target of a backedge, by setting f_lasti to opcode_index before
+    /// calling the native code.  Only valid if supports_osr().
+    void AddOsrEntryBB(int opcode_index, llvm::BasicBlock *block);
+
 private:
     // Stack pointer relative push and pop methods are for internal
     // use only.
@@ -340,13 +443,17 @@ private:
     // Flags to indicate whether the code object is watching any of the
     // watchable dicts.
     std::bitset<NUM_WATCHING_REASONS> uses_watched_dicts_;
+    // For each watched dict, whether we depend on all of it, and otherwise
+    // the keys we depend on.
+    std::bitset<NUM_WATCHING_REASONS> watches_whole_dict_;
+    std::vector<PyObject *> watched_keys_[NUM_WATCHING_REASONS];
 
     // The following pointers hold values created in the function's
     // entry block. They're constant after construction.
     llvm::Value *frame_;
 
-    // Address of code_object_->co_use_jit, used for guards.
-    llvm::Value *use_jit_addr_;
+    // Address of code_object_->co_fatalbailcount, used for guards.
+    llvm::Value *fatalbailcount_addr_;
 
     llvm::Value *tstate_;
     llvm::Value *stack_bottom_;
@@ -379,7 +486,9 @@ private:
     llvm::BasicBlock *unreachable_block_;
 
     // In generators, we use this switch to jump back to the most
-    // recently executed yield instruction.
+    // recently executed yield instruction.  In functions that support
+    // on-stack replacement, it jumps to the loop header the eval loop was
+    // at when it handed us the frame.
     llvm::SwitchInst *yield_resume_switch_;
 
     llvm::BasicBlock *bail_to_interpreter_block_;
@@ -410,6 +519,21 @@ private:
     // Stores information about the stack top for every opcode
     std::vector<int> stack_info_;
     int stack_top_;
+    // The number of opcode arguments passed to SetOpcodeArgsWithGuard()
+    // that are still on the stack until BeginOpcodeImpl().
+    int guarded_args_;
+
+    // See UnboxedValue.  unboxed_stack_ is indexed by absolute stack slot;
+    // entries at or above the current stack top are stale.
+    std::vector<UnboxedValue> unboxed_stack_;
+    std::vector<UnboxedValue> unboxed_locals_;
+    // True if any entry in unboxed_stack_ may be in use.
+    bool have_unboxed_stack_;
+
+    // Boxes the virtual stack slots below the current stack top into the
+    // stack, without changing what we know about them.  Used on the way
+    // out to the interpreter.
+    void StoreUnboxedValuesToStack();
 
     // True if something went wrong and we need to stop compilation without
     // aborting the process. If this is true, a Python error has already
@@ -417,6 +541,8 @@ private:
     bool error_;
 
     const bool is_generator_;
+    const bool supports_osr_;
+    const bool counts_hotness_;
     bool uses_delete_fast_;
 };
 
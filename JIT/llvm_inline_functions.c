@@ -731,6 +731,66 @@ _PyLlvm_StoreSubscr_List(PyObject *o, PyObject *key, PyObject *value)
     return 0;
 }
 
+/* FOR_ITER over a list or tuple iterator.  Like listiter_next() and
+   tupleiter_next(), these return NULL without setting an exception once
+   the iterator is exhausted.  The caller has checked iter's type. */
+PyObject * __attribute__((always_inline))
+_PyLlvm_ListIter_Next(PyObject *iter)
+{
+    PyListIterObject *it = (PyListIterObject *)iter;
+    PyListObject *seq = it->it_seq;
+    PyObject *item;
+
+    if (seq == NULL)
+        return NULL;
+    if (it->it_index < PyList_GET_SIZE(seq)) {
+        item = PyList_GET_ITEM(seq, it->it_index);
+        ++it->it_index;
+        Py_INCREF(item);
+        return item;
+    }
+    it->it_seq = NULL;
+    Py_DECREF(seq);
+    return NULL;
+}
+
+PyObject * __attribute__((always_inline))
+_PyLlvm_TupleIter_Next(PyObject *iter)
+{
+    PyTupleIterObject *it = (PyTupleIterObject *)iter;
+    PyTupleObject *seq = it->it_seq;
+    PyObject *item;
+
+    if (seq == NULL)
+        return NULL;
+    if (it->it_index < PyTuple_GET_SIZE(seq)) {
+        item = PyTuple_GET_ITEM(seq, it->it_index);
+        ++it->it_index;
+        Py_INCREF(item);
+        return item;
+    }
+    it->it_seq = NULL;
+    Py_DECREF(seq);
+    return NULL;
+}
+
+/* FOR_ITER over an xrange iterator, split in two so the JIT can keep the
+   next value unboxed.  Call _PyLlvm_RangeIter_Next() only if
+   _PyLlvm_RangeIter_Done() returned false. */
+int __attribute__((always_inline))
+_PyLlvm_RangeIter_Done(PyObject *iter)
+{
+    PyRangeIterObject *it = (PyRangeIterObject *)iter;
+    return it->index >= it->len;
+}
+
+long __attribute__((always_inline))
+_PyLlvm_RangeIter_Next(PyObject *iter)
+{
+    PyRangeIterObject *it = (PyRangeIterObject *)iter;
+    return it->start + (it->index++) * it->step;
+}
+
 PyObject * __attribute__((always_inline))
 _PyLlvm_BinLt_Int(PyObject *v, PyObject *w)
 {
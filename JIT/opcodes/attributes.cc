@@ -28,8 +28,9 @@ class AccessAttrStats {
 public:
     AccessAttrStats()
         : loads(0), stores(0), optimized_loads(0), optimized_stores(0),
-          no_opt_no_data(0), no_opt_no_mcache(0), no_opt_overrode_access(0),
-          no_opt_polymorphic(0), no_opt_nonstring_name(0) {
+          optimized_polymorphic(0), uncached_types(0), no_opt_no_data(0),
+          no_opt_no_mcache(0), no_opt_overrode_access(0),
+          no_opt_megamorphic(0), no_opt_nonstring_name(0) {
     }
 
     ~AccessAttrStats() {
@@ -43,12 +44,16 @@ public:
         errs() << "STORE_ATTR opcodes: " << this->stores << "\n";
         errs() << "Optimized STORE_ATTR opcodes: "
                << this->optimized_stores << "\n";
+        errs() << "Optimized polymorphic opcodes: "
+               << this->optimized_polymorphic << "\n";
+        errs() << "Types left to the generic path: "
+               << this->uncached_types << "\n";
         errs() << "No opt: no data: " << this->no_opt_no_data << "\n";
         errs() << "No opt: no mcache support: "
                << this->no_opt_no_mcache << "\n";
         errs() << "No opt: overrode getattr: "
                << this->no_opt_overrode_access << "\n";
-        errs() << "No opt: polymorphic: " << this->no_opt_polymorphic << "\n";
+        errs() << "No opt: megamorphic: " << this->no_opt_megamorphic << "\n";
         errs() << "No opt: non-string name: "
                << this->no_opt_nonstring_name << "\n";
     }
@@ -61,6 +66,11 @@ public:
     unsigned optimized_loads;
     // Number of stores we optimized.
     unsigned optimized_stores;
+    // Number of optimized loads and stores that cache more than one type.
+    unsigned optimized_polymorphic;
+    // Number of types seen at optimized opcodes that we couldn't cache, and
+    // so go through the generic path.
+    unsigned uncached_types;
     // Number of opcodes we were unable to optimize due to missing data.
     unsigned no_opt_no_data;
     // Number of opcodes we were unable to optimize because the type didn't
@@ -69,8 +79,9 @@ public:
     // Number of opcodes we were unable to optimize because the type overrode
     // tp_getattro.
     unsigned no_opt_overrode_access;
-    // Number of opcodes we were unable to optimize due to polymorphism.
-    unsigned no_opt_polymorphic;
+    // Number of opcodes we were unable to optimize because they saw more
+    // types than an AttributeCache holds.
+    unsigned no_opt_megamorphic;
     // Number of opcodes we were unable to optimize because the attribute name
     // was not a string.
     unsigned no_opt_nonstring_name;
@@ -80,20 +91,26 @@ static llvm::ManagedStatic<AccessAttrStats> access_attr_stats;
 
 class MethodStats {
 public:
+    MethodStats() : total(0), known(0), polymorphic(0), unknown(0) {}
+
     ~MethodStats() {
         errs() << "\nLOAD/CALL_METHOD optimization:\n";
         errs() << "Total load opcodes: " << this->total << "\n";
         errs() << "Optimized opcodes: "
                << (this->known + this->unknown) << "\n";
         errs() << "Predictable methods: " << this->known << "\n";
+        errs() << "Predictable methods, polymorphic: "
+               << this->polymorphic << "\n";
         errs() << "Unpredictable methods: " << this->unknown << "\n";
     }
 
     // Total number of LOAD_METHOD opcodes compiled.
     unsigned total;
-    // Number of monomorphic method call sites.
+    // Number of method call sites with cached methods.
     unsigned known;
-    // Number of polymorphic method call sites that were still optimized.
+    // Number of those that cache more than one type.
+    unsigned polymorphic;
+    // Number of method call sites optimized without looking at types.
     unsigned unknown;
 };
 
@@ -145,10 +162,10 @@ OpcodeAttributes::LOAD_ATTR_fast(int names_index)
 {
     PyObject *name =
         PyTuple_GET_ITEM(this->fbuilder_->code_object()->co_names, names_index);
-    AttributeAccessor accessor(this->fbuilder_, name, ATTR_ACCESS_LOAD);
+    AttributeCache cache(this->fbuilder_, name, ATTR_ACCESS_LOAD);
 
     // Check that we can optimize this load.
-    if (!accessor.CanOptimizeAttrAccess()) {
+    if (!cache.CanOptimizeAttrAccess()) {
         return false;
     }
     ACCESS_ATTR_INC_STATS(optimized_loads);
@@ -157,33 +174,62 @@ OpcodeAttributes::LOAD_ATTR_fast(int names_index)
 
     // Emit the appropriate guards.
     Value *obj_v = this->fbuilder_->GetOpcodeArg(0);
-    BasicBlock *do_load = this->state_->CreateBasicBlock("LOAD_ATTR_do_load");
-    accessor.GuardAttributeAccess(obj_v, do_load);
+    llvm::SmallVector<BasicBlock*, AttributeCache::MAX_ENTRIES> do_loads;
+    for (size_t i = 0; i < cache.entries_.size(); ++i) {
+        do_loads.push_back(
+            this->state_->CreateBasicBlock("LOAD_ATTR_do_load"));
+    }
+    BasicBlock *generic_load =
+        this->state_->CreateBasicBlock("LOAD_ATTR_generic_load");
+    BasicBlock *done = this->state_->CreateBasicBlock("LOAD_ATTR_done");
+    cache.GuardAttributeAccess(obj_v, do_loads, generic_load);
+
+    Value *result_addr = this->state_->CreateAllocaInEntryBlock(
+        PyTypeBuilder<PyObject *>::get(this->fbuilder_->context()),
+        NULL, "LOAD_ATTR_result_addr");
 
     // Call the inline function that deals with the lookup.  LLVM propagates
     // these constant arguments through the body of the function.
-    this->builder_.SetInsertPoint(do_load);
-    this->fbuilder_->BeginOpcodeImpl();
     PyConstantMirror &mirror = llvm_data_->constant_mirror();
-    Value *descr_get_v = mirror.GetGlobalForFunctionPointer<descrgetfunc>(
-            (void*)accessor.descr_get_, "");
     Value *getattr_func = this->state_->GetGlobalFunction<
         PyObject *(PyObject *obj, PyTypeObject *type, PyObject *name,
                    long dictoffset, PyObject *descr, descrgetfunc descr_get,
                    char is_data_descr)>("_PyLlvm_Object_GenericGetAttr");
-    Value *args[] = {
-        obj_v,
-        accessor.guard_type_v_,
-        accessor.name_v_,
-        accessor.dictoffset_v_,
-        accessor.descr_v_,
-        descr_get_v,
-        accessor.is_data_descr_v_
-    };
-    Value *result = this->state_->CreateCall(getattr_func,
-                                             args, array_endof(args));
+    for (size_t i = 0; i < cache.entries_.size(); ++i) {
+        const AttributeAccessor &accessor = cache.entries_[i];
+        this->builder_.SetInsertPoint(do_loads[i]);
+        this->fbuilder_->BeginOpcodeImpl();
+        Value *descr_get_v = mirror.GetGlobalForFunctionPointer<descrgetfunc>(
+                (void*)accessor.descr_get_, "");
+        Value *args[] = {
+            obj_v,
+            accessor.guard_type_v_,
+            accessor.name_v_,
+            accessor.dictoffset_v_,
+            accessor.descr_v_,
+            descr_get_v,
+            accessor.is_data_descr_v_
+        };
+        Value *result = this->state_->CreateCall(getattr_func,
+                                                 args, array_endof(args));
+        this->builder_.CreateStore(result, result_addr);
+        this->builder_.CreateBr(done);
+    }
+
+    // Any other type gets what LOAD_ATTR_safe would do.
+    this->builder_.SetInsertPoint(generic_load);
+    this->fbuilder_->BeginOpcodeImpl();
+    Function *pyobj_getattr = this->state_->GetGlobalFunction<
+        PyObject *(PyObject *, PyObject *)>("PyObject_GetAttr");
+    Value *generic_result = this->state_->CreateCall(
+        pyobj_getattr, obj_v, this->fbuilder_->LookupName(names_index),
+        "LOAD_ATTR_generic_result");
+    this->builder_.CreateStore(generic_result, result_addr);
+    this->builder_.CreateBr(done);
 
     // Put the result on the stack and possibly propagate an exception.
+    this->builder_.SetInsertPoint(done);
+    Value *result = this->builder_.CreateLoad(result_addr, "LOAD_ATTR_result");
     this->state_->DecRef(obj_v);
     this->fbuilder_->PropagateExceptionOnNull(result);
     this->fbuilder_->SetOpcodeResult(0, result);
@@ -219,10 +265,10 @@ OpcodeAttributes::STORE_ATTR_fast(int names_index)
 {
     PyObject *name =
         PyTuple_GET_ITEM(this->fbuilder_->code_object()->co_names, names_index);
-    AttributeAccessor accessor(this->fbuilder_, name, ATTR_ACCESS_STORE);
+    AttributeCache cache(this->fbuilder_, name, ATTR_ACCESS_STORE);
 
     // Check that we can optimize this store.
-    if (!accessor.CanOptimizeAttrAccess()) {
+    if (!cache.CanOptimizeAttrAccess()) {
         return false;
     }
     ACCESS_ATTR_INC_STATS(optimized_stores);
@@ -232,34 +278,63 @@ OpcodeAttributes::STORE_ATTR_fast(int names_index)
     // Emit appropriate guards.
     Value *val_v = this->fbuilder_->GetOpcodeArg(0);
     Value *obj_v = this->fbuilder_->GetOpcodeArg(1);
-    BasicBlock *do_store =
-      this->state_->CreateBasicBlock("STORE_ATTR_do_store");
-    accessor.GuardAttributeAccess(obj_v, do_store);
+    llvm::SmallVector<BasicBlock*, AttributeCache::MAX_ENTRIES> do_stores;
+    for (size_t i = 0; i < cache.entries_.size(); ++i) {
+        do_stores.push_back(
+            this->state_->CreateBasicBlock("STORE_ATTR_do_store"));
+    }
+    BasicBlock *generic_store =
+        this->state_->CreateBasicBlock("STORE_ATTR_generic_store");
+    BasicBlock *done = this->state_->CreateBasicBlock("STORE_ATTR_done");
+    cache.GuardAttributeAccess(obj_v, do_stores, generic_store);
+
+    Value *result_addr = this->state_->CreateAllocaInEntryBlock(
+        PyTypeBuilder<int>::get(this->fbuilder_->context()),
+        NULL, "STORE_ATTR_result_addr");
 
     // Call the inline function that deals with the lookup.  LLVM propagates
     // these constant arguments through the body of the function.
-    this->builder_.SetInsertPoint(do_store);
-    this->fbuilder_->BeginOpcodeImpl();
     PyConstantMirror &mirror = llvm_data_->constant_mirror();
-    Value *descr_set_v = mirror.GetGlobalForFunctionPointer<descrsetfunc>(
-        (void*)accessor.descr_set_, "");
     Value *setattr_func = this->state_->GetGlobalFunction<
         int (PyObject *obj, PyObject *val, PyTypeObject *type, PyObject *name,
              long dictoffset, PyObject *descr, descrsetfunc descr_set,
              char is_data_descr)>("_PyLlvm_Object_GenericSetAttr");
-    Value *args[] = {
-        obj_v,
-        val_v,
-        accessor.guard_type_v_,
-        accessor.name_v_,
-        accessor.dictoffset_v_,
-        accessor.descr_v_,
-        descr_set_v,
-        accessor.is_data_descr_v_
-    };
-    Value *result = this->state_->CreateCall(setattr_func, args,
-                                             array_endof(args));
+    for (size_t i = 0; i < cache.entries_.size(); ++i) {
+        const AttributeAccessor &accessor = cache.entries_[i];
+        this->builder_.SetInsertPoint(do_stores[i]);
+        this->fbuilder_->BeginOpcodeImpl();
+        Value *descr_set_v = mirror.GetGlobalForFunctionPointer<descrsetfunc>(
+            (void*)accessor.descr_set_, "");
+        Value *args[] = {
+            obj_v,
+            val_v,
+            accessor.guard_type_v_,
+            accessor.name_v_,
+            accessor.dictoffset_v_,
+            accessor.descr_v_,
+            descr_set_v,
+            accessor.is_data_descr_v_
+        };
+        Value *result = this->state_->CreateCall(setattr_func, args,
+                                                 array_endof(args));
+        this->builder_.CreateStore(result, result_addr);
+        this->builder_.CreateBr(done);
+    }
 
+    // Any other type gets what STORE_ATTR_safe would do.
+    this->builder_.SetInsertPoint(generic_store);
+    this->fbuilder_->BeginOpcodeImpl();
+    Function *pyobj_setattr = this->state_->GetGlobalFunction<
+        int(PyObject *, PyObject *, PyObject *)>("PyObject_SetAttr");
+    Value *generic_result = this->state_->CreateCall(
+        pyobj_setattr, obj_v, this->fbuilder_->LookupName(names_index), val_v,
+        "STORE_ATTR_generic_result");
+    this->builder_.CreateStore(generic_result, result_addr);
+    this->builder_.CreateBr(done);
+
+    this->builder_.SetInsertPoint(done);
+    Value *result = this->builder_.CreateLoad(result_addr,
+                                              "STORE_ATTR_result");
     this->state_->DecRef(obj_v);
     this->state_->DecRef(val_v);
     this->fbuilder_->PropagateExceptionOnNonZero(result);
@@ -360,64 +435,102 @@ OpcodeAttributes::LOAD_METHOD_known(int names_index)
     // Do an optimized LOAD_ATTR with the optimized LOAD_METHOD.
     PyObject *name =
         PyTuple_GET_ITEM(this->fbuilder_->code_object()->co_names, names_index);
-    AttributeAccessor accessor(this->fbuilder_, name, ATTR_ACCESS_LOAD);
+    AttributeCache cache(this->fbuilder_, name, ATTR_ACCESS_LOAD);
 
     // Check that we can optimize this load.
-    if (!accessor.CanOptimizeAttrAccess()) {
+    if (!cache.CanOptimizeAttrAccess()) {
         return false;
     }
 
-    // Check that the descriptor is in fact a method.  The only way this could
-    // fail is if between recording feedback and optimizing this code, the type
-    // is modified and the method replaced.
-    if (!_PyObject_ShouldBindMethod((PyObject*)accessor.guard_type_,
-                                    accessor.descr_)) {
+    // Check that the descriptors are in fact methods.  The only way this
+    // could fail is if between recording feedback and optimizing this code,
+    // a type is modified and the method replaced.  Such types get the same
+    // treatment as types we haven't seen.
+    AttributeCache::EntryList &entries = cache.entries_;
+    for (AttributeCache::EntryList::iterator it = entries.begin();
+         it != entries.end();) {
+        if (_PyObject_ShouldBindMethod((PyObject*)it->guard_type_,
+                                       it->descr_)) {
+            ++it;
+        } else {
+            it = entries.erase(it);
+        }
+    }
+    if (entries.empty()) {
         return false;
     }
 
     METHOD_INC_STATS(known);
+    if (entries.size() > 1) {
+        METHOD_INC_STATS(polymorphic);
+    }
     ACCESS_ATTR_INC_STATS(optimized_loads);
 
     this->fbuilder_->SetOpcodeArgsWithGuard(1);
 
     // Emit the appropriate guards.
     Value *obj_v = this->fbuilder_->GetOpcodeArg(0);
-    BasicBlock *do_load = state_->CreateBasicBlock("LOAD_METHOD_do_load");
-    accessor.GuardAttributeAccess(obj_v, do_load);
+    llvm::SmallVector<BasicBlock*, AttributeCache::MAX_ENTRIES> do_loads;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        do_loads.push_back(state_->CreateBasicBlock("LOAD_METHOD_do_load"));
+    }
+    BasicBlock *unknown_load =
+        state_->CreateBasicBlock("LOAD_METHOD_unknown_load");
+    BasicBlock *push_result =
+        state_->CreateBasicBlock("LOAD_METHOD_push_result");
+    cache.GuardAttributeAccess(obj_v, do_loads, unknown_load);
+
+    Value *method_addr = state_->CreateAllocaInEntryBlock(
+        PyTypeBuilder<PyObject *>::get(this->fbuilder_->context()),
+        NULL, "LOAD_METHOD_method_addr");
 
     // Call the inline function that deals with the lookup.  LLVM propagates
-    // these constant arguments through the body of the function.
-    this->builder_.SetInsertPoint(do_load);
+    // these constant arguments through the body of the function.  We bail
+    // if it returns NULL.
     Value *getattr_func = state_->GetGlobalFunction<
         PyObject *(PyObject *obj, PyTypeObject *tp, PyObject *name,
                    long dictoffset, PyObject *method)>(
                            "_PyLlvm_Object_GetKnownMethod");
-    Value *args[] = {
-        obj_v,
-        accessor.guard_type_v_,
-        accessor.name_v_,
-        accessor.dictoffset_v_,
-        accessor.descr_v_,
-    };
-    Value *method_v = state_->CreateCall(getattr_func, args, array_endof(args));
-
-    // Bail if method_v is NULL.
-    BasicBlock *push_result =
-        state_->CreateBasicBlock("LOAD_METHOD_push_result");
-    this->builder_.CreateCondBr(state_->IsNull(method_v),
-                                     accessor.bail_block_, push_result);
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const AttributeAccessor &accessor = entries[i];
+        this->builder_.SetInsertPoint(do_loads[i]);
+        Value *args[] = {
+            obj_v,
+            accessor.guard_type_v_,
+            accessor.name_v_,
+            accessor.dictoffset_v_,
+            accessor.descr_v_,
+        };
+        Value *method_v =
+            state_->CreateCall(getattr_func, args, array_endof(args));
+        this->builder_.CreateStore(method_v, method_addr);
+        this->builder_.CreateCondBr(state_->IsNull(method_v),
+                                    cache.bail_block_, push_result);
+    }
+
+    // Any other type gets what LOAD_METHOD_unknown would do.
+    this->builder_.SetInsertPoint(unknown_load);
+    Value *unknown_func = state_->GetGlobalFunction<
+        PyObject *(PyObject *obj, PyObject *name)>(
+                "_PyLlvm_Object_GetUnknownMethod");
+    Value *unknown_method_v = state_->CreateCall(
+        unknown_func, obj_v, state_->EmbedPointer<PyObject*>(name));
+    this->builder_.CreateStore(unknown_method_v, method_addr);
+    this->builder_.CreateCondBr(state_->IsNull(unknown_method_v),
+                                cache.bail_block_, push_result);
 
     // Put the method and self on the stack.  We bail instead of raising
     // exceptions.
     this->builder_.SetInsertPoint(push_result);
     this->fbuilder_->BeginOpcodeImpl();
+    Value *method_v = this->builder_.CreateLoad(method_addr, "LOAD_METHOD_method");
     this->fbuilder_->SetOpcodeResult(0, method_v);
     this->fbuilder_->SetOpcodeResult(1, obj_v);
     return true;
 }
 
 bool
-AttributeAccessor::CanOptimizeAttrAccess()
+AttributeCache::CanOptimizeAttrAccess()
 {
     // Only optimize string attribute loads.  This leaves unicode hanging for
     // now, but most objects are still constructed with string objects.  If it
@@ -427,7 +540,7 @@ AttributeAccessor::CanOptimizeAttrAccess()
         return false;
     }
 
-    // Only optimize monomorphic load sites with data.
+    // Only optimize load sites with data that have seen a handful of types.
     const PyRuntimeFeedback *feedback = this->fbuilder_->GetFeedback();
     if (feedback == NULL) {
         ACCESS_ATTR_INC_STATS(no_opt_no_data);
@@ -435,25 +548,89 @@ AttributeAccessor::CanOptimizeAttrAccess()
     }
 
     if (feedback->ObjectsOverflowed()) {
-        ACCESS_ATTR_INC_STATS(no_opt_polymorphic);
+        ACCESS_ATTR_INC_STATS(no_opt_megamorphic);
         return false;
     }
     llvm::SmallVector<PyObject*, 3> types_seen;
     feedback->GetSeenObjectsInto(types_seen);
-    if (types_seen.size() != 1) {
-        ACCESS_ATTR_INC_STATS(no_opt_polymorphic);
+    if (types_seen.empty()) {
+        ACCESS_ATTR_INC_STATS(no_opt_no_data);
+        return false;
+    }
+    if (types_seen.size() > MAX_ENTRIES) {
+        ACCESS_ATTR_INC_STATS(no_opt_megamorphic);
         return false;
     }
 
+    // Types we can't optimize are left to the generic path along with the
+    // ones we haven't seen.
+    for (size_t i = 0; i < types_seen.size(); ++i) {
+        assert(PyType_Check(types_seen[i]));
+        AttributeAccessor accessor(this->fbuilder_, this->name_,
+                                   this->access_kind_);
+        if (accessor.CanOptimizeAttrAccess((PyTypeObject*)types_seen[i])) {
+            this->entries_.push_back(accessor);
+        } else {
+            ACCESS_ATTR_INC_STATS(uncached_types);
+        }
+    }
+    if (this->entries_.empty()) {
+        return false;
+    }
+    if (this->entries_.size() > 1) {
+        ACCESS_ATTR_INC_STATS(optimized_polymorphic);
+    }
+    return true;
+}
+
+void
+AttributeCache::GuardAttributeAccess(
+    Value *obj_v, const llvm::SmallVectorImpl<BasicBlock*> &hits,
+    BasicBlock *miss)
+{
+    LlvmFunctionBuilder *fbuilder = this->fbuilder_;
+    BuilderT &builder = fbuilder->builder();
+    LlvmFunctionState *state = fbuilder->state();
+    assert(hits.size() == this->entries_.size());
+
+    BasicBlock *bail_block = state->CreateBasicBlock("ATTR_bail_block");
+    BasicBlock *guard_type = state->CreateBasicBlock("ATTR_check_valid");
+    this->bail_block_ = bail_block;
+
+    // Make sure that the code object is still valid.  This may fail if the
+    // code object is invalidated inside of a call to the code object.
+    builder.CreateCondBr(fbuilder->GetMachineCodeValidCond(),
+                         guard_type, bail_block);
+
+    // Compare ob_type against each cached type in turn.
+    builder.SetInsertPoint(guard_type);
+    Value *type_v = builder.CreateLoad(ObjectTy::ob_type(builder, obj_v));
+    for (size_t i = 0; i < this->entries_.size(); ++i) {
+        bool last = (i + 1 == this->entries_.size());
+        BasicBlock *next_type =
+            last ? miss : state->CreateBasicBlock("ATTR_check_next_type");
+        this->entries_[i].GuardAttributeAccess(type_v, hits[i], next_type,
+                                               bail_block);
+        if (!last) {
+            builder.SetInsertPoint(next_type);
+        }
+    }
+
+    // Fill in the bail bb.
+    builder.SetInsertPoint(bail_block);
+    fbuilder->CreateGuardBailPoint(_PYGUARD_ATTR);
+}
+
+bool
+AttributeAccessor::CanOptimizeAttrAccess(PyTypeObject *type)
+{
     // During the course of the compilation, we borrow a reference to the type
     // object from the feedback.  When compilation finishes, we listen for type
     // object modifications.  When a type object is freed, it notifies its
     // listeners, and the code object will be invalidated.  All other
     // references are borrowed from the type object, which cannot change
     // without invalidating the code.
-    PyObject *type_obj = types_seen[0];
-    assert(PyType_Check(type_obj));
-    PyTypeObject *type = this->guard_type_ = (PyTypeObject*)type_obj;
+    this->guard_type_ = type;
 
     // The type must support the method cache so we can listen for
     // modifications to it.
@@ -526,7 +703,9 @@ AttributeAccessor::MakeLlvmValues()
 }
 
 void
-AttributeAccessor::GuardAttributeAccess(Value *obj_v, BasicBlock *do_access)
+AttributeAccessor::GuardAttributeAccess(Value *type_v, BasicBlock *do_access,
+                                        BasicBlock *type_miss,
+                                        BasicBlock *bail_block)
 {
     LlvmFunctionBuilder *fbuilder = this->fbuilder_;
     BuilderT &builder = this->fbuilder_->builder();
@@ -538,23 +717,15 @@ AttributeAccessor::GuardAttributeAccess(Value *obj_v, BasicBlock *do_access)
     fbuilder->WatchType(this->guard_type_);
     this->MakeLlvmValues();
 
-    BasicBlock *bail_block = state->CreateBasicBlock("ATTR_bail_block");
-    BasicBlock *guard_type = state->CreateBasicBlock("ATTR_check_valid");
     BasicBlock *guard_descr = state->CreateBasicBlock("ATTR_check_descr");
     this->bail_block_ = bail_block;
 
-    // Make sure that the code object is still valid.  This may fail if the
-    // code object is invalidated inside of a call to the code object.
-    builder.CreateCondBr(fbuilder->GetUseJitCond(), guard_type, bail_block);
-
-    // Compare ob_type against type and bail if it's the wrong type.  Since
-    // we've subscribed to the type object for modification updates, the code
-    // will be invalidated before the type object is freed.  Therefore we don't
-    // need to incref it, or any of its members.
-    builder.SetInsertPoint(guard_type);
-    Value *type_v = builder.CreateLoad(ObjectTy::ob_type(builder, obj_v));
+    // Compare ob_type against type and try the next one if it's the wrong
+    // type.  Since we've subscribed to the type object for modification
+    // updates, the code will be invalidated before the type object is freed.
+    // Therefore we don't need to incref it, or any of its members.
     Value *is_right_type = builder.CreateICmpEQ(type_v, this->guard_type_v_);
-    builder.CreateCondBr(is_right_type, guard_descr, bail_block);
+    builder.CreateCondBr(is_right_type, guard_descr, type_miss);
 
     // If there is a descriptor, we need to guard on the descriptor type.  This
     // means emitting one more guard as well as subscribing to changes in the
@@ -572,10 +743,6 @@ AttributeAccessor::GuardAttributeAccess(Value *obj_v, BasicBlock *do_access)
     } else {
         builder.CreateBr(do_access);
     }
-
-    // Fill in the bail bb.
-    builder.SetInsertPoint(bail_block);
-    fbuilder->CreateGuardBailPoint(_PYGUARD_ATTR);
 }
 
 void
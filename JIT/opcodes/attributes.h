@@ -6,6 +6,7 @@
 #error This header expects to be included only in C++ source
 #endif
 
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/Support/IRBuilder.h"
 #include "llvm/Support/TargetFolder.h"
 
@@ -31,9 +32,10 @@ enum AttrAccessKind {
 };
 
 // This class encapsulates the common data and code for doing optimized
-// attribute access.  This object helps perform checks, generate guard
-// code, and register invalidation listeners when generating an optimized
-// LOAD_ATTR or STORE_ATTR opcode.
+// attribute access on one receiver type.  This object helps perform checks,
+// generate guard code, and register invalidation listeners when generating
+// an optimized LOAD_ATTR or STORE_ATTR opcode.  AttributeCache strings
+// several of these together for polymorphic sites.
 class AttributeAccessor {
 public:
     // Construct an attribute accessor object.  "name" is a reference to
@@ -60,14 +62,18 @@ public:
           bail_block_(0) { }
 
     // This helper method returns false if a LOAD_ATTR or STORE_ATTR opcode
-    // cannot be optimized.  If the opcode can be optimized, it fills in
-    // all of the fields of this object by reading the feedback from the
-    // code object.
-    bool CanOptimizeAttrAccess();
-
-    // This helper method emits the common type guards for an optimized
-    // LOAD_ATTR or STORE_ATTR.
-    void GuardAttributeAccess(llvm::Value *obj_v, llvm::BasicBlock *do_access);
+    // cannot be optimized for receivers of the given type.  If it can be
+    // optimized, it fills in all of the fields of this object by looking
+    // the attribute up on the type.
+    bool CanOptimizeAttrAccess(PyTypeObject *type);
+
+    // This helper method emits the guards for one type: if type_v, the
+    // receiver's type, is guard_type_, we branch to do_access, or to
+    // bail_block if the descriptor's type has changed.  Otherwise we branch
+    // to type_miss.
+    void GuardAttributeAccess(llvm::Value *type_v, llvm::BasicBlock *do_access,
+                              llvm::BasicBlock *type_miss,
+                              llvm::BasicBlock *bail_block);
 
     LlvmFunctionBuilder *fbuilder_;
     AttrAccessKind access_kind_;
@@ -121,6 +127,56 @@ private:
 };
 
 
+// A polymorphic inline cache for one LOAD_ATTR, STORE_ATTR or LOAD_METHOD
+// opcode.  It holds an AttributeAccessor for each receiver type the
+// feedback has seen, and the guards it emits try each of them in turn.
+// Receivers of any other type take the opcode's generic path, so a site
+// that sees a new type doesn't bail.
+//
+// Sites that have seen more than MAX_ENTRIES types are megamorphic, and we
+// don't specialize them at all.  The feedback remembers that they
+// overflowed when the code is invalidated (see
+// PyFeedbackMap::ClearKeepingMegamorphic()), so recompiling won't
+// specialize them again just because the new feedback hasn't overflowed
+// yet.
+class AttributeCache {
+public:
+    // PyLimitedFeedback holds at most three objects.
+    enum { MAX_ENTRIES = 3 };
+
+    AttributeCache(LlvmFunctionBuilder *fbuilder, PyObject *name,
+                   AttrAccessKind kind)
+        : fbuilder_(fbuilder),
+          access_kind_(kind),
+          name_(name),
+          bail_block_(0) { }
+
+    // Returns false if the opcode has no feedback, is megamorphic, or saw
+    // no type that we can optimize.  Otherwise fills in entries_.
+    bool CanOptimizeAttrAccess();
+
+    // Emits the guards for an optimized attribute access on obj_v.  We bail
+    // if the code object has been invalidated, and then branch to hits[i]
+    // if obj_v's type is entries_[i]'s, or to miss if it's none of them.
+    // Fills in bail_block_.
+    void GuardAttributeAccess(
+        llvm::Value *obj_v,
+        const llvm::SmallVectorImpl<llvm::BasicBlock*> &hits,
+        llvm::BasicBlock *miss);
+
+    typedef llvm::SmallVector<AttributeAccessor, MAX_ENTRIES> EntryList;
+
+    LlvmFunctionBuilder *fbuilder_;
+    AttrAccessKind access_kind_;
+    PyObject *name_;
+    EntryList entries_;
+    llvm::BasicBlock *bail_block_;
+
+private:
+    typedef llvm::IRBuilder<true, llvm::TargetFolder> BuilderT;
+};
+
+
 // This class includes all code related to access attributes.
 class OpcodeAttributes
 {
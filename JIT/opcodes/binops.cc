@@ -2,15 +2,22 @@
 
 #include "JIT/opcodes/binops.h"
 #include "JIT/llvm_fbuilder.h"
+#include "JIT/PyTypeBuilder.h"
 #include "Util/Instrumentation.h"
 
 #include "llvm/BasicBlock.h"
+#include "llvm/Constants.h"
+#include "llvm/DerivedTypes.h"
 #include "llvm/Function.h"
 #include "llvm/Instructions.h"
+#include "llvm/Intrinsics.h"
 #include "llvm/Support/ManagedStatic.h"
 
 using llvm::BasicBlock;
+using llvm::ConstantFP;
 using llvm::Function;
+using llvm::Intrinsic;
+using llvm::Type;
 using llvm::Value;
 using llvm::errs;
 
@@ -126,6 +133,104 @@ OpcodeBinops::OptimizedBinOp(const char *apifunc)
     this->fbuilder_->SetOpcodeResult(0, result);
 }
 
+bool
+OpcodeBinops::UnboxedBinOp(UnboxedOp op)
+{
+    typedef LlvmFunctionBuilder::UnboxedValue UnboxedValue;
+    UnboxedValue::Kind lhs_kind = this->fbuilder_->PredictUnboxedKind(1, 0);
+    UnboxedValue::Kind rhs_kind = this->fbuilder_->PredictUnboxedKind(0, 1);
+    bool is_float = (lhs_kind == UnboxedValue::FLOAT ||
+                     rhs_kind == UnboxedValue::FLOAT);
+    // Int division depends on -Qnew and on the signs of the operands, and
+    // int true division needs to round correctly; leave those to the
+    // generic code.
+    if (lhs_kind == UnboxedValue::NONE || rhs_kind == UnboxedValue::NONE ||
+        (op == UNBOXED_DIV && !is_float)) {
+        this->fbuilder_->MaterializeUnboxedValues();
+        return false;
+    }
+
+    BINOP_INC_STATS(optimized);
+    LlvmFunctionBuilder::BuilderT &builder = this->fbuilder_->builder();
+    BasicBlock *bailpoint =
+        this->state_->CreateBasicBlock("UNBOXED_BINOP_bail");
+
+    this->fbuilder_->SetOpcodeArgsWithGuard(2);
+    Value *lhs = this->fbuilder_->UnboxOpcodeArg(0, lhs_kind, bailpoint);
+    Value *rhs = this->fbuilder_->UnboxOpcodeArg(1, rhs_kind, bailpoint);
+
+    Value *result;
+    if (is_float) {
+        // Like float's convert_to_double().
+        const Type *double_type =
+            Type::getDoubleTy(this->fbuilder_->context());
+        if (lhs_kind == UnboxedValue::INT)
+            lhs = builder.CreateSIToFP(lhs, double_type);
+        if (rhs_kind == UnboxedValue::INT)
+            rhs = builder.CreateSIToFP(rhs, double_type);
+        switch (op) {
+        case UNBOXED_ADD:
+            result = builder.CreateFAdd(lhs, rhs, "unboxed_sum");
+            break;
+        case UNBOXED_SUB:
+            result = builder.CreateFSub(lhs, rhs, "unboxed_difference");
+            break;
+        case UNBOXED_MUL:
+            result = builder.CreateFMul(lhs, rhs, "unboxed_product");
+            break;
+        case UNBOXED_DIV: {
+            // Let the eval loop raise ZeroDivisionError.
+            BasicBlock *nonzero =
+                this->state_->CreateBasicBlock("UNBOXED_BINOP_nonzero");
+            builder.CreateCondBr(
+                builder.CreateFCmpOEQ(rhs, ConstantFP::get(double_type, 0.0)),
+                bailpoint, nonzero);
+            builder.SetInsertPoint(nonzero);
+            result = builder.CreateFDiv(lhs, rhs, "unboxed_quotient");
+            break;
+        }
+        }
+    } else {
+        Intrinsic::ID id;
+        switch (op) {
+        case UNBOXED_ADD:
+            id = Intrinsic::sadd_with_overflow;
+            break;
+        case UNBOXED_SUB:
+            id = Intrinsic::ssub_with_overflow;
+            break;
+        default:
+            id = Intrinsic::smul_with_overflow;
+            break;
+        }
+        const Type *long_type =
+            PyTypeBuilder<long>::get(this->fbuilder_->context());
+        Function *arith = Intrinsic::getDeclaration(
+            this->state_->module(), id, &long_type, 1);
+        Value *result_and_overflow =
+            this->state_->CreateCall(arith, lhs, rhs, "unboxed_result");
+        result = builder.CreateExtractValue(result_and_overflow, 0);
+        // On overflow, the eval loop will switch to longs.
+        BasicBlock *no_overflow =
+            this->state_->CreateBasicBlock("UNBOXED_BINOP_no_overflow");
+        builder.CreateCondBr(builder.CreateExtractValue(result_and_overflow, 1),
+                             bailpoint, no_overflow);
+        builder.SetInsertPoint(no_overflow);
+    }
+
+    BasicBlock *success = builder.GetInsertBlock();
+    builder.SetInsertPoint(bailpoint);
+    this->fbuilder_->CreateGuardBailPoint(_PYGUARD_BINOP);
+
+    builder.SetInsertPoint(success);
+    this->fbuilder_->DecRefOpcodeArg(0);
+    this->fbuilder_->DecRefOpcodeArg(1);
+    this->fbuilder_->BeginOpcodeImpl();
+    this->fbuilder_->SetUnboxedResult(
+        0, is_float ? UnboxedValue::FLOAT : UnboxedValue::INT, result);
+    return true;
+}
+
 #define BINOP_METH(OPCODE, APIFUNC)     \
 void                                    \
 OpcodeBinops::OPCODE()                  \
@@ -143,14 +248,38 @@ OpcodeBinops::OPCODE()                  \
     this->OptimizedBinOp(#APIFUNC);     \
 }
 
-BINOP_OPT(BINARY_ADD, PyNumber_Add)
-BINOP_OPT(BINARY_SUBTRACT, PyNumber_Subtract)
-BINOP_OPT(BINARY_MULTIPLY, PyNumber_Multiply)
-BINOP_OPT(BINARY_DIVIDE, PyNumber_Divide)
+// These try UnboxedBinOp() first.
+#define BINOP_UNBOXED_OPT(OPCODE, APIFUNC, UNBOXED_OP)  \
+void                                                    \
+OpcodeBinops::OPCODE()                                  \
+{                                                       \
+    BINOP_INC_STATS(total);                             \
+    if (this->UnboxedBinOp(UNBOXED_OP))                 \
+        return;                                         \
+    this->OptimizedBinOp(#APIFUNC);                     \
+}
+
+#define BINOP_UNBOXED_METH(OPCODE, APIFUNC, UNBOXED_OP) \
+void                                                    \
+OpcodeBinops::OPCODE()                                  \
+{                                                       \
+    BINOP_INC_STATS(total);                             \
+    if (this->UnboxedBinOp(UNBOXED_OP))                 \
+        return;                                         \
+    BINOP_INC_STATS(omitted);                           \
+    this->GenericBinOp(#APIFUNC);                       \
+}
+
+BINOP_UNBOXED_OPT(BINARY_ADD, PyNumber_Add, UNBOXED_ADD)
+BINOP_UNBOXED_OPT(BINARY_SUBTRACT, PyNumber_Subtract, UNBOXED_SUB)
+BINOP_UNBOXED_OPT(BINARY_MULTIPLY, PyNumber_Multiply, UNBOXED_MUL)
+BINOP_UNBOXED_OPT(BINARY_DIVIDE, PyNumber_Divide, UNBOXED_DIV)
+
 BINOP_OPT(BINARY_MODULO, PyNumber_Remainder)
 BINOP_OPT(BINARY_SUBSCR, PyObject_GetItem)
 
-BINOP_METH(BINARY_TRUE_DIVIDE, PyNumber_TrueDivide)
+BINOP_UNBOXED_METH(BINARY_TRUE_DIVIDE, PyNumber_TrueDivide, UNBOXED_DIV)
+
 BINOP_METH(BINARY_LSHIFT, PyNumber_Lshift)
 BINOP_METH(BINARY_RSHIFT, PyNumber_Rshift)
 BINOP_METH(BINARY_OR, PyNumber_Or)
@@ -158,11 +287,13 @@ BINOP_METH(BINARY_XOR, PyNumber_Xor)
 BINOP_METH(BINARY_AND, PyNumber_And)
 BINOP_METH(BINARY_FLOOR_DIVIDE, PyNumber_FloorDivide)
 
-BINOP_METH(INPLACE_ADD, PyNumber_InPlaceAdd)
-BINOP_METH(INPLACE_SUBTRACT, PyNumber_InPlaceSubtract)
-BINOP_METH(INPLACE_MULTIPLY, PyNumber_InPlaceMultiply)
-BINOP_METH(INPLACE_TRUE_DIVIDE, PyNumber_InPlaceTrueDivide)
-BINOP_METH(INPLACE_DIVIDE, PyNumber_InPlaceDivide)
+// Ints and floats don't have in-place operators.
+BINOP_UNBOXED_METH(INPLACE_ADD, PyNumber_InPlaceAdd, UNBOXED_ADD)
+BINOP_UNBOXED_METH(INPLACE_SUBTRACT, PyNumber_InPlaceSubtract, UNBOXED_SUB)
+BINOP_UNBOXED_METH(INPLACE_MULTIPLY, PyNumber_InPlaceMultiply, UNBOXED_MUL)
+BINOP_UNBOXED_METH(INPLACE_TRUE_DIVIDE, PyNumber_InPlaceTrueDivide,
+                   UNBOXED_DIV)
+BINOP_UNBOXED_METH(INPLACE_DIVIDE, PyNumber_InPlaceDivide, UNBOXED_DIV)
 BINOP_METH(INPLACE_MODULO, PyNumber_InPlaceRemainder)
 BINOP_METH(INPLACE_LSHIFT, PyNumber_InPlaceLshift)
 BINOP_METH(INPLACE_RSHIFT, PyNumber_InPlaceRshift)
@@ -173,6 +304,8 @@ BINOP_METH(INPLACE_FLOOR_DIVIDE, PyNumber_InPlaceFloorDivide)
 
 #undef BINOP_METH
 #undef BINOP_OPT
+#undef BINOP_UNBOXED_METH
+#undef BINOP_UNBOXED_OPT
 
 // PyNumber_Power() and PyNumber_InPlacePower() take three arguments, the
 // third should be Py_None when calling from BINARY_POWER/INPLACE_POWER.
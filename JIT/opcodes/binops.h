@@ -68,6 +68,14 @@ private:
     // GenericPowOp's is "PyObject *(*)(PyObject *, PyObject *, PyObject *)"
     void GenericPowOp(const char *apifunc);
 
+    // The arithmetic we know how to do on unboxed ints and floats.
+    enum UnboxedOp { UNBOXED_ADD, UNBOXED_SUB, UNBOXED_MUL, UNBOXED_DIV };
+    // If type feedback says the operands are ints or floats, computes op
+    // on their raw values and leaves the result unboxed; see
+    // LlvmFunctionBuilder::UnboxedValue.  Otherwise emits nothing, boxes
+    // any unboxed values on the stack, and returns false.
+    bool UnboxedBinOp(UnboxedOp op);
+
     LlvmFunctionBuilder *fbuilder_;
     LlvmFunctionState *state_;
 };
@@ -1,7 +1,10 @@
 #include "Python.h"
+#include "code.h"
+#include "frameobject.h"
 
 #include "JIT/ConstantMirror.h"
 #include "JIT/global_llvm_data.h"
+#include "JIT/llvm_compile.h"
 #include "JIT/llvm_fbuilder.h"
 #include "JIT/opcodes/call.h"
 
@@ -10,6 +13,7 @@
 #include "llvm/Instructions.h"
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 
 using llvm::BasicBlock;
 using llvm::Constant;
@@ -25,7 +29,8 @@ public:
     CallFunctionStats()
         : total(0), direct_calls(0), inlined(0),
           no_opt_kwargs(0), no_opt_params(0),
-          no_opt_no_data(0), no_opt_polymorphic(0) {
+          no_opt_no_data(0), no_opt_polymorphic(0),
+          no_opt_not_cfunc(0), no_opt_not_inlinable(0) {
     }
 
     ~CallFunctionStats() {
@@ -38,6 +43,8 @@ public:
         errs() << "No opt: not C function: " << this->no_opt_not_cfunc << "\n";
         errs() << "No opt: no data: " << this->no_opt_no_data << "\n";
         errs() << "No opt: polymorphic: " << this->no_opt_polymorphic << "\n";
+        errs() << "No opt: Python function not inlinable: "
+               << this->no_opt_not_inlinable << "\n";
     }
 
     // How many CALL_FUNCTION opcodes were compiled.
@@ -51,14 +58,14 @@ public:
     unsigned no_opt_kwargs;
     // We only optimize METH_ARG_RANGE functions so far.
     unsigned no_opt_params;
-    // We only optimize callsites where we've collected data. Note that since
-    // we record only PyCFunctions, any call to a Python function will show up
-    // as having no data.
+    // We only optimize callsites where we've collected data.
     unsigned no_opt_no_data;
     // We only optimize monomorphic callsites so far.
     unsigned no_opt_polymorphic;
-    // We only optimize direct calls to C functions.
+    // We only optimize direct calls to C functions...
     unsigned no_opt_not_cfunc;
+    // ... and calls to small Python functions we can inline.
+    unsigned no_opt_not_inlinable;
 };
 
 static llvm::ManagedStatic<CallFunctionStats> call_function_stats;
@@ -68,6 +75,17 @@ static llvm::ManagedStatic<CallFunctionStats> call_function_stats;
 #define CF_INC_STATS(field)
 #endif  /* Py_WITH_INSTRUMENTATION */
 
+// Python functions with more bytecode than this are never inlined.  This is
+// meant for accessors and other small helpers.
+static const Py_ssize_t MAX_INLINED_CODE_SIZE = 48;
+
+// Nonzero while we're generating IR to be inlined.  We don't inline calls
+// inside inlined code.  Protected by the GIL: every thread translates
+// bytecode to IR with the GIL held, compile threads included (see
+// JIT/compile_thread.h).  Each compile thread's compile lock only covers
+// its own PyGlobalLlvmData, so it wouldn't do.
+static int inlining_depth = 0;
+
 namespace py {
 
 OpcodeCall::OpcodeCall(LlvmFunctionBuilder *fbuilder) :
@@ -113,6 +131,9 @@ OpcodeCall::CALL_FUNCTION_fast(int oparg)
 
     PyMethodDef *func_record = fdo_data[0].second;
     PyTypeObject *type_record = (PyTypeObject *)fdo_data[0].first;
+    if (type_record == &PyFunction_Type) {
+        return this->CALL_FUNCTION_inline(oparg & 0xff);
+    }
     // We embed a pointer to type_record but we don't incref it because it can
     // only be PyCFunction_Type or PyMethodDescr_Type, which are statically
     // allocated anyway.
@@ -313,6 +334,194 @@ OpcodeCall::CALL_FUNCTION_fast(int oparg)
     return true;
 }
 
+PyCodeObject *
+OpcodeCall::GetInlinableCallee(int num_args)
+{
+    if (inlining_depth > 0)
+        return NULL;
+
+    // Feedback index 1 records the code of the Python functions called here.
+    const PyRuntimeFeedback *feedback = this->fbuilder_->GetFeedback(1);
+    if (feedback == NULL || feedback->ObjectsOverflowed())
+        return NULL;
+    llvm::SmallVector<PyObject *, 3> codes;
+    feedback->GetSeenObjectsInto(codes);
+    if (codes.size() != 1 || !PyCode_Check(codes[0]))
+        return NULL;
+    PyCodeObject *callee = (PyCodeObject *)codes[0];
+
+    if (callee == this->fbuilder_->code_object())
+        return NULL;
+    // We only handle the calls that fast_function() can make without
+    // PyEval_EvalCodeEx().
+    const int flags_required = CO_OPTIMIZED | CO_NEWLOCALS | CO_NOFREE;
+    const int flags_forbidden = CO_VARKEYWORDS | CO_VARARGS | CO_GENERATOR;
+    if ((callee->co_flags & (flags_required | flags_forbidden)) !=
+        flags_required)
+        return NULL;
+    if (callee->co_argcount != num_args)
+        return NULL;
+    // Only inline callees that are small and have proven themselves hot
+    // and stable enough to get machine code of their own.
+    if (PyString_GET_SIZE(callee->co_code) > MAX_INLINED_CODE_SIZE)
+        return NULL;
+    if (callee->co_native_function == NULL || !callee->co_use_jit ||
+        callee->co_fatalbailcount >= PY_MAX_FATALBAILCOUNT)
+        return NULL;
+    return callee;
+}
+
+bool
+OpcodeCall::CALL_FUNCTION_inline(int num_args)
+{
+    PyCodeObject *callee = this->GetInlinableCallee(num_args);
+    if (callee == NULL) {
+        CF_INC_STATS(no_opt_not_inlinable);
+        return false;
+    }
+
+    ++inlining_depth;
+    Function *callee_function = _PyCode_ToInlinableLlvmIr(callee);
+    --inlining_depth;
+    if (callee_function == NULL) {
+        // We can still call it the slow way.
+        PyErr_Clear();
+        CF_INC_STATS(no_opt_not_inlinable);
+        return false;
+    }
+
+    BasicBlock *check_code =
+        this->state_->CreateBasicBlock("CALL_FUNCTION_check_code");
+    BasicBlock *enter_frame =
+        this->state_->CreateBasicBlock("CALL_FUNCTION_enter_frame");
+    BasicBlock *inlined_call =
+        this->state_->CreateBasicBlock("CALL_FUNCTION_inlined_call");
+    BasicBlock *interpreted_call =
+        this->state_->CreateBasicBlock("CALL_FUNCTION_interpreted_call");
+    BasicBlock *call_done =
+        this->state_->CreateBasicBlock("CALL_FUNCTION_call_done");
+    BasicBlock *invalid_assumptions =
+        this->state_->CreateBasicBlock("CALL_FUNCTION_invalid_assumptions");
+
+    BasicBlock *current = this->builder_.GetInsertBlock();
+    this->builder_.SetInsertPoint(invalid_assumptions);
+    this->fbuilder_->CreateGuardBailPoint(_PYGUARD_PYFUNC);
+    this->builder_.SetInsertPoint(current);
+
+#ifdef WITH_TSC
+    this->state_->LogTscEvent(CALL_START_LLVM);
+#endif
+    Value *stack_pointer =
+        this->builder_.CreateLoad(this->fbuilder_->stack_pointer_addr());
+    llvm_data_->tbaa_stack.MarkInstruction(stack_pointer);
+    Value *actual_func = this->builder_.CreateLoad(
+        this->builder_.CreateGEP(
+            stack_pointer,
+            ConstantInt::getSigned(
+                Type::getInt64Ty(this->fbuilder_->context()),
+                -num_args - 1)));
+    Value *args = this->builder_.CreateGEP(
+        stack_pointer,
+        ConstantInt::getSigned(
+            Type::getInt64Ty(this->fbuilder_->context()), -num_args));
+    llvm::SmallVector<Value*, 8> arg_values;
+    for (int i = 0; i < num_args; ++i) {
+        arg_values.push_back(
+            this->builder_.CreateLoad(
+                this->builder_.CreateGEP(
+                    args,
+                    ConstantInt::getSigned(
+                        Type::getInt64Ty(this->fbuilder_->context()), i))));
+    }
+
+    // Make sure we're calling a function with the code we inlined.  The
+    // global variable keeps callee alive, so its address can't be reused.
+    Value *actual_type = this->builder_.CreateLoad(
+        ObjectTy::ob_type(this->builder_, actual_func));
+    this->builder_.CreateCondBr(
+        this->builder_.CreateICmpEQ(
+            actual_type,
+            this->state_->EmbedPointer<PyTypeObject*>(&PyFunction_Type)),
+        check_code, invalid_assumptions);
+
+    this->builder_.SetInsertPoint(check_code);
+    Value *actual_code = this->builder_.CreateLoad(
+        FunctionTy::func_code(
+            this->builder_,
+            this->builder_.CreateBitCast(
+                actual_func,
+                PyTypeBuilder<PyFunctionObject *>::get(
+                    this->fbuilder_->context()))));
+    Value *expected_code = this->builder_.CreateBitCast(
+        this->state_->GetGlobalVariableFor((PyObject *)callee),
+        PyTypeBuilder<PyObject *>::get(this->fbuilder_->context()));
+    this->builder_.CreateCondBr(
+        this->builder_.CreateICmpEQ(actual_code, expected_code),
+        enter_frame, invalid_assumptions);
+
+    // _PyEval_EnterInlinedFrame() decides whether the inlined code may run;
+    // if not, the frame goes to the interpreter.
+    this->builder_.SetInsertPoint(enter_frame);
+    Value *frame = this->state_->CreateCall(
+        this->state_->GetGlobalFunction<
+            PyFrameObject *(PyObject *, PyObject **)>(
+                "_PyEval_EnterInlinedFrame"),
+        actual_func, args, "CALL_FUNCTION_frame");
+    this->fbuilder_->PropagateExceptionOnNull(frame);
+    Value *result_addr = this->state_->CreateAllocaInEntryBlock(
+        PyTypeBuilder<PyObject *>::get(this->fbuilder_->context()),
+        NULL, "CALL_FUNCTION_result_addr");
+    Value *use_jit = this->builder_.CreateLoad(
+        FrameTy::f_use_jit(this->builder_, frame));
+    this->builder_.CreateCondBr(this->state_->IsNonZero(use_jit),
+                                inlined_call, interpreted_call);
+
+    this->builder_.SetInsertPoint(interpreted_call);
+    Value *interpreted_result = this->state_->CreateCall(
+        this->state_->GetGlobalFunction<PyObject *(PyFrameObject *)>(
+            "PyEval_EvalFrame"),
+        frame, "CALL_FUNCTION_interpreted_result");
+    this->builder_.CreateStore(interpreted_result, result_addr);
+    this->state_->CreateCall(
+        this->state_->GetGlobalFunction<void(PyFrameObject *)>(
+            "_PyEval_ReleaseInlinedFrame"),
+        frame);
+    this->builder_.CreateBr(call_done);
+
+    this->builder_.SetInsertPoint(inlined_call);
+    llvm::CallInst *inlined_result = this->state_->CreateCall(
+        callee_function, frame, "CALL_FUNCTION_inlined_result");
+    this->builder_.CreateStore(inlined_result, result_addr);
+    this->state_->CreateCall(
+        this->state_->GetGlobalFunction<void(PyFrameObject *)>(
+            "_PyEval_LeaveInlinedFrame"),
+        frame);
+    this->builder_.CreateBr(call_done);
+
+    this->builder_.SetInsertPoint(call_done);
+    if (llvm::InlineFunction(inlined_result)) {
+        callee_function->eraseFromParent();
+    } else {
+        // Leave it as an ordinary call to a private copy of the callee.
+        callee_function->setLinkage(llvm::GlobalValue::InternalLinkage);
+    }
+
+    Value *result = this->builder_.CreateLoad(result_addr);
+    this->state_->DecRef(actual_func);
+    for (int i = 0; i < num_args; ++i) {
+        this->state_->DecRef(arg_values[i]);
+    }
+    this->fbuilder_->SetOpcodeArguments(num_args + 1);
+    this->fbuilder_->PropagateExceptionOnNull(result);
+    this->fbuilder_->SetOpcodeResult(0, result);
+
+    // Check signals and maybe switch threads after each function call.
+    this->fbuilder_->CheckPyTicker();
+
+    CF_INC_STATS(inlined);
+    return true;
+}
+
 void
 OpcodeCall::CALL_FUNCTION_fast_len(Value *actual_func,
                                    Value *stack_pointer,
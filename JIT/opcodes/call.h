@@ -40,6 +40,15 @@ private:
     void CALL_FUNCTION_safe(int num_args);
     bool CALL_FUNCTION_fast(int num_args);
 
+    // Splices the IR for a small Python function into the call site, if
+    // feedback says this call site always calls the same code object and
+    // that code object is suitable.  Returns false, emitting nothing, if
+    // not.
+    bool CALL_FUNCTION_inline(int num_args);
+    // Returns the code object that CALL_FUNCTION_inline() should splice in,
+    // or NULL.
+    PyCodeObject *GetInlinableCallee(int num_args);
+
     // Specialized version of CALL_FUNCTION for len() on certain types.
     void CALL_FUNCTION_fast_len(llvm::Value *actual_func,
                                 llvm::Value *stack_pointer,
@@ -107,10 +107,86 @@ OpcodeCmpops::COMPARE_OP_fast(int cmp_op, const PyTypeObject *lhs_type,
     return true;
 }
 
+bool
+OpcodeCmpops::COMPARE_OP_unboxed(int cmp_op)
+{
+    typedef LlvmFunctionBuilder::UnboxedValue UnboxedValue;
+    UnboxedValue::Kind kind = this->fbuilder_->PredictUnboxedKind(1, 0);
+    if (kind == UnboxedValue::NONE ||
+        this->fbuilder_->PredictUnboxedKind(0, 1) != kind) {
+        return false;
+    }
+    switch (cmp_op) {
+    case PyCmp_EQ:
+    case PyCmp_NE:
+    case PyCmp_LT:
+    case PyCmp_LE:
+    case PyCmp_GT:
+    case PyCmp_GE:
+        break;
+    default:
+        return false;
+    }
+
+    CMPOP_INC_STATS(optimized);
+    BasicBlock *bailpoint =
+        this->state_->CreateBasicBlock("CMPOP_UNBOXED_bail");
+
+    this->fbuilder_->SetOpcodeArgsWithGuard(2);
+    Value *lhs = this->fbuilder_->UnboxOpcodeArg(0, kind, bailpoint);
+    Value *rhs = this->fbuilder_->UnboxOpcodeArg(1, kind, bailpoint);
+
+    // Floats compare false against NaN, except for !=.
+    Value *result;
+    bool is_int = kind == UnboxedValue::INT;
+    switch (cmp_op) {
+    case PyCmp_EQ:
+        result = is_int ? this->builder_.CreateICmpEQ(lhs, rhs)
+                        : this->builder_.CreateFCmpOEQ(lhs, rhs);
+        break;
+    case PyCmp_NE:
+        result = is_int ? this->builder_.CreateICmpNE(lhs, rhs)
+                        : this->builder_.CreateFCmpUNE(lhs, rhs);
+        break;
+    case PyCmp_LT:
+        result = is_int ? this->builder_.CreateICmpSLT(lhs, rhs)
+                        : this->builder_.CreateFCmpOLT(lhs, rhs);
+        break;
+    case PyCmp_LE:
+        result = is_int ? this->builder_.CreateICmpSLE(lhs, rhs)
+                        : this->builder_.CreateFCmpOLE(lhs, rhs);
+        break;
+    case PyCmp_GT:
+        result = is_int ? this->builder_.CreateICmpSGT(lhs, rhs)
+                        : this->builder_.CreateFCmpOGT(lhs, rhs);
+        break;
+    default:
+        result = is_int ? this->builder_.CreateICmpSGE(lhs, rhs)
+                        : this->builder_.CreateFCmpOGE(lhs, rhs);
+        break;
+    }
+
+    BasicBlock *success = this->builder_.GetInsertBlock();
+    this->builder_.SetInsertPoint(bailpoint);
+    this->fbuilder_->CreateBailPoint(_PYFRAME_GUARD_FAIL);
+
+    this->builder_.SetInsertPoint(success);
+    this->fbuilder_->DecRefOpcodeArg(0);
+    this->fbuilder_->DecRefOpcodeArg(1);
+    this->fbuilder_->BeginOpcodeImpl();
+    this->fbuilder_->SetUnboxedResult(0, UnboxedValue::BOOL, result);
+    return true;
+}
+
 void
 OpcodeCmpops::COMPARE_OP(int cmp_op)
 {
     CMPOP_INC_STATS(total);
+    if (this->COMPARE_OP_unboxed(cmp_op)) {
+        return;
+    }
+    this->fbuilder_->MaterializeUnboxedValues();
+
     const PyTypeObject *lhs_type = this->fbuilder_->GetTypeFeedback(0);
     const PyTypeObject *rhs_type = this->fbuilder_->GetTypeFeedback(1);
     if (lhs_type != NULL && rhs_type != NULL) {
@@ -176,13 +252,11 @@ OpcodeCmpops::COMPARE_OP_safe(int cmp_op)
         Py_FatalError("unknown COMPARE_OP oparg");
         return;  // Not reached.
     }
-    Value *value = this->builder_.CreateSelect(
-        result,
-        this->state_->GetGlobalVariableFor((PyObject*)&_Py_TrueStruct),
-        this->state_->GetGlobalVariableFor((PyObject*)&_Py_ZeroStruct),
-        "COMPARE_OP_result");
-    this->state_->IncRef(value);
-    this->fbuilder_->SetOpcodeResult(0, value);
+    // Leave the i1 on the stack.  A POP_JUMP_IF_* right after us branches
+    // on it directly, so "x is None" or "k in d" in a condition never
+    // touches Py_True or Py_False; anything else gets a box.
+    this->fbuilder_->SetUnboxedResult(
+        0, LlvmFunctionBuilder::UnboxedValue::BOOL, result);
 }
 
 void
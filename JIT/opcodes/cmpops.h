@@ -33,6 +33,10 @@ private:
                          const PyTypeObject *lhs_type,
                          const PyTypeObject *rhs_type);
     void COMPARE_OP_safe(int cmp_op);
+    // Compares two ints or two floats without boxing them, leaving an
+    // unboxed bool on the stack.  Returns false, emitting nothing, if type
+    // feedback doesn't say that's safe.
+    bool COMPARE_OP_unboxed(int cmp_op);
 
     // Call PyObject_RichCompare(lhs, rhs, cmp_op), pushing the result
     // onto the stack. cmp_op is one of Py_EQ, Py_NE, Py_LT, Py_LE, Py_GT
@@ -10,6 +10,8 @@
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <vector>
+
 using llvm::BasicBlock;
 using llvm::ConstantInt;
 using llvm::Function;
@@ -39,8 +41,31 @@ public:
 static llvm::ManagedStatic<ImportNameStats> import_name_stats;
 
 #define IMPORT_NAME_INC_STATS(field) import_name_stats->field++
+
+class UnpackSequenceStats {
+public:
+    UnpackSequenceStats()
+        : total(0), built(0) {
+    }
+
+    ~UnpackSequenceStats() {
+        errs() << "\nUNPACK_SEQUENCE opcodes:\n";
+        errs() << "Total: " << this->total << "\n";
+        errs() << "Of sequences built just before: " << this->built << "\n";
+    }
+
+    // Total number of UNPACK_SEQUENCE opcodes compiled.
+    unsigned total;
+    // Number that unpacked a BUILD_TUPLE or BUILD_LIST we didn't allocate.
+    unsigned built;
+};
+
+static llvm::ManagedStatic<UnpackSequenceStats> unpack_sequence_stats;
+
+#define UNPACK_SEQUENCE_INC_STATS(field) unpack_sequence_stats->field++
 #else
 #define IMPORT_NAME_INC_STATS(field)
+#define UNPACK_SEQUENCE_INC_STATS(field)
 #endif  /* Py_WITH_INSTRUMENTATION */
 
 namespace py {
@@ -104,6 +129,7 @@ OpcodeContainer::BUILD_MAP(int size)
 void
 OpcodeContainer::UNPACK_SEQUENCE(int size)
 {
+    UNPACK_SEQUENCE_INC_STATS(total);
     // TODO(twouters): We could do even better by combining this opcode and the
     // STORE_* ones that follow into a single block of code circumventing the
     // stack altogether. And omitting the horrible external stack munging that
@@ -134,6 +160,26 @@ OpcodeContainer::UNPACK_SEQUENCE(int size)
                                this->fbuilder_->stack_pointer_addr());
 }
 
+void
+OpcodeContainer::UNPACK_BUILT_SEQUENCE(int size)
+{
+    UNPACK_SEQUENCE_INC_STATS(total);
+    UNPACK_SEQUENCE_INC_STATS(built);
+    // The items are still on the stack with the last one on top, and
+    // UNPACK_SEQUENCE would leave the first one on top.  Reference counts
+    // come out the same: the sequence would have stolen the stack's
+    // references, and unpacking it would have handed out new ones just
+    // before freeing it.
+    std::vector<Value*> items;
+    items.reserve(size);
+    for (int i = 0; i < size; ++i) {
+        items.push_back(this->fbuilder_->Pop());
+    }
+    for (int i = 0; i < size; ++i) {
+        this->fbuilder_->Push(items[i]);
+    }
+}
+
 #define INT_OBJ_OBJ_OBJ int(PyObject*, PyObject*, PyObject*)
 
 void
@@ -332,7 +378,7 @@ OpcodeContainer::IMPORT_NAME_fast()
     BasicBlock *invalid_assumptions =
         this->state_->CreateBasicBlock("IMPORT_NAME_invalid_assumptions");
 
-    this->builder_.CreateCondBr(this->fbuilder_->GetUseJitCond(),
+    this->builder_.CreateCondBr(this->fbuilder_->GetMachineCodeValidCond(),
                                 keep_going,
                                 invalid_assumptions);
 
@@ -26,6 +26,9 @@ public:
     void BUILD_MAP(int size);
 
     void UNPACK_SEQUENCE(int size);
+    // Stands in for BUILD_TUPLE or BUILD_LIST followed by an
+    // UNPACK_SEQUENCE of the same size, without allocating the sequence.
+    void UNPACK_BUILT_SEQUENCE(int size);
 
     void STORE_SUBSCR();
     void DELETE_SUBSCR();
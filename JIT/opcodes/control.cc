@@ -4,6 +4,7 @@
 #include "JIT/llvm_fbuilder.h"
 
 #include "llvm/BasicBlock.h"
+#include "llvm/Constants.h"
 #include "llvm/Function.h"
 #include "llvm/Instructions.h"
 #include "llvm/Support/ManagedStatic.h"
@@ -279,6 +280,35 @@ OpcodeControl::FillPyCondBranchBailBlock(BasicBlock *bail_to,
     this->builder_.SetInsertPoint(current);
 }
 
+Value *
+OpcodeControl::PopBranchCondition()
+{
+    typedef LlvmFunctionBuilder::UnboxedValue UnboxedValue;
+    UnboxedValue test = this->fbuilder_->PeekUnboxed(0);
+    Value *test_value = this->fbuilder_->Pop();
+    Value *is_true;
+    switch (test.kind) {
+    case UnboxedValue::BOOL:
+        is_true = test.raw;
+        break;
+    case UnboxedValue::INT:
+        is_true = this->state_->IsNonZero(test.raw);
+        break;
+    case UnboxedValue::FLOAT:
+        // NaN is true.
+        is_true = this->builder_.CreateFCmpUNE(
+            test.raw, llvm::ConstantFP::get(test.raw->getType(), 0.0));
+        break;
+    default:
+        this->fbuilder_->MaterializeUnboxedValues();
+        return this->fbuilder_->IsPythonTrue(test_value);
+    }
+    if (!test.is_virtual)
+        this->state_->DecRef(test_value);
+    this->fbuilder_->MaterializeUnboxedValues();
+    return is_true;
+}
+
 void
 OpcodeControl::POP_JUMP_IF_FALSE(unsigned target_idx,
                                  unsigned fallthrough_idx,
@@ -291,8 +321,7 @@ OpcodeControl::POP_JUMP_IF_FALSE(unsigned target_idx,
                                    /*on false: */ fallthrough_idx, &fallthrough,
                                    &bail_idx, &bail_to);
 
-    Value *test_value = this->fbuilder_->Pop();
-    Value *is_true = this->fbuilder_->IsPythonTrue(test_value);
+    Value *is_true = this->PopBranchCondition();
     this->builder_.CreateCondBr(is_true, fallthrough, target);
 
     if (bail_to)
@@ -311,8 +340,7 @@ OpcodeControl::POP_JUMP_IF_TRUE(unsigned target_idx,
                                    /*on false: */ target_idx, &target,
                                    &bail_idx, &bail_to);
 
-    Value *test_value = this->fbuilder_->Pop();
-    Value *is_true = this->fbuilder_->IsPythonTrue(test_value);
+    Value *is_true = this->PopBranchCondition();
     this->builder_.CreateCondBr(is_true, target, fallthrough);
 
     if (bail_to)
@@ -90,6 +90,12 @@ private:
     void FillPyCondBranchBailBlock(llvm::BasicBlock *bail_to,
                                    unsigned bail_idx);
 
+    // Helper function for the POP_JUMP_IF_{TRUE,FALSE}.  Pops the top of
+    // the stack and returns an i1 telling whether it's true, using its
+    // unboxed value if we know it.  Since the caller is about to end the
+    // basic block, this also boxes any other unboxed values on the stack.
+    llvm::Value *PopBranchCondition();
+
     LlvmFunctionBuilder *fbuilder_;
     LlvmFunctionState *state_;
     BuilderT &builder_;
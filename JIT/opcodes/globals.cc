@@ -40,6 +40,8 @@ void OpcodeGlobals::LOAD_GLOBAL_fast(int index)
     assert(code->co_watching[WATCHING_BUILTINS]);
 
     PyObject *name = PyTuple_GET_ITEM(code->co_names, index);
+    // Only writes to this name can invalidate what we cache here: a global
+    // shadows the builtin, and adding one shadows it after the fact.
     PyObject *obj = PyDict_GetItem(code->co_watching[WATCHING_GLOBALS], name);
     if (obj == NULL) {
         obj = PyDict_GetItem(code->co_watching[WATCHING_BUILTINS], name);
@@ -51,9 +53,9 @@ void OpcodeGlobals::LOAD_GLOBAL_fast(int index)
             this->LOAD_GLOBAL_safe(index);
             return;
         }
+        this->fbuilder_->WatchDict(WATCHING_BUILTINS, name);
     }
-    this->fbuilder_->WatchDict(WATCHING_GLOBALS);
-    this->fbuilder_->WatchDict(WATCHING_BUILTINS);
+    this->fbuilder_->WatchDict(WATCHING_GLOBALS, name);
 
     BasicBlock *keep_going =
         this->state_->CreateBasicBlock("LOAD_GLOBAL_keep_going");
@@ -63,7 +65,7 @@ void OpcodeGlobals::LOAD_GLOBAL_fast(int index)
 #ifdef WITH_TSC
     this->state_->LogTscEvent(LOAD_GLOBAL_ENTER_LLVM);
 #endif
-    this->builder_.CreateCondBr(this->fbuilder_->GetUseJitCond(),
+    this->builder_.CreateCondBr(this->fbuilder_->GetMachineCodeValidCond(),
                                 keep_going,
                                 invalid_assumptions);
 
@@ -4,10 +4,12 @@
 #include "JIT/llvm_fbuilder.h"
 
 #include "llvm/BasicBlock.h"
+#include "llvm/Constants.h"
 #include "llvm/Function.h"
 #include "llvm/Instructions.h"
 
 using llvm::BasicBlock;
+using llvm::ConstantFP;
 using llvm::ConstantInt;
 using llvm::Function;
 using llvm::Type;
@@ -25,12 +27,28 @@ OpcodeLocals::OpcodeLocals(LlvmFunctionBuilder *fbuilder) :
 void
 OpcodeLocals::LOAD_CONST(int index)
 {
+    typedef LlvmFunctionBuilder::UnboxedValue UnboxedValue;
     PyObject *co_consts = this->fbuilder_->code_object()->co_consts;
+    PyObject *constant = PyTuple_GET_ITEM(co_consts, index);
     Value *const_ = this->builder_.CreateBitCast(
-        this->state_->GetGlobalVariableFor(PyTuple_GET_ITEM(co_consts, index)),
+        this->state_->GetGlobalVariableFor(constant),
         PyTypeBuilder<PyObject*>::get(this->fbuilder_->context()));
     this->state_->IncRef(const_);
-    this->fbuilder_->Push(const_);
+    // Let unboxed arithmetic use the constant's value directly.
+    if (PyInt_CheckExact(constant)) {
+        this->fbuilder_->PushKnownUnboxed(
+            const_, UnboxedValue::INT,
+            this->state_->GetSigned<long>(PyInt_AS_LONG(constant)));
+    }
+    else if (PyFloat_CheckExact(constant)) {
+        this->fbuilder_->PushKnownUnboxed(
+            const_, UnboxedValue::FLOAT,
+            ConstantFP::get(Type::getDoubleTy(this->fbuilder_->context()),
+                            PyFloat_AS_DOUBLE(constant)));
+    }
+    else {
+        this->fbuilder_->Push(const_);
+    }
 }
 
 // TODO(collinwinter): we'd like to implement this by simply marking the load
@@ -40,6 +58,17 @@ OpcodeLocals::LOAD_CONST(int index)
 void
 OpcodeLocals::LOAD_FAST(int index)
 {
+    // A local we know the raw value of was stored in this block, so it
+    // can't be NULL.
+    const LlvmFunctionBuilder::UnboxedValue &known =
+        this->fbuilder_->GetUnboxedLocal(index);
+    if (known.kind != LlvmFunctionBuilder::UnboxedValue::NONE) {
+        Value *local = this->builder_.CreateLoad(
+            this->fbuilder_->GetLocal(index), "FAST_loaded");
+        this->state_->IncRef(local);
+        this->fbuilder_->PushKnownUnboxed(local, known.kind, known.raw);
+        return;
+    }
     // Simple check: if DELETE_FAST is never used, function parameters cannot
     // be NULL.
     if (!this->fbuilder_->uses_delete_fast() &&
@@ -106,7 +135,21 @@ OpcodeLocals::LOAD_FAST_safe(int index)
 void
 OpcodeLocals::STORE_FAST(int index)
 {
-    this->SetLocal(index, this->fbuilder_->Pop());
+    typedef LlvmFunctionBuilder::UnboxedValue UnboxedValue;
+    UnboxedValue value = this->fbuilder_->PeekUnboxed(0);
+    Value *new_value = this->fbuilder_->Pop();
+    if (value.kind == UnboxedValue::NONE) {
+        this->SetLocal(index, new_value);
+        this->fbuilder_->ForgetUnboxedLocal(index);
+        return;
+    }
+    // Locals always hold a box, since anything can look at them through
+    // the frame.
+    if (value.is_virtual)
+        new_value = this->fbuilder_->BoxUnboxedValue(value);
+    this->SetLocal(index, new_value);
+    this->fbuilder_->SetUnboxedLocal(
+        index, UnboxedValue(value.kind, value.raw, false));
 }
 
 void
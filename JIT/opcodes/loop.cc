@@ -6,12 +6,45 @@
 #include "llvm/BasicBlock.h"
 #include "llvm/Function.h"
 #include "llvm/Instructions.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/raw_ostream.h"
 
 using llvm::BasicBlock;
 using llvm::ConstantInt;
 using llvm::Function;
 using llvm::Type;
 using llvm::Value;
+using llvm::errs;
+
+#ifdef Py_WITH_INSTRUMENTATION
+class ForIterStats {
+public:
+    ForIterStats()
+        : total(0), optimized(0), omitted(0) {
+    }
+
+    ~ForIterStats() {
+        errs() << "\nFOR_ITER opcodes:\n";
+        errs() << "Total: " << this->total << "\n";
+        errs() << "Optimized: " << this->optimized << "\n";
+        errs() << "Omitted: " << this->omitted << "\n";
+    }
+
+    // Total number of FOR_ITER opcodes compiled.
+    unsigned total;
+    // Number iterating inline over a list, tuple or xrange.
+    unsigned optimized;
+    // Number that call tp_iternext because the feedback named some other
+    // type, or more than one.
+    unsigned omitted;
+};
+
+static llvm::ManagedStatic<ForIterStats> for_iter_stats;
+
+#define FOR_ITER_INC_STATS(field) for_iter_stats->field++
+#else
+#define FOR_ITER_INC_STATS(field)
+#endif  /* Py_WITH_INSTRUMENTATION */
 
 // Use like "this->GET_GLOBAL_VARIABLE(Type, variable)".
 #define GET_GLOBAL_VARIABLE(TYPE, VARIABLE) \
@@ -42,6 +75,99 @@ OpcodeLoop::GET_ITER()
 void
 OpcodeLoop::FOR_ITER(llvm::BasicBlock *target,
                      llvm::BasicBlock *fallthrough)
+{
+    FOR_ITER_INC_STATS(total);
+    if (!this->FOR_ITER_fast(target)) {
+        this->FOR_ITER_safe(target);
+    }
+}
+
+bool
+OpcodeLoop::FOR_ITER_fast(llvm::BasicBlock *target)
+{
+    typedef LlvmFunctionBuilder::UnboxedValue UnboxedValue;
+    const PyTypeObject *iter_type = this->fbuilder_->GetTypeFeedback(0);
+    // NULL for xrange iterators, which we handle specially.
+    const char *next_func;
+    if (iter_type == &PyListIter_Type) {
+        next_func = "_PyLlvm_ListIter_Next";
+    }
+    else if (iter_type == &PyTupleIter_Type) {
+        next_func = "_PyLlvm_TupleIter_Next";
+    }
+    else if (iter_type == &PyRangeIter_Type) {
+        next_func = NULL;
+    }
+    else {
+        FOR_ITER_INC_STATS(omitted);
+        return false;
+    }
+    FOR_ITER_INC_STATS(optimized);
+
+    BasicBlock *type_ok = this->state_->CreateBasicBlock("FOR_ITER_type_ok");
+    BasicBlock *bailpoint = this->state_->CreateBasicBlock("FOR_ITER_bail");
+    BasicBlock *got_next = this->state_->CreateBasicBlock("FOR_ITER_got_next");
+    BasicBlock *iter_ended =
+        this->state_->CreateBasicBlock("FOR_ITER_iter_ended");
+
+    this->fbuilder_->SetOpcodeArgsWithGuard(1);
+    Value *iter = this->fbuilder_->GetOpcodeArg(0);
+    // These types are static, so they can't go away under us.
+    Value *actual_type = this->builder_.CreateLoad(
+        ObjectTy::ob_type(this->builder_, iter), "iter_type");
+    this->builder_.CreateCondBr(
+        this->builder_.CreateICmpEQ(
+            actual_type,
+            this->state_->EmbedPointer<PyTypeObject*>(
+                const_cast<PyTypeObject*>(iter_type))),
+        type_ok, bailpoint);
+
+    this->builder_.SetInsertPoint(bailpoint);
+    this->fbuilder_->CreateGuardBailPoint(_PYGUARD_FOR_ITER);
+
+    // Neither kind of iterator raises StopIteration, so running out needs
+    // no exception checks.
+    this->builder_.SetInsertPoint(type_ok);
+    this->fbuilder_->BeginOpcodeImpl();
+    if (next_func != NULL) {
+        Value *next = this->state_->CreateCall(
+            this->state_->GetGlobalFunction<PyObject*(PyObject*)>(next_func),
+            iter, "next");
+        this->builder_.CreateCondBr(this->state_->IsNull(next),
+                                    iter_ended, got_next);
+        this->builder_.SetInsertPoint(got_next);
+        this->fbuilder_->SetOpcodeResult(0, iter);
+        this->fbuilder_->SetOpcodeResult(1, next);
+    }
+    else {
+        // Leave the counter unboxed for the loop body; STORE_FAST boxes
+        // it, but later arithmetic on the loop variable can use the raw
+        // value.
+        Value *done = this->state_->CreateCall(
+            this->state_->GetGlobalFunction<int(PyObject*)>(
+                "_PyLlvm_RangeIter_Done"),
+            iter, "range_done");
+        this->builder_.CreateCondBr(this->state_->IsNonZero(done),
+                                    iter_ended, got_next);
+        this->builder_.SetInsertPoint(got_next);
+        Value *next = this->state_->CreateCall(
+            this->state_->GetGlobalFunction<long(PyObject*)>(
+                "_PyLlvm_RangeIter_Next"),
+            iter, "next");
+        this->fbuilder_->SetOpcodeResult(0, iter);
+        this->fbuilder_->SetUnboxedResult(1, UnboxedValue::INT, next);
+    }
+
+    this->builder_.SetInsertPoint(iter_ended);
+    this->state_->DecRef(iter);
+    this->builder_.CreateBr(target);
+
+    this->builder_.SetInsertPoint(got_next);
+    return true;
+}
+
+void
+OpcodeLoop::FOR_ITER_safe(llvm::BasicBlock *target)
 {
     Value *iter = this->fbuilder_->Pop();
     Value *iter_tp = this->builder_.CreateBitCast(
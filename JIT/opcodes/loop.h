@@ -28,7 +28,6 @@ public:
     void GET_ITER();
     void FOR_ITER(llvm::BasicBlock *target, llvm::BasicBlock *fallthrough);
 
-
     void CONTINUE_LOOP(llvm::BasicBlock *target,
                        int target_opindex,
                        llvm::BasicBlock *fallthrough);
@@ -38,6 +37,13 @@ public:
 private:
     typedef llvm::IRBuilder<true, llvm::TargetFolder> BuilderT;
 
+    // Iterates inline over list, tuple and xrange iterators, guarded by
+    // the type feedback for this opcode.  Returns false if the feedback
+    // doesn't name one of those types.
+    bool FOR_ITER_fast(llvm::BasicBlock *target);
+    // Calls tp_iternext.
+    void FOR_ITER_safe(llvm::BasicBlock *target);
+
     LlvmFunctionBuilder *fbuilder_;
     LlvmFunctionState *state_;
     BuilderT &builder_;
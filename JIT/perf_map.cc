@@ -0,0 +1,470 @@
+// Writes perf map and jitdump files.  See perf_map.h for an overview.
+
+#include "Python.h"
+#include "code.h"
+
+#include "JIT/global_llvm_data.h"
+#include "JIT/perf_map.h"
+
+#include "llvm/Analysis/DebugInfo.h"
+#include "llvm/CodeGen/MachineFunction.h"
+#include "llvm/Function.h"
+#include "llvm/Support/DataTypes.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#define PY_HAVE_JITDUMP 1
+#endif
+
+#ifdef PY_HAVE_JITDUMP
+// The jitdump format, version 1.  All fields are in host byte order.
+namespace {
+enum {
+    JITDUMP_MAGIC = 0x4A695444,  // "JiTD"
+    JITDUMP_VERSION = 1,
+    JIT_CODE_LOAD = 0,
+    JIT_CODE_DEBUG_INFO = 2,
+    JIT_CODE_CLOSE = 3
+};
+
+struct JitDumpFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+};
+
+struct JitDumpRecordHeader {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+};
+
+// Followed by the function's name, NUL-terminated, and its machine code.
+struct JitDumpCodeLoad {
+    JitDumpRecordHeader header;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+};
+
+// Followed by nr_entry JitDumpDebugEntrys.
+struct JitDumpDebugInfo {
+    JitDumpRecordHeader header;
+    uint64_t code_addr;
+    uint64_t nr_entry;
+};
+
+// Followed by the source file's name, NUL-terminated.
+struct JitDumpDebugEntry {
+    uint64_t addr;
+    uint32_t lineno;
+    uint32_t discrim;
+};
+}  // anonymous namespace
+
+// perf matches these timestamps against its samples, which it takes from
+// CLOCK_MONOTONIC when run with -k 1.
+static uint64_t
+jitdump_timestamp()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static uint32_t
+jitdump_elf_machine()
+{
+#if defined(__x86_64__)
+    return EM_X86_64;
+#elif defined(__i386__)
+    return EM_386;
+#elif defined(__arm__)
+    return EM_ARM;
+#elif defined(__powerpc64__)
+    return EM_PPC64;
+#elif defined(__powerpc__)
+    return EM_PPC;
+#else
+    return EM_NONE;
+#endif
+}
+#endif  // PY_HAVE_JITDUMP
+
+static std::string
+output_path(const char *prefix, long pid, const char *suffix)
+{
+    char path[64];
+    PyOS_snprintf(path, sizeof(path), "/tmp/%s-%ld.%s", prefix, pid, suffix);
+    return path;
+}
+
+static FILE *
+open_perf_map(long pid)
+{
+    return fopen(output_path("perf", pid, "map").c_str(), "a");
+}
+
+#ifdef PY_HAVE_JITDUMP
+// Creates the jitdump file, writes its header, and maps its first page
+// into memory as *marker.  Returns NULL with errno set on failure.
+static FILE *
+open_jitdump(long pid, void **marker)
+{
+    std::string path = output_path("jit", pid, "dump");
+    int fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd < 0)
+        return NULL;
+    FILE *file = fdopen(fd, "w+");
+    if (file == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    JitDumpFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = JITDUMP_MAGIC;
+    header.version = JITDUMP_VERSION;
+    header.total_size = sizeof(header);
+    header.elf_mach = jitdump_elf_machine();
+    header.pid = pid;
+    header.timestamp = jitdump_timestamp();
+    if (fwrite(&header, sizeof(header), 1, file) != 1 || fflush(file) != 0) {
+        fclose(file);
+        return NULL;
+    }
+
+    // perf record only notices the file through an executable mapping of
+    // it.  We never touch the mapping.
+    *marker = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC,
+                   MAP_PRIVATE, fd, 0);
+    if (*marker == MAP_FAILED) {
+        int saved_errno = errno;
+        fclose(file);
+        errno = saved_errno;
+        return NULL;
+    }
+    return file;
+}
+#endif  // PY_HAVE_JITDUMP
+
+PyPerfJitEventListener::PyPerfJitEventListener()
+    : names_(&lock_), perf_map_(NULL), jitdump_(NULL),
+      jitdump_marker_(NULL), next_code_index_(0), pid_(0)
+{
+}
+
+PyPerfJitEventListener::~PyPerfJitEventListener()
+{
+    if (this->perf_map_ != NULL)
+        fclose(this->perf_map_);
+    this->CloseJitDump();
+}
+
+bool
+PyPerfJitEventListener::OwnedByThisProcess() const
+{
+    return this->pid_ == (long)getpid();
+}
+
+// The parent still owns the files we inherited, so leave them alone and
+// start our own.  If that fails, we just stop writing; there's nobody to
+// report the error to.
+void
+PyPerfJitEventListener::ReopenAfterFork()
+{
+    this->pid_ = (long)getpid();
+    if (this->perf_map_ != NULL) {
+        fclose(this->perf_map_);
+        this->perf_map_ = open_perf_map(this->pid_);
+        if (this->perf_map_ == NULL)
+            perror("perf map");
+    }
+#ifdef PY_HAVE_JITDUMP
+    if (this->jitdump_ != NULL) {
+        fclose(this->jitdump_);
+        munmap(this->jitdump_marker_, sysconf(_SC_PAGESIZE));
+        this->next_code_index_ = 0;
+        this->jitdump_ = open_jitdump(this->pid_, &this->jitdump_marker_);
+        if (this->jitdump_ == NULL)
+            perror("jitdump");
+    }
+#endif
+}
+
+int
+PyPerfJitEventListener::SetPerfMapEnabled(bool enabled)
+{
+    llvm::sys::ScopedLock lock(this->lock_);
+    if (!this->OwnedByThisProcess())
+        this->ReopenAfterFork();
+    if (enabled == this->perf_map_enabled())
+        return 0;
+    if (!enabled) {
+        fclose(this->perf_map_);
+        this->perf_map_ = NULL;
+        if (!this->jitdump_enabled())
+            this->names_.clear();
+        return 0;
+    }
+    long pid = (long)getpid();
+    FILE *file = open_perf_map(pid);
+    if (file == NULL) {
+        std::string path = output_path("perf", pid, "map");
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError,
+                                       const_cast<char *>(path.c_str()));
+        return -1;
+    }
+    this->perf_map_ = file;
+    this->pid_ = pid;
+    return 0;
+}
+
+int
+PyPerfJitEventListener::SetJitDumpEnabled(bool enabled)
+{
+#ifdef PY_HAVE_JITDUMP
+    llvm::sys::ScopedLock lock(this->lock_);
+    if (!this->OwnedByThisProcess())
+        this->ReopenAfterFork();
+    if (enabled == this->jitdump_enabled())
+        return 0;
+    if (!enabled) {
+        this->CloseJitDump();
+        if (!this->perf_map_enabled())
+            this->names_.clear();
+        return 0;
+    }
+    long pid = (long)getpid();
+    FILE *file = open_jitdump(pid, &this->jitdump_marker_);
+    if (file == NULL) {
+        std::string path = output_path("jit", pid, "dump");
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError,
+                                       const_cast<char *>(path.c_str()));
+        return -1;
+    }
+    this->jitdump_ = file;
+    this->next_code_index_ = 0;
+    this->pid_ = pid;
+    return 0;
+#else
+    if (!enabled)
+        return 0;
+    PyErr_SetString(PyExc_NotImplementedError,
+                    "jitdump output is only supported on Linux");
+    return -1;
+#endif
+}
+
+void
+PyPerfJitEventListener::CloseJitDump()
+{
+#ifdef PY_HAVE_JITDUMP
+    if (this->jitdump_ == NULL)
+        return;
+    if (this->OwnedByThisProcess()) {
+        JitDumpRecordHeader close_record;
+        close_record.id = JIT_CODE_CLOSE;
+        close_record.total_size = sizeof(close_record);
+        close_record.timestamp = jitdump_timestamp();
+        fwrite(&close_record, sizeof(close_record), 1, this->jitdump_);
+    }
+    fclose(this->jitdump_);
+    munmap(this->jitdump_marker_, sysconf(_SC_PAGESIZE));
+    this->jitdump_ = NULL;
+    this->jitdump_marker_ = NULL;
+#endif
+}
+
+void
+PyPerfJitEventListener::NameFunction(llvm::Function *function,
+                                     PyCodeObject *code)
+{
+    llvm::sys::ScopedLock lock(this->lock_);
+    if (!this->perf_map_enabled() && !this->jitdump_enabled())
+        return;
+    char firstlineno[32];
+    PyOS_snprintf(firstlineno, sizeof(firstlineno), ":%d",
+                  code->co_firstlineno);
+    std::string name = "py::";
+    name += PyString_AS_STRING(code->co_name);
+    name += ":";
+    name += PyString_AS_STRING(code->co_filename);
+    name += firstlineno;
+    // Both formats end the name at a newline or NUL.
+    for (std::string::iterator it = name.begin(); it != name.end(); ++it) {
+        if (*it == '\n' || *it == '\0')
+            *it = ' ';
+    }
+    this->names_[function] = name;
+}
+
+void
+PyPerfJitEventListener::NotifyFunctionEmitted(
+    const llvm::Function &function, void *code, size_t size,
+    const EmittedFunctionDetails &details)
+{
+    llvm::sys::ScopedLock lock(this->lock_);
+    if (!this->perf_map_enabled() && !this->jitdump_enabled())
+        return;
+    if (!this->OwnedByThisProcess())
+        this->ReopenAfterFork();
+
+    // Functions we didn't name come from the stdlib bitcode, or were
+    // translated from bytecode before output was enabled.
+    std::string name;
+    llvm::ValueMap<const llvm::Function *, std::string,
+                   NamesConfig>::iterator it =
+        this->names_.find(&function);
+    if (it != this->names_.end()) {
+        name = it->second;
+        this->names_.erase(it);
+    }
+    else {
+        name = function.getName();
+    }
+
+    if (this->perf_map_ != NULL)
+        this->WritePerfMapEntry(code, size, name);
+    if (this->jitdump_ != NULL)
+        this->WriteJitDumpEntry(code, size, name, details);
+}
+
+void
+PyPerfJitEventListener::WritePerfMapEntry(const void *code, size_t size,
+                                          const std::string &name)
+{
+    // perf may read the file while we're still running, so don't leave
+    // entries sitting in the buffer.
+    fprintf(this->perf_map_, "%lx %lx %s\n", (unsigned long)code,
+            (unsigned long)size, name.c_str());
+    if (fflush(this->perf_map_) != 0) {
+        perror("perf map");
+        fclose(this->perf_map_);
+        this->perf_map_ = NULL;
+    }
+}
+
+void
+PyPerfJitEventListener::WriteJitDumpEntry(
+    const void *code, size_t size, const std::string &name,
+    const EmittedFunctionDetails &details)
+{
+#ifdef PY_HAVE_JITDUMP
+    uint64_t timestamp = jitdump_timestamp();
+
+    // The line table has to come before the code it describes.  The JIT
+    // starts a new entry whenever the DebugLoc changes, which also happens
+    // between columns and scopes we don't use, so merge entries for the
+    // same line.
+    std::vector<std::pair<JitDumpDebugEntry, std::string> > lines;
+    if (details.MF != NULL) {
+        for (size_t i = 0, e = details.LineStarts.size(); i != e; ++i) {
+            const EmittedFunctionDetails::LineStart &start =
+                details.LineStarts[i];
+            if (start.Loc.isUnknown())
+                continue;
+            llvm::DILocation loc = details.MF->getDILocation(start.Loc);
+            unsigned line = loc.getLineNumber();
+            if (line == 0 ||
+                (!lines.empty() && lines.back().first.lineno == line))
+                continue;
+            JitDumpDebugEntry entry;
+            entry.addr = start.Address;
+            entry.lineno = line;
+            entry.discrim = 0;
+            std::string filename = loc.getScope().getFilename();
+            lines.push_back(std::make_pair(entry, filename));
+        }
+    }
+    if (!lines.empty()) {
+        JitDumpDebugInfo debug_info;
+        debug_info.header.id = JIT_CODE_DEBUG_INFO;
+        debug_info.header.total_size = sizeof(debug_info);
+        debug_info.header.timestamp = timestamp;
+        debug_info.code_addr = (uintptr_t)code;
+        debug_info.nr_entry = lines.size();
+        for (size_t i = 0; i < lines.size(); ++i) {
+            debug_info.header.total_size +=
+                sizeof(JitDumpDebugEntry) + lines[i].second.size() + 1;
+        }
+        fwrite(&debug_info, sizeof(debug_info), 1, this->jitdump_);
+        for (size_t i = 0; i < lines.size(); ++i) {
+            fwrite(&lines[i].first, sizeof(JitDumpDebugEntry), 1,
+                   this->jitdump_);
+            fwrite(lines[i].second.c_str(), lines[i].second.size() + 1, 1,
+                   this->jitdump_);
+        }
+    }
+
+    JitDumpCodeLoad load;
+    load.header.id = JIT_CODE_LOAD;
+    load.header.total_size = sizeof(load) + name.size() + 1 + size;
+    load.header.timestamp = timestamp;
+    load.pid = this->pid_;
+    load.tid = syscall(SYS_gettid);
+    load.vma = (uintptr_t)code;
+    load.code_addr = (uintptr_t)code;
+    load.code_size = size;
+    load.code_index = this->next_code_index_++;
+    fwrite(&load, sizeof(load), 1, this->jitdump_);
+    fwrite(name.c_str(), name.size() + 1, 1, this->jitdump_);
+    fwrite(code, size, 1, this->jitdump_);
+
+    if (fflush(this->jitdump_) != 0 || ferror(this->jitdump_)) {
+        perror("jitdump");
+        this->CloseJitDump();
+    }
+#endif  // PY_HAVE_JITDUMP
+}
+
+// C API.  These run with the GIL held; the listener's own lock keeps the
+// compile threads from emitting code while we switch files.
+
+int
+_PyPerfMap_SetEnabled(int enabled)
+{
+    PyGlobalLlvmData *global_data = PyGlobalLlvmData::Get();
+    return global_data->perf_listener().SetPerfMapEnabled(enabled != 0);
+}
+
+int
+_PyPerfMap_SetJitDump(int enabled)
+{
+    PyGlobalLlvmData *global_data = PyGlobalLlvmData::Get();
+    return global_data->perf_listener().SetJitDumpEnabled(enabled != 0);
+}
+
+int
+_PyPerfMap_IsEnabled(void)
+{
+    PyGlobalLlvmData *global_data = PyGlobalLlvmData::Get();
+    return global_data->perf_listener().perf_map_enabled();
+}
+
+int
+_PyPerfMap_IsJitDumpEnabled(void)
+{
+    PyGlobalLlvmData *global_data = PyGlobalLlvmData::Get();
+    return global_data->perf_listener().jitdump_enabled();
+}
@@ -0,0 +1,120 @@
+/* Tells Linux perf(1) about JIT-compiled Python functions.
+
+   perf finds symbols by looking at the files mapped into the process,
+   so samples that land in JIT-emitted machine code show up as bare
+   addresses.  perf understands two ways for a JIT to describe its code:
+
+   - /tmp/perf-<pid>.map, a text file with one "<start> <size> <name>" line
+     per function.  `perf report` reads it directly.
+
+   - /tmp/jit-<pid>.dump, the binary jitdump format (see
+     tools/perf/Documentation/jitdump-specification.txt in the Linux
+     source).  It also holds a copy of the machine code and a line table
+     built from co_lnotab, so `perf annotate` can show which source lines
+     are hot.  Use it with `perf record -k 1` followed by `perf inject
+     --jit`.
+
+   Both are written from a JITEventListener, every time _LlvmFunction_Jit()
+   emits machine code.  Python functions are named "py::<name>:<file>:<first
+   line>"; functions compiled before output was enabled are not described.
+   _llvm.set_perf_map() and _llvm.set_jitdump() switch them on and off. */
+#ifndef PYTHON_PERF_MAP_H
+#define PYTHON_PERF_MAP_H
+
+#include "Python.h"
+#include "code.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef WITH_LLVM
+/* Start or stop writing /tmp/perf-<pid>.map or /tmp/jit-<pid>.dump.
+   Return 0 on success, or -1 with an exception set if the file can't be
+   opened. */
+PyAPI_FUNC(int) _PyPerfMap_SetEnabled(int enabled);
+PyAPI_FUNC(int) _PyPerfMap_SetJitDump(int enabled);
+
+PyAPI_FUNC(int) _PyPerfMap_IsEnabled(void);
+PyAPI_FUNC(int) _PyPerfMap_IsJitDumpEnabled(void);
+#endif  /* WITH_LLVM */
+
+#ifdef __cplusplus
+}
+
+#ifdef WITH_LLVM
+#include "llvm/ADT/ValueMap.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/System/Mutex.h"
+
+#include <stdio.h>
+#include <string>
+
+namespace llvm {
+class Function;
+}
+
+// Owned by the interpreter's PyGlobalLlvmData and registered with its
+// ExecutionEngine and every compile thread's, so functions may be emitted
+// on several threads at once.  It takes its own lock.
+class PyPerfJitEventListener : public llvm::JITEventListener {
+public:
+    PyPerfJitEventListener();
+    virtual ~PyPerfJitEventListener();
+
+    // Return 0 on success, or -1 with an exception set.
+    int SetPerfMapEnabled(bool enabled);
+    int SetJitDumpEnabled(bool enabled);
+
+    bool perf_map_enabled() const { return this->perf_map_ != NULL; }
+    bool jitdump_enabled() const { return this->jitdump_ != NULL; }
+
+    // Remembers that function was generated from code, so its machine code
+    // can be named after code.  Does nothing when no output is enabled.
+    void NameFunction(llvm::Function *function, PyCodeObject *code);
+
+    virtual void NotifyFunctionEmitted(const llvm::Function &function,
+                                       void *code, size_t size,
+                                       const EmittedFunctionDetails &details);
+
+private:
+    // Returns false if the file should be reopened because we've forked.
+    bool OwnedByThisProcess() const;
+    void ReopenAfterFork();
+
+    void WritePerfMapEntry(const void *code, size_t size,
+                           const std::string &name);
+    void WriteJitDumpEntry(const void *code, size_t size,
+                           const std::string &name,
+                           const EmittedFunctionDetails &details);
+    void CloseJitDump();
+
+    // Lets names_ forget deleted functions under lock_, whichever thread
+    // deletes them.
+    struct NamesConfig : llvm::ValueMapConfig<const llvm::Function *> {
+        typedef llvm::sys::Mutex *ExtraData;
+        static llvm::sys::Mutex *getMutex(llvm::sys::Mutex *mutex) {
+            return mutex;
+        }
+    };
+
+    // Protects everything below.  Recursive.
+    llvm::sys::Mutex lock_;
+
+    // Names of Python functions that haven't been emitted yet.
+    llvm::ValueMap<const llvm::Function *, std::string, NamesConfig> names_;
+
+    FILE *perf_map_;
+    FILE *jitdump_;
+    // The page of jitdump_ we mapped into memory; perf record looks for
+    // this mapping to find the file.
+    void *jitdump_marker_;
+    // Index of the next JIT_CODE_LOAD record.
+    unsigned long long next_code_index_;
+    // The process that opened the files.  A child process writes its own.
+    long pid_;
+};
+#endif  // WITH_LLVM
+#endif  // __cplusplus
+
+#endif  /* PYTHON_PERF_MAP_H */
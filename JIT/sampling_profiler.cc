@@ -0,0 +1,204 @@
+// Implements the SIGPROF sampler.  See sampling_profiler.h for an overview.
+
+#include "Python.h"
+#include "code.h"
+#include "frameobject.h"
+
+#include "JIT/sampling_profiler.h"
+
+#include <set>
+
+#include <signal.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#if defined(HAVE_SETITIMER) && defined(SIGPROF)
+#define SAMPLER_SUPPORTED
+#endif
+
+volatile sig_atomic_t _PySampler_Pending = 0;
+
+typedef std::set<PyCodeObject *> PySampledCodeSet;
+
+// Code objects with a nonzero co_samples, for _PySampler_GetSamples().
+static PySampledCodeSet *sampled_code = NULL;
+static unsigned long total_samples = 0;
+static int sample_rate = 0;
+
+#ifdef SAMPLER_SUPPORTED
+static PyOS_sighandler_t old_handler = SIG_DFL;
+
+// Runs on whichever thread the kernel picks, at any point, so all it may
+// do is touch the two volatiles.
+static void
+sample_handler(int sig)
+{
+    ++_PySampler_Pending;
+    _Py_Ticker = 0;
+}
+
+static int
+set_timer(int rate)
+{
+    struct itimerval timer;
+    // setitimer() wants tv_usec below a second, so rate 1 needs tv_sec.
+    timer.it_interval.tv_sec = rate ? 1 / rate : 0;
+    timer.it_interval.tv_usec = rate ? (1000000 / rate) % 1000000 : 0;
+    timer.it_value = timer.it_interval;
+    return setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+// Installs sample_handler() and returns the handler it replaced.  Unlike
+// PyOS_setsig(), asks for interrupted system calls to be restarted.
+static PyOS_sighandler_t
+install_handler(void)
+{
+#ifdef HAVE_SIGACTION
+    struct sigaction context, ocontext;
+    context.sa_handler = sample_handler;
+    sigemptyset(&context.sa_mask);
+    context.sa_flags = SA_RESTART;
+    if (sigaction(SIGPROF, &context, &ocontext) == -1)
+        return SIG_ERR;
+    return ocontext.sa_handler;
+#else
+    return PyOS_setsig(SIGPROF, sample_handler);
+#endif
+}
+#endif  /* SAMPLER_SUPPORTED */
+
+int
+_PySampler_Start(int rate)
+{
+    if (rate < 1 || rate > PY_MAX_SAMPLE_RATE) {
+        PyErr_Format(PyExc_ValueError,
+                     "sample rate must be from 1 to %d", PY_MAX_SAMPLE_RATE);
+        return -1;
+    }
+#ifdef SAMPLER_SUPPORTED
+    if (sample_rate == 0) {
+        PyOS_sighandler_t handler = install_handler();
+        if (handler == SIG_ERR) {
+            PyErr_SetFromErrno(PyExc_OSError);
+            return -1;
+        }
+        old_handler = handler;
+    }
+    if (set_timer(rate) < 0) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        if (sample_rate == 0)
+            PyOS_setsig(SIGPROF, old_handler);
+        return -1;
+    }
+    sample_rate = rate;
+    return 0;
+#else
+    PyErr_SetString(PyExc_NotImplementedError,
+                    "sampling needs setitimer() and SIGPROF");
+    return -1;
+#endif
+}
+
+void
+_PySampler_Stop(void)
+{
+#ifdef SAMPLER_SUPPORTED
+    if (sample_rate == 0)
+        return;
+    set_timer(0);
+    // Python code may have replaced sample_handler() since, and restoring
+    // old_handler would silently drop its handler.
+    if (PyOS_getsig(SIGPROF) == sample_handler)
+        PyOS_setsig(SIGPROF, old_handler);
+    sample_rate = 0;
+#endif
+}
+
+void
+_PySampler_AfterFork(void)
+{
+#ifdef SAMPLER_SUPPORTED
+    if (sample_rate == 0)
+        return;
+    _PySampler_Pending = 0;
+    // The child inherits sample_handler() but not the timer.  Time-based
+    // hotness can't work without samples, so rearm it in that case.
+    if (Py_JitTimeHotness && set_timer(sample_rate) == 0)
+        return;
+    if (PyOS_getsig(SIGPROF) == sample_handler)
+        PyOS_setsig(SIGPROF, old_handler);
+    sample_rate = 0;
+#endif
+}
+
+int
+_PySampler_GetRate(void)
+{
+    return sample_rate;
+}
+
+void
+_PySampler_TakeSample(PyThreadState *tstate)
+{
+    // A signal arriving between these two lines is simply dropped.
+    int samples = _PySampler_Pending;
+    _PySampler_Pending = 0;
+    if (samples <= 0 || tstate->frame == NULL)
+        return;
+
+    PyCodeObject *code = tstate->frame->f_code;
+    if (code->co_samples == 0) {
+        if (sampled_code == NULL)
+            sampled_code = new PySampledCodeSet;
+        sampled_code->insert(code);
+    }
+    code->co_samples += samples;
+    total_samples += samples;
+
+    if (Py_JitTimeHotness &&
+        (unsigned long)code->co_samples * 100 >=
+        total_samples * PY_HOT_SAMPLE_PERCENT)
+        code->co_hotness += (long)samples * PY_HOTNESS_PER_SAMPLE;
+}
+
+PyObject *
+_PySampler_GetSamples(void)
+{
+    PyObject *per_code = PyDict_New();
+    if (per_code == NULL)
+        return NULL;
+    if (sampled_code != NULL) {
+        for (PySampledCodeSet::const_iterator it = sampled_code->begin(),
+                 end = sampled_code->end(); it != end; ++it) {
+            PyObject *count = PyInt_FromLong((*it)->co_samples);
+            if (count == NULL ||
+                PyDict_SetItem(per_code, (PyObject *)*it, count) < 0) {
+                Py_XDECREF(count);
+                Py_DECREF(per_code);
+                return NULL;
+            }
+            Py_DECREF(count);
+        }
+    }
+    return Py_BuildValue("(kN)", total_samples, per_code);
+}
+
+void
+_PySampler_Clear(void)
+{
+    if (sampled_code != NULL) {
+        for (PySampledCodeSet::const_iterator it = sampled_code->begin(),
+                 end = sampled_code->end(); it != end; ++it)
+            (*it)->co_samples = 0;
+        sampled_code->clear();
+    }
+    total_samples = 0;
+}
+
+void
+_PySampler_Forget(PyCodeObject *code)
+{
+    if (code->co_samples != 0 && sampled_code != NULL)
+        sampled_code->erase(code);
+}
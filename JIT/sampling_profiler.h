@@ -0,0 +1,109 @@
+/* A SIGPROF sampling profiler, and hotness measured in time
+   (-Xjithotness=time).
+
+   co_hotness counts calls and loop backedges, which is only a proxy for
+   where the time goes.  It takes a long time to notice a function that
+   is rarely called but does a lot of work in C, such as a wrapper around
+   a big regex or a pickle.  It quickly notices a trivial function that is
+   called constantly, even when compiling it gains little.
+
+   While the sampler runs, an ITIMER_PROF timer sends SIGPROF every
+   1/rate seconds of CPU time the process uses.  The signal handler only
+   counts the sample and sets _Py_Ticker to 0, like Py_AddPendingCall().
+   The thread running Python code then picks up the sample in
+   _PyEval_HandlePyTickerExpired(), from the eval loop or machine code,
+   and adds it to co_samples of the code its current frame is running.
+   Time spent in a C function without releasing the GIL is therefore
+   charged to the Python code that called it.  Threads that don't hold
+   the GIL aren't running Python code, so they are never sampled.
+
+   Under -Xjithotness=time (_llvm.set_hotness_model("time")), calls and
+   backedges stop adding to co_hotness in the eval loop.  Instead each
+   sample adds PY_HOTNESS_PER_SAMPLE, but only while the code has at least
+   PY_HOT_SAMPLE_PERCENT of all the samples taken so far.  Everything that
+   keys off co_hotness then works unchanged: maybe_compile(), on-stack
+   replacement, tiering up, and starting over after invalidation.
+   Baseline machine code from -Xjitopt=tiered still counts its backedges
+   toward tiering up.
+
+   The sampler also works as a statistical profiler under either model:
+   _llvm.start_sampling(), _llvm.get_samples(), _llvm.clear_samples() and
+   _llvm.stop_sampling().  Like any SIGPROF profiler, it can make system
+   calls that SA_RESTART doesn't restart fail with EINTR, and it stops if
+   Python code installs its own SIGPROF handler.  The timer isn't
+   inherited across fork(), so the sampler is stopped in the child unless
+   -Xjithotness=time needs it.
+
+   Everything here except the signal handler is called with the GIL
+   held. */
+#ifndef PYTHON_SAMPLING_PROFILER_H
+#define PYTHON_SAMPLING_PROFILER_H
+
+#include "Python.h"
+#include "code.h"
+
+#include <signal.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef WITH_LLVM
+/* Samples per second of CPU time when -Xjithotness=time starts the
+   sampler. */
+#define PY_DEFAULT_SAMPLE_RATE 100
+
+/* The most samples per second we ask for.  The kernel doesn't deliver
+   SIGPROF much more often than its scheduler tick anyway. */
+#define PY_MAX_SAMPLE_RATE 1000
+
+/* What one sample adds to co_hotness under -Xjithotness=time.  Code gets
+   hot on its fifth sample, 50ms of CPU time at the default rate. */
+#define PY_HOTNESS_PER_SAMPLE (PY_HOTNESS_THRESHOLD / 4)
+
+/* Under -Xjithotness=time, samples only add to co_hotness while the code
+   has at least this percentage of all samples, so code that accumulates a
+   handful of samples over a long run isn't compiled for it. */
+#define PY_HOT_SAMPLE_PERCENT 1
+
+/* Samples the signal handler has counted but no thread has picked up. */
+PyAPI_DATA(volatile sig_atomic_t) _PySampler_Pending;
+
+/* Starts sampling rate times a second of CPU time, or changes the rate if
+   the sampler is already running.  Returns 0 on success, or -1 with an
+   exception set. */
+PyAPI_FUNC(int) _PySampler_Start(int rate);
+
+/* Stops sampling and restores the SIGPROF handler that was installed
+   before _PySampler_Start().  A handler installed since then is left
+   alone. */
+PyAPI_FUNC(void) _PySampler_Stop(void);
+
+/* Called from PyOS_AfterFork() in the child, which didn't inherit the
+   timer.  Rearms it under -Xjithotness=time, and otherwise stops the
+   sampler. */
+void _PySampler_AfterFork(void);
+
+/* Returns the rate the sampler is running at, or 0 if it's stopped. */
+PyAPI_FUNC(int) _PySampler_GetRate(void);
+
+/* Called when _Py_Ticker runs out and _PySampler_Pending is set.  Charges
+   the pending samples to the code tstate is running. */
+void _PySampler_TakeSample(PyThreadState *tstate);
+
+/* Returns a new (total, {code: samples}) tuple of what has been sampled
+   so far.  The total includes samples of code that has since died. */
+PyAPI_FUNC(PyObject *) _PySampler_GetSamples(void);
+
+/* Forgets everything sampled so far.  Leaves co_hotness alone. */
+PyAPI_FUNC(void) _PySampler_Clear(void);
+
+/* Called when code dies. */
+void _PySampler_Forget(PyCodeObject *code);
+#endif  /* WITH_LLVM */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* PYTHON_SAMPLING_PROFILER_H */
@@ -192,4 +192,10 @@ def_op('CALL_FUNCTION_VAR_KW', 142)  # #args + (#kwargs << 8)
 def_op('EXTENDED_ARG', 143)
 EXTENDED_ARG = 143
 
+# Specialized instructions that the eval loop substitutes into a code object's
+# co_quickened.  They never appear in co_code.
+def_op('BINARY_ADD_INT', 69)
+def_op('LOAD_ATTR_INSTANCE_DICT', 144)  # Inline cache index
+def_op('LOAD_GLOBAL_CACHED', 145)       # Inline cache index
+
 del def_op, name_op, jrel_op, jabs_op
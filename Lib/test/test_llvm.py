@@ -13,7 +13,12 @@ import __builtin__
 import contextlib
 import functools
 import gc
+import os
+import struct
+import subprocess
 import sys
+import time
+import traceback
 import types
 import unittest
 import weakref
@@ -44,6 +49,28 @@ def set_jit_control(new_level):
         _llvm.set_jit_control(orig_level)
 
 
+@contextlib.contextmanager
+def set_background_compile(on):
+    orig = _llvm.get_background_compile()
+    _llvm.set_background_compile(on)
+    try:
+        yield
+    finally:
+        _llvm.wait_for_background_compiles()
+        _llvm.set_background_compile(orig)
+
+
+@contextlib.contextmanager
+def set_tiered_compile(on):
+    orig = _llvm.get_tiered_compile()
+    _llvm.set_tiered_compile(on)
+    try:
+        yield
+    finally:
+        _llvm.wait_for_background_compiles()
+        _llvm.set_tiered_compile(orig)
+
+
 def at_each_optimization_level(func):
     """Decorator for test functions, to run them at each optimization level."""
     levels = [None, -1, 0, 1, 2]
@@ -2490,11 +2517,11 @@ def foo():
         self.assertFalse(foo.__code__.co_use_jit)
         foo()
 
-        # +1 point each for 1e6 loop iterations.
-        hotness = HOTNESS_CALL + HOTNESS_LOOP * 1000000
+        # +1 point for each loop iteration, until the loop gets hot enough to
+        # switch to machine code through on-stack replacement.  The machine
+        # code doesn't count backedges.
+        hotness = _llvm.get_hotness_threshold() + HOTNESS_LOOP
         self.assertEqual(foo.__code__.co_hotness, hotness)
-
-        foo()  # Hot-or-not calculations are done on function-entry.
         self.assertTrue(foo.__code__.co_use_jit)
 
     def test_nested_for_loop_hotness(self):
@@ -2529,8 +2556,12 @@ def foo():
         self.assertFalse(foo.__code__.co_use_jit)
         foo()
 
-        hotness = HOTNESS_CALL + HOTNESS_LOOP * 1000000
+        # The conditional backedge threaded straight to the loop header
+        # counts, and can trigger on-stack replacement, just like the
+        # JUMP_ABSOLUTE.
+        hotness = _llvm.get_hotness_threshold() + HOTNESS_LOOP
         self.assertEqual(foo.__code__.co_hotness, hotness)
+        self.assertTrue(foo.__code__.co_use_jit)
 
     def test_early_for_loop_exit_hotness(self):
         # Make sure we understand how the hotness model counts early exits from
@@ -2561,8 +2592,91 @@ def foo():
         self.assertFalse(foo.__code__.co_use_jit)
         foo()
 
-        hotness = HOTNESS_CALL + HOTNESS_LOOP * 1000000
+        hotness = _llvm.get_hotness_threshold() + HOTNESS_LOOP
+        self.assertEqual(foo.__code__.co_hotness, hotness)
+        self.assertTrue(foo.__code__.co_use_jit)
+
+    def test_short_loop_hotness(self):
+        # Loops that don't get hot are left in the eval loop.
+        foo = compile_for_llvm("foo", """
+def foo():
+    for x in xrange(1000):
+        pass
+""", optimization_level=None)
+        foo()
+        hotness = HOTNESS_CALL + HOTNESS_LOOP * 1000
         self.assertEqual(foo.__code__.co_hotness, hotness)
+        self.assertFalse(foo.__code__.co_use_jit)
+
+    def test_osr_preserves_frame_state(self):
+        # The loop gets hot halfway through the only call to foo().  The
+        # machine code has to pick up the locals, the value stack (the outer
+        # loop's iterator) and the block stack from the eval loop.
+        foo = compile_for_llvm("foo", """
+def foo(n):
+    total = 0
+    seen = []
+    for i in xrange(n):
+        for j in xrange(3):
+            try:
+                total += i * j
+            except ZeroDivisionError:
+                pass
+        if i % 100000 == 0:
+            seen.append(i)
+    return total, seen
+""", optimization_level=None)
+        n = _llvm.get_hotness_threshold()
+        total, seen = foo(n)
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertEqual(total, 3 * n * (n - 1) / 2)
+        self.assertEqual(seen, range(0, n, 100000))
+
+    def test_osr_break_and_exception(self):
+        foo = compile_for_llvm("foo", """
+def foo(n, stop):
+    i = 0
+    while True:
+        i += 1
+        if i == stop:
+            break
+    if i == n:
+        raise ValueError(i)
+    return i
+""", optimization_level=None)
+        stop = _llvm.get_hotness_threshold() * 2
+        self.assertEqual(foo(-1, stop), stop)
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertRaises(ValueError, foo, stop, stop)
+
+    def test_osr_disabled_by_jit_control(self):
+        foo = compile_for_llvm("foo", """
+def foo():
+    for x in xrange(1000000):
+        pass
+""", optimization_level=None)
+        with set_jit_control("never"):
+            foo()
+        self.assertEqual(foo.__code__.co_hotness,
+                         HOTNESS_CALL + HOTNESS_LOOP * 1000000)
+        self.assertFalse(foo.__code__.co_use_jit)
+
+    def test_osr_gives_up_when_codegen_refuses(self):
+        # Code using exec can't be compiled.  Once that's known, later loop
+        # iterations must not keep trying.
+        foo = compile_for_llvm("foo", """
+def foo(n):
+    exec ""
+    for x in xrange(n):
+        pass
+""", optimization_level=None)
+        foo(_llvm.get_hotness_threshold() + 10)
+        self.assertFalse(foo.__code__.co_use_jit)
+        self.assertEqual(foo.__code__.co_fatalbailcount,
+                         _llvm.get_max_fatal_bail_count())
+        self.assertEqual(foo.__code__.co_optimization, -1)
+        foo(10)
+        self.assertFalse(foo.__code__.co_use_jit)
 
     def test_generator_hotness(self):
         foo = compile_for_llvm("foo", """
@@ -2754,11 +2868,20 @@ def foo():
         sys.setbailerror(False)
         self.assertEqual(foo(lambda x: 7), 7)
 
-    def test_guard_failure_blocks_native_code(self):
-        # Until we can recompile things, failing a guard should force use of the
-        # eval loop forever after. Even once we can recompile things, we should
-        # limit how often we're willing to recompile highly-dynamic functions.
-        # test_mutants has a good example of this.
+    def spin_until_recompiled(self, func, *args):
+        # After a fatal guard failure, code has to get twice as hot as it did
+        # the time before to be compiled again.
+        threshold = _llvm.get_hotness_threshold()
+        limit = (threshold << func.__code__.co_fatalbailcount) / HOTNESS_CALL
+        with set_jit_control("whenhot"):
+            for _ in xrange(limit + 1000):
+                func(*args)
+                if func.__code__.co_use_jit:
+                    break
+
+    def test_guard_failure_recompiles(self):
+        # Failing a guard throws away the machine code, but once the code
+        # gets hot again, we recompile it under the new assumptions.
 
         # Compile like this so we get a new code object every time.
         foo = compile_for_llvm("foo", "def foo(): return len([])",
@@ -2771,12 +2894,40 @@ def foo():
         with test_support.swap_attr(__builtin__, "len", lambda x: 7):
             self.assertEqual(foo.__code__.co_use_jit, False)
             self.assertEqual(foo.__code__.co_fatalbailcount, 1)
-            # Since we can't recompile things yet, co_use_jit should be left
-            # at False and execution should use the eval loop.
+            self.assertEqual(foo.__code__.co_hotness, 0)
+            self.assertEqual(foo.__code__.co_llvm, None)
+            # Getting as hot as it was the first time isn't enough.
             spin_until_hot(foo, [])
             self.assertEqual(foo.__code__.co_use_jit, False)
             self.assertEqual(foo(), 7)
 
+            self.spin_until_recompiled(foo)
+            self.assertEqual(foo.__code__.co_use_jit, True)
+            self.assertEqual(foo.__code__.co_fatalbailcount, 1)
+            sys.setbailerror(True)
+            try:
+                self.assertEqual(foo(), 7)
+            finally:
+                sys.setbailerror(False)
+
+    def test_guard_failures_block_native_code(self):
+        # We limit how often we're willing to recompile highly-dynamic
+        # functions.  test_mutants has a good example of this.
+        foo = compile_for_llvm("foo", "def foo(): return len([])",
+                               optimization_level=None)
+        max_bails = _llvm.get_max_fatal_bail_count()
+        for i in range(max_bails):
+            self.spin_until_recompiled(foo)
+            self.assertEqual(foo.__code__.co_use_jit, True)
+            with test_support.swap_attr(__builtin__, "len", lambda x: i):
+                self.assertEqual(foo.__code__.co_fatalbailcount, i + 1)
+        self.assertEqual(foo.__code__.co_use_jit, False)
+
+        # The eval loop is used forever after.
+        self.spin_until_recompiled(foo)
+        self.assertEqual(foo.__code__.co_use_jit, False)
+        self.assertEqual(foo(), 0)
+
     def test_fast_calls_method(self):
         # This used to crash at one point while developing CALL_FUNCTION's
         # FDO-ified machine code. We include it here as a simple regression
@@ -3039,6 +3190,209 @@ def foo():
         self.assertEqual(mul_float_int(float(sys.maxint), sys.maxint),
                          float(sys.maxint) * sys.maxint)
 
+    def test_unboxed_arithmetic(self):
+        # Intermediate results and locals stay unboxed within a basic block;
+        # make sure they're boxed correctly whenever they escape.
+        foo = compile_for_llvm('foo', """
+def foo(a, b, c):
+    x = a * b + c
+    y = x - 1
+    if y < x:
+        return (a + b) * (x + y)
+    return x
+""", optimization_level=None)
+        spin_until_hot(foo, [2, 3, 4])
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertEqual(foo(2, 3, 4), 95)
+        self.assertEqual(foo(-2, 3, 0), -13)
+
+        # The first of these bails with an unboxed a * b on the stack.
+        self.assertRaises(RuntimeError, foo, 2, 3, 4.0)
+        self.assertRaises(RuntimeError, foo, sys.maxint, 2, 0)
+
+        sys.setbailerror(False)
+        self.assertEqual(foo(2, 3, 4.0), 95.0)
+        self.assertEqual(type(foo(2, 3, 4.0)), float)
+        x = sys.maxint * 2
+        self.assertEqual(foo(sys.maxint, 2, 0),
+                         (long(sys.maxint) + 2) * (x + x - 1))
+
+    def test_unboxed_float_loop(self):
+        foo = compile_for_llvm('foo', """
+def foo(n, step):
+    total = 0.0
+    i = 0
+    while i < n:
+        total += (i + 1) / step
+        i += 1
+    return total, i
+""", optimization_level=None)
+        spin_until_hot(foo, [3, 0.5])
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertEqual(foo(3, 0.5), (12.0, 3))
+        self.assertEqual(foo(0, 0.5), (0.0, 0))
+        self.assertEqual(foo(2, -2.0), (-1.5, 2))
+
+        nan = float("nan")
+        compare = compile_for_llvm('compare', """
+def compare(a, b):
+    return [a == b, a != b, a < b, a <= b, a > b, a >= b]
+""", optimization_level=None)
+        spin_until_hot(compare, [1.0, 2.0])
+        self.assertTrue(compare.__code__.co_use_jit)
+        self.assertEqual(compare(1.0, 2.0),
+                         [False, True, True, True, False, False])
+        self.assertEqual(compare(2.0, 2.0),
+                         [True, False, False, True, False, True])
+        self.assertEqual(compare(nan, nan),
+                         [False, True, False, False, False, False])
+
+        sys.setbailerror(False)
+        self.assertRaises(ZeroDivisionError, foo, 1, 0.0)
+        self.assertEqual(compare(1, 2.0),
+                         [False, True, True, True, False, False])
+
+    def test_unboxed_identity_and_containment(self):
+        # is, is not, in and not in leave a raw bool for the jump that
+        # follows them, and box it when it's used as a value.
+        foo = compile_for_llvm('foo', """
+def foo(x, d):
+    result = []
+    if x is None:
+        result.append("none")
+    if x is not None:
+        result.append("some")
+    if x in d:
+        result.append("in")
+    if x not in d:
+        result.append("not in")
+    try:
+        d[x]
+    except KeyError:
+        result.append("missing")
+    result.append(x in d)
+    result.append(x is None)
+    return result
+""", optimization_level=None)
+        spin_until_hot(foo, [1, {1: 2}], [None, {}])
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertEqual(foo(None, {}),
+                         ["none", "not in", "missing", False, True])
+        self.assertEqual(foo(1, {1: 2}), ["some", "in", True, False])
+        self.assertEqual(foo(1, {2: 3}),
+                         ["some", "not in", "missing", False, False])
+
+    def test_for_iter_list(self):
+        foo = compile_for_llvm('foo', """
+def foo(seq):
+    result = []
+    for x in seq:
+        result.append(x)
+        if x == "shrink":
+            del seq[:]
+    return result
+""", optimization_level=None)
+        spin_until_hot(foo, [[1, 2]])
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertEqual(foo([1, "a", None]), [1, "a", None])
+        self.assertEqual(foo([]), [])
+        self.assertEqual(foo(["shrink", 2, 3]), ["shrink"])
+        # Other iterators fail the type guard.
+        self.assertRaises(RuntimeError, foo, (1, 2))
+        sys.setbailerror(False)
+        self.assertEqual(foo((1, 2)), [1, 2])
+        self.assertEqual(foo(iter([1, 2])), [1, 2])
+
+    def test_for_iter_tuple(self):
+        foo = compile_for_llvm('foo', """
+def foo(seq):
+    total = 0
+    for x in seq:
+        total += x
+    return total
+""", optimization_level=None)
+        spin_until_hot(foo, [(1, 2)])
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertEqual(foo((1, 2, 3)), 6)
+        self.assertEqual(foo(()), 0)
+        self.assertRaises(RuntimeError, foo, [1, 2])
+        sys.setbailerror(False)
+        self.assertEqual(foo([1, 2]), 3)
+
+    def test_for_iter_xrange(self):
+        foo = compile_for_llvm('foo', """
+def foo(r):
+    total = 0
+    for i in r:
+        total += i * 2
+    return total, i
+""", optimization_level=None)
+        spin_until_hot(foo, [xrange(3)])
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertEqual(foo(xrange(10)), (90, 9))
+        # Negative steps: 2 * (5 + 2 - 1 - 4) and 2 * (0 - 2 - 4).
+        self.assertEqual(foo(xrange(5, -5, -3)), (4, -4))
+        self.assertEqual(foo(xrange(0, -6, -2)), (-12, -4))
+        self.assertRaises(UnboundLocalError, foo, xrange(0))
+        # The loop variable escapes boxed, and overflow in the unboxed
+        # arithmetic bails.
+        big = xrange(sys.maxint - 1, sys.maxint)
+        self.assertRaises(RuntimeError, foo, big)
+        sys.setbailerror(False)
+        self.assertEqual(foo(big),
+                         (2 * (sys.maxint - 1), sys.maxint - 1))
+        self.assertEqual(foo([1, 2]), (6, 2))
+
+    def test_unpack_built_sequence(self):
+        # The peephole optimizer leaves these alone because they have more
+        # than three items.  The JIT skips building the sequences.
+        foo = compile_for_llvm('foo', """
+def foo(a, b, c, d):
+    a, b, c, d = d, c, b, a
+    [w, x, y, z] = [a, b, c, d]
+    return a, b, c, d, w, x, y, z
+""", optimization_level=JIT_OPT_LEVEL)
+        self.assertEqual(foo(1, 2, 3, 4), (4, 3, 2, 1, 4, 3, 2, 1))
+        item = object()
+        refcount = sys.getrefcount(item)
+        foo(item, item, item, item)
+        self.assertEqual(sys.getrefcount(item), refcount)
+
+    def test_inline_python_call(self):
+        add_one = compile_for_llvm('add_one', """
+def add_one(x):
+    return x + 1
+""", optimization_level=None)
+        foo = compile_for_llvm('foo', """
+def foo(f, x):
+    return f(x) * 2
+""", optimization_level=None)
+        # The callee needs machine code of its own before it gets inlined.
+        spin_until_hot(add_one, [1])
+        spin_until_hot(foo, [add_one, 1])
+        self.assertTrue(add_one.__code__.co_use_jit)
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertEqual(foo(add_one, 5), 12)
+
+        # The inlined callee still runs in a frame of its own, even when it
+        # bails to the interpreter.
+        sys.setbailerror(False)
+        try:
+            foo(add_one, None)
+        except TypeError:
+            tb = traceback.extract_tb(sys.exc_info()[2])
+            self.assertEqual([entry[2] for entry in tb[-2:]],
+                             ["foo", "add_one"])
+        else:
+            self.fail("TypeError not raised")
+
+        # Calling a different function fails the guard.
+        sub_one = lambda x: x - 1
+        sys.setbailerror(True)
+        self.assertRaises(RuntimeError, foo, sub_one, 5)
+        sys.setbailerror(False)
+        self.assertEqual(foo(sub_one, 5), 8)
+
     def getitem_inlining_test(self, getitem_type):
         # Test BINARY_SUBSCR specialization for indexing a sequence with an int.
         foo = compile_for_llvm('foo', 'def foo(a, b): return a[b]',
@@ -3512,10 +3866,9 @@ def foo():
         # If we get here, we haven't bailed, but double-check to be sure.
         self.assertTrue(foo.__code__.co_use_jit)
 
-    def test_load_attr_fast_bails(self):
-        # Test that this simple object uses fast attribute lookup.  We do this
-        # by checking that it bails when we stick a descriptor on the class for
-        # that attribute.
+    def test_load_attr_fast_new_type_uses_generic_path(self):
+        # Objects of a type the feedback hasn't seen get the generic
+        # attribute lookup rather than bailing.
         class C(object):
             def __init__(self, foo=0):
                 self.foo = foo
@@ -3526,22 +3879,59 @@ def foo():
         spin_until_hot(get_foo, [c])
         self.assertTrue(get_foo.__code__.co_use_jit)
 
-        # Check that the code bails correctly by passing an argument of another
-        # type.
         class D(object):
             def __init__(self):
                 self.foo = -1
         d = D()
         sys.setbailerror(True)
-        self.assertRaises(RuntimeError, get_foo, d)
+        self.assertEqual(get_foo(d), -1)
+        self.assertEqual(get_foo(C(foo=-2)), -2)
+        self.assertRaises(AttributeError, get_foo, object())
+        self.assertTrue(get_foo.__code__.co_use_jit)
+
+    def test_load_attr_fast_polymorphic(self):
+        # Up to three receiver types get their own cache entries.
+        class Base(object):
+            def __init__(self, foo):
+                self.foo = foo
+        class Sub1(Base):
+            pass
+        class Sub2(Base):
+            @property
+            def foo(self):
+                return -self.__dict__["foo"]
+            @foo.setter
+            def foo(self, value):
+                self.__dict__["foo"] = value
+        def get_foo(c):
+            return c.foo
 
-        # Check that another object of the same type doesn't bail.
-        c2 = C(foo=-1)
-        self.assertEqual(get_foo(c2), -1)
+        spin_until_hot(get_foo, [Base(1)], [Sub1(2)], [Sub2(3)])
+        self.assertTrue(get_foo.__code__.co_use_jit)
+        sys.setbailerror(True)
+        self.assertEqual(get_foo(Base(4)), 4)
+        self.assertEqual(get_foo(Sub1(5)), 5)
+        self.assertEqual(get_foo(Sub2(6)), -6)
 
-        # Check that even though it bails, it gets the right answer.
+        # Each entry is invalidated along with its type.
+        Sub1.foo = property(lambda self: "new")
+        self.assertFalse(get_foo.__code__.co_use_jit)
         sys.setbailerror(False)
-        self.assertEqual(get_foo(d), -1)
+        self.assertEqual(get_foo(Sub1(7)), "new")
+
+    def test_load_attr_megamorphic_not_specialized(self):
+        classes = [type("C%d" % i, (object,), {"foo": i}) for i in range(5)]
+        def get_foo(c):
+            return c.foo
+        spin_until_hot(get_foo, *[[cls()] for cls in classes])
+        self.assertTrue(get_foo.__code__.co_use_jit)
+        sys.setbailerror(True)
+        for i, cls in enumerate(classes):
+            self.assertEqual(get_foo(cls()), i)
+        # The code doesn't depend on any of the types.
+        classes[0].foo = 10
+        self.assertTrue(get_foo.__code__.co_use_jit)
+        self.assertEqual(get_foo(classes[0]()), 10)
 
     def test_load_attr_fast_new_descriptor_invalidates(self):
         # Test that this simple object uses fast attribute lookup.  We do this
@@ -3854,7 +4244,7 @@ def foo():
         self.assertEqual(get_foo(c), 2)
         self.assertFalse(get_foo.__code__.co_use_jit)
 
-    def test_store_attr_fast_bails(self):
+    def test_store_attr_fast_new_type_uses_generic_path(self):
         class C(object):
             pass
         c = C()
@@ -3862,15 +4252,28 @@ def foo():
             o.foo = x
         spin_until_hot(set_attr, [c, 0])
 
-        # Check that this bails properly when called on itself, a function.
-        self.assertRaises(RuntimeError, set_attr, set_attr, 1)
-
-        # Check that when it bails, it does the correct thing.
-        sys.setbailerror(False)
+        # Calling it on itself, a function, takes the generic path.
+        sys.setbailerror(True)
         set_attr(set_attr, 1)
         self.assertEqual(set_attr.foo, 1)
         set_attr(set_attr, 2)
         self.assertEqual(set_attr.foo, 2)
+        self.assertRaises(AttributeError, set_attr, 5, 0)
+
+    def test_store_attr_fast_polymorphic(self):
+        class C(object):
+            pass
+        class D(object):
+            __slots__ = ("foo",)
+        def set_attr(o, x):
+            o.foo = x
+        spin_until_hot(set_attr, [C(), 0], [D(), 0])
+        self.assertTrue(set_attr.__code__.co_use_jit)
+        sys.setbailerror(True)
+        c, d = C(), D()
+        set_attr(c, 1)
+        set_attr(d, 2)
+        self.assertEqual((c.foo, d.foo), (1, 2))
 
     def test_store_attr_fast_invalidates(self):
         class C(object):
@@ -4206,6 +4609,33 @@ def foo(l):
         D.bar = C.__dict__["bar"]
         d.bar()  # This should not raise.
 
+    def test_polymorphic_methods(self):
+        class Base(object):
+            def bar(self):
+                return 1
+        class C(Base):
+            pass
+        class D(Base):
+            def bar(self):
+                return 2
+        class E(object):
+            def bar(self):
+                return 3
+        foo = compile_for_llvm("foo", "def foo(c): return c.bar()",
+                               optimization_level=None)
+        spin_until_hot(foo, [Base()], [C()], [D()])
+        self.assertTrue(foo.__code__.co_use_jit)
+        sys.setbailerror(True)
+        self.assertEqual([foo(Base()), foo(C()), foo(D())], [1, 1, 2])
+        # Types we haven't seen get the method looked up the slow way.
+        self.assertEqual(foo(E()), 3)
+
+        # Replacing a method invalidates the code.
+        C.bar = lambda self: 4
+        self.assertFalse(foo.__code__.co_use_jit)
+        sys.setbailerror(False)
+        self.assertEqual(foo(C()), 4)
+
     def test_object_attrs(self):
         # Test that we don't optimize method access to an object attribute,
         # even though it looks like a method access.
@@ -4333,6 +4763,25 @@ class LlvmRebindBuiltinsTests(test_dynamic.RebindBuiltinsTests):
         with test_support.swap_attr(__builtin__, "len", lambda x: 7):
             self.assertEqual(foo.__code__.co_use_jit, False)
 
+    def test_changing_unrelated_names_keeps_function(self):
+        foo = compile_for_llvm("foo", "def foo(): return len(range(3))",
+                               optimization_level=None)
+        self.configure_func(foo)
+        self.assertEqual(foo.__code__.co_use_jit, True)
+
+        # foo() only depends on the names it loads.
+        with test_support.swap_item(globals(), "unrelated", 7):
+            self.assertEqual(foo.__code__.co_use_jit, True)
+        with test_support.swap_attr(__builtin__, "unrelated", 7):
+            self.assertEqual(foo.__code__.co_use_jit, True)
+        self.assertEqual(foo(), 3)
+        self.assertEqual(foo.__code__.co_fatalbailcount, 0)
+
+        # A new global shadowing one of the builtins it loads does count.
+        with test_support.swap_item(globals(), "range", lambda x: [x]):
+            self.assertEqual(foo.__code__.co_use_jit, False)
+            self.assertEqual(foo(), 1)
+
     def test_nondict_builtins_class(self):
         # Regression test: this used to trigger a fatal assertion when trying
         # to watch an instance of D; assertions from pure-Python code are a
@@ -4378,6 +4827,388 @@ class SetJitControlTests(LlvmTestCase):
         self.assertRaises(ValueError, _llvm.set_jit_control, "asdf")
 
 
+class BackgroundCompileTests(LlvmTestCase):
+
+    def test_get_set(self):
+        with set_background_compile(True):
+            self.assertTrue(_llvm.get_background_compile())
+            with set_background_compile(False):
+                self.assertFalse(_llvm.get_background_compile())
+            self.assertTrue(_llvm.get_background_compile())
+
+    def test_nothing_pending(self):
+        self.assertEqual(_llvm.wait_for_background_compiles(), 0)
+
+    def test_hot_function_compiled_in_background(self):
+        foo = compile_for_llvm("foo", """
+def foo(x):
+    return x + 1
+""", optimization_level=None)
+        with set_background_compile(True):
+            self.assertEqual(spin_until_hot(foo, [1])[-1], 2)
+            _llvm.wait_for_background_compiles()
+            self.assertTrue(foo.__code__.co_use_jit)
+            self.assertEqual(foo.__code__.co_optimization, JIT_OPT_LEVEL)
+            self.assertEqual(foo(5), 6)
+
+    def test_hot_loop_enters_background_compiled_code(self):
+        # The loop gets hot and queues foo, then keeps running in the eval
+        # loop.  Backing off between OSR attempts mustn't stop it from
+        # switching to the machine code once that's published.
+        foo = compile_for_llvm("foo", """
+def foo(n, wait_at, wait):
+    total = 0
+    for i in xrange(n):
+        if i == wait_at:
+            wait()
+        total += i
+    return total
+""", optimization_level=None)
+        wait_at = _llvm.get_hotness_threshold() + 10
+        n = wait_at + 100000
+        with set_background_compile(True):
+            self.assertEqual(
+                foo(n, wait_at, _llvm.wait_for_background_compiles),
+                n * (n - 1) / 2)
+        self.assertTrue(foo.__code__.co_use_jit)
+        # Machine code doesn't count backedges, so the hotness shows that
+        # the loop didn't finish in the eval loop.
+        self.assertTrue(foo.__code__.co_hotness <
+                        HOTNESS_CALL + HOTNESS_LOOP * n)
+
+    def test_stale_globals_not_published(self):
+        # Whether the globals change before or after the compile thread
+        # publishes the machine code, foo must end up back in the
+        # interpreter.
+        foo = compile_for_llvm("foo", """
+def foo():
+    return len([])
+""", optimization_level=None, globals_dict={})
+        with set_background_compile(True):
+            spin_until_hot(foo)
+            foo.func_globals["len"] = lambda x: 7
+            _llvm.wait_for_background_compiles()
+            self.assertFalse(foo.__code__.co_use_jit)
+            self.assertEqual(foo.__code__.co_fatalbailcount, 1)
+            self.assertEqual(foo(), 7)
+
+    def test_set_compile_threads(self):
+        old_threads = _llvm.get_compile_threads()[0]
+        try:
+            _llvm.set_compile_threads(3)
+            self.assertEqual(_llvm.get_compile_threads()[0], 3)
+            self.assertRaises(ValueError, _llvm.set_compile_threads, 0)
+            self.assertEqual(_llvm.get_compile_threads()[0], 3)
+        finally:
+            _llvm.set_compile_threads(old_threads)
+
+    def test_compile_on_several_threads(self):
+        funcs = [compile_for_llvm("foo", """
+def foo(x):
+    return x + %d
+""" % i, optimization_level=None) for i in range(4)]
+        old_threads = _llvm.get_compile_threads()[0]
+        try:
+            _llvm.set_compile_threads(4)
+            with set_background_compile(True):
+                for func in funcs:
+                    spin_until_hot(func, [1])
+                self.assertTrue(1 <= _llvm.get_compile_threads()[1] <= 4)
+                _llvm.wait_for_background_compiles()
+        finally:
+            _llvm.set_compile_threads(old_threads)
+        for i, func in enumerate(funcs):
+            self.assertTrue(func.__code__.co_use_jit)
+            self.assertEqual(func(5), 5 + i)
+
+
+class TieredCompileTests(LlvmTestCase):
+
+    def test_get_set(self):
+        with set_tiered_compile(True):
+            self.assertTrue(_llvm.get_tiered_compile())
+            with set_tiered_compile(False):
+                self.assertFalse(_llvm.get_tiered_compile())
+            self.assertTrue(_llvm.get_tiered_compile())
+
+    def test_baseline_then_full(self):
+        foo = compile_for_llvm("foo", """
+def foo(x):
+    return x + 1
+""", optimization_level=None)
+        with set_tiered_compile(True):
+            spin_until_hot(foo, [1])
+            self.assertTrue(foo.__code__.co_use_jit)
+            self.assertEqual(foo.__code__.co_optimization, 0)
+
+            remaining = _llvm.get_tier_up_threshold() - foo.__code__.co_hotness
+            for _ in xrange(remaining // HOTNESS_CALL + 2):
+                self.assertEqual(foo(1), 2)
+            _llvm.wait_for_background_compiles()
+            self.assertEqual(foo.__code__.co_optimization, JIT_OPT_LEVEL)
+            self.assertEqual(foo(5), 6)
+
+    def test_baseline_loops_count_hotness(self):
+        foo = compile_for_llvm("foo", """
+def foo(n):
+    total = 0
+    for i in xrange(n):
+        total += i
+    return total
+""", optimization_level=None)
+        with set_tiered_compile(True):
+            spin_until_hot(foo, [0])
+            self.assertEqual(foo.__code__.co_optimization, 0)
+            hotness = foo.__code__.co_hotness
+            self.assertEqual(foo(1000), 499500)
+            self.assertTrue(foo.__code__.co_hotness >=
+                            hotness + 1000 * HOTNESS_LOOP)
+
+    def test_tier_up_from_running_frame(self):
+        # The baseline machine code must survive being replaced while a
+        # frame is still running it.
+        foo = compile_for_llvm("foo", """
+def foo(n, callback):
+    if n:
+        callback()
+        return foo(n - 1, callback)
+    return 0
+""", optimization_level=None)
+        # foo must see the same callback throughout, or its call guard fails.
+        should_tier_up = [False]
+        def callback():
+            if should_tier_up[0]:
+                should_tier_up[0] = False
+                remaining = (_llvm.get_tier_up_threshold() -
+                             foo.__code__.co_hotness)
+                for _ in xrange(remaining // HOTNESS_CALL + 2):
+                    foo(0, callback)
+                _llvm.wait_for_background_compiles()
+        with set_tiered_compile(True):
+            spin_until_hot(foo, [1, callback])
+            self.assertEqual(foo.__code__.co_optimization, 0)
+            should_tier_up[0] = True
+            self.assertEqual(foo(3, callback), 0)
+            self.assertEqual(foo.__code__.co_optimization, JIT_OPT_LEVEL)
+
+
+class JitCacheTests(unittest.TestCase):
+
+    SCRIPT = """
+import _llvm
+def foo():
+    return len([])
+print foo.__code__.co_hotness > 0,
+print foo.__code__.co_fatalbailcount,
+for _ in xrange(%d):
+    foo()
+print foo.__code__.co_use_jit,
+for _ in xrange(%d):
+    foo()
+print foo.__code__.co_use_jit,
+if %r:
+    len = lambda x: 7
+    print foo(),
+"""
+
+    def tearDown(self):
+        test_support.unlink(test_support.TESTFN)
+
+    def run_script(self, invalidate=False):
+        # A tenth of the calls that make fresh code hot is plenty for code
+        # the cache knows.
+        warmup = JIT_SPIN_COUNT // 10
+        script = self.SCRIPT % (warmup, JIT_SPIN_COUNT, invalidate)
+        process = subprocess.Popen(
+            [sys.executable, "-Xjit=whenhot",
+             "-Xjitcache=" + test_support.TESTFN, "-c", script],
+            stdout=subprocess.PIPE)
+        output = process.communicate()[0]
+        self.assertEqual(process.returncode, 0)
+        return output.split()
+
+    def test_hot_code_compiled_after_warmup(self):
+        self.assertEqual(self.run_script(), ["False", "0", "False", "True"])
+        # The cached code isn't compiled right away, so it can record
+        # feedback first, but it doesn't have to get hot from scratch.
+        self.assertEqual(self.run_script(), ["True", "0", "True", "True"])
+
+    def test_invalidated_code_not_marked_hot(self):
+        # Code whose machine code was invalidated has to get hot again the
+        # usual way, since it will probably be invalidated again.
+        self.assertEqual(self.run_script(invalidate=True),
+                         ["False", "0", "False", "True", "7"])
+        with open(test_support.TESTFN) as cache:
+            records = cache.readlines()[1:]
+        self.assertTrue(records)
+        self.assertTrue(all(record.startswith("I ") for record in records),
+                        records)
+        self.assertEqual(self.run_script(), ["False", "0", "False", "True"])
+
+    def test_fatal_bails_remembered(self):
+        self.run_script(invalidate=True)
+        # Pretend foo used up all its fatal bails.
+        with open(test_support.TESTFN) as cache:
+            lines = cache.readlines()
+        with open(test_support.TESTFN, "w") as cache:
+            cache.write(lines[0])
+            for line in lines[1:]:
+                cache.write("F" + line[1:])
+        self.assertEqual(self.run_script(),
+                         ["False", str(_llvm.get_max_fatal_bail_count()),
+                          "False", "False"])
+
+    def test_other_builds_ignored(self):
+        with open(test_support.TESTFN, "w") as cache:
+            cache.write("unladen-jit-cache 0 some other build\n")
+        self.assertEqual(self.run_script(), ["False", "0", "False", "True"])
+        with open(test_support.TESTFN) as cache:
+            self.assertNotEqual(cache.readline(),
+                                "unladen-jit-cache 0 some other build\n")
+
+
+class JitProfileTests(unittest.TestCase):
+
+    SCRIPT = """
+import _llvm, sys
+def foo(x):
+    return x.upper()
+print foo.__code__.co_hotness > _llvm.get_hotness_threshold(),
+for _ in xrange(%d):
+    foo("a")
+sys.setbailerror(True)
+try:
+    foo(u"a")
+except RuntimeError:
+    print "bailed",
+else:
+    print "ok",
+"""
+
+    def tearDown(self):
+        test_support.unlink(test_support.TESTFN)
+
+    def run_script(self, spins):
+        process = subprocess.Popen(
+            [sys.executable, "-Xjit=whenhot",
+             "-Xjitprofile=" + test_support.TESTFN, "-c",
+             self.SCRIPT % spins],
+            stdout=subprocess.PIPE)
+        output = process.communicate()[0]
+        self.assertEqual(process.returncode, 0)
+        return output.split()
+
+    def write_profile(self, *lines):
+        with open(test_support.TESTFN, "w") as profile:
+            for line in lines:
+                profile.write(line + "\n")
+
+    def header(self):
+        _llvm.dump_feedback(test_support.TESTFN)
+        with open(test_support.TESTFN) as profile:
+            return profile.readline().rstrip("\n")
+
+    def test_hotness_and_feedback_restored(self):
+        self.assertEqual(self.run_script(JIT_SPIN_COUNT), ["False", "bailed"])
+        # foo is compiled on its first call, and is already specialized on
+        # str.upper even though it has never seen a str in this process.
+        self.assertEqual(self.run_script(0), ["True", "bailed"])
+
+    def test_dump_writes_header(self):
+        self.assertTrue(self.header().startswith("unladen-jit-profile 1 "))
+
+    def test_load(self):
+        header = self.header()
+        self.write_profile(header, "code 5 0 1 <no such file>",
+                           "3 0 counters 1 2 3")
+        self.assertEqual(_llvm.load_feedback(test_support.TESTFN), 1)
+
+    def test_other_builds_ignored(self):
+        self.write_profile("unladen-jit-profile 0 some other build",
+                           "code 5 0 1 <no such file>")
+        self.assertEqual(_llvm.load_feedback(test_support.TESTFN), 0)
+
+    def test_malformed(self):
+        self.write_profile(self.header(), "3 0 counters 1 2 3")
+        self.assertRaises(ValueError, _llvm.load_feedback,
+                          test_support.TESTFN)
+        self.write_profile(self.header(), "code 5 0 1 <no such file>",
+                           "x 0 counters")
+        self.assertRaises(ValueError, _llvm.load_feedback,
+                          test_support.TESTFN)
+
+    def test_missing_file(self):
+        test_support.unlink(test_support.TESTFN)
+        self.assertRaises(IOError, _llvm.load_feedback, test_support.TESTFN)
+
+
+class PerfMapTests(unittest.TestCase):
+
+    SCRIPT = """
+import _llvm, os
+_llvm.set_perf_map(True)
+_llvm.set_jitdump(%r)
+def foo():
+    return 1
+foo.__code__.co_use_jit = True
+foo()
+_llvm.set_jitdump(False)
+print os.getpid()
+"""
+
+    def setUp(self):
+        self.outputs = []
+
+    def tearDown(self):
+        for path in self.outputs:
+            test_support.unlink(path)
+
+    def run_script(self, jitdump=False):
+        process = subprocess.Popen(
+            [sys.executable, "-Xjit=whenhot", "-c", self.SCRIPT % jitdump],
+            stdout=subprocess.PIPE)
+        output = process.communicate()[0]
+        self.assertEqual(process.returncode, 0)
+        pid = int(output)
+        self.outputs += ["/tmp/perf-%d.map" % pid, "/tmp/jit-%d.dump" % pid]
+        return self.outputs[-2:]
+
+    def test_get_set(self):
+        self.outputs.append("/tmp/perf-%d.map" % os.getpid())
+        self.assertFalse(_llvm.get_perf_map())
+        _llvm.set_perf_map(True)
+        try:
+            self.assertTrue(_llvm.get_perf_map())
+        finally:
+            _llvm.set_perf_map(False)
+        self.assertFalse(_llvm.get_perf_map())
+
+    def test_perf_map_names_python_functions(self):
+        perf_map, _ = self.run_script()
+        with open(perf_map) as map_file:
+            entries = [line.rstrip("\n").split(" ", 2) for line in map_file]
+        foo_entries = [entry for entry in entries
+                       if entry[2] == "py::foo:<string>:5"]
+        self.assertEqual(len(foo_entries), 1, entries)
+        start, size, _ = foo_entries[0]
+        self.assertTrue(int(start, 16) > 0)
+        self.assertTrue(int(size, 16) > 0)
+
+    if sys.platform.startswith("linux"):
+        def test_jitdump(self):
+            _, jitdump_file = self.run_script(jitdump=True)
+            with open(jitdump_file, "rb") as dump:
+                data = dump.read()
+            magic, version, header_size = struct.unpack("=III", data[:12])
+            self.assertEqual(magic, 0x4A695444)
+            self.assertEqual(version, 1)
+            self.assertEqual(header_size, 40)
+            self.assertTrue("py::foo:<string>:5\0" in data)
+            # Turning the dump off writes JIT_CODE_CLOSE.
+            record_id, record_size, _ = struct.unpack("=IIQ", data[-16:])
+            self.assertEqual((record_id, record_size), (3, 16))
+
+
 def modify_code_object(code_obj, **changes):
     order = ["argcount", "nlocals", "stacksize", "flags", "code",
              "consts", "names", "varnames", "filename", "name",
@@ -4393,6 +5224,283 @@ def modify_code_object(code_obj, **changes):
     return types.CodeType(*members)
 
 
+class CodeMemoryTests(LlvmTestCase):
+
+    def compile_and_run(self):
+        foo = compile_for_llvm("foo", "def foo(x): return x + 1",
+                               optimization_level=JIT_OPT_LEVEL)
+        self.assertEqual(foo(1), 2)
+        return foo
+
+    def test_counts_live_code(self):
+        before = _llvm.get_live_code_bytes()
+        foo = self.compile_and_run()
+        self.assertTrue(_llvm.get_live_code_bytes() > before)
+        self.assertTrue(_llvm.get_ir_instruction_count() > 0)
+
+    def test_code_freed_with_code_object(self):
+        # The first compilation may also JIT runtime helpers, which stay.
+        self.compile_and_run()
+        code_bytes = _llvm.get_live_code_bytes()
+        instructions = _llvm.get_ir_instruction_count()
+        for _ in xrange(10):
+            self.compile_and_run()
+        self.assertEqual(_llvm.get_live_code_bytes(), code_bytes)
+        self.assertEqual(_llvm.get_ir_instruction_count(), instructions)
+
+    def test_code_budget_evicts_least_recently_used(self):
+        old_budget = _llvm.get_code_budget()
+        try:
+            # Start with as little machine code as we can.
+            _llvm.set_code_budget(1)
+            _llvm.set_code_budget(0)
+            baseline = _llvm.get_live_code_bytes()
+
+            bar = compile_for_llvm("bar", "def bar(x): return x + 2",
+                                   optimization_level=None)
+            foo = compile_for_llvm("foo", "def foo(x): return x + 1",
+                                   optimization_level=None)
+            spin_until_hot(bar, [1])
+            spin_until_hot(foo, [1])
+            self.assertTrue(bar.__code__.co_use_jit)
+            self.assertTrue(foo.__code__.co_use_jit)
+            bar_size = _llvm.get_code_size(bar.__code__)
+            foo_size = _llvm.get_code_size(foo.__code__)
+            self.assertTrue(bar_size > 0)
+            self.assertTrue(foo_size > 0)
+            evictions = _llvm.get_code_evictions()
+
+            # bar() ran less recently, so it goes first.
+            _llvm.set_code_budget(baseline + foo_size + bar_size // 2)
+            self.assertEqual(_llvm.get_code_budget(),
+                             baseline + foo_size + bar_size // 2)
+            self.assertFalse(bar.__code__.co_use_jit)
+            self.assertEqual(_llvm.get_code_size(bar.__code__), 0)
+            self.assertTrue(foo.__code__.co_use_jit)
+            self.assertTrue(_llvm.get_code_evictions() > evictions)
+
+            # It has to get hot again, but not from scratch.
+            self.assertTrue(0 < bar.__code__.co_hotness <
+                            _llvm.get_hotness_threshold())
+            self.assertEqual(bar(1), 3)
+            self.assertRaises(ValueError, _llvm.set_code_budget, -1)
+        finally:
+            _llvm.set_code_budget(old_budget)
+
+    def test_code_budget_flag(self):
+        process = subprocess.Popen(
+            [sys.executable, "-Xjitbudget=64k", "-c",
+             "import _llvm; print _llvm.get_code_budget()"],
+            stdout=subprocess.PIPE)
+        output = process.communicate()[0]
+        self.assertEqual(process.returncode, 0)
+        self.assertEqual(output.strip(), "65536")
+
+    def test_code_budget_flag_overflow(self):
+        for budget in ["9" * 30, "%dk" % sys.maxint, "%dm" % sys.maxint]:
+            process = subprocess.Popen(
+                [sys.executable, "-Xjitbudget=" + budget, "-c", "pass"],
+                stderr=subprocess.PIPE)
+            process.communicate()
+            self.assertEqual(process.returncode, 2)
+
+
+class JitStatsTests(LlvmTestCase):
+
+    def setUp(self):
+        _llvm.clear_jit_stats()
+
+    def test_counts_compiles_and_invalidations(self):
+        foo = compile_for_llvm("foo", "def foo(): return len([])",
+                               optimization_level=None)
+        spin_until_hot(foo, [])
+        self.assertTrue(foo.__code__.co_use_jit)
+        with test_support.swap_attr(__builtin__, "len", lambda x: 7):
+            self.assertFalse(foo.__code__.co_use_jit)
+
+        # Other code, like spin_until_hot(), may get compiled too.
+        stats = _llvm.get_jit_stats()
+        self.assertTrue(stats["compiles"] >= 1)
+        self.assertTrue(stats["invalidations"] >= 1)
+        self.assertTrue(stats["compile_seconds"] >= 0)
+        self.assertEqual(stats["live_code_bytes"],
+                         _llvm.get_live_code_bytes())
+        foo_stats = stats["code"][foo.__code__]
+        self.assertEqual(foo_stats["compiles"], 1)
+        self.assertEqual(foo_stats["invalidations"], 1)
+        self.assertEqual(foo_stats["code_size"],
+                         _llvm.get_code_size(foo.__code__))
+        self.assertTrue(foo_stats["feedback_bytes"] > 0)
+
+    def test_counts_guard_failures_by_site(self):
+        foo = compile_for_llvm("foo", "def foo(a, b): return a + b",
+                               optimization_level=None)
+        spin_until_hot(foo, [1, 2])
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertEqual(foo(1.0, 2.0), 3.0)
+        self.assertEqual(foo(1.0, 2.0), 3.0)
+
+        stats = _llvm.get_jit_stats()
+        self.assertTrue(stats["bails"]["guard_fail"] >= 2)
+        self.assertTrue(stats["guard_fails"]["binop"] >= 2)
+        foo_stats = stats["code"][foo.__code__]
+        self.assertEqual(foo_stats["bails"], {"guard_fail": 2})
+        self.assertEqual(foo_stats["guard_fails"], {"binop": 2})
+        # Both bails came from the BINARY_ADD.
+        add_index = foo.__code__.co_code.index(chr(opmap["BINARY_ADD"]))
+        self.assertEqual(foo_stats["bail_sites"],
+                         {(add_index, "guard_fail"): 2})
+
+        _llvm.clear_jit_stats()
+        stats = _llvm.get_jit_stats()
+        self.assertEqual(stats["bails"], {})
+        self.assertEqual(stats["code"], {})
+
+
+class FeedbackSamplingTests(LlvmTestCase):
+
+    def setUp(self):
+        super(FeedbackSamplingTests, self).setUp()
+        self._old_sampling = _llvm.get_feedback_sampling()
+
+    def tearDown(self):
+        _llvm.set_feedback_sampling(*self._old_sampling)
+        super(FeedbackSamplingTests, self).tearDown()
+
+    def compile_upper(self):
+        return compile_for_llvm("foo", """
+def foo(x):
+    return x.upper()
+""", optimization_level=None)
+
+    def test_get_set(self):
+        _llvm.set_feedback_sampling(10, 50)
+        self.assertEqual(_llvm.get_feedback_sampling(), (10, 50))
+        self.assertRaises(ValueError, _llvm.set_feedback_sampling, 0, 0)
+        self.assertRaises(ValueError, _llvm.set_feedback_sampling, 1, 101)
+        self.assertEqual(_llvm.get_feedback_sampling(), (10, 50))
+
+    def test_sampled_feedback_still_specializes(self):
+        _llvm.set_feedback_sampling(10, 50)
+        foo = self.compile_upper()
+        spin_until_hot(foo, ["a"])
+        self.assertTrue(foo.__code__.co_use_jit)
+        # Specialized on str.upper, so a unicode argument bails.
+        self.assertRaises(RuntimeError, foo, u"a")
+
+    def test_no_feedback_until_hot(self):
+        _llvm.set_feedback_sampling(1, 100)
+        foo = self.compile_upper()
+        spin_until_hot(foo, ["a"])
+        self.assertTrue(foo.__code__.co_use_jit)
+        self.assertEqual(foo(u"a"), u"A")
+
+
+class SamplingProfilerTests(LlvmTestCase):
+
+    def setUp(self):
+        super(SamplingProfilerTests, self).setUp()
+        self._old_model = _llvm.get_hotness_model()
+        self._old_rate = _llvm.get_sampling_rate()
+        _llvm.clear_samples()
+
+    def tearDown(self):
+        _llvm.set_hotness_model(self._old_model)
+        if self._old_rate:
+            _llvm.start_sampling(self._old_rate)
+        else:
+            _llvm.stop_sampling()
+        _llvm.clear_samples()
+        super(SamplingProfilerTests, self).tearDown()
+
+    def compile_sorter(self):
+        return compile_for_llvm("foo", """
+def foo(data):
+    return sorted(data)
+""", optimization_level=None)
+
+    def test_get_set(self):
+        _llvm.start_sampling(500)
+        self.assertEqual(_llvm.get_sampling_rate(), 500)
+        self.assertRaises(ValueError, _llvm.start_sampling, 0)
+        self.assertRaises(ValueError, _llvm.start_sampling, 10 ** 6)
+        self.assertEqual(_llvm.get_sampling_rate(), 500)
+        _llvm.start_sampling(1)
+        self.assertEqual(_llvm.get_sampling_rate(), 1)
+        _llvm.stop_sampling()
+        self.assertEqual(_llvm.get_sampling_rate(), 0)
+
+        _llvm.set_hotness_model("time")
+        self.assertEqual(_llvm.get_hotness_model(), "time")
+        self.assertNotEqual(_llvm.get_sampling_rate(), 0)
+        self.assertRaises(ValueError, _llvm.set_hotness_model, "calories")
+        _llvm.set_hotness_model("calls")
+        self.assertEqual(_llvm.get_hotness_model(), "calls")
+
+    if hasattr(os, "fork"):
+        def test_fork_stops_sampling(self):
+            _llvm.set_hotness_model("calls")
+            _llvm.start_sampling(500)
+            pid = os.fork()
+            if pid == 0:
+                os._exit(_llvm.get_sampling_rate())
+            self.assertEqual(os.waitpid(pid, 0), (pid, 0))
+            self.assertEqual(_llvm.get_sampling_rate(), 500)
+
+        def test_fork_keeps_time_model_sampling(self):
+            _llvm.set_hotness_model("time")
+            _llvm.start_sampling(50)
+            pid = os.fork()
+            if pid == 0:
+                os._exit(_llvm.get_sampling_rate() != 50)
+            self.assertEqual(os.waitpid(pid, 0), (pid, 0))
+
+    def test_samples_land_on_the_caller_of_c_code(self):
+        foo = self.compile_sorter()
+        data = range(100000, 0, -1)
+        _llvm.start_sampling(1000)
+        deadline = time.clock() + 10
+        while (_llvm.get_samples()[1].get(foo.__code__, 0) < 10 and
+               time.clock() < deadline):
+            foo(data)
+        total, per_code = _llvm.get_samples()
+        self.assertTrue(per_code[foo.__code__] >= 10)
+        self.assertEqual(foo.__code__.co_samples, per_code[foo.__code__])
+        self.assertTrue(total >= sum(per_code.values()))
+
+        _llvm.clear_samples()
+        self.assertEqual(_llvm.get_samples(), (0, {}))
+        self.assertEqual(foo.__code__.co_samples, 0)
+
+    def test_time_model_ignores_calls(self):
+        _llvm.set_hotness_model("time")
+        _llvm.stop_sampling()
+        foo = compile_for_llvm("foo", """
+def foo(n):
+    for i in xrange(n):
+        pass
+""", optimization_level=None)
+        for _ in xrange(JIT_SPIN_COUNT):
+            foo(2)
+        self.assertEqual(foo.__code__.co_hotness, 0)
+        self.assertFalse(foo.__code__.co_use_jit)
+
+    def test_time_model_compiles_expensive_code(self):
+        foo = self.compile_sorter()
+        data = range(100000, 0, -1)
+        _llvm.set_hotness_model("time")
+        _llvm.start_sampling(1000)
+        calls = 0
+        deadline = time.clock() + 10
+        while not foo.__code__.co_use_jit and time.clock() < deadline:
+            foo(data)
+            calls += 1
+        self.assertTrue(foo.__code__.co_use_jit)
+        # Counting calls, it would have taken far longer.
+        self.assertTrue(calls < JIT_SPIN_COUNT)
+        self.assertEqual(foo([3, 1, 2]), [1, 2, 3])
+
+
 class CrashRegressionTests(unittest.TestCase):
 
     """Tests for segfaults uncovered by fuzz testing."""
@@ -4496,7 +5604,11 @@ def test_main():
         tests = [LoopExceptionInteractionTests, GeneralCompilationTests,
                  OperatorTests, LiteralsTests, BailoutTests, InliningTests,
                  LlvmRebindBuiltinsTests, OptimizationTests,
-                 SetJitControlTests, TypeBasedAnalysisTests,
+                 SetJitControlTests, BackgroundCompileTests,
+                 TieredCompileTests, JitCacheTests, JitProfileTests,
+                 PerfMapTests, CodeMemoryTests, JitStatsTests,
+                 FeedbackSamplingTests, SamplingProfilerTests,
+                 TypeBasedAnalysisTests,
                  CrashRegressionTests, LoadMethodTests]
     if sys.flags.optimize >= 1:
         print >>sys.stderr, "test_llvm -- skipping some tests due to -O flag."
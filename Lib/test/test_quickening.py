@@ -0,0 +1,180 @@
+"""Tests for the eval loop's specialized instructions (quickening)."""
+
+import opcode
+import sys
+import unittest
+from test import test_support
+
+try:
+    import _llvm
+except ImportError:
+    _llvm = None
+
+
+def quickened_ops(func):
+    """Returns the names of func's instructions as the eval loop runs them,
+    or None if func hasn't been quickened."""
+    code = func.__code__
+    if code.co_quickened is None:
+        return None
+    ops = []
+    i = 0
+    while i < len(code.co_code):
+        ops.append(opcode.opname[ord(code.co_quickened[i])])
+        if ord(code.co_code[i]) >= opcode.HAVE_ARGUMENT:
+            i += 3
+        else:
+            i += 1
+    return ops
+
+
+class Plain(object):
+    pass
+
+
+class QuickeningTests(unittest.TestCase):
+
+    def setUp(self):
+        self.threshold = sys.getquickenthreshold()
+        sys.setquickenthreshold(2)
+        # Machine code never runs the quickened bytecode.
+        if _llvm:
+            self.jit_control = _llvm.get_jit_control()
+            _llvm.set_jit_control("never")
+
+    def tearDown(self):
+        sys.setquickenthreshold(self.threshold)
+        if _llvm:
+            _llvm.set_jit_control(self.jit_control)
+
+    def run_until_quickened(self, func, *args):
+        for _ in range(2):
+            result = func(*args)
+        self.assertNotEqual(quickened_ops(func), None)
+        return result
+
+    def test_threshold(self):
+        self.assertRaises(ValueError, sys.setquickenthreshold, -1)
+        def foo():
+            return 1
+        foo()
+        self.assertEqual(quickened_ops(foo), None)
+        foo()
+        self.assertNotEqual(quickened_ops(foo), None)
+        # co_code itself never changes.
+        self.assertEqual(len(foo.__code__.co_quickened),
+                         len(foo.__code__.co_code))
+
+    def test_threshold_zero_never_quickens(self):
+        sys.setquickenthreshold(0)
+        def foo():
+            return 1
+        for _ in range(10):
+            foo()
+        self.assertEqual(quickened_ops(foo), None)
+
+    def test_load_global(self):
+        namespace = {}
+        exec "def foo(): return len" in namespace
+        foo = namespace["foo"]
+        self.assertEqual(self.run_until_quickened(foo), len)
+        self.assertTrue("LOAD_GLOBAL_CACHED" in quickened_ops(foo))
+
+        # Shadowing the builtin in the globals and taking it away again.
+        namespace["len"] = 5
+        self.assertEqual(foo(), 5)
+        namespace["len"] = 6
+        self.assertEqual(foo(), 6)
+        del namespace["len"]
+        self.assertEqual(foo(), len)
+        namespace.clear()
+        self.assertRaises(NameError, foo)
+
+    def test_load_global_from_other_globals(self):
+        namespace = {"x": 1}
+        exec "def foo(): return x" in namespace
+        foo = namespace["foo"]
+        self.assertEqual(self.run_until_quickened(foo), 1)
+        # The same code run against another globals dict.
+        other = type(foo)(foo.__code__, {"x": 2})
+        self.assertEqual(other(), 2)
+        self.assertEqual(foo(), 1)
+
+    def test_load_attr(self):
+        def foo(obj):
+            return obj.attr
+        obj = Plain()
+        obj.attr = 1
+        self.assertEqual(self.run_until_quickened(foo, obj), 1)
+        self.assertTrue("LOAD_ATTR_INSTANCE_DICT" in quickened_ops(foo))
+
+        obj.attr = 2
+        self.assertEqual(foo(obj), 2)
+        # A data descriptor on the class takes precedence.
+        Plain.attr = property(lambda self: 3)
+        try:
+            self.assertEqual(foo(obj), 3)
+        finally:
+            del Plain.attr
+        self.assertEqual(foo(obj), 2)
+        # A class attribute shows through once the instance's is gone.
+        Plain.attr = 4
+        try:
+            del obj.attr
+            self.assertEqual(foo(obj), 4)
+        finally:
+            del Plain.attr
+        self.assertRaises(AttributeError, foo, obj)
+
+    def test_load_attr_despecializes(self):
+        def foo(obj):
+            return obj.real
+        self.run_until_quickened(foo, 1)
+        for i in range(100):
+            self.assertEqual(foo(i), i)
+        self.assertTrue("LOAD_ATTR" in quickened_ops(foo))
+        self.assertFalse("LOAD_ATTR_INSTANCE_DICT" in quickened_ops(foo))
+
+    def test_binary_add(self):
+        def foo(a, b):
+            return a + b
+        self.assertEqual(self.run_until_quickened(foo, 1, 2), 3)
+        self.assertTrue("BINARY_ADD_INT" in quickened_ops(foo))
+        self.assertEqual(foo(sys.maxint, 1), sys.maxint + 1)
+        self.assertTrue("BINARY_ADD" in quickened_ops(foo))
+        self.assertEqual(foo("a", "b"), "ab")
+        self.assertEqual(foo(1, 2), 3)
+
+    def test_tracing_sees_the_same_lines(self):
+        def foo(obj):
+            x = obj.attr
+            return x + len(())
+        obj = Plain()
+        obj.attr = 1
+        def trace(frame, event, arg):
+            if frame.f_code is foo.__code__ and event == "line":
+                lines.append(frame.f_lineno)
+            return trace
+        lines = []
+        sys.settrace(trace)
+        try:
+            foo(obj)
+        finally:
+            sys.settrace(None)
+        before = lines
+        self.run_until_quickened(foo, obj)
+        lines = []
+        sys.settrace(trace)
+        try:
+            foo(obj)
+        finally:
+            sys.settrace(None)
+        self.assertEqual(lines, before)
+
+
+def test_main():
+    test_support.run_unittest(QuickeningTests)
+
+
+if __name__ == "__main__":
+    test_main()
@@ -544,9 +544,9 @@ class SizeofTest(unittest.TestCase):
         check(complex(0,1), size(h + '2d'))
         # code
         if WITH_LLVM:
-            check(get_cell().func_code, size(h + '4i8Pi6Pc2ilP'))
+            check(get_cell().func_code, size(h + '4i8Pi6Pc2il2PcPlil2Pi'))
         else:
-            check(get_cell().func_code, size(h + '4i8Pi3P'))
+            check(get_cell().func_code, size(h + '4i8Pi3P2Pi'))
         # BaseException
         check(BaseException(), size(h + '3P'))
         # UnicodeEncodeError
@@ -576,9 +576,10 @@ class SizeofTest(unittest.TestCase):
         dict_llvm_suffix = ''
         if WITH_LLVM:
             dict_llvm_suffix = 'P'
-        check({}, size(h + '3P2P' + 8*'P2P' + dict_llvm_suffix))
+        check({}, size(h + '3P2P' + 8*'P2P' + 'Q' + dict_llvm_suffix))
         x = {1:1, 2:2, 3:3, 4:4, 5:5, 6:6, 7:7, 8:8}
-        check(x, size(h + '3P2P' + 8*'P2P' + dict_llvm_suffix) + 16*size('P2P'))
+        check(x, size(h + '3P2P' + 8*'P2P' + 'Q' + dict_llvm_suffix) +
+              16*size('P2P'))
         del dict_llvm_suffix
         # dictionary-keyiterator
         check({}.iterkeys(), size(h + 'P2PPP'))
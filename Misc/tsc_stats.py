@@ -2,24 +2,27 @@
 
 """Compute timing statistics based on the output of Python with TSC enabled.
 
-To use this script, pass --with-tsc to ./configure and call sys.settscdump(True)
-in the script that you want to use to record timings.  When the script and
-interpreter exit, the timings will be printed to stderr as a CSV file separated
-by tabs.  You should redirect that to this script, either through a file or
-pipe:
+To use this script, pass --with-tsc to ./configure and call
+sys.settscdump(True) in the script that you want to use to record timings.
+Events are streamed to tsc-<pid>.dump in the current directory until
+sys.settscdump(False) is called or the interpreter exits; pass a filename as
+the second argument to settscdump() to write somewhere else.  Then run this
+script on the trace:
 
-    ./python myscript.py 2>&1 >&3 3>&- | Misc/tsc_stats.py
-    ./python myscript.py 2> stats ; Misc/tsc_stats.py stats
+    ./python myscript.py ; Misc/tsc_stats.py tsc-12345.dump
+
+The trace format is documented in Util/EventTimer.h.  Pass --dump to print
+the events as tab-separated (thread, event, time) lines instead of analyzing
+them.
 
 This script outputs statistics about function call overhead, exception handling
 overhead, bytecode to LLVM IR compilation overhead, native code generation
 overhead, and various other things.
 
-In order to not use too much memory, the event timer in Python periodically
-flushes the event buffer.  This messes up a lot of the timings, so it also
-prints out events that let us figure out how long the flush took.  We take that
-time and go back and adjust the times to erase that overhead.  Otherwise our
-max, mean, and stddev statistics would be meaningless.
+Each thread logs into its own buffer, which a background thread writes out,
+so the flushes don't show up in the timings.  If a thread logs events faster
+than they can be written, some are dropped; we report how many, and don't pair
+up events on either side of a gap.
 
 In order to get more meaningful results for function call overhead, any time
 spent doing compilation in the eval loop is not counted against the function
@@ -30,11 +33,70 @@ way off.
 
 from __future__ import division
 
-import itertools
 import math
+import struct
 import sys
 
 
+class TraceFormatError(Exception):
+    pass
+
+
+def read_trace(input):
+    """Read a trace written by sys.settscdump().
+
+    Returns (threads, events, dropped).  threads maps dense thread ids to
+    PyThread_get_thread_ident() values.  events maps dense thread ids to that
+    thread's list of (event name, time) pairs, in the order they were logged;
+    a None entry marks a place where events were dropped.  dropped maps dense
+    thread ids to the number of events dropped.
+    """
+    data = input.read()
+    if data[:8] != "PYTSCDMP":
+        raise TraceFormatError("not a TSC trace")
+    (version, num_names) = struct.unpack_from("<II", data, 8)
+    if version != 1:
+        raise TraceFormatError("unknown trace version %d" % version)
+    pos = 16
+    names = []
+    for _ in xrange(num_names):
+        length = ord(data[pos])
+        names.append(data[pos + 1:pos + 1 + length])
+        pos += 1 + length
+
+    threads = {}
+    events = {}
+    dropped = {}
+    try:
+        while pos < len(data):
+            (tag, thread) = struct.unpack_from("<cI", data, pos)
+            pos += 5
+            if tag == "T":
+                (threads[thread],) = struct.unpack_from("<Q", data, pos)
+                pos += 8
+                events.setdefault(thread, [])
+            elif tag == "E":
+                (count,) = struct.unpack_from("<I", data, pos)
+                pos += 4
+                append = events[thread].append
+                for _ in xrange(count):
+                    (time, event) = struct.unpack_from("<QH", data, pos)
+                    pos += 10
+                    append((names[event], time))
+            elif tag == "D":
+                (count,) = struct.unpack_from("<I", data, pos)
+                pos += 4
+                dropped[thread] = dropped.get(thread, 0) + count
+                events[thread].append(None)
+            else:
+                raise TraceFormatError("bad record tag %r at offset %d" %
+                                       (tag, pos - 5))
+    except struct.error:
+        # The interpreter was killed in the middle of a write.
+        pass
+    return (threads, events, dropped)
+
+
 def median(xs):
     """Return the median of some numeric values.
 
@@ -113,7 +175,6 @@ class DeltaStatistic(object):
             event: the name of the event
             time: the timestamp counter when the event occurred
         """
-        # TODO(rnk): Keep things thread local.
         if event.startswith(self.start_prefix):
             # If we already started, we missed an end event.  Record the old
             # start event that didn't get an end, and use this start event
@@ -146,12 +207,19 @@ class DeltaStatistic(object):
 
         return False
 
+    def reset(self):
+        """Forget any start event; the next event starts a new thread."""
+        self.started = False
+        self.start_event = None
+        self.start_time = 0
+
 
 class TimeAnalyzer(object):
 
     def __init__(self, input):
         self.input = input
         self.missed_events = []
+        self.dropped = {}
         m_e = self.missed_events  # Shorthand
         self.call_stats = DeltaStatistic("CALL_START_", "CALL_ENTER_", m_e)
         self.exception_stats = DeltaStatistic("EXCEPT_RAISE_", "EXCEPT_CATCH_",
@@ -163,7 +231,6 @@ class TimeAnalyzer(object):
                                          "LLVM_COMPILE_END", m_e)
         self.eval_compile_stats = DeltaStatistic("EVAL_COMPILE_START",
                                                  "EVAL_COMPILE_END", m_e)
-        self.flush_stats = DeltaStatistic("FLUSH_START", "FLUSH_END", m_e)
         self.statistics = [
                 self.call_stats,
                 self.exception_stats,
@@ -171,22 +238,28 @@ class TimeAnalyzer(object):
                 self.native_stats,
                 self.llvm_stats,
                 self.eval_compile_stats,
-                self.flush_stats,
                 ]
 
-    def flush_fudge(self, flush_delta):
-        """Fudge the start time of open stats to eliminate flush overhead."""
-        for stat in self.statistics:
-            if stat.started:
-                stat.start_time += flush_delta
-
     def analyze(self):
         """Process the input into categorized timings."""
-        for line in self.input:
-            (thread, event, time) = line.strip().split("\t")
-            time = int(time)
+        (_, events, self.dropped) = read_trace(self.input)
+        # Only pair up events from the same thread.
+        for thread_events in events.itervalues():
+            self.analyze_thread(thread_events)
+
+    def analyze_thread(self, thread_events):
+        for stat in self.statistics:
+            stat.reset()
+        for item in thread_events:
+            if item is None:
+                # Events were dropped here, so the next end event doesn't
+                # belong to any start event we've seen.
+                for stat in self.statistics:
+                    stat.reset()
+                continue
+            (event, time) = item
             for stat in self.statistics:
-                if stat.try_match(thread, event, time):
+                if stat.try_match(None, event, time):
                     if not stat.started and stat.aggregate_deltas:
                         delta = stat.aggregate_deltas[-1]
                         if (stat is self.eval_compile_stats and
@@ -194,10 +267,6 @@ class TimeAnalyzer(object):
                             # Fudge the call_stats start time to erase
                             # compilation overhead in the eval loop.
                             self.call_stats.start_time += delta
-                        if stat is self.flush_stats:
-                            # Fudge every stat that has an open timing to
-                            # eliminate the flush overhead.
-                            self.flush_fudge(delta)
                     break
             else:
                 # If no statistic matched the event, log it as missed.
@@ -265,14 +334,28 @@ class TimeAnalyzer(object):
         print "missed events:",
         print ", ".join("%s %d" % (event, count)
                         for (event, count) in grouped.iteritems())
+        print "dropped events:", sum(self.dropped.itervalues())
+
+
+def dump_trace(input):
+    """Print every event as a tab-separated (thread, event, time) line."""
+    (_, events, dropped) = read_trace(input)
+    for (thread, thread_events) in sorted(events.iteritems()):
+        for item in thread_events:
+            if item is not None:
+                print "%d\t%s\t%d" % (thread, item[0], item[1])
 
 
 def main(argv):
-    if argv:
-        assert len(argv) == 2, "tsc_stats.py expects one file as input."
-        input = open(argv[1])
-    else:
-        input = sys.stdin
+    args = argv[1:]
+    dump = "--dump" in args
+    if dump:
+        args.remove("--dump")
+    assert len(args) == 1, "tsc_stats.py expects one trace file as input."
+    input = open(args[0], "rb")
+    if dump:
+        dump_trace(input)
+        return
     analyzer = TimeAnalyzer(input)
     analyzer.analyze()
     analyzer.print_analysis()
@@ -8,9 +8,15 @@ LLVM-py.
 
 #include "Python.h"
 #include "_llvmfunctionobject.h"
+#include "JIT/code_budget.h"
+#include "JIT/compile_thread.h"
+#include "JIT/feedback_profile.h"
 #include "JIT/global_llvm_data_fwd.h"
+#include "JIT/jit_stats.h"
 #include "JIT/llvm_compile.h"
+#include "JIT/perf_map.h"
 #include "JIT/RuntimeFeedback_fwd.h"
+#include "JIT/sampling_profiler.h"
 
 PyDoc_STRVAR(llvm_module_doc,
 "Defines thin wrappers around fundamental LLVM types.");
@@ -161,6 +167,18 @@ llvm_get_hotness_threshold(PyObject *self)
     return PyInt_FromLong(PY_HOTNESS_THRESHOLD);
 }
 
+PyDoc_STRVAR(llvm_get_max_fatal_bail_count_doc,
+"get_max_fatal_bail_count() -> int\n\
+\n\
+Return how many times a code object's machine code may be invalidated\n\
+before it's left to the eval loop for good.");
+
+static PyObject *
+llvm_get_max_fatal_bail_count(PyObject *self)
+{
+    return PyInt_FromLong(PY_MAX_FATALBAILCOUNT);
+}
+
 PyDoc_STRVAR(llvm_collect_unused_globals_doc,
 "collect_unused_globals()\n\
 \n\
@@ -174,6 +192,513 @@ llvm_collect_unused_globals(PyObject *self)
     Py_RETURN_NONE;
 }
 
+PyDoc_STRVAR(llvm_set_background_compile_doc,
+"set_background_compile(bool)\n\
+\n\
+If true, hot functions are compiled on a separate thread and keep running\n\
+in the interpreter until their machine code is ready.  Otherwise they are\n\
+compiled by the thread that made them hot.");
+
+static PyObject *
+llvm_set_background_compile(PyObject *self, PyObject *on_obj)
+{
+    int on = PyObject_IsTrue(on_obj);
+    if (on == -1)  /* Error. */
+        return NULL;
+#ifndef WITH_THREAD
+    if (on) {
+        PyErr_SetString(PyExc_ValueError,
+                        "background compilation requires thread support");
+        return NULL;
+    }
+#endif
+    Py_JitBackgroundCompile = on;
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(llvm_get_background_compile_doc,
+"get_background_compile() -> bool\n\
+\n\
+Return whether hot functions are compiled on a separate thread.");
+
+static PyObject *
+llvm_get_background_compile(PyObject *self)
+{
+    return PyBool_FromLong(Py_JitBackgroundCompile);
+}
+
+PyDoc_STRVAR(llvm_set_compile_threads_doc,
+"set_compile_threads(n)\n\
+\n\
+Compile hot functions in the background on up to n threads at once.  Extra\n\
+threads exit once they finish what they're compiling.");
+
+static PyObject *
+llvm_set_compile_threads(PyObject *self, PyObject *arg)
+{
+    long threads = PyInt_AsLong(arg);
+    if (threads == -1 && PyErr_Occurred())
+        return NULL;
+    if (threads < 1 || threads > INT_MAX) {
+        PyErr_SetString(PyExc_ValueError,
+                        "need at least one compile thread");
+        return NULL;
+    }
+    _PyLlvm_SetCompileThreads((int)threads);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(llvm_get_compile_threads_doc,
+"get_compile_threads() -> (int, int)\n\
+\n\
+Return the most threads that may compile in the background, and how many\n\
+are running now.  If LLVM isn't thread-safe, only one ever runs.");
+
+static PyObject *
+llvm_get_compile_threads(PyObject *self)
+{
+    return Py_BuildValue("(ii)", Py_JitCompileThreads,
+                         _PyLlvm_CompileThreadCount());
+}
+
+PyDoc_STRVAR(llvm_set_tiered_compile_doc,
+"set_tiered_compile(bool)\n\
+\n\
+If true, hot functions are first compiled with little optimization, and\n\
+recompiled with full optimization on a separate thread if they stay hot.\n\
+Otherwise they are fully optimized as soon as they get hot.");
+
+static PyObject *
+llvm_set_tiered_compile(PyObject *self, PyObject *on_obj)
+{
+    int on = PyObject_IsTrue(on_obj);
+    if (on == -1)  /* Error. */
+        return NULL;
+#ifndef WITH_THREAD
+    if (on) {
+        PyErr_SetString(PyExc_ValueError,
+                        "tiered compilation requires thread support");
+        return NULL;
+    }
+#endif
+    Py_JitTiered = on;
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(llvm_get_tiered_compile_doc,
+"get_tiered_compile() -> bool\n\
+\n\
+Return whether hot functions get cheap machine code first.");
+
+static PyObject *
+llvm_get_tiered_compile(PyObject *self)
+{
+    return PyBool_FromLong(Py_JitTiered);
+}
+
+PyDoc_STRVAR(llvm_get_tier_up_threshold_doc,
+"get_tier_up_threshold() -> long\n\
+\n\
+Return the co_hotness past which tiered compilation recompiles code with\n\
+full optimization.");
+
+static PyObject *
+llvm_get_tier_up_threshold(PyObject *self)
+{
+    return PyInt_FromLong(PY_TIER_UP_THRESHOLD);
+}
+
+PyDoc_STRVAR(llvm_wait_for_background_compiles_doc,
+"wait_for_background_compiles() -> int\n\
+\n\
+Block until every function queued for background compilation has been\n\
+compiled or discarded.  Returns the number of functions that were pending.");
+
+static PyObject *
+llvm_wait_for_background_compiles(PyObject *self)
+{
+    Py_ssize_t pending = _PyLlvm_CompileQueueSize();
+    _PyLlvm_WaitForCompileQueue();
+    return PyInt_FromSsize_t(pending);
+}
+
+PyDoc_STRVAR(llvm_dump_feedback_doc,
+"dump_feedback(path) -> int\n\
+\n\
+Write the runtime feedback and hotness of every code object that has\n\
+recorded feedback to path, along with anything loaded by load_feedback()\n\
+about code that hasn't run since.  Returns the number of code objects\n\
+written.");
+
+static PyObject *
+llvm_dump_feedback(PyObject *self, PyObject *args)
+{
+    const char *path;
+    Py_ssize_t written;
+
+    if (!PyArg_ParseTuple(args, "s:dump_feedback", &path))
+        return NULL;
+    written = _PyFeedbackProfile_Dump(path);
+    if (written < 0)
+        return NULL;
+    return PyInt_FromSsize_t(written);
+}
+
+PyDoc_STRVAR(llvm_load_feedback_doc,
+"load_feedback(path) -> int\n\
+\n\
+Read a file written by dump_feedback().  Code objects that start recording\n\
+feedback from now on begin with the hotness and feedback saved there.\n\
+Returns the number of code objects read; a file written by a different\n\
+build of Python is ignored.");
+
+static PyObject *
+llvm_load_feedback(PyObject *self, PyObject *args)
+{
+    const char *path;
+    Py_ssize_t loaded;
+
+    if (!PyArg_ParseTuple(args, "s:load_feedback", &path))
+        return NULL;
+    loaded = _PyFeedbackProfile_Load(path);
+    if (loaded < 0)
+        return NULL;
+    return PyInt_FromSsize_t(loaded);
+}
+
+PyDoc_STRVAR(llvm_set_perf_map_doc,
+"set_perf_map(bool)\n\
+\n\
+If true, describe each function compiled to machine code from now on in\n\
+/tmp/perf-<pid>.map, so that perf report can name it.");
+
+static PyObject *
+llvm_set_perf_map(PyObject *self, PyObject *on_obj)
+{
+    int on = PyObject_IsTrue(on_obj);
+    if (on == -1)  /* Error. */
+        return NULL;
+    if (_PyPerfMap_SetEnabled(on) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(llvm_get_perf_map_doc,
+"get_perf_map() -> bool\n\
+\n\
+Return whether compiled functions are written to /tmp/perf-<pid>.map.");
+
+static PyObject *
+llvm_get_perf_map(PyObject *self)
+{
+    return PyBool_FromLong(_PyPerfMap_IsEnabled());
+}
+
+PyDoc_STRVAR(llvm_set_jitdump_doc,
+"set_jitdump(bool)\n\
+\n\
+If true, write each function compiled to machine code from now on, with\n\
+its line table, to /tmp/jit-<pid>.dump for perf inject --jit.  Turning it\n\
+off closes the file.  Only available on Linux.");
+
+static PyObject *
+llvm_set_jitdump(PyObject *self, PyObject *on_obj)
+{
+    int on = PyObject_IsTrue(on_obj);
+    if (on == -1)  /* Error. */
+        return NULL;
+    if (_PyPerfMap_SetJitDump(on) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(llvm_get_jitdump_doc,
+"get_jitdump() -> bool\n\
+\n\
+Return whether compiled functions are written to /tmp/jit-<pid>.dump.");
+
+static PyObject *
+llvm_get_jitdump(PyObject *self)
+{
+    return PyBool_FromLong(_PyPerfMap_IsJitDumpEnabled());
+}
+
+PyDoc_STRVAR(llvm_get_live_code_bytes_doc,
+"get_live_code_bytes() -> int\n\
+\n\
+Return the number of bytes of machine code the JIT has emitted and not yet\n\
+freed.  A code object's machine code is freed when the code object is.");
+
+static PyObject *
+llvm_get_live_code_bytes(PyObject *self)
+{
+    return PyInt_FromSize_t(
+        PyGlobalLlvmData_GetLiveCodeBytes(PyGlobalLlvmData_GET()));
+}
+
+PyDoc_STRVAR(llvm_get_ir_instruction_count_doc,
+"get_ir_instruction_count() -> int\n\
+\n\
+Return the number of LLVM IR instructions held in the JIT's module.  This\n\
+includes runtime helpers loaded from the stdlib bitcode.");
+
+static PyObject *
+llvm_get_ir_instruction_count(PyObject *self)
+{
+    return PyInt_FromSize_t(
+        PyGlobalLlvmData_CountIrInstructions(PyGlobalLlvmData_GET()));
+}
+
+PyDoc_STRVAR(llvm_set_code_budget_doc,
+"set_code_budget(bytes)\n\
+\n\
+Keep at most this many bytes of machine code, evicting the machine code\n\
+that ran least recently until the rest fits.  0 means no limit.");
+
+static PyObject *
+llvm_set_code_budget(PyObject *self, PyObject *arg)
+{
+    Py_ssize_t budget = PyNumber_AsSsize_t(arg, PyExc_OverflowError);
+    if (budget == -1 && PyErr_Occurred())
+        return NULL;
+    if (budget < 0) {
+        PyErr_SetString(PyExc_ValueError,
+                        "code budget must not be negative");
+        return NULL;
+    }
+    _PyCodeBudget_SetBudget(budget);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(llvm_get_code_budget_doc,
+"get_code_budget() -> int\n\
+\n\
+Return the most bytes of machine code kept before evicting any, or 0 if\n\
+there's no limit.");
+
+static PyObject *
+llvm_get_code_budget(PyObject *self)
+{
+    return PyInt_FromSsize_t(Py_JitCodeBudget);
+}
+
+PyDoc_STRVAR(llvm_set_feedback_sampling_doc,
+"set_feedback_sampling(interval, warmup)\n\
+\n\
+Only record runtime feedback on every interval'th call of a function, and\n\
+only once it's warmup percent of the way to being hot.  (1, 0) records\n\
+feedback on every call.");
+
+static PyObject *
+llvm_set_feedback_sampling(PyObject *self, PyObject *args)
+{
+    int interval, warmup;
+    if (!PyArg_ParseTuple(args, "ii:set_feedback_sampling",
+                          &interval, &warmup))
+        return NULL;
+    if (interval < 1) {
+        PyErr_SetString(PyExc_ValueError,
+                        "feedback interval must be at least 1");
+        return NULL;
+    }
+    if (warmup < 0 || warmup > 100) {
+        PyErr_SetString(PyExc_ValueError,
+                        "feedback warmup must be a percentage");
+        return NULL;
+    }
+    Py_JitFeedbackInterval = interval;
+    Py_JitFeedbackWarmup = warmup;
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(llvm_get_feedback_sampling_doc,
+"get_feedback_sampling() -> (interval, warmup)\n\
+\n\
+Return the settings from set_feedback_sampling().");
+
+static PyObject *
+llvm_get_feedback_sampling(PyObject *self)
+{
+    return Py_BuildValue("(ii)", Py_JitFeedbackInterval,
+                         Py_JitFeedbackWarmup);
+}
+
+PyDoc_STRVAR(llvm_get_code_size_doc,
+"get_code_size(code) -> int\n\
+\n\
+Return the bytes of machine code held for code, including machine code\n\
+that was replaced or invalidated but may still be running.");
+
+static PyObject *
+llvm_get_code_size(PyObject *self, PyObject *code)
+{
+    if (!PyCode_Check(code)) {
+        PyErr_SetString(PyExc_TypeError, "expected a code object");
+        return NULL;
+    }
+    return PyInt_FromSize_t(_PyCodeBudget_GetCodeSize((PyCodeObject *)code));
+}
+
+PyDoc_STRVAR(llvm_get_code_evictions_doc,
+"get_code_evictions() -> int\n\
+\n\
+Return how many times machine code has been evicted to stay within the\n\
+code budget.");
+
+static PyObject *
+llvm_get_code_evictions(PyObject *self)
+{
+    return PyInt_FromSsize_t(_PyCodeBudget_GetEvictionCount());
+}
+
+PyDoc_STRVAR(llvm_get_jit_stats_doc,
+"get_jit_stats() -> dict\n\
+\n\
+Return what the JIT has done since startup or the last clear_jit_stats():\n\
+\n\
+  compiles, compile_seconds: how often code was given machine code, and\n\
+      how long that took, from generating IR to emitting machine code.\n\
+  invalidations: how often machine code was thrown away because something\n\
+      it depended on changed.\n\
+  bails: how often frames fell back to the eval loop, by reason.\n\
+  guard_fails: the \"guard_fail\" bails, by the kind of guard that failed.\n\
+  evictions, live_code_bytes: as get_code_evictions() and\n\
+      get_live_code_bytes().\n\
+  code: for each code object the JIT has touched, a dict with the same\n\
+      compiles, compile_seconds, invalidations, bails and guard_fails\n\
+      keys, plus code_size, as get_code_size(), feedback_bytes, the memory\n\
+      held by its runtime feedback, and bail_sites, mapping (opcode index,\n\
+      reason) to the number of bails from there.\n\
+\n\
+Reasons that never happened are left out of bails and guard_fails.");
+
+static PyObject *
+llvm_get_jit_stats(PyObject *self)
+{
+    return _PyJitStats_Get();
+}
+
+PyDoc_STRVAR(llvm_clear_jit_stats_doc,
+"clear_jit_stats()\n\
+\n\
+Reset the counters returned by get_jit_stats().");
+
+static PyObject *
+llvm_clear_jit_stats(PyObject *self)
+{
+    _PyJitStats_Clear();
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(llvm_set_hotness_model_doc,
+"set_hotness_model(model)\n\
+\n\
+Choose how hot functions are found.  'calls' counts calls and loop\n\
+iterations.  'time' counts only the samples the sampling profiler takes of\n\
+functions with at least 1% of all samples, and starts the profiler if it\n\
+isn't running.  Switching back to 'calls' leaves the profiler running.");
+
+static PyObject *
+llvm_set_hotness_model(PyObject *self, PyObject *model_obj)
+{
+    const char *model = PyString_AsString(model_obj);
+    if (model == NULL)
+        return NULL;
+    if (strcmp(model, "calls") == 0) {
+        Py_JitTimeHotness = 0;
+        Py_RETURN_NONE;
+    }
+    if (strcmp(model, "time") == 0) {
+        if (_PySampler_GetRate() == 0 &&
+            _PySampler_Start(PY_DEFAULT_SAMPLE_RATE) < 0)
+            return NULL;
+        Py_JitTimeHotness = 1;
+        Py_RETURN_NONE;
+    }
+    PyErr_Format(PyExc_ValueError,
+                 "hotness model should be 'calls' or 'time', not '%s'",
+                 model);
+    return NULL;
+}
+
+PyDoc_STRVAR(llvm_get_hotness_model_doc,
+"get_hotness_model() -> str\n\
+\n\
+Return 'calls' or 'time'; see set_hotness_model().");
+
+static PyObject *
+llvm_get_hotness_model(PyObject *self)
+{
+    return PyString_FromString(Py_JitTimeHotness ? "time" : "calls");
+}
+
+PyDoc_STRVAR(llvm_start_sampling_doc,
+"start_sampling([rate])\n\
+\n\
+Start sampling which code is running rate times a second of CPU time\n\
+(100 by default), or change the rate if the profiler is already running.\n\
+The profiler uses SIGPROF.");
+
+static PyObject *
+llvm_start_sampling(PyObject *self, PyObject *args)
+{
+    int rate = PY_DEFAULT_SAMPLE_RATE;
+    if (!PyArg_ParseTuple(args, "|i:start_sampling", &rate))
+        return NULL;
+    if (_PySampler_Start(rate) < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(llvm_stop_sampling_doc,
+"stop_sampling()\n\
+\n\
+Stop the sampling profiler.  Under the 'time' hotness model, nothing gets\n\
+any hotter until it's started again.");
+
+static PyObject *
+llvm_stop_sampling(PyObject *self)
+{
+    _PySampler_Stop();
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(llvm_get_sampling_rate_doc,
+"get_sampling_rate() -> int\n\
+\n\
+Return the samples per second the profiler takes, or 0 if it's stopped.");
+
+static PyObject *
+llvm_get_sampling_rate(PyObject *self)
+{
+    return PyInt_FromLong(_PySampler_GetRate());
+}
+
+PyDoc_STRVAR(llvm_get_samples_doc,
+"get_samples() -> (total, {code: samples})\n\
+\n\
+Return how many samples the profiler has taken since startup or the last\n\
+clear_samples(), and how many of them caught each live code object\n\
+running.  Time spent in C functions counts for the code that called them.");
+
+static PyObject *
+llvm_get_samples(PyObject *self)
+{
+    return _PySampler_GetSamples();
+}
+
+PyDoc_STRVAR(llvm_clear_samples_doc,
+"clear_samples()\n\
+\n\
+Forget the samples taken so far.  Hotness already gained from them stays.");
+
+static PyObject *
+llvm_clear_samples(PyObject *self)
+{
+    _PySampler_Clear();
+    Py_RETURN_NONE;
+}
+
 static struct PyMethodDef llvm_methods[] = {
     {"set_debug", (PyCFunction)llvm_setdebug, METH_O, setdebug_doc},
     {"compile", llvm_compile, METH_VARARGS, llvm_compile_doc},
@@ -185,8 +710,73 @@ static struct PyMethodDef llvm_methods[] = {
      llvm_set_jit_control_doc},
     {"get_hotness_threshold", (PyCFunction)llvm_get_hotness_threshold,
      METH_NOARGS, llvm_get_hotness_threshold_doc},
+    {"get_max_fatal_bail_count", (PyCFunction)llvm_get_max_fatal_bail_count,
+     METH_NOARGS, llvm_get_max_fatal_bail_count_doc},
     {"collect_unused_globals", (PyCFunction)llvm_collect_unused_globals,
      METH_NOARGS, llvm_collect_unused_globals_doc},
+    {"set_background_compile", (PyCFunction)llvm_set_background_compile,
+     METH_O, llvm_set_background_compile_doc},
+    {"get_background_compile", (PyCFunction)llvm_get_background_compile,
+     METH_NOARGS, llvm_get_background_compile_doc},
+    {"set_compile_threads", (PyCFunction)llvm_set_compile_threads,
+     METH_O, llvm_set_compile_threads_doc},
+    {"get_compile_threads", (PyCFunction)llvm_get_compile_threads,
+     METH_NOARGS, llvm_get_compile_threads_doc},
+    {"set_tiered_compile", (PyCFunction)llvm_set_tiered_compile,
+     METH_O, llvm_set_tiered_compile_doc},
+    {"get_tiered_compile", (PyCFunction)llvm_get_tiered_compile,
+     METH_NOARGS, llvm_get_tiered_compile_doc},
+    {"get_tier_up_threshold", (PyCFunction)llvm_get_tier_up_threshold,
+     METH_NOARGS, llvm_get_tier_up_threshold_doc},
+    {"wait_for_background_compiles",
+     (PyCFunction)llvm_wait_for_background_compiles, METH_NOARGS,
+     llvm_wait_for_background_compiles_doc},
+    {"dump_feedback", llvm_dump_feedback, METH_VARARGS,
+     llvm_dump_feedback_doc},
+    {"load_feedback", llvm_load_feedback, METH_VARARGS,
+     llvm_load_feedback_doc},
+    {"set_perf_map", (PyCFunction)llvm_set_perf_map, METH_O,
+     llvm_set_perf_map_doc},
+    {"get_perf_map", (PyCFunction)llvm_get_perf_map, METH_NOARGS,
+     llvm_get_perf_map_doc},
+    {"set_jitdump", (PyCFunction)llvm_set_jitdump, METH_O,
+     llvm_set_jitdump_doc},
+    {"get_jitdump", (PyCFunction)llvm_get_jitdump, METH_NOARGS,
+     llvm_get_jitdump_doc},
+    {"get_live_code_bytes", (PyCFunction)llvm_get_live_code_bytes,
+     METH_NOARGS, llvm_get_live_code_bytes_doc},
+    {"get_ir_instruction_count", (PyCFunction)llvm_get_ir_instruction_count,
+     METH_NOARGS, llvm_get_ir_instruction_count_doc},
+    {"set_code_budget", (PyCFunction)llvm_set_code_budget, METH_O,
+     llvm_set_code_budget_doc},
+    {"get_code_budget", (PyCFunction)llvm_get_code_budget, METH_NOARGS,
+     llvm_get_code_budget_doc},
+    {"set_feedback_sampling", llvm_set_feedback_sampling, METH_VARARGS,
+     llvm_set_feedback_sampling_doc},
+    {"get_feedback_sampling", (PyCFunction)llvm_get_feedback_sampling,
+     METH_NOARGS, llvm_get_feedback_sampling_doc},
+    {"get_code_size", (PyCFunction)llvm_get_code_size, METH_O,
+     llvm_get_code_size_doc},
+    {"get_code_evictions", (PyCFunction)llvm_get_code_evictions,
+     METH_NOARGS, llvm_get_code_evictions_doc},
+    {"get_jit_stats", (PyCFunction)llvm_get_jit_stats, METH_NOARGS,
+     llvm_get_jit_stats_doc},
+    {"clear_jit_stats", (PyCFunction)llvm_clear_jit_stats, METH_NOARGS,
+     llvm_clear_jit_stats_doc},
+    {"set_hotness_model", (PyCFunction)llvm_set_hotness_model, METH_O,
+     llvm_set_hotness_model_doc},
+    {"get_hotness_model", (PyCFunction)llvm_get_hotness_model, METH_NOARGS,
+     llvm_get_hotness_model_doc},
+    {"start_sampling", llvm_start_sampling, METH_VARARGS,
+     llvm_start_sampling_doc},
+    {"stop_sampling", (PyCFunction)llvm_stop_sampling, METH_NOARGS,
+     llvm_stop_sampling_doc},
+    {"get_sampling_rate", (PyCFunction)llvm_get_sampling_rate, METH_NOARGS,
+     llvm_get_sampling_rate_doc},
+    {"get_samples", (PyCFunction)llvm_get_samples, METH_NOARGS,
+     llvm_get_samples_doc},
+    {"clear_samples", (PyCFunction)llvm_clear_samples, METH_NOARGS,
+     llvm_clear_samples_doc},
     { NULL, NULL }
 };
 
@@ -85,6 +85,26 @@ static char *usage_3 = "\
 -x     : skip first line of source, allowing use of non-Unix forms of #!cmd\n\
 -Xjit=arg : control JIT compilation: -Xjit=whenhot (default), -Xjit=never,\n\
             -Xjit=always.\n\
+-Xjitcompile=arg : where hot code is compiled: -Xjitcompile=foreground\n\
+            (default) or -Xjitcompile=background for a separate thread.\n\
+-Xjitthreads=n : compile in the background on up to n threads at once.\n\
+-Xjitopt=arg : how hot code is optimized: -Xjitopt=full (default) compiles\n\
+            it fully right away; -Xjitopt=tiered compiles it cheaply first\n\
+            and optimizes it in the background if it stays hot.\n\
+-Xjitcache=path : remember which functions were worth compiling in path,\n\
+            and compile them after a short warm-up next time.\n\
+-Xjitprofile=path : load runtime feedback and hotness from path at startup,\n\
+            and save them there at exit.\n\
+-Xjitbudget=size : keep at most size bytes of machine code (with an optional\n\
+            k or m suffix), evicting the least recently used.\n\
+-Xjitsample=n : only record runtime feedback on every nth call of a function.\n\
+-Xjitwarmup=p : only record runtime feedback once a function is p percent of\n\
+            the way to being hot.\n\
+-Xjithotness=arg : how hotness is measured: -Xjithotness=calls (default)\n\
+            counts calls and loop iterations; -Xjithotness=time samples\n\
+            where CPU time goes.\n\
+-Xquicken=n : specialize the bytecode of functions that have run n times\n\
+            (default 8); 0 never does.\n\
 ";
 #ifdef WITH_PY3K_WARNINGS
 static char *usage_4 = "\
@@ -357,6 +377,21 @@ Py_Main(int argc, char **argv)
 			break;
 
                 case 'X':
+			if (strncmp(_PyOS_optarg, "quicken=", 8) == 0) {
+				const char *count = _PyOS_optarg + 8;
+				char *end;
+				long threshold = strtol(count, &end, 10);
+				if (end != count && *end == '\0' && threshold >= 0
+				    && threshold <= INT_MAX) {
+					Py_QuickenThreshold = (int)threshold;
+					break;
+				}
+
+				fprintf(stderr,
+				        "-Xquicken value should be a non-negative"
+				        " number, not `%s'\n",
+				        _PyOS_optarg);
+			} else
 #ifdef WITH_LLVM
 			/* Support both -Xjit=never and -Xjit never is a huge
 			   hassle due to the way _PyOS_GetOpt() works. This
@@ -372,6 +407,126 @@ Py_Main(int argc, char **argv)
 				        "-Xjit value should be `whenhot'"
 				        ", `always`, or `never', not `%s'\n",
 				        _PyOS_optarg);
+			} else if (strncmp(_PyOS_optarg, "jitcompile=", 11) == 0) {
+				const char *where = _PyOS_optarg + 11;
+				if (strcmp(where, "foreground") == 0) {
+					Py_JitBackgroundCompile = 0;
+					break;
+				}
+				if (strcmp(where, "background") == 0) {
+					Py_JitBackgroundCompile = 1;
+					break;
+				}
+
+				fprintf(stderr,
+				        "-Xjitcompile value should be"
+				        " `foreground' or `background', not `%s'\n",
+				        _PyOS_optarg);
+			} else if (strncmp(_PyOS_optarg, "jitthreads=", 11) == 0) {
+				const char *count = _PyOS_optarg + 11;
+				char *end;
+				long threads = strtol(count, &end, 10);
+				if (end != count && *end == '\0' && threads >= 1
+				    && threads <= INT_MAX) {
+					Py_JitCompileThreads = (int)threads;
+					break;
+				}
+
+				fprintf(stderr,
+				        "-Xjitthreads value should be a positive"
+				        " number, not `%s'\n",
+				        _PyOS_optarg);
+			} else if (strncmp(_PyOS_optarg, "jitopt=", 7) == 0) {
+				const char *how = _PyOS_optarg + 7;
+				if (strcmp(how, "full") == 0) {
+					Py_JitTiered = 0;
+					break;
+				}
+				if (strcmp(how, "tiered") == 0) {
+					Py_JitTiered = 1;
+					break;
+				}
+
+				fprintf(stderr,
+				        "-Xjitopt value should be"
+				        " `full' or `tiered', not `%s'\n",
+				        _PyOS_optarg);
+			} else if (strncmp(_PyOS_optarg, "jitcache=", 9) == 0
+			           && _PyOS_optarg[9] != '\0') {
+				Py_JitCacheFile = _PyOS_optarg + 9;
+				break;
+			} else if (strncmp(_PyOS_optarg, "jitprofile=", 11) == 0
+			           && _PyOS_optarg[11] != '\0') {
+				Py_JitProfileFile = _PyOS_optarg + 11;
+				break;
+			} else if (strncmp(_PyOS_optarg, "jitbudget=", 10) == 0) {
+				const char *size = _PyOS_optarg + 10;
+				char *end;
+				long budget, multiplier = 1;
+				errno = 0;
+				budget = strtol(size, &end, 10);
+				if (*end == 'k' || *end == 'K') {
+					multiplier = 1024;
+					++end;
+				} else if (*end == 'm' || *end == 'M') {
+					multiplier = 1024 * 1024;
+					++end;
+				}
+				if (end != size && *end == '\0' && errno != ERANGE
+				    && budget >= 0
+				    && budget <= LONG_MAX / multiplier) {
+					Py_JitCodeBudget = budget * multiplier;
+					break;
+				}
+
+				fprintf(stderr,
+				        "-Xjitbudget value should be a number of"
+				        " bytes, optionally followed by `k' or `m',"
+				        " not `%s'\n",
+				        _PyOS_optarg);
+			} else if (strncmp(_PyOS_optarg, "jitsample=", 10) == 0) {
+				const char *count = _PyOS_optarg + 10;
+				char *end;
+				long interval = strtol(count, &end, 10);
+				if (end != count && *end == '\0' && interval >= 1
+				    && interval <= INT_MAX) {
+					Py_JitFeedbackInterval = (int)interval;
+					break;
+				}
+
+				fprintf(stderr,
+				        "-Xjitsample value should be a positive"
+				        " number, not `%s'\n",
+				        _PyOS_optarg);
+			} else if (strncmp(_PyOS_optarg, "jitwarmup=", 10) == 0) {
+				const char *percent = _PyOS_optarg + 10;
+				char *end;
+				long warmup = strtol(percent, &end, 10);
+				if (end != percent && *end == '\0' && warmup >= 0
+				    && warmup <= 100) {
+					Py_JitFeedbackWarmup = (int)warmup;
+					break;
+				}
+
+				fprintf(stderr,
+				        "-Xjitwarmup value should be a percentage"
+				        " from 0 to 100, not `%s'\n",
+				        _PyOS_optarg);
+			} else if (strncmp(_PyOS_optarg, "jithotness=", 11) == 0) {
+				const char *how = _PyOS_optarg + 11;
+				if (strcmp(how, "calls") == 0) {
+					Py_JitTimeHotness = 0;
+					break;
+				}
+				if (strcmp(how, "time") == 0) {
+					Py_JitTimeHotness = 1;
+					break;
+				}
+
+				fprintf(stderr,
+				        "-Xjithotness value should be"
+				        " `calls' or `time', not `%s'\n",
+				        _PyOS_optarg);
 			} else
 #endif  /* WITH_LLVM */
 			if (strchr(_PyOS_optarg, '=') == NULL) {
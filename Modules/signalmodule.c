@@ -5,6 +5,8 @@
 
 #include "Python.h"
 #include "intrcheck.h"
+#include "JIT/compile_thread.h"
+#include "JIT/sampling_profiler.h"
 
 #ifdef MS_WINDOWS
 #include <process.h>
@@ -927,5 +929,11 @@ PyOS_AfterFork(void)
 	main_pid = getpid();
 	_PyImport_ReInitLock();
 	PyThread_ReInitTLS();
+#ifdef WITH_LLVM
+	_PyLlvm_ReInitCompileThread();
+#endif
+#endif
+#ifdef WITH_LLVM
+	_PySampler_AfterFork();
 #endif
 }
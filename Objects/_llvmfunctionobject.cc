@@ -5,6 +5,7 @@
 
 #include "frameobject.h"
 #include "structmember.h"
+#include "JIT/compile_thread.h"
 #include "JIT/global_llvm_data.h"
 #include "Util/Stats.h"
 
@@ -35,6 +36,13 @@ struct _LlvmFunction {
     // shutdown, where the Module is destroyed without destroying all
     // code objects first.
     Function *lf_function;
+    // The PyGlobalLlvmData whose module holds lf_function.  Its compile
+    // lock protects lf_function.
+    PyGlobalLlvmData *lf_llvm_data;
+    // Links the functions on a code object's co_retired_llvm_functions.
+    _LlvmFunction *lf_retired_next;
+    // Bytes of machine code emitted for lf_function; 0 until it's JITted.
+    size_t lf_code_size;
 };
 
 #ifdef Py_WITH_INSTRUMENTATION
@@ -73,26 +81,73 @@ static llvm::ManagedStatic<LlvmIrSizeStats> llvm_ir_size_stats;
 #endif  // Py_WITH_INSTRUMENTATION
 
 _LlvmFunction *
-_LlvmFunction_New(void *llvm_function)
+_LlvmFunction_New(PyGlobalLlvmData *global_data, void *llvm_function)
 {
     llvm::Function *typed_function = (llvm::Function*)llvm_function;
     _LlvmFunction *wrapper = new _LlvmFunction();
     wrapper->lf_function = typed_function;
+    wrapper->lf_llvm_data = global_data;
+    wrapper->lf_retired_next = NULL;
+    wrapper->lf_code_size = 0;
     return wrapper;
 }
 
+void
+_LlvmFunction_Retire(_LlvmFunction **retired, _LlvmFunction *functionobj)
+{
+    assert(functionobj->lf_retired_next == NULL &&
+           "Function was already retired");
+    functionobj->lf_retired_next = *retired;
+    *retired = functionobj;
+}
+
+void
+_LlvmFunction_DeallocRetired(_LlvmFunction *retired)
+{
+    while (retired != NULL) {
+        _LlvmFunction *next = retired->lf_retired_next;
+        _LlvmFunction_Dealloc(retired);
+        retired = next;
+    }
+}
+
+size_t
+_LlvmFunction_GetCodeSize(_LlvmFunction *functionobj)
+{
+    return functionobj->lf_code_size;
+}
+
+size_t
+_LlvmFunction_GetRetiredCodeSize(_LlvmFunction *retired)
+{
+    size_t total = 0;
+    for (; retired != NULL; retired = retired->lf_retired_next)
+        total += retired->lf_code_size;
+    return total;
+}
+
 void
 _LlvmFunction_Dealloc(_LlvmFunction *functionobj)
 {
+    PyGlobalLlvmData *global_data = functionobj->lf_llvm_data;
+    PyLlvmCompileLock lock(global_data);
     llvm::Function *function = functionobj->lf_function;
     // Clear the AssertingVH to avoid crashing when we delete the function.
     functionobj->lf_function = NULL;
-    // Allow global optimizations to destroy the function.
-    function->setLinkage(llvm::GlobalValue::InternalLinkage);
+    // Hand the machine code back to the JIT's memory manager now, so the
+    // next function we emit can reuse it, rather than whenever the IR
+    // happens to be deleted.
+    global_data->getExecutionEngine()->freeMachineCodeForFunction(function);
     if (function->use_empty()) {
         // Delete the function if it's already unused.
         function->eraseFromParent();
     }
+    else {
+        // Drop the body so it stops holding on to the globals it used.  That
+        // leaves an external declaration, which globaldce deletes once its
+        // last use goes away.
+        function->deleteBody();
+    }
     delete functionobj;
 }
 
@@ -142,11 +197,13 @@ clear_body(llvm::Function *function)
 }
 
 PyEvalFrameFunction
-_LlvmFunction_Jit(_LlvmFunction *function_obj)
+_LlvmFunction_Jit(PyGlobalLlvmData *global_llvm_data,
+                  _LlvmFunction *function_obj)
 {
+    assert(function_obj->lf_llvm_data == global_llvm_data &&
+           "Function belongs to another module");
+    PyLlvmCompileLock lock(global_llvm_data);
     llvm::Function *function = (llvm::Function *)function_obj->lf_function;
-    PyGlobalLlvmData *global_llvm_data =
-        PyThreadState_GET()->interp->global_llvm_data;
     llvm::ExecutionEngine *engine = global_llvm_data->getExecutionEngine();
 
     PyEvalFrameFunction native_func;
@@ -164,6 +221,8 @@ _LlvmFunction_Jit(_LlvmFunction *function_obj)
 #else
     native_func = (PyEvalFrameFunction)engine->getPointerToFunction(function);
 #endif
+    function_obj->lf_code_size =
+        global_llvm_data->GetMachineCodeSize((void *)native_func);
     // Clear the function body to reduce memory usage. This means we'll
     // need to re-compile the bytecode to IR and reoptimize it again, if we
     // need it again.
@@ -176,6 +235,8 @@ _LlvmFunction_Optimize(PyGlobalLlvmData *global_data,
                        _LlvmFunction *llvm_function,
                        int level)
 {
+    assert(llvm_function->lf_llvm_data == global_data &&
+           "Function belongs to another module");
     return global_data->Optimize(*llvm_function->lf_function, level);
 }
 
@@ -254,6 +315,7 @@ recompile(PyLlvmFunctionObject *functionobj)
 static PyObject *
 llvmfunction_str(PyLlvmFunctionObject *function_obj)
 {
+    PyLlvmCompileLock lock;
     std::string result;
     llvm::raw_string_ostream wrapper(result);
 
@@ -272,6 +334,7 @@ llvmfunction_str(PyLlvmFunctionObject *function_obj)
 static PyObject *
 func_view_cfg(PyLlvmFunctionObject *function_obj)
 {
+    PyLlvmCompileLock lock;
     _LlvmFunction *new_function = recompile(function_obj);
     if (new_function == NULL) {
         return NULL;
@@ -285,6 +348,7 @@ func_view_cfg(PyLlvmFunctionObject *function_obj)
 static PyObject *
 func_get_module(PyLlvmFunctionObject *op)
 {
+    PyLlvmCompileLock lock(op->code_object->co_llvm_function->lf_llvm_data);
     llvm::Module *module = _PyLlvmFunction_GetFunction(op)->getParent();
     if (module == NULL) {
         PyErr_BadInternalCall();
@@ -1,9 +1,14 @@
 #include "Python.h"
 #include "code.h"
 #include "structmember.h"
+#include "JIT/code_budget.h"
+#include "JIT/code_cache.h"
+#include "JIT/feedback_profile.h"
 #include "JIT/global_llvm_data_fwd.h"
+#include "JIT/jit_stats.h"
 #include "JIT/llvm_compile.h"
 #include "JIT/RuntimeFeedback_fwd.h"
+#include "JIT/sampling_profiler.h"
 
 #define NAME_CHARS \
 	"0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ_abcdefghijklmnopqrstuvwxyz"
@@ -107,6 +112,9 @@ PyCode_New(int argcount, int nlocals, int stacksize, int flags,
 		co->co_lnotab = lnotab;
 		co->co_zombieframe = NULL;
 		co->co_weakreflist = NULL;
+		co->co_quickened = NULL;
+		co->co_inline_caches = NULL;
+		co->co_quicken_count = 0;
 #ifdef WITH_LLVM
 		co->co_llvm_function = NULL;
 		co->co_native_function = NULL;
@@ -118,6 +126,14 @@ PyCode_New(int argcount, int nlocals, int stacksize, int flags,
 		co->co_hotness = 0;
 		co->co_fatalbailcount = 0;
 		co->co_watching = NULL;
+		co->co_watched_keys = NULL;
+		co->co_compile_queued = 0;
+		co->co_retired_llvm_functions = NULL;
+		co->co_native_last_used = 0;
+		co->co_feedback_countdown = 0;
+		co->co_samples = 0;
+		_PyJitCache_ApplyTo(co);
+		_PyFeedbackProfile_ApplyTo(co);
 #endif
 	}
 	return co;
@@ -145,10 +161,21 @@ static PyMemberDef code_memberlist[] = {
 	{"co_hotness", T_INT,		OFF(co_hotness),	READONLY},
 	{"co_fatalbailcount", T_INT,	OFF(co_fatalbailcount),	READONLY},
 	{"co_use_jit", T_BOOL,		OFF(co_use_jit)},
+	{"co_samples", T_LONG,		OFF(co_samples),	READONLY},
 #endif
 	{NULL}	/* Sentinel */
 };
 
+static PyObject *
+code_get_quickened(PyCodeObject *code)
+{
+	if (code->co_quickened == NULL)
+		Py_RETURN_NONE;
+
+	return PyString_FromStringAndSize((char *)code->co_quickened,
+					  PyString_GET_SIZE(code->co_code));
+}
+
 #ifdef WITH_LLVM
 static PyObject *
 code_get_optimization(PyCodeObject *code)
@@ -183,6 +210,7 @@ static PyGetSetDef code_getsetlist[] = {
 	{"co_optimization", (getter)code_get_optimization,
 	 (setter)code_set_optimization},
 	{"co_llvm", (getter)code_get_co_llvm, (setter)NULL},
+	{"co_quickened", (getter)code_get_quickened, (setter)NULL},
 	{NULL} /* Sentinel */
 };
 
@@ -209,9 +237,15 @@ _PyCode_WatchDict(PyCodeObject *code, ReasonWatched reason, PyObject *dict)
 			return -1;
 	}
 
+	/* Keep the keys that machine code already compiled against this dict
+	   depends on. */
+	if (code->co_watching[reason] == dict)
+		return 0;
 	if (code->co_watching[reason] != NULL) {
 		_PyDict_DropWatcher(code->co_watching[reason], code);
 	}
+	if (code->co_watched_keys != NULL)
+		Py_CLEAR(code->co_watched_keys[reason]);
 	/* Note that we do not hold a reference to these dicts. If one of these
 	   dicts is deleted, it will notify all dependent code objects.
 	   Likewise, if this code object is deleted, it will remove itself from
@@ -229,6 +263,99 @@ _PyCode_IgnoreDict(PyCodeObject *code, ReasonWatched reason)
 		return 0;
 	_PyDict_DropWatcher(code->co_watching[reason], code);
 	code->co_watching[reason] = NULL;
+	if (code->co_watched_keys != NULL)
+		Py_CLEAR(code->co_watched_keys[reason]);
+	return 0;
+}
+
+/* Returns a new tuple holding the keys of old followed by any keys of new
+   that aren't in old, or NULL on failure. */
+static PyObject *
+merge_watched_keys(PyObject *old, PyObject *new)
+{
+	Py_ssize_t i, j, n_old = PyTuple_GET_SIZE(old);
+	PyObject *merged = PySequence_List(old);
+	PyObject *result;
+	if (merged == NULL)
+		return NULL;
+	for (i = 0; i < PyTuple_GET_SIZE(new); ++i) {
+		PyObject *key = PyTuple_GET_ITEM(new, i);
+		for (j = 0; j < n_old; ++j) {
+			if (PyTuple_GET_ITEM(old, j) == key)
+				break;
+		}
+		if (j == n_old && PyList_Append(merged, key) < 0) {
+			Py_DECREF(merged);
+			return NULL;
+		}
+	}
+	result = PyList_AsTuple(merged);
+	Py_DECREF(merged);
+	return result;
+}
+
+int
+_PyCode_AddWatchedKeys(PyCodeObject *code, ReasonWatched reason,
+		       PyObject *keys)
+{
+	PyObject *old, *merged;
+
+	assert(keys == Py_None || PyTuple_CheckExact(keys));
+	if (code->co_watching == NULL || code->co_watching[reason] == NULL)
+		return 0;
+	if (code->co_watched_keys == NULL) {
+		code->co_watched_keys = new_watch_list();
+		if (code->co_watched_keys == NULL)
+			return -1;
+	}
+
+	/* Machine code compiled earlier against the same dict, and IR
+	   inlined from this code object into other functions, may still
+	   depend on keys that the new machine code doesn't, so the set only
+	   grows until the machine code is invalidated. */
+	old = code->co_watched_keys[reason];
+	if (old == Py_None)
+		return 0;
+	if (old == NULL || keys == Py_None) {
+		merged = keys;
+		Py_INCREF(merged);
+	}
+	else {
+		merged = merge_watched_keys(old, keys);
+		if (merged == NULL)
+			return -1;
+	}
+	Py_XDECREF(old);
+	code->co_watched_keys[reason] = merged;
+	return 0;
+}
+
+int
+_PyCode_DependsOnDictKey(PyCodeObject *code, PyObject *dict, PyObject *key)
+{
+	Py_ssize_t i, j;
+
+	if (code->co_watched_keys == NULL)
+		return 1;
+	/* Anything but an exact string might compare equal to one of our
+	   keys in ways we can't cheaply rule out. */
+	if (!PyString_CheckExact(key))
+		return 1;
+	/* The same dict can be watched for more than one reason, eg. when
+	   globals is builtins. */
+	for (i = 0; i < NUM_WATCHING_REASONS; ++i) {
+		PyObject *keys;
+		if (code->co_watching[i] != dict)
+			continue;
+		keys = code->co_watched_keys[i];
+		if (keys == NULL || keys == Py_None)
+			return 1;
+		for (j = 0; j < PyTuple_GET_SIZE(keys); ++j) {
+			PyObject *watched = PyTuple_GET_ITEM(keys, j);
+			if (watched == key || _PyString_Eq(watched, key))
+				return 1;
+		}
+	}
 	return 0;
 }
 
@@ -257,6 +384,8 @@ _PyCode_IgnoreWatchedDicts(PyCodeObject *code)
 			_PyDict_DropWatcher(code->co_watching[i], code);
 		}
 		code->co_watching[i] = NULL;
+		if (code->co_watched_keys != NULL)
+			Py_CLEAR(code->co_watched_keys[i]);
 	}
 }
 
@@ -270,8 +399,45 @@ _PyCode_InvalidateMachineCode(PyCodeObject *code)
 	code->co_fatalbailcount++;
 	/* This is a no-op if not configured with --with-instrumentation. */
 	_PyEval_RecordFatalBail(code);
+	_PyJitCache_RecordFatalBail(code);
+	_PyJitStats_RecordInvalidation(code);
 	/* The machine code is invalid, no need to keep watching these dicts. */
 	_PyCode_IgnoreWatchedDicts(code);
+
+	/* Frames that are still running the old machine code will bail when
+	   they next check a guard, since it tests co_fatalbailcount.  Until
+	   then the code has to stay around. */
+	if (code->co_llvm_function != NULL) {
+		_LlvmFunction_Retire(&code->co_retired_llvm_functions,
+				     code->co_llvm_function);
+		code->co_llvm_function = NULL;
+	}
+	code->co_native_function = NULL;
+	code->co_optimization = -1;
+	/* Start over.  If the code gets hot again, we'll compile it with
+	   what it sees from now on; see _PyCode_HotnessThreshold().  Sites
+	   that were megamorphic stay that way. */
+	code->co_hotness = 0;
+	if (code->co_runtime_feedback != NULL)
+		PyFeedbackMap_ClearKeepingMegamorphic(
+			code->co_runtime_feedback);
+}
+
+int
+_PyCode_CanCompileToLlvm(PyCodeObject *code)
+{
+	/* Large functions take a very long time to translate to LLVM
+	   IR, optimize, and JIT, so we just keep them in the
+	   interpreter. */
+	if (PyString_GET_SIZE(code->co_code) > 5000)
+		return 0;
+	// The exec statement wants to mess with the frame object in
+	// ways that can inhibit optimizations (or make them harder to
+	// implement), so we refuse to optimize code objects that use
+	// exec.
+	if (code->co_flags & CO_USES_EXEC)
+		return 0;
+	return 1;
 }
 
 int
@@ -286,17 +452,7 @@ _PyCode_ToOptimizedLlvmIr(PyCodeObject *code, int new_opt_level)
 			     new_opt_level);
 		return -1;
 	}
-	/* Large functions take a very long time to translate to LLVM
-	   IR, optimize, and JIT, so we just keep them in the
-	   interpreter. */
-	if (PyString_GET_SIZE(code->co_code) > 5000) {
-		return 1;
-	}
-	// The exec statement wants to mess with the frame object in
-	// ways that can inhibit optimizations (or make them harder to
-	// implement), so we refuse to optimize code objects that use
-	// exec.
-	if (code->co_flags & CO_USES_EXEC)
+	if (!_PyCode_CanCompileToLlvm(code))
 		return 1;
 	if (code->co_llvm_function == NULL) {
 		code->co_llvm_function = _PyCode_ToLlvmIr(code);
@@ -318,6 +474,7 @@ _PyCode_ToOptimizedLlvmIr(PyCodeObject *code, int new_opt_level)
 }
 #else
 static PyGetSetDef code_getsetlist[] = {
+	{"co_quickened", (getter)code_get_quickened, (setter)NULL},
 	{NULL} /* Sentinel */
 };
 #endif  /* WITH_LLVM */
@@ -464,18 +621,32 @@ code_dealloc(PyCodeObject *co)
                 PyObject_GC_Del(co->co_zombieframe);
         if (co->co_weakreflist != NULL)
 		PyObject_ClearWeakRefs((PyObject*)co);
+	PyMem_Free(co->co_quickened);
+	PyMem_Free(co->co_inline_caches);
 #ifdef WITH_LLVM
 	// co_native_function is destroyed by co_llvm_function.
 	if (co->co_llvm_function) {
 		_LlvmFunction_Dealloc(co->co_llvm_function);
 		co->co_llvm_function = NULL;
 	}
+	_LlvmFunction_DeallocRetired(co->co_retired_llvm_functions);
+	co->co_retired_llvm_functions = NULL;
+	_PyCodeBudget_Forget(co);
+	_PyJitStats_Forget(co);
+	_PySampler_Forget(co);
 	if (co->co_watching) {
 		_PyCode_IgnoreWatchedDicts(co);
 		PyMem_Free(co->co_watching);
 		co->co_watching = NULL;
 	}
-	PyFeedbackMap_Del(co->co_runtime_feedback);
+	if (co->co_watched_keys) {
+		PyMem_Free(co->co_watched_keys);
+		co->co_watched_keys = NULL;
+	}
+	if (co->co_runtime_feedback) {
+		_PyFeedbackProfile_Untrack(co);
+		PyFeedbackMap_Del(co->co_runtime_feedback);
+	}
 #endif
 	PyObject_DEL(co);
 }
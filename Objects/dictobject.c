@@ -147,9 +147,13 @@ _PyDict_Dummy(void)
 }
 #endif
 
+/* Where ma_keys_version values come from.  64 bits won't wrap. */
+static unsigned PY_LONG_LONG keys_version_counter = 0;
+#define NEW_KEYS_VERSION(mp) ((mp)->ma_keys_version = ++keys_version_counter)
+
 /* forward declarations */
 static PyDictEntry *lookdict_string(PyDictObject *mp, PyObject *key, long hash);
-static void notify_watchers(PyDictObject *self);
+static void notify_watchers(PyDictObject *self, PyObject *key);
 static void del_watchers_array(PyDictObject *self);
 
 #ifdef SHOW_CONVERSION_COUNTS
@@ -265,6 +269,7 @@ PyDict_New(void)
 #endif
 	}
 	mp->ma_lookup = lookdict_string;
+	NEW_KEYS_VERSION(mp);
 #ifdef WITH_LLVM
 	mp->ma_watchers = NULL;
 #endif
@@ -478,6 +483,7 @@ insertdict(register PyDictObject *mp, PyObject *key, long hash, PyObject *value)
 		ep->me_hash = (Py_ssize_t)hash;
 		ep->me_value = value;
 		mp->ma_used++;
+		NEW_KEYS_VERSION(mp);
 	}
 	return 0;
 }
@@ -711,7 +717,7 @@ PyDict_SetItem(register PyObject *op, PyObject *key, PyObject *value)
 	if (status < 0)
 		return -1;
 	else if (status == 0)
-		notify_watchers(mp);
+		notify_watchers(mp, key);
 	/* If we added a key, we can safely resize.  Otherwise just return!
 	 * If fill >= 2/3 size, adjust size.  Normally, this doubles or
 	 * quaduples the size, but it's also possible for the dict to shrink
@@ -764,9 +770,10 @@ PyDict_DelItem(PyObject *op, PyObject *key)
 	old_value = ep->me_value;
 	ep->me_value = NULL;
 	mp->ma_used--;
+	NEW_KEYS_VERSION(mp);
 	Py_DECREF(old_value);
 	Py_DECREF(old_key);
-	notify_watchers(mp);
+	notify_watchers(mp, key);
 	return 0;
 }
 
@@ -791,7 +798,7 @@ PyDict_Clear(PyObject *op)
 #endif
 
 	/* Clear the list of watching code objects. */
-	notify_watchers(mp);
+	notify_watchers(mp, NULL);
 	del_watchers_array(mp);
 
 	table = mp->ma_table;
@@ -818,6 +825,7 @@ PyDict_Clear(PyObject *op)
 		EMPTY_TO_MINSIZE(mp);
 	}
 	/* else it's a small table that's already empty */
+	NEW_KEYS_VERSION(mp);
 
 	/* Now we can finally clear things.  If C had refcounts, we could
 	 * assert that the refcount on table is 1 now, i.e. that this function
@@ -921,7 +929,7 @@ dict_dealloc(register PyDictObject *mp)
 	Py_ssize_t fill = mp->ma_fill;
 
 	/* De-optimize any optimized code objects. */
-	notify_watchers(mp);
+	notify_watchers(mp, NULL);
 	del_watchers_array(mp);
 
  	PyObject_GC_UnTrack(mp);
@@ -1505,7 +1513,7 @@ PyDict_Merge(PyObject *a, PyObject *b, int override)
 					return -1;
 			}
 		}
-		notify_watchers(mp);
+		notify_watchers(mp, NULL);
 	}
 	else {
 		/* Do it the generic, slower way */
@@ -1945,8 +1953,9 @@ dict_pop(PyDictObject *mp, PyObject *key, PyObject *deflt)
 	old_value = ep->me_value;
 	ep->me_value = NULL;
 	mp->ma_used--;
+	NEW_KEYS_VERSION(mp);
 	Py_DECREF(old_key);
-	notify_watchers(mp);
+	notify_watchers(mp, key);
 	return old_value;
 }
 
@@ -2003,9 +2012,10 @@ dict_popitem(PyDictObject *mp)
 	ep->me_key = dummy;
 	ep->me_value = NULL;
 	mp->ma_used--;
+	NEW_KEYS_VERSION(mp);
 	assert(mp->ma_table[0].me_value == NULL);
 	mp->ma_table[0].me_hash = i + 1;  /* next place to start */
-	notify_watchers(mp);
+	notify_watchers(mp, PyTuple_GET_ITEM(res, 0));
 	return res;
 }
 
@@ -2074,39 +2084,65 @@ _PyDict_IsWatchedBy(PyDictObject *mp, PyCodeObject *code)
 #endif  /* WITH_LLVM */
 
 #ifdef WITH_LLVM
+struct watcher_notification {
+	PyDictObject *dict;
+	PyObject *key;
+};
+
 static void
-notify_watcher_callback(PyObject *obj, void *unused)
+notify_watcher_callback(PyObject *obj, void *arg)
 {
+	struct watcher_notification *notification =
+		(struct watcher_notification *)arg;
+	PyCodeObject *code = (PyCodeObject *)obj;
 	assert(PyCode_Check(obj));
-	_PyCode_InvalidateMachineCode((PyCodeObject *)obj);
+
+	if (notification->key != NULL &&
+	    !_PyCode_DependsOnDictKey(code, (PyObject *)notification->dict,
+				      notification->key)) {
+		/* No-op if not configured with --with-instrumentation. */
+		_PyEval_RecordWatcherNotification(0);
+		return;
+	}
+	_PyEval_RecordWatcherNotification(1);
+	_PyCode_InvalidateMachineCode(code);
 }
 
 // We split the real work of notify_watchers() out into a separate function so
 // that gcc will inline the self->ma_watchers == NULL test.
 static void
-notify_watchers_helper(PyDictObject *self)
+notify_watchers_helper(PyDictObject *self, PyObject *key)
 {
+	struct watcher_notification notification;
+
 	/* No-op if not configured with --with-instrumentation. */
 	_PyEval_RecordWatcherCount(PySmallPtrSet_Size(self->ma_watchers));
 
 	/* Assume that we're only updating PyCodeObjects. This may need to be
 	   made more general in the future.
-	   Note that notifying the watching code objects clears them from this
-	   list. There's no point in notifying a code object multiple times
-	   in quick succession. */
-	PySmallPtrSet_ForEach(self->ma_watchers, notify_watcher_callback, NULL);
-	assert(PySmallPtrSet_Size(self->ma_watchers) == 0);
+	   Note that invalidating the watching code objects clears them from
+	   this list. There's no point in notifying a code object multiple
+	   times in quick succession.  Code objects that only cached other
+	   keys stay on the list. */
+	notification.dict = self;
+	notification.key = key;
+	PySmallPtrSet_ForEach(self->ma_watchers, notify_watcher_callback,
+			      &notification);
+	assert(key != NULL || PySmallPtrSet_Size(self->ma_watchers) == 0);
 }
 #endif  /* WITH_LLVM */
 
+/* Tell the code objects watching this dict that it changed.  key is the key
+   that was added, changed or removed, or NULL if the change could affect any
+   key. */
 static void
-notify_watchers(PyDictObject *self)
+notify_watchers(PyDictObject *self, PyObject *key)
 {
 #ifdef WITH_LLVM
 	if (self->ma_watchers == NULL)
 		return;
 
-	notify_watchers_helper(self);
+	notify_watchers_helper(self, key);
 #endif  /* WITH_LLVM */
 }
 
@@ -2312,6 +2348,7 @@ dict_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 		assert(d->ma_table == NULL && d->ma_fill == 0 && d->ma_used == 0);
 		INIT_NONZERO_DICT_SLOTS(d);
 		d->ma_lookup = lookdict_string;
+		NEW_KEYS_VERSION(d);
 #ifdef SHOW_CONVERSION_COUNTS
 		++created;
 #endif
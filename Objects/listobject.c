@@ -2791,11 +2791,7 @@ PyTypeObject PyList_Type = {
 
 /*********************** List Iterator **************************/
 
-typedef struct {
-	PyObject_HEAD
-	long it_index;
-	PyListObject *it_seq; /* Set to NULL when iterator is exhausted */
-} listiterobject;
+typedef PyListIterObject listiterobject;
 
 static PyObject *list_iter(PyObject *);
 static void listiter_dealloc(listiterobject *);
@@ -884,11 +884,7 @@ PyTuple_Fini(void)
 
 /*********************** Tuple Iterator **************************/
 
-typedef struct {
-	PyObject_HEAD
-	long it_index;
-	PyTupleObject *it_seq; /* Set to NULL when iterator is exhausted */
-} tupleiterobject;
+typedef PyTupleIterObject tupleiterobject;
 
 static void
 tupleiter_dealloc(tupleiterobject *it)
@@ -29,10 +29,17 @@
 #include "llvm/Function.h"
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/raw_ostream.h"
+#include "JIT/code_budget.h"
+#include "JIT/code_cache.h"
+#include "JIT/compile_thread.h"
+#include "JIT/feedback_profile.h"
 #include "JIT/global_llvm_data.h"
+#include "JIT/jit_stats.h"
 #include "JIT/RuntimeFeedback.h"
+#include "JIT/sampling_profiler.h"
 #include "Util/Stats.h"
 
+#include <map>
 #include <set>
 
 using llvm::errs;
@@ -100,6 +107,37 @@ private:
 
 static llvm::ManagedStatic<FeedbackMapCounter> feedback_map_counter;
 
+// Memory taken by each feedback map when it's created.  Maps only grow
+// past this for feedback the bytecode scan didn't predict.
+class FeedbackMapSizeStats : public DataVectorStats<size_t> {
+public:
+	FeedbackMapSizeStats()
+		: DataVectorStats<size_t>("Feedback map size in bytes") {}
+};
+
+static llvm::ManagedStatic<FeedbackMapSizeStats> feedback_map_size_stats;
+
+// Count how often the eval loop hands a running frame off to machine code
+// in the middle of a loop.
+class OsrEntryCounter {
+public:
+	OsrEntryCounter() : counter_(0) {}
+
+	~OsrEntryCounter() {
+		errs() << "\nOn-stack replacements:\n";
+		errs() << "N: " << this->counter_ << "\n";
+	}
+
+	void IncCounter() {
+		this->counter_++;
+	}
+
+private:
+	unsigned counter_;
+};
+
+static llvm::ManagedStatic<OsrEntryCounter> osr_entry_counter;
+
 
 class HotnessTracker {
 	// llvm::DenseSet or llvm::SmallPtrSet may be better, but as of this
@@ -141,38 +179,60 @@ static llvm::ManagedStatic<HotnessTracker> hot_code;
 
 
 // Keep track of which functions failed fatal guards, but kept being called.
-// This can help gauge the efficacy of optimizations that involve fatal guards.
+// This can help gauge the efficacy of optimizations that involve fatal guards,
+// and of recompiling code after its machine code has been invalidated.
 class FatalBailTracker {
 public:
 	~FatalBailTracker() {
 		errs() << "\nCode objects that failed fatal guards:\n";
-		errs() << "\tfile:line (funcname) bail hotness"
-		       << " -> final hotness\n";
+		errs() << "\tfile:line (funcname) invalidations recompiles"
+		       << " bail hotness -> final hotness\n";
 
 		for (TrackerData::const_iterator it = this->code_.begin();
 				it != this->code_.end(); ++it) {
 			PyCodeObject *code = it->first;
-			if (code->co_hotness == it->second)
+			const CodeStats &stats = it->second;
+			if (stats.recompiles == 0 &&
+			    code->co_hotness == stats.bail_hotness)
 				continue;
 			errs() << "\t" << _PyEval_GetCodeName(code)
-			       << "\t" << it->second << " -> "
+			       << "\t" << stats.invalidations
+			       << "\t" << stats.recompiles
+			       << "\t" << stats.bail_hotness << " -> "
 			       << code->co_hotness << "\n";
 		}
 	}
 
 	void RecordFatalBail(PyCodeObject *code) {
-		Py_INCREF(code);
-		this->code_.push_back(std::make_pair(code, code->co_hotness));
+		std::pair<TrackerData::iterator, bool> inserted =
+			this->code_.insert(std::make_pair(code, CodeStats()));
+		if (inserted.second)
+			Py_INCREF(code);
+		CodeStats &stats = inserted.first->second;
+		stats.invalidations++;
+		stats.bail_hotness = code->co_hotness;
+	}
+
+	void RecordRecompile(PyCodeObject *code) {
+		TrackerData::iterator it = this->code_.find(code);
+		if (it != this->code_.end())
+			it->second.recompiles++;
 	}
 
 private:
-	// Keep a list of (code object, hotness) where hotness is the
-	// value of co_hotness when RecordFatalBail() was called. This is
-	// used to hide code objects whose machine code functions are
-	// invalidated during shutdown because their module dict has gone away;
-	// these code objects are uninteresting for our analysis.
-	typedef std::pair<PyCodeObject *, long> DataPoint;
-	typedef std::vector<DataPoint> TrackerData;
+	struct CodeStats {
+		CodeStats() : invalidations(0), recompiles(0), bail_hotness(0) {}
+
+		int invalidations;
+		int recompiles;
+		// The value of co_hotness when RecordFatalBail() was last
+		// called. This is used to hide code objects whose machine
+		// code functions are invalidated during shutdown because
+		// their module dict has gone away; these code objects are
+		// uninteresting for our analysis.
+		long bail_hotness;
+	};
+	typedef std::map<PyCodeObject *, CodeStats> TrackerData;
 
 	TrackerData code_;
 };
@@ -187,6 +247,14 @@ _PyEval_RecordFatalBail(PyCodeObject *code)
 	fatal_bail_tracker->RecordFatalBail(code);
 }
 
+// C wrapper for FatalBailTracker::RecordRecompile().
+void
+_PyEval_RecordRecompile(PyCodeObject *code)
+{
+	if (code->co_fatalbailcount > 0)
+		fatal_bail_tracker->RecordRecompile(code);
+}
+
 
 // Collect stats on how many watchers the globals/builtins dicts acculumate.
 // This currently records how many watchers the dict had when it changed, ie,
@@ -206,6 +274,39 @@ _PyEval_RecordWatcherCount(size_t watcher_count)
 }
 
 
+// Count how often a write to a watched dict left a watching code object's
+// machine code alone because the code didn't depend on the key written.
+class AvoidedInvalidationStats {
+public:
+	AvoidedInvalidationStats() : invalidated_(0), avoided_(0) {}
+
+	~AvoidedInvalidationStats() {
+		errs() << "\nWatched dict writes:\n";
+		errs() << "Code objects invalidated: " << this->invalidated_ << "\n";
+		errs() << "Invalidations avoided: " << this->avoided_ << "\n";
+	}
+
+	void RecordNotification(int invalidated) {
+		if (invalidated)
+			this->invalidated_++;
+		else
+			this->avoided_++;
+	}
+
+private:
+	unsigned invalidated_;
+	unsigned avoided_;
+};
+
+static llvm::ManagedStatic<AvoidedInvalidationStats> avoided_invalidations;
+
+void
+_PyEval_RecordWatcherNotification(int invalidated)
+{
+	avoided_invalidations->RecordNotification(invalidated);
+}
+
+
 class BailCountStats {
 public:
 	BailCountStats() : total_(0), trace_on_entry_(0), line_trace_(0),
@@ -292,6 +393,8 @@ public:
 			GUARD_CASE(_PYGUARD_CFUNC)
 			GUARD_CASE(_PYGUARD_BRANCH)
 			GUARD_CASE(_PYGUARD_STORE_SUBSCR)
+			GUARD_CASE(_PYGUARD_PYFUNC)
+			GUARD_CASE(_PYGUARD_FOR_ITER)
 			default:
 				wrapper << ((int)frame->f_guard_type);
 		}
@@ -343,8 +446,16 @@ static PyObject * update_star_args(int, int, PyObject *, PyObject ***);
 static PyObject * load_args(PyObject ***, int);
 
 #ifdef WITH_LLVM
+/* The most hot backedges a frame skips between OSR attempts. */
+#define PY_MAX_OSR_BACKOFF 1024
+
 static inline void mark_called(PyCodeObject *co);
+static void create_feedback_map(PyCodeObject *co);
+static inline int should_record_feedback(PyCodeObject *co);
 static inline int maybe_compile(PyCodeObject *co, PyFrameObject *f);
+static int maybe_enter_osr(PyCodeObject *co, PyFrameObject *f,
+			   int target, PyObject **stack_pointer,
+			   PyObject **retval);
 
 /* Record data for use in generating optimized machine code. */
 static void record_type(PyCodeObject *, int, int, int, PyObject *);
@@ -353,6 +464,31 @@ static void record_object(PyCodeObject *, int, int, int, PyObject *);
 static void inc_feedback_counter(PyCodeObject *, int, int, int, int);
 #endif  /* WITH_LLVM */
 
+/* The inline cache of one specialized instruction in co_quickened; see
+   quicken_code(). */
+typedef struct _PyInlineCache {
+	/* The instruction's argument in co_code.  In co_quickened, the
+	   specialized instruction's argument is the index of its cache. */
+	int ic_oparg;
+	/* Misses left before the generic instruction is put back. */
+	int ic_misses_left;
+	/* Where in the dict's hash table the value was last found. */
+	Py_ssize_t ic_index;
+	/* LOAD_GLOBAL_CACHED: if the value came from the builtins, the
+	   ma_keys_version of the globals it was missing from, else 0. */
+	unsigned PY_LONG_LONG ic_globals_keys;
+	/* LOAD_ATTR_INSTANCE_DICT: the type of the object the attribute was
+	   found on, and its tp_version_tag at the time. */
+	PyTypeObject *ic_type;
+	unsigned int ic_type_version;
+} _PyInlineCache;
+
+static inline void maybe_quicken(PyCodeObject *co);
+static inline void despecialize(unsigned char *instr, int opcode, int oparg);
+static PyObject * fill_global_cache(_PyInlineCache *, PyFrameObject *,
+				    PyObject *);
+static PyObject * fill_attr_cache(_PyInlineCache *, PyObject *, PyObject *);
+
 int _Py_ProfilingPossible = 0;
 
 /* Keep this in sync with llvm_fbuilder.cc */
@@ -816,6 +952,10 @@ PyEval_EvalFrame(PyFrameObject *f)
 #ifdef WITH_LLVM
 	/* We only collect feedback if it will be useful. */
 	int rec_feedback = (Py_JitControl == PY_JIT_WHENHOT);
+	/* Hot backedges to skip before the next OSR attempt, and how many
+	   to skip after the next one fails.  See maybe_enter_osr(). */
+	int osr_skip = 0;
+	int osr_backoff = 1;
 #endif
 
 	/* when tracing we set things up so that
@@ -979,8 +1119,16 @@ PyEval_EvalFrame(PyFrameObject *f)
 	INC_COUNTER(0, PY_FDO_JUMP_FALSE)
 #define RECORD_NONBOOLEAN() \
 	INC_COUNTER(0, PY_FDO_JUMP_NON_BOOLEAN)
+/* Once a loop backedge makes the code hot, hot_backedge considers switching
+   to machine code in the middle of the loop.  Under -Xjithotness=time only
+   the sampling profiler adds to co_hotness, but we still check it here. */
 #define UPDATE_HOTNESS_JABS() \
-	do { if (oparg <= f->f_lasti) ++co->co_hotness; } while (0)
+	do { \
+		if (oparg <= f->f_lasti && \
+		    (co->co_hotness += !Py_JitTimeHotness) > \
+		    _PyCode_HotnessThreshold(co)) \
+			goto hot_backedge; \
+	} while (0)
 #else
 #define RECORD_TYPE(arg_index, obj)
 #define RECORD_OBJECT(arg_index, obj)
@@ -1109,13 +1257,17 @@ PyEval_EvalFrame(PyFrameObject *f)
 	tstate->frame = f;
 
 #ifdef WITH_LLVM
+	/* Code that starts out hot, such as code restored from a
+	 * -Xjitprofile profile, is compiled on its first call, so it needs
+	 * its feedback map, seeded from the profile, first. */
+	if (co->co_runtime_feedback == NULL &&
+	    Py_JitControl == PY_JIT_WHENHOT &&
+	    co->co_hotness > _PyCode_HotnessThreshold(co))
+		create_feedback_map(co);
 	maybe_compile(co, f);
 
 	if (f->f_use_jit) {
 		assert(bail_reason == _PYFRAME_NO_BAIL);
-		assert(co->co_native_function != NULL &&
-		       "maybe_compile was supposed to ensure"
-		       " that co_native_function exists");
 		if (!co->co_use_jit) {
 			// A frame cannot use_jit if the underlying code object
 			// can't use_jit. This comes up when a generator is
@@ -1123,7 +1275,11 @@ PyEval_EvalFrame(PyFrameObject *f)
 			f->f_use_jit = 0;
 		}
 		else {
+			assert(co->co_native_function != NULL &&
+			       "maybe_compile was supposed to ensure"
+			       " that co_native_function exists");
 			assert(co->co_fatalbailcount < PY_MAX_FATALBAILCOUNT);
+			_PyCodeBudget_MarkUsed(co);
 			retval = co->co_native_function(f);
 			goto exit_eval_frame;
 		}
@@ -1133,6 +1289,7 @@ PyEval_EvalFrame(PyFrameObject *f)
 #ifdef Py_WITH_INSTRUMENTATION
 		bail_count_stats->RecordBail(f, bail_reason);
 #endif
+		_PyJitStats_RecordBail(f, bail_reason);
 		if (_Py_BailError) {
 			/* When we bail, we set f_lasti to the current opcode
 			 * minus 1, so we add one back.  */
@@ -1143,18 +1300,19 @@ PyEval_EvalFrame(PyFrameObject *f)
 		}
 	}
 
+	/* Frames that bailed from machine code always record feedback, since
+	 * it's what the next compile will go on. */
+	if (rec_feedback && bail_reason == _PYFRAME_NO_BAIL)
+		rec_feedback = should_record_feedback(co);
+
 	/* Create co_runtime_feedback now that we're about to use it.  You
 	 * might think this would cause a problem if the user flips
 	 * Py_JitControl from "never" to "whenhot", but since the value of
 	 * rec_feedback is constant for the duration of this frame's execution,
 	 * we will not accidentally try to record feedback without initializing
 	 * co_runtime_feedback.  */
-	if (rec_feedback && co->co_runtime_feedback == NULL) {
-#if Py_WITH_INSTRUMENTATION
-		feedback_map_counter->IncCounter();
-#endif
-		co->co_runtime_feedback = PyFeedbackMap_New();
-	}
+	if (rec_feedback && co->co_runtime_feedback == NULL)
+		create_feedback_map(co);
 #endif  /* WITH_LLVM */
 
 	switch (bail_reason) {
@@ -1191,7 +1349,11 @@ PyEval_EvalFrame(PyFrameObject *f)
 	consts = co->co_consts;
 	fastlocals = f->f_localsplus;
 	freevars = f->f_localsplus + co->co_nlocals;
-	first_instr = (unsigned char*) PyString_AS_STRING(co->co_code);
+	maybe_quicken(co);
+	if (co->co_quickened != NULL)
+		first_instr = co->co_quickened;
+	else
+		first_instr = (unsigned char*) PyString_AS_STRING(co->co_code);
 	/* An explanation is in order for the next line.
 
 	   f->f_lasti now refers to the index of the last instruction
@@ -1587,6 +1749,7 @@ PyEval_EvalFrame(PyFrameObject *f)
 			v = TOP();
 			RECORD_TYPE(0, v);
 			RECORD_TYPE(1, w);
+		  binary_add_generic:
 			if (PyInt_CheckExact(v) && PyInt_CheckExact(w)) {
 				/* INLINE: int + int */
 				register long a, b, i;
@@ -1617,6 +1780,34 @@ PyEval_EvalFrame(PyFrameObject *f)
 			}
 			DISPATCH();
 
+		TARGET(BINARY_ADD_INT)
+			w = POP();
+			v = TOP();
+			opcode = BINARY_ADD;
+			RECORD_TYPE(0, v);
+			RECORD_TYPE(1, w);
+			if (PyInt_CheckExact(v) && PyInt_CheckExact(w)) {
+				register long a, b, i;
+				a = PyInt_AS_LONG(v);
+				b = PyInt_AS_LONG(w);
+				i = a + b;
+				if ((i^a) >= 0 || (i^b) >= 0) {
+					x = PyInt_FromLong(i);
+					Py_DECREF(v);
+					Py_DECREF(w);
+					SET_TOP(x);
+					if (x == NULL) {
+						why = UNWIND_EXCEPTION;
+						break;
+					}
+					DISPATCH();
+				}
+			}
+			/* Not two ints, or the sum needs a long: this is no
+			   place for BINARY_ADD_INT. */
+			despecialize(next_instr - 1, BINARY_ADD, 0);
+			goto binary_add_generic;
+
 		TARGET(BINARY_SUBTRACT)
 			w = POP();
 			v = TOP();
@@ -2322,6 +2513,7 @@ PyEval_EvalFrame(PyFrameObject *f)
 		TARGET(LOAD_GLOBAL)
 			PY_LOG_TSC_EVENT(LOAD_GLOBAL_ENTER_EVAL);
 			w = GETITEM(names, oparg);
+		  load_global_generic:
 			if (PyString_CheckExact(w)) {
 				/* Inline the PyDict_GetItem() calls.
 				   WARNING: this is an extreme speed hack.
@@ -2377,6 +2569,48 @@ PyEval_EvalFrame(PyFrameObject *f)
 			PY_LOG_TSC_EVENT(LOAD_GLOBAL_EXIT_EVAL);
 			DISPATCH();
 
+		TARGET(LOAD_GLOBAL_CACHED)
+		{
+			_PyInlineCache *cache = &co->co_inline_caches[oparg];
+			PyDictObject *d;
+
+			oparg = cache->ic_oparg;
+			w = GETITEM(names, oparg);
+			/* If the name came from the builtins, it's still
+			   missing from the globals as long as no key has been
+			   added to them. */
+			if (cache->ic_globals_keys == 0)
+				d = (PyDictObject *)f->f_globals;
+			else if (((PyDictObject *)f->f_globals)->ma_keys_version
+				 == cache->ic_globals_keys)
+				d = (PyDictObject *)f->f_builtins;
+			else
+				d = NULL;
+			/* The interned name is where we found it last time. */
+			if (d != NULL && cache->ic_index <= d->ma_mask &&
+			    d->ma_table[cache->ic_index].me_key == w &&
+			    (x = d->ma_table[cache->ic_index].me_value) != NULL) {
+				Py_INCREF(x);
+				PUSH(x);
+				DISPATCH();
+			}
+			if (--cache->ic_misses_left <= 0) {
+				despecialize(next_instr - 3, LOAD_GLOBAL, oparg);
+				goto load_global_generic;
+			}
+			x = fill_global_cache(cache, f, w);
+			if (x != NULL) {
+				Py_INCREF(x);
+				PUSH(x);
+				DISPATCH();
+			}
+			if (PyErr_Occurred()) {
+				why = UNWIND_EXCEPTION;
+				break;
+			}
+			goto load_global_generic;
+		}
+
 		TARGET(DELETE_FAST)
 			x = GETLOCAL(oparg);
 			if (x != NULL) {
@@ -2469,6 +2703,7 @@ PyEval_EvalFrame(PyFrameObject *f)
 			w = GETITEM(names, oparg);
 			v = TOP();
 			RECORD_TYPE(0, v);
+		  load_attr_generic:
 			x = PyObject_GetAttr(v, w);
 			Py_DECREF(v);
 			SET_TOP(x);
@@ -2478,6 +2713,55 @@ PyEval_EvalFrame(PyFrameObject *f)
 			}
 			DISPATCH();
 
+		TARGET(LOAD_ATTR_INSTANCE_DICT)
+		{
+			_PyInlineCache *cache = &co->co_inline_caches[oparg];
+			PyTypeObject *type;
+			PyDictObject *d;
+
+			opcode = LOAD_ATTR;
+			oparg = cache->ic_oparg;
+			w = GETITEM(names, oparg);
+			v = TOP();
+			RECORD_TYPE(0, v);
+			/* Any change to the type or its bases that could stop
+			   the instance dict from deciding the attribute gives
+			   the type a new version tag. */
+			type = Py_TYPE(v);
+			if (type == cache->ic_type &&
+			    type->tp_version_tag == cache->ic_type_version &&
+			    PyType_HasFeature(type,
+					      Py_TPFLAGS_VALID_VERSION_TAG)) {
+				d = *(PyDictObject **)((char *)v +
+						       type->tp_dictoffset);
+				if (d != NULL && cache->ic_index <= d->ma_mask &&
+				    d->ma_table[cache->ic_index].me_key == w &&
+				    (x = d->ma_table[cache->ic_index].me_value)
+				    != NULL) {
+					Py_INCREF(x);
+					Py_DECREF(v);
+					SET_TOP(x);
+					DISPATCH();
+				}
+			}
+			if (--cache->ic_misses_left <= 0) {
+				despecialize(next_instr - 3, LOAD_ATTR, oparg);
+				goto load_attr_generic;
+			}
+			x = fill_attr_cache(cache, v, w);
+			if (x != NULL) {
+				Py_INCREF(x);
+				Py_DECREF(v);
+				SET_TOP(x);
+				DISPATCH();
+			}
+			if (PyErr_Occurred()) {
+				why = UNWIND_EXCEPTION;
+				break;
+			}
+			goto load_attr_generic;
+		}
+
 		TARGET(LOAD_METHOD)
 			w = GETITEM(names, oparg);
 			v = TOP();
@@ -2700,6 +2984,33 @@ PyEval_EvalFrame(PyFrameObject *f)
 			DISPATCH();
 #endif
 
+#ifdef WITH_LLVM
+		hot_backedge:
+			/* We're about to jump back to the header of a hot
+			   loop.  A long-running loop can get hot without the
+			   function ever being called again, so rather than
+			   wait for that, try to run the rest of this frame as
+			   machine code starting at the loop header. */
+			if (!tstate->use_tracing && --osr_skip < 0) {
+				err = maybe_enter_osr(co, f, oparg,
+						      stack_pointer, &retval);
+				if (err < 0) {
+					why = UNWIND_EXCEPTION;
+					break;
+				}
+				if (err > 0)
+					goto exit_eval_frame;
+				/* Back off exponentially, so a frame that
+				   can't enter machine code yet doesn't pay
+				   for maybe_compile() on every iteration. */
+				osr_skip = osr_backoff;
+				if (osr_backoff < PY_MAX_OSR_BACKOFF)
+					osr_backoff *= 2;
+			}
+			JUMPTO(oparg);
+			DISPATCH();
+#endif
+
 		TARGET(GET_ITER)
 			/* before: [obj]; after [getiter(obj)] */
 			v = TOP();
@@ -2747,7 +3058,7 @@ PyEval_EvalFrame(PyFrameObject *f)
 
 		TARGET(CONTINUE_LOOP)
 #ifdef WITH_LLVM
-			++co->co_hotness;
+			co->co_hotness += !Py_JitTimeHotness;
 #endif
 			retval = PyInt_FromLong(oparg);
 			if (!retval) {
@@ -2870,6 +3181,13 @@ PyEval_EvalFrame(PyFrameObject *f)
 						       stack_pointer[-i-1]);
 					}
 				}
+				/* For Python functions, record the code
+				 * object, in order to splice its IR into
+				 * ours. */
+				else if (PyFunction_Check(*func)) {
+					RECORD_OBJECT(1,
+					    PyFunction_GET_CODE(*func));
+				}
 			}
 #endif
 			x = _PyEval_CallFunction(stack_pointer,
@@ -3849,6 +4167,10 @@ _PyEval_HandlePyTickerExpired(PyThreadState *tstate)
 {
 	_Py_Ticker = _Py_CheckInterval;
 	tstate->tick_counter++;
+#ifdef WITH_LLVM
+	if (_PySampler_Pending)
+		_PySampler_TakeSample(tstate);
+#endif
 	if (things_to_do) {
 		if (Py_MakePendingCalls() < 0) {
 			return -1;
@@ -4321,12 +4643,303 @@ err_args(PyMethodDef *ml, int flags, int min_arity, int max_arity, int nargs)
 			     ml->ml_name, min_arity, nargs);
 }
 
+/* Quickening.  Most code never gets hot enough to be compiled to machine
+   code, so the eval loop speeds it up by itself.  Once a code object has
+   started running Py_QuickenThreshold times, quicken_code() gives it a
+   private copy of its bytecode, co_quickened, which the eval loop runs from
+   then on, and speculatively replaces some instructions in the copy:
+
+   - LOAD_GLOBAL with LOAD_GLOBAL_CACHED, which remembers where in the
+     globals or builtins it found the name;
+   - LOAD_ATTR with LOAD_ATTR_INSTANCE_DICT, which remembers the type of the
+     object and where in the object's __dict__ it found the attribute;
+   - BINARY_ADD with BINARY_ADD_INT, which only adds ints.
+
+   The argument of a specialized instruction is the index of its
+   _PyInlineCache in co_inline_caches, which keeps the original argument.
+   Caches start out empty, so an instruction's first run misses and fills
+   its cache.  Once a cache has missed QUICKEN_MAX_MISSES times, and as soon
+   as BINARY_ADD_INT sees anything but two ints with an int sum, the generic
+   instruction goes back.  co_quickened has co_code's layout, so f_lasti,
+   jump targets, line numbers and runtime feedback mean the same in both;
+   everything but the eval loop, including the JIT, keeps using co_code. */
+
+#define QUICKEN_MAX_MISSES 16
+
+/* Returns 0 on success, or -1 with an exception set. */
+static int
+quicken_code(PyCodeObject *co)
+{
+	const unsigned char *code =
+		(const unsigned char *)PyString_AS_STRING(co->co_code);
+	Py_ssize_t code_size = PyString_GET_SIZE(co->co_code);
+	unsigned char *quickened;
+	_PyInlineCache *caches = NULL;
+	int num_caches = 0, cache = 0;
+	int opcode, oparg;
+	Py_ssize_t i;
+
+	for (i = 0; i < code_size; i += HAS_ARG(code[i]) ? 3 : 1) {
+		if (code[i] == LOAD_GLOBAL || code[i] == LOAD_ATTR)
+			++num_caches;
+	}
+	/* Cache indices have to fit in an instruction's argument. */
+	if (num_caches > 0x10000)
+		num_caches = 0x10000;
+
+	quickened = (unsigned char *)PyMem_Malloc(code_size);
+	if (num_caches > 0)
+		caches = (_PyInlineCache *)PyMem_Malloc(
+			num_caches * sizeof(_PyInlineCache));
+	if (quickened == NULL || (num_caches > 0 && caches == NULL)) {
+		PyMem_Free(quickened);
+		PyMem_Free(caches);
+		PyErr_NoMemory();
+		return -1;
+	}
+	memcpy(quickened, code, code_size);
+
+	for (i = 0; i < code_size; i += HAS_ARG(opcode) ? 3 : 1) {
+		opcode = code[i];
+		if (opcode == EXTENDED_ARG) {
+			/* Leave the extended instruction alone. */
+			i += 3;
+			if (i >= code_size)
+				break;
+			opcode = code[i];
+			continue;
+		}
+		switch (opcode) {
+		case BINARY_ADD:
+			quickened[i] = BINARY_ADD_INT;
+			break;
+		case LOAD_GLOBAL:
+		case LOAD_ATTR:
+			if (cache == num_caches)
+				break;
+			oparg = (code[i + 2] << 8) + code[i + 1];
+			memset(&caches[cache], 0, sizeof(_PyInlineCache));
+			caches[cache].ic_oparg = oparg;
+			caches[cache].ic_misses_left = QUICKEN_MAX_MISSES;
+			quickened[i] = opcode == LOAD_GLOBAL ?
+				LOAD_GLOBAL_CACHED : LOAD_ATTR_INSTANCE_DICT;
+			quickened[i + 1] = cache & 0xff;
+			quickened[i + 2] = cache >> 8;
+			++cache;
+			break;
+		}
+	}
+
+	co->co_quickened = quickened;
+	co->co_inline_caches = caches;
+	return 0;
+}
+
+static inline void
+maybe_quicken(PyCodeObject *co)
+{
+	if (co->co_quickened != NULL || Py_QuickenThreshold <= 0)
+		return;
+	if (++co->co_quicken_count < Py_QuickenThreshold)
+		return;
+	co->co_quicken_count = 0;
+	/* Quickening is only an optimization; if we can't afford it, run
+	   co_code and try again later. */
+	if (quicken_code(co) < 0)
+		PyErr_Clear();
+}
+
+/* Puts the generic instruction back at instr, in co_quickened. */
+static inline void
+despecialize(unsigned char *instr, int opcode, int oparg)
+{
+	instr[0] = opcode;
+	if (HAS_ARG(opcode)) {
+		instr[1] = oparg & 0xff;
+		instr[2] = oparg >> 8;
+	}
+}
+
+/* Looks name up in f's globals and then its builtins, for
+   LOAD_GLOBAL_CACHED, and remembers where it was found.  Returns a borrowed
+   reference, or NULL, with an exception set if a lookup failed.  If the name
+   is in neither dict, the generic LOAD_GLOBAL raises the NameError. */
+static PyObject *
+fill_global_cache(_PyInlineCache *cache, PyFrameObject *f, PyObject *name)
+{
+	PyDictObject *globals = (PyDictObject *)f->f_globals;
+	PyDictObject *builtins = (PyDictObject *)f->f_builtins;
+	unsigned PY_LONG_LONG globals_keys;
+	PyDictEntry *e;
+	long hash;
+
+	if (!PyString_CheckExact(name))
+		return NULL;
+	hash = ((PyStringObject *)name)->ob_shash;
+	if (hash == -1)
+		return NULL;
+	/* Read this first, in case the lookup changes the globals. */
+	globals_keys = globals->ma_keys_version;
+	e = globals->ma_lookup(globals, name, hash);
+	if (e == NULL)
+		return NULL;
+	if (e->me_value != NULL) {
+		cache->ic_globals_keys = 0;
+		cache->ic_index = e - globals->ma_table;
+		return e->me_value;
+	}
+	e = builtins->ma_lookup(builtins, name, hash);
+	if (e == NULL || e->me_value == NULL)
+		return NULL;
+	cache->ic_globals_keys = globals_keys;
+	cache->ic_index = e - builtins->ma_table;
+	return e->me_value;
+}
+
+/* Looks name up in the __dict__ of v, for LOAD_ATTR_INSTANCE_DICT, and
+   remembers where it was found if v's type always lets the instance dict
+   decide that attribute.  Returns a borrowed reference, or NULL, with an
+   exception set if the lookup failed.  Otherwise the generic LOAD_ATTR
+   looks the attribute up. */
+static PyObject *
+fill_attr_cache(_PyInlineCache *cache, PyObject *v, PyObject *name)
+{
+	PyTypeObject *type = Py_TYPE(v);
+	unsigned int type_version;
+	PyObject *descr;
+	PyDictObject *dict;
+	PyDictEntry *e;
+	long hash;
+
+	if (type->tp_getattro != PyObject_GenericGetAttr ||
+	    type->tp_dictoffset <= 0 || !PyString_CheckExact(name))
+		return NULL;
+	hash = ((PyStringObject *)name)->ob_shash;
+	if (hash == -1)
+		return NULL;
+	/* A data descriptor on the type would take precedence over the
+	   instance dict.  Other class attributes are fine, as long as their
+	   type can't grow a __set__ later. */
+	descr = _PyType_Lookup(type, name);
+	if (descr != NULL &&
+	    (PyType_HasFeature(Py_TYPE(descr), Py_TPFLAGS_HEAPTYPE) ||
+	     Py_TYPE(descr)->tp_descr_set != NULL))
+		return NULL;
+	/* _PyType_Lookup() gave the type a version tag if it could.  Read it
+	   before the lookup, which may run Python code. */
+	if (!PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG))
+		return NULL;
+	type_version = type->tp_version_tag;
+	dict = *(PyDictObject **)((char *)v + type->tp_dictoffset);
+	if (dict == NULL)
+		return NULL;
+	e = dict->ma_lookup(dict, name, hash);
+	if (e == NULL || e->me_value == NULL)
+		return NULL;
+	cache->ic_type = type;
+	cache->ic_type_version = type_version;
+	cache->ic_index = e - dict->ma_table;
+	return e->me_value;
+}
+
 #ifdef WITH_LLVM
+// Gives co the co_runtime_feedback the eval loop records into, seeded from
+// any loaded -Xjitprofile profile.
+static void
+create_feedback_map(PyCodeObject *co)
+{
+	co->co_runtime_feedback = PyFeedbackMap_New(co->co_code);
+#if Py_WITH_INSTRUMENTATION
+	feedback_map_counter->IncCounter();
+	feedback_map_size_stats->RecordDataPoint(
+		co->co_runtime_feedback->GetMemoryUsage());
+#endif
+	_PyFeedbackProfile_Track(co);
+}
+
 static inline void
 mark_called(PyCodeObject *co)
 {
-	co->co_hotness += 10;
+	if (!Py_JitTimeHotness)
+		co->co_hotness += 10;
+}
+
+// Decides whether a new frame for co records runtime feedback.  Recording
+// costs a feedback map lookup at every RECORD_* site, which warm code that
+// never gets hot pays for nothing, so -Xjitwarmup skips code that isn't
+// yet close to hot and -Xjitsample only records every Nth call.  Either
+// makes the feedback less complete: a function that gets hot in a loop
+// during a single call may be compiled without any.
+static inline int
+should_record_feedback(PyCodeObject *co)
+{
+	if (Py_JitFeedbackWarmup > 0 &&
+	    co->co_hotness <=
+	    _PyCode_HotnessThreshold(co) / 100 * Py_JitFeedbackWarmup)
+		return 0;
+	if (Py_JitFeedbackInterval > 1) {
+		if (co->co_feedback_countdown > 0) {
+			--co->co_feedback_countdown;
+			return 0;
+		}
+		co->co_feedback_countdown = Py_JitFeedbackInterval - 1;
+	}
+	return 1;
+}
+
+#ifdef WITH_THREAD
+// Hand a hot code object off to the background compile thread. The frame
+// keeps running in the eval loop; once the compile thread publishes
+// co_native_function, later calls will pick up the machine code.
+//
+// Returns 0 on success or -1 on failure.
+static int
+queue_background_compile(PyCodeObject *co, PyFrameObject *f)
+{
+	if (co->co_compile_queued || !_PyCode_CanCompileToLlvm(co))
+		return 0;
+	if (_PyCode_WatchDict(co, WATCHING_GLOBALS, f->f_globals))
+		return -1;
+	if (_PyCode_WatchDict(co, WATCHING_BUILTINS, f->f_builtins))
+		return -1;
+	return _PyLlvm_QueueCompile(co);
+}
+
+// With tiered compilation, maybe_compile() first gives hot code baseline
+// machine code, which is quick to produce and keeps counting the code's
+// hotness.  If the code stays hot, we hand it to the compile thread to be
+// recompiled at the full optimization level.  Calls keep using the baseline
+// machine code until the compile thread swaps in the new code.
+//
+// Returns 0 on success or -1 on failure.
+static inline int
+maybe_tier_up(PyCodeObject *co)
+{
+	if (Py_JitTiered &&
+	    co->co_optimization < std::max(Py_DEFAULT_JIT_OPT_LEVEL,
+					   Py_OptimizeFlag) &&
+	    co->co_hotness > PY_TIER_UP_THRESHOLD &&
+	    co->co_native_function != NULL &&
+	    Py_JitControl == PY_JIT_WHENHOT)
+		return _PyLlvm_QueueCompile(co);
+	return 0;
+}
+
+// Translates co to IR whose machine code counts the code's hotness, and
+// optimizes it at Py_BASELINE_JIT_OPT_LEVEL.  Returns the same values as
+// _PyCode_ToOptimizedLlvmIr().
+static int
+compile_baseline(PyCodeObject *co)
+{
+	assert(co->co_llvm_function == NULL);
+	if (!_PyCode_CanCompileToLlvm(co))
+		return 1;
+	co->co_llvm_function = _PyCode_ToBaselineLlvmIr(co);
+	if (co->co_llvm_function == NULL)
+		return -1;
+	return _PyCode_ToOptimizedLlvmIr(co, Py_BASELINE_JIT_OPT_LEVEL);
 }
+#endif
 
 // Decide whether to compile a code object's bytecode to native code based on
 // the current Py_JitControl setting and the code's hotness.  We do the
@@ -4338,10 +4951,18 @@ mark_called(PyCodeObject *co)
 //   (co_use_jit is true).
 // - We are running under PY_JIT_ALWAYS.
 //
+// If Py_JitBackgroundCompile is set, hot code under PY_JIT_WHENHOT is queued
+// for the background compile thread rather than compiled here.  If
+// Py_JitTiered is set, it's compiled here at Py_BASELINE_JIT_OPT_LEVEL
+// instead, and maybe_tier_up() takes care of the rest.
+//
 // Returns 0 on success or -1 on failure.
 //
-// If this code object has had too many fatal guard failures (see
-// PY_MAX_FATALBAILCOUNT), it is forced to use the eval loop forever.
+// Each fatal guard failure throws away the code's machine code and
+// hotness, and it has to get twice as hot as before to be compiled again;
+// see _PyCode_HotnessThreshold().  If this code object has had too many
+// fatal guard failures (see PY_MAX_FATALBAILCOUNT), it is forced to use the
+// eval loop forever.  So is code that codegen refused to compile.
 //
 // This function is performance-critical. If you're changing this function,
 // you should keep a close eye on the benchmarks, particularly call_simple.
@@ -4372,7 +4993,7 @@ maybe_compile(PyCodeObject *co, PyFrameObject *f)
 	}
 
 	bool is_hot = false;
-	if (co->co_hotness > PY_HOTNESS_THRESHOLD) {
+	if (co->co_hotness > _PyCode_HotnessThreshold(co)) {
 		is_hot = true;
 #ifdef Py_WITH_INSTRUMENTATION
 		hot_code->AddHotCode(co);
@@ -4383,8 +5004,14 @@ maybe_compile(PyCodeObject *co, PyFrameObject *f)
 		PyErr_BadInternalCall();
 		return -1;
 	case PY_JIT_WHENHOT:
-		if (is_hot)
+		if (is_hot) {
+#ifdef WITH_THREAD
+			if (Py_JitBackgroundCompile && !Py_JitTiered &&
+			    co->co_native_function == NULL)
+				return queue_background_compile(co, f);
+#endif
 			co->co_use_jit = 1;
+		}
 		break;
 	case PY_JIT_ALWAYS:
 		co->co_use_jit = 1;
@@ -4394,6 +5021,8 @@ maybe_compile(PyCodeObject *co, PyFrameObject *f)
 	}
 
 	if (co->co_use_jit) {
+		// When we started compiling, or 0 if we didn't need to.
+		double compile_start = 0;
 		if (co->co_llvm_function == NULL) {
 			// Translate the bytecode to IR and optimize it if we
 			// haven't already done that.
@@ -4407,6 +5036,7 @@ maybe_compile(PyCodeObject *co, PyFrameObject *f)
 				Timer timer(*ir_compilation_times);
 #endif
 				PY_LOG_TSC_EVENT(LLVM_COMPILE_START);
+				compile_start = _PyJitStats_Now();
 				if (_PyCode_WatchDict(co,
 				                      WATCHING_GLOBALS,
 				                      f->f_globals))
@@ -4415,13 +5045,25 @@ maybe_compile(PyCodeObject *co, PyFrameObject *f)
 				                      WATCHING_BUILTINS,
 				                      f->f_builtins))
 					return -1;
+#ifdef WITH_THREAD
+				if (Py_JitTiered && is_hot &&
+				    Py_JitControl == PY_JIT_WHENHOT)
+					r = compile_baseline(co);
+				else
+#endif
 				r = _PyCode_ToOptimizedLlvmIr(
 					co, target_optimization);
 				PY_LOG_TSC_EVENT(LLVM_COMPILE_END);
 				if (r < 0)  // Error
 					return -1;
 				if (r == 1) {  // Codegen refused
+					// It will refuse again, so don't try
+					// on every call or, through OSR, on
+					// every loop iteration.
 					co->co_use_jit = 0;
+					co->co_fatalbailcount =
+						PY_MAX_FATALBAILCOUNT;
+					_PyCode_IgnoreWatchedDicts(co);
 					return 0;
 				}
 			}
@@ -4432,19 +5074,77 @@ maybe_compile(PyCodeObject *co, PyFrameObject *f)
 			Timer timer(*mc_compilation_times);
 #endif
 			PY_LOG_TSC_EVENT(JIT_START);
+			if (compile_start == 0)
+				compile_start = _PyJitStats_Now();
 			co->co_native_function =
-				_LlvmFunction_Jit(co->co_llvm_function);
+				_LlvmFunction_Jit(PyGlobalLlvmData::Get(),
+						  co->co_llvm_function);
 			PY_LOG_TSC_EVENT(JIT_END);
 			if (co->co_native_function == NULL) {
 				return -1;
 			}
+			_PyJitCache_RecordCompiled(co);
+			_PyEval_RecordRecompile(co);
+			_PyCodeBudget_RecordCompiled(co);
+			_PyJitStats_RecordCompile(
+				co, _PyJitStats_Now() - compile_start);
+		}
+#ifdef WITH_THREAD
+		else if (maybe_tier_up(co) < 0) {
+			return -1;
 		}
+#endif
 		PY_LOG_TSC_EVENT(EVAL_COMPILE_END);
 	}
 
 	f->f_use_jit = co->co_use_jit;
 	return 0;
 }
+
+// On-stack replacement: called from the eval loop when a backedge to target
+// is taken in a hot code object.  If maybe_compile() decides the code should
+// use machine code, we hand the frame, with its value stack, block stack and
+// locals intact, to the native function, which picks up at target (see
+// LlvmFunctionBuilder::AddOsrEntryBB).  The native code then owns the
+// frame's stack and runs it to completion.
+//
+// Returns 1 if the frame was run to completion by machine code, with its
+// result stored in *retval; 0 if the eval loop should keep going; or -1 on
+// error.
+//
+// When this returns 0, the eval loop skips the next 1, 2, 4, ... hot
+// backedges of the frame before trying again, up to PY_MAX_OSR_BACKOFF.
+// Code still waiting in the background compile queue, or a frame whose
+// globals don't match the machine code's, would otherwise go through
+// maybe_compile() on every iteration for the rest of the frame.
+static int
+maybe_enter_osr(PyCodeObject *co, PyFrameObject *f, int target,
+		PyObject **stack_pointer, PyObject **retval)
+{
+	// Generators resume through their own switch on f_lasti, and the
+	// eval loop is responsible for them between yields.
+	if (co->co_flags & CO_GENERATOR)
+		return 0;
+	// Code we gave up on compiling stays in the eval loop.
+	if (co->co_fatalbailcount >= PY_MAX_FATALBAILCOUNT)
+		return 0;
+	if (maybe_compile(co, f) < 0)
+		return -1;
+	if (!f->f_use_jit)
+		return 0;
+	assert(co->co_native_function != NULL &&
+	       "maybe_compile was supposed to ensure"
+	       " that co_native_function exists");
+	assert(co->co_fatalbailcount < PY_MAX_FATALBAILCOUNT);
+#ifdef Py_WITH_INSTRUMENTATION
+	osr_entry_counter->IncCounter();
+#endif
+	f->f_lasti = target;
+	f->f_stacktop = stack_pointer;
+	_PyCodeBudget_MarkUsed(co);
+	*retval = co->co_native_function(f);
+	return 1;
+}
 #endif  /* WITH_LLVM */
 
 #define C_TRACE(x, call) \
@@ -4705,6 +5405,80 @@ fast_function(PyObject *func, PyObject ***pp_stack, int n, int na, int nk)
 				 PyFunction_GET_CLOSURE(func));
 }
 
+#ifdef WITH_LLVM
+/* Machine code that has a Python function's IR spliced into it calls these
+   around the spliced body, in place of fast_function() and
+   PyEval_EvalFrame().  func must be a function that fast_function() would
+   call without PyEval_EvalCodeEx(), and args must point to its co_argcount
+   arguments; we take new references to them.
+
+   If func's machine code can't run in the new frame, we leave f_use_jit
+   unset and the caller must run the frame with PyEval_EvalFrame() and
+   release it with _PyEval_ReleaseInlinedFrame().  Otherwise we set
+   f_use_jit and do PyEval_EvalFrame()'s bookkeeping, and the caller must
+   run the spliced body and then call _PyEval_LeaveInlinedFrame().  Returns
+   NULL with an exception set on failure. */
+PyFrameObject *
+_PyEval_EnterInlinedFrame(PyObject *func, PyObject **args)
+{
+	PyCodeObject *co = (PyCodeObject *)PyFunction_GET_CODE(func);
+	PyThreadState *tstate = PyThreadState_GET();
+	PyFrameObject *f;
+	int i;
+
+	f = PyFrame_New(tstate, co, PyFunction_GET_GLOBALS(func), NULL);
+	if (f == NULL)
+		return NULL;
+	for (i = 0; i < co->co_argcount; i++) {
+		Py_INCREF(args[i]);
+		f->f_localsplus[i] = args[i];
+	}
+	mark_called(co);
+
+	/* The spliced body relies on the same assumptions about globals and
+	   builtins as co's own machine code; see maybe_compile(). */
+	if (!co->co_use_jit)
+		return f;
+#ifdef WITH_THREAD
+	if (maybe_tier_up(co) < 0) {
+		Py_DECREF(f);
+		return NULL;
+	}
+#endif
+	if (co->co_watching && co->co_watching[WATCHING_GLOBALS] &&
+	    (co->co_watching[WATCHING_GLOBALS] != f->f_globals ||
+	     co->co_watching[WATCHING_BUILTINS] != f->f_builtins))
+		return f;
+
+	if (Py_EnterRecursiveCall("")) {
+		Py_DECREF(f);
+		return NULL;
+	}
+	tstate->frame = f;
+	f->f_use_jit = 1;
+	_PyCodeBudget_MarkUsed(co);
+	return f;
+}
+
+void
+_PyEval_LeaveInlinedFrame(PyFrameObject *f)
+{
+	Py_LeaveRecursiveCall();
+	f->f_tstate->frame = f->f_back;
+	_PyEval_ReleaseInlinedFrame(f);
+}
+
+void
+_PyEval_ReleaseInlinedFrame(PyFrameObject *f)
+{
+	PyThreadState *tstate = f->f_tstate;
+	/* Like fast_function(). */
+	++tstate->recursion_depth;
+	Py_DECREF(f);
+	--tstate->recursion_depth;
+}
+#endif  /* WITH_LLVM */
+
 static PyObject *
 update_keyword_args(PyObject *orig_kwdict, int nk, PyObject ***pp_stack,
                     PyObject *func)
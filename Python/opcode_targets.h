@@ -68,7 +68,7 @@ static void *opcode_targets[256] = {
 	&&TARGET_BINARY_OR,
 	&&TARGET_INPLACE_POWER,
 	&&TARGET_GET_ITER,
-	&&_unknown_opcode,
+	&&TARGET_BINARY_ADD_INT,
 	&&_unknown_opcode,
 	&&_unknown_opcode,
 	&&_unknown_opcode,
@@ -143,8 +143,8 @@ static void *opcode_targets[256] = {
 	&&TARGET_CALL_FUNCTION_KW,
 	&&TARGET_CALL_FUNCTION_VAR_KW,
 	&&TARGET_EXTENDED_ARG,
-	&&_unknown_opcode,
-	&&_unknown_opcode,
+	&&TARGET_LOAD_ATTR_INSTANCE_DICT,
+	&&TARGET_LOAD_GLOBAL_CACHED,
 	&&_unknown_opcode,
 	&&_unknown_opcode,
 	&&_unknown_opcode,
@@ -86,9 +86,6 @@ PyInterpreterState_New(void)
 #else
 		interp->dlopenflags = RTLD_LAZY;
 #endif
-#endif
-#ifdef WITH_TSC
-		interp->tscdump = 0;
 #endif
 
 		HEAD_LOCK();
@@ -17,7 +17,11 @@
 #include "ast.h"
 #include "eval.h"
 #include "marshal.h"
+#include "JIT/code_cache.h"
+#include "JIT/compile_thread.h"
+#include "JIT/feedback_profile.h"
 #include "JIT/global_llvm_data_fwd.h"
+#include "JIT/sampling_profiler.h"
 
 #ifdef HAVE_SIGNAL_H
 #include <signal.h>
@@ -96,6 +100,16 @@ Py_JitOpts Py_JitControl = PY_JIT_WHENHOT; /* For -Xjit */
 #else
 Py_JitOpts Py_JitControl = PY_JIT_NEVER;
 #endif  /* WITH_LLVM */
+int Py_JitBackgroundCompile = 0; /* For -Xjitcompile */
+int Py_JitCompileThreads = 1; /* For -Xjitthreads */
+int Py_JitTiered = 0; /* For -Xjitopt */
+const char *Py_JitCacheFile = NULL; /* For -Xjitcache */
+const char *Py_JitProfileFile = NULL; /* For -Xjitprofile */
+Py_ssize_t Py_JitCodeBudget = 0; /* For -Xjitbudget */
+int Py_JitFeedbackInterval = 1; /* For -Xjitsample */
+int Py_JitFeedbackWarmup = 0; /* For -Xjitwarmup */
+int Py_JitTimeHotness = 0; /* For -Xjithotness */
+int Py_QuickenThreshold = 8; /* For -Xquicken */
 
 /* PyModule_GetWarningsModule is no longer necessary as of 2.6
 since _warnings is builtin.  This API should not be used. */
@@ -304,6 +318,12 @@ Py_InitializeEx(int install_sigs)
 	Py_JitControl = PY_JIT_NEVER;
 
 	initmain(); /* Module __main__ */
+#ifdef WITH_LLVM
+	_PyFeedbackProfile_Init();
+	if (Py_JitTimeHotness &&
+	    _PySampler_Start(PY_DEFAULT_SAMPLE_RATE) < 0)
+		Py_FatalError("Py_Initialize: can't start the sampling profiler");
+#endif
 	if (!Py_NoSiteFlag)
 		initsite(); /* Module site */
 
@@ -497,6 +517,15 @@ Py_Finalize(void)
 	tstate = PyThreadState_GET();
 	interp = tstate->interp;
 
+#ifdef WITH_LLVM
+	/* Stop compiling in the background before we start tearing down
+	   the objects the compile thread works on. */
+	_PyLlvm_StopCompileThread();
+	_PySampler_Stop();
+	_PyJitCache_Save();
+	_PyFeedbackProfile_Fini();
+#endif
+
 	/* Disable signal handling */
 	PyOS_FiniInterrupts();
 
@@ -19,6 +19,7 @@ Data members:
 #include "code.h"
 #include "frameobject.h"
 #include "eval.h"
+#include "Util/EventTimer.h"
 
 #include "osdefs.h"
 
@@ -487,30 +488,66 @@ PyDoc_STRVAR(getcheckinterval_doc,
 "getcheckinterval() -> current check interval; see setcheckinterval()."
 );
 
+static PyObject *
+sys_setquickenthreshold(PyObject *self, PyObject *args)
+{
+	int threshold;
+
+	if (!PyArg_ParseTuple(args, "i:setquickenthreshold", &threshold))
+		return NULL;
+	if (threshold < 0) {
+		PyErr_SetString(PyExc_ValueError,
+				"quicken threshold must be non-negative");
+		return NULL;
+	}
+	Py_QuickenThreshold = threshold;
+	Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(setquickenthreshold_doc,
+"setquickenthreshold(n)\n\
+\n\
+Specialize the bytecode of a function once the interpreter has run it n\n\
+times.  0 turns this off for functions that aren't specialized yet."
+);
+
+static PyObject *
+sys_getquickenthreshold(PyObject *self, PyObject *args)
+{
+	return PyInt_FromLong(Py_QuickenThreshold);
+}
+
+PyDoc_STRVAR(getquickenthreshold_doc,
+"getquickenthreshold() -> current quicken threshold; see setquickenthreshold()."
+);
+
 #ifdef WITH_TSC
 static PyObject *
 sys_settscdump(PyObject *self, PyObject *args)
 {
 	int bool;
-	PyThreadState *tstate = PyThreadState_Get();
+	char *path = NULL;
 
-	if (!PyArg_ParseTuple(args, "i:settscdump", &bool))
+	if (!PyArg_ParseTuple(args, "i|z:settscdump", &bool, &path))
 		return NULL;
-	if (bool)
-		tstate->interp->tscdump = 1;
+	if (bool) {
+		if (_PyTscDump_Start(path) < 0)
+			return NULL;
+	}
 	else
-		tstate->interp->tscdump = 0;
+		_PyTscDump_Stop();
 	Py_INCREF(Py_None);
 	return Py_None;
 
 }
 
 PyDoc_STRVAR(settscdump_doc,
-"settscdump(bool)\n\
+"settscdump(bool[, filename])\n\
 \n\
-If true, tell the Python interpreter to dump VM measurements to\n\
-stderr.  If false, turn off dump.  The measurements are based on the\n\
-processor's time-stamp counter."
+If true, start recording VM measurements based on the processor's\n\
+time-stamp counter, streaming them to filename (default\n\
+tsc-<pid>.dump in the current directory).  If false, finish writing\n\
+the file and stop recording.  Misc/tsc_stats.py reads the file."
 );
 #endif /* TSC */
 
@@ -945,6 +982,10 @@ static PyMethodDef sys_methods[] = {
 	 setcheckinterval_doc},
 	{"getcheckinterval",	sys_getcheckinterval, METH_NOARGS,
 	 getcheckinterval_doc},
+	{"setquickenthreshold", sys_setquickenthreshold, METH_VARARGS,
+	 setquickenthreshold_doc},
+	{"getquickenthreshold", sys_getquickenthreshold, METH_NOARGS,
+	 getquickenthreshold_doc},
 #ifdef HAVE_DLOPEN
 	{"setdlopenflags", sys_setdlopenflags, METH_VARARGS,
 	 setdlopenflags_doc},
@@ -23,10 +23,18 @@ protected:
     {
         PyCodeObject *code = PyMem_NEW(PyCodeObject, 1);
         assert(code != NULL);
-        // We only initialize the fields related to dict watchers.
+        // We only initialize the fields related to dict watchers and
+        // _PyCode_InvalidateMachineCode().
         code->co_watching = NULL;
+        code->co_watched_keys = NULL;
         code->co_use_jit = 0;
         code->co_fatalbailcount = 0;
+        code->co_hotness = 0;
+        code->co_optimization = -1;
+        code->co_llvm_function = NULL;
+        code->co_native_function = NULL;
+        code->co_runtime_feedback = NULL;
+        code->co_retired_llvm_functions = NULL;
         code->ob_type = &PyCode_Type;
         return code;
     }
@@ -127,11 +135,14 @@ TEST_F(CodeWatchingTest, InvalidateMachineCode)
 
     // Fake our way through compilation.
     code->co_use_jit = 1;
+    code->co_hotness = PY_HOTNESS_THRESHOLD + 1;
+    code->co_optimization = 2;
     _PyCode_WatchDict(code, WATCHING_GLOBALS, this->globals_);
     _PyCode_WatchDict(code, WATCHING_BUILTINS, this->builtins_);
     EXPECT_EQ(2, _PyCode_WatchingSize(code));
     EXPECT_EQ(1, _PyDict_NumWatchers((PyDictObject *)this->globals_));
     EXPECT_EQ(1, _PyDict_NumWatchers((PyDictObject *)this->builtins_));
+    EXPECT_EQ(PY_HOTNESS_THRESHOLD, _PyCode_HotnessThreshold(code));
 
     _PyCode_InvalidateMachineCode(code);
     EXPECT_EQ(1, code->co_fatalbailcount);
@@ -139,6 +150,21 @@ TEST_F(CodeWatchingTest, InvalidateMachineCode)
     EXPECT_EQ(0, _PyCode_WatchingSize(code));
     EXPECT_EQ(0, _PyDict_NumWatchers((PyDictObject *)this->globals_));
     EXPECT_EQ(0, _PyDict_NumWatchers((PyDictObject *)this->builtins_));
+    // The code has to get hot again, twice as hot as before, before it's
+    // recompiled.
+    EXPECT_EQ(0, code->co_hotness);
+    EXPECT_EQ(-1, code->co_optimization);
+    EXPECT_TRUE(code->co_native_function == NULL);
+    EXPECT_EQ(2 * PY_HOTNESS_THRESHOLD, _PyCode_HotnessThreshold(code));
+
+    // Fake a recompile, and invalidate that too.
+    code->co_use_jit = 1;
+    _PyCode_WatchDict(code, WATCHING_GLOBALS, this->globals_);
+    _PyCode_InvalidateMachineCode(code);
+    EXPECT_EQ(2, code->co_fatalbailcount);
+    EXPECT_EQ(0, code->co_use_jit);
+    EXPECT_EQ(0, _PyDict_NumWatchers((PyDictObject *)this->globals_));
+    EXPECT_EQ(4 * PY_HOTNESS_THRESHOLD, _PyCode_HotnessThreshold(code));
 
     PyMem_DEL(code);
 }
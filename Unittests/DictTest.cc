@@ -23,10 +23,18 @@ protected:
     {
         PyCodeObject *code = PyMem_NEW(PyCodeObject, 1);
         assert(code != NULL);
-        // We only initialize the fields related to dict watchers.
+        // We only initialize the fields related to dict watchers and
+        // _PyCode_InvalidateMachineCode().
         code->co_watching = NULL;
+        code->co_watched_keys = NULL;
         code->co_use_jit = 0;
         code->co_fatalbailcount = 0;
+        code->co_hotness = 0;
+        code->co_optimization = -1;
+        code->co_llvm_function = NULL;
+        code->co_native_function = NULL;
+        code->co_runtime_feedback = NULL;
+        code->co_retired_llvm_functions = NULL;
         code->ob_type = &PyCode_Type;
         return code;
     }
@@ -116,3 +124,50 @@ TEST_F(DictWatcherTest, NotifyWatcher)
 
     PyMem_DEL(code1);
 }
+
+TEST_F(DictWatcherTest, NotifyWatchedKeysOnly)
+{
+    PyCodeObject *code1 = this->FakeCodeObject();
+    code1->co_use_jit = 1;
+    PyDictObject *globals_dict = (PyDictObject *)this->globals_;
+
+    EXPECT_EQ(0, _PyCode_WatchDict(code1, WATCHING_GLOBALS, this->globals_));
+    // Not interned, so the dict's key will be a different object.
+    PyObject *keys = Py_BuildValue("(s)", "watched");
+    EXPECT_EQ(0, _PyCode_AddWatchedKeys(code1, WATCHING_GLOBALS, keys));
+    Py_DECREF(keys);
+
+    PyDict_SetItemString(this->globals_, "unrelated", Py_None);
+    EXPECT_EQ(1, code1->co_use_jit);
+    EXPECT_EQ(1, _PyDict_NumWatchers(globals_dict));
+
+    PyDict_SetItemString(this->globals_, "watched", Py_None);
+    EXPECT_EQ(0, code1->co_use_jit);
+    EXPECT_EQ(0, _PyDict_NumWatchers(globals_dict));
+    EXPECT_EQ(0, _PyCode_WatchingSize(code1));
+
+    PyMem_Free(code1->co_watched_keys);
+    PyMem_DEL(code1);
+}
+
+TEST_F(DictWatcherTest, NotifyNonStringKey)
+{
+    PyCodeObject *code1 = this->FakeCodeObject();
+    code1->co_use_jit = 1;
+
+    EXPECT_EQ(0, _PyCode_WatchDict(code1, WATCHING_GLOBALS, this->globals_));
+    PyObject *keys = Py_BuildValue("(s)", "watched");
+    EXPECT_EQ(0, _PyCode_AddWatchedKeys(code1, WATCHING_GLOBALS, keys));
+    Py_DECREF(keys);
+
+    // We don't try to prove that other types of keys can't compare equal
+    // to the names we depend on.
+    PyObject *key = PyInt_FromLong(5);
+    PyDict_SetItem(this->globals_, key, Py_None);
+    Py_DECREF(key);
+    EXPECT_EQ(0, code1->co_use_jit);
+    EXPECT_EQ(0, _PyDict_NumWatchers((PyDictObject *)this->globals_));
+
+    PyMem_Free(code1->co_watched_keys);
+    PyMem_DEL(code1);
+}
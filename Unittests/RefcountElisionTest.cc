@@ -0,0 +1,240 @@
+#include "JIT/RefcountElision.h"
+
+#include "Python.h"
+#include "JIT/global_llvm_data.h"
+#include "JIT/PyTypeBuilder.h"
+
+#include "llvm/Analysis/Verifier.h"
+#include "llvm/BasicBlock.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/Function.h"
+#include "llvm/Instructions.h"
+#include "llvm/Module.h"
+#include "llvm/PassManager.h"
+#include "llvm/Support/IRBuilder.h"
+#include "llvm/Target/TargetData.h"
+#include "gtest/gtest.h"
+
+using llvm::BasicBlock;
+using llvm::CallInst;
+using llvm::ConstantInt;
+using llvm::Function;
+using llvm::FunctionPassManager;
+using llvm::GlobalValue;
+using llvm::IRBuilder;
+using llvm::Value;
+using llvm::dyn_cast;
+
+namespace {
+
+class PythonRuntime {
+public:
+    PythonRuntime()
+    {
+        Py_NoSiteFlag = true;
+        Py_Initialize();
+    }
+    ~PythonRuntime()
+    {
+        Py_Finalize();
+    }
+};
+
+class RefcountElisionTest : public testing::Test {
+protected:
+    RefcountElisionTest()
+        : global_data_(*PyGlobalLlvmData::Get()),
+          fpm_(this->global_data_.module()),
+          function_(Function::Create(
+                        PyTypeBuilder<void(PyObject*, PyObject**, int)>::get(
+                            this->global_data_.context()),
+                        GlobalValue::ExternalLinkage,
+                        "function", this->global_data_.module())),
+          builder_(BasicBlock::Create(this->function_->getContext(), "",
+                                      this->function_))
+    {
+        Function::arg_iterator args = this->function_->arg_begin();
+        this->object_ = args++;
+        this->stack_ = args++;
+        this->flag_ = args++;
+
+        llvm::Module *module = this->global_data_.module();
+        this->incref_ = module->getFunction("_PyLlvm_WrapIncref");
+        this->decref_ = module->getFunction("_PyLlvm_WrapDecref");
+        this->opaque_ = Function::Create(
+            PyTypeBuilder<void()>::get(this->global_data_.context()),
+            GlobalValue::ExternalLinkage, "opaque", module);
+
+        fpm_.add(new llvm::TargetData(
+                     *this->global_data_.getExecutionEngine()
+                     ->getTargetData()));
+        fpm_.add(CreatePyRefcountElisionPass(this->global_data_));
+        // Make sure nothing stupid happens.
+        fpm_.add(llvm::createVerifierPass());
+    }
+
+    Value *StackSlot(int index)
+    {
+        return this->builder_.CreateGEP(
+            this->stack_,
+            ConstantInt::get(PyTypeBuilder<int>::get(
+                                 this->global_data_.context()), index));
+    }
+
+    int CountCallsTo(Function *callee, BasicBlock *only_in = NULL)
+    {
+        int count = 0;
+        for (Function::iterator bb = this->function_->begin(),
+                 bb_end = this->function_->end(); bb != bb_end; ++bb) {
+            if (only_in != NULL && only_in != &*bb)
+                continue;
+            for (BasicBlock::iterator inst = bb->begin(); inst != bb->end();
+                 ++inst) {
+                CallInst *call = dyn_cast<CallInst>(inst);
+                if (call != NULL && call->getCalledFunction() == callee)
+                    ++count;
+            }
+        }
+        return count;
+    }
+
+    PythonRuntime pr_;
+    PyGlobalLlvmData &global_data_;
+    FunctionPassManager fpm_;
+    Function *function_;
+    IRBuilder<> builder_;
+    Value *object_;
+    Value *stack_;
+    Value *flag_;
+    Function *incref_;
+    Function *decref_;
+    Function *opaque_;
+};
+
+TEST_F(RefcountElisionTest, RemovesAdjacentPair)
+{
+    this->builder_.CreateCall(this->incref_, this->object_);
+    this->builder_.CreateCall(this->decref_, this->object_);
+    this->builder_.CreateRetVoid();
+
+    this->fpm_.run(*this->function_);
+
+    EXPECT_EQ(0, this->CountCallsTo(this->incref_));
+    EXPECT_EQ(0, this->CountCallsTo(this->decref_));
+}
+
+TEST_F(RefcountElisionTest, KeepsPairAroundUnknownCall)
+{
+    this->builder_.CreateCall(this->incref_, this->object_);
+    this->builder_.CreateCall(this->opaque_);
+    this->builder_.CreateCall(this->decref_, this->object_);
+    this->builder_.CreateRetVoid();
+
+    this->fpm_.run(*this->function_);
+
+    EXPECT_EQ(1, this->CountCallsTo(this->incref_));
+    EXPECT_EQ(1, this->CountCallsTo(this->decref_));
+}
+
+TEST_F(RefcountElisionTest, KeepsPairAroundOtherDecref)
+{
+    // Decrefing a different object can run a __del__ method.
+    Value *other = this->builder_.CreateLoad(this->StackSlot(0));
+    this->builder_.CreateCall(this->incref_, this->object_);
+    this->builder_.CreateCall(this->decref_, other);
+    this->builder_.CreateCall(this->decref_, this->object_);
+    this->builder_.CreateRetVoid();
+
+    this->fpm_.run(*this->function_);
+
+    EXPECT_EQ(1, this->CountCallsTo(this->incref_));
+    EXPECT_EQ(2, this->CountCallsTo(this->decref_));
+}
+
+TEST_F(RefcountElisionTest, LooksThroughStackSlots)
+{
+    // Push(object); ... Pop() with a separately-computed address.
+    this->builder_.CreateCall(this->incref_, this->object_);
+    this->builder_.CreateStore(this->object_, this->StackSlot(1));
+    Value *popped = this->builder_.CreateLoad(this->StackSlot(1));
+    this->builder_.CreateCall(this->decref_, popped);
+    this->builder_.CreateRetVoid();
+
+    this->fpm_.run(*this->function_);
+
+    EXPECT_EQ(0, this->CountCallsTo(this->incref_));
+    EXPECT_EQ(0, this->CountCallsTo(this->decref_));
+}
+
+TEST_F(RefcountElisionTest, OverwrittenStackSlot)
+{
+    Value *other = this->builder_.CreateLoad(this->StackSlot(0));
+    this->builder_.CreateCall(this->incref_, this->object_);
+    this->builder_.CreateStore(this->object_, this->StackSlot(1));
+    this->builder_.CreateStore(other, this->StackSlot(1));
+    Value *popped = this->builder_.CreateLoad(this->StackSlot(1));
+    this->builder_.CreateCall(this->decref_, popped);
+    this->builder_.CreateRetVoid();
+
+    this->fpm_.run(*this->function_);
+
+    EXPECT_EQ(1, this->CountCallsTo(this->incref_));
+    EXPECT_EQ(1, this->CountCallsTo(this->decref_));
+}
+
+TEST_F(RefcountElisionTest, SinksIncrefPastGuard)
+{
+    BasicBlock *fast = BasicBlock::Create(this->function_->getContext(),
+                                          "fast", this->function_);
+    BasicBlock *slow = BasicBlock::Create(this->function_->getContext(),
+                                          "slow", this->function_);
+    this->builder_.CreateCall(this->incref_, this->object_);
+    this->builder_.CreateCondBr(
+        this->builder_.CreateIsNotNull(this->flag_), fast, slow);
+
+    this->builder_.SetInsertPoint(fast);
+    this->builder_.CreateCall(this->decref_, this->object_);
+    this->builder_.CreateRetVoid();
+
+    this->builder_.SetInsertPoint(slow);
+    this->builder_.CreateCall(this->opaque_);
+    this->builder_.CreateCall(this->decref_, this->object_);
+    this->builder_.CreateRetVoid();
+
+    this->fpm_.run(*this->function_);
+
+    EXPECT_EQ(0, this->CountCallsTo(this->incref_, fast));
+    EXPECT_EQ(0, this->CountCallsTo(this->decref_, fast));
+    EXPECT_EQ(1, this->CountCallsTo(this->incref_, slow));
+    EXPECT_EQ(1, this->CountCallsTo(this->decref_, slow));
+    EXPECT_EQ(1, this->CountCallsTo(this->incref_));
+}
+
+TEST_F(RefcountElisionTest, DoesNotSinkWithoutPayoff)
+{
+    BasicBlock *left = BasicBlock::Create(this->function_->getContext(),
+                                          "left", this->function_);
+    BasicBlock *right = BasicBlock::Create(this->function_->getContext(),
+                                           "right", this->function_);
+    BasicBlock *entry = this->builder_.GetInsertBlock();
+    this->builder_.CreateCall(this->incref_, this->object_);
+    this->builder_.CreateCondBr(
+        this->builder_.CreateIsNotNull(this->flag_), left, right);
+
+    this->builder_.SetInsertPoint(left);
+    this->builder_.CreateCall(this->opaque_);
+    this->builder_.CreateCall(this->decref_, this->object_);
+    this->builder_.CreateRetVoid();
+
+    this->builder_.SetInsertPoint(right);
+    this->builder_.CreateCall(this->opaque_);
+    this->builder_.CreateCall(this->decref_, this->object_);
+    this->builder_.CreateRetVoid();
+
+    this->fpm_.run(*this->function_);
+
+    EXPECT_EQ(1, this->CountCallsTo(this->incref_, entry));
+    EXPECT_EQ(1, this->CountCallsTo(this->incref_));
+}
+
+}  // namespace
@@ -1,4 +1,5 @@
 #include "Python.h"
+#include "opcode.h"
 #include "JIT/RuntimeFeedback.h"
 #include "llvm/ADT/SmallVector.h"
 #include "gtest/gtest.h"
@@ -260,6 +261,45 @@ TEST_F(PyLimitedFeedbackTest, Counter)
     // How to check that saturation works?
 }
 
+TEST_F(PyLimitedFeedbackTest, CounterBy)
+{
+    EXPECT_EQ(PY_FDO_KIND_EMPTY, this->feedback_.GetKind());
+    this->feedback_.IncCounter(0);
+    this->feedback_.IncCounterBy(0, 41);
+    this->feedback_.IncCounterBy(1, 0);
+    EXPECT_EQ(PY_FDO_KIND_COUNTERS, this->feedback_.GetKind());
+    EXPECT_EQ(42U, this->feedback_.GetCounter(0));
+    EXPECT_EQ(0U, this->feedback_.GetCounter(1));
+
+    // Counters saturate instead of wrapping.
+    uintptr_t saturated = this->feedback_.GetCounter(0);
+    this->feedback_.IncCounterBy(0, ~(uintptr_t)0);
+    EXPECT_LT(saturated, this->feedback_.GetCounter(0));
+    saturated = this->feedback_.GetCounter(0);
+    this->feedback_.IncCounterBy(0, 5);
+    this->feedback_.IncCounter(0);
+    EXPECT_EQ(saturated, this->feedback_.GetCounter(0));
+}
+
+TEST_F(PyLimitedFeedbackTest, TypeMethodSeen)
+{
+    PyObject *descr = PyObject_GetAttrString((PyObject *)&PyList_Type,
+                                             "append");
+    PyMethodDef *ml = ((PyMethodDescrObject *)descr)->d_method;
+
+    this->feedback_.AddTypeMethodSeen(Py_TYPE(descr), ml);
+    EXPECT_EQ(PY_FDO_KIND_FUNCS, this->feedback_.GetKind());
+    // The same function as seen through AddFuncSeen() isn't new.
+    this->feedback_.AddFuncSeen(descr);
+    SmallVector<PyTypeMethodPair, 3> seen;
+    this->feedback_.GetSeenFuncsInto(seen);
+    ASSERT_EQ(1U, seen.size());
+    EXPECT_EQ(Py_TYPE(descr), seen[0].first);
+    EXPECT_EQ(ml, seen[0].second);
+
+    Py_DECREF(descr);
+}
+
 TEST_F(PyLimitedFeedbackTest, Copyable)
 {
     long int_start_refcnt = Py_REFCNT(this->an_int_);
@@ -404,6 +444,45 @@ TEST_F(PyFullFeedbackTest, Counter)
     // How to check that saturation works?
 }
 
+TEST_F(PyFullFeedbackTest, CounterBy)
+{
+    EXPECT_EQ(PY_FDO_KIND_EMPTY, this->feedback_.GetKind());
+    this->feedback_.IncCounter(0);
+    this->feedback_.IncCounterBy(0, 41);
+    this->feedback_.IncCounterBy(1, 0);
+    EXPECT_EQ(PY_FDO_KIND_COUNTERS, this->feedback_.GetKind());
+    EXPECT_EQ(42U, this->feedback_.GetCounter(0));
+    EXPECT_EQ(0U, this->feedback_.GetCounter(1));
+
+    // Counters saturate instead of wrapping.
+    uintptr_t saturated = this->feedback_.GetCounter(0);
+    this->feedback_.IncCounterBy(0, ~(uintptr_t)0);
+    EXPECT_LT(saturated, this->feedback_.GetCounter(0));
+    saturated = this->feedback_.GetCounter(0);
+    this->feedback_.IncCounterBy(0, 5);
+    this->feedback_.IncCounter(0);
+    EXPECT_EQ(saturated, this->feedback_.GetCounter(0));
+}
+
+TEST_F(PyFullFeedbackTest, TypeMethodSeen)
+{
+    PyObject *descr = PyObject_GetAttrString((PyObject *)&PyList_Type,
+                                             "append");
+    PyMethodDef *ml = ((PyMethodDescrObject *)descr)->d_method;
+
+    this->feedback_.AddTypeMethodSeen(Py_TYPE(descr), ml);
+    EXPECT_EQ(PY_FDO_KIND_FUNCS, this->feedback_.GetKind());
+    // The same function as seen through AddFuncSeen() isn't new.
+    this->feedback_.AddFuncSeen(descr);
+    SmallVector<PyTypeMethodPair, 3> seen;
+    this->feedback_.GetSeenFuncsInto(seen);
+    ASSERT_EQ(1U, seen.size());
+    EXPECT_EQ(Py_TYPE(descr), seen[0].first);
+    EXPECT_EQ(ml, seen[0].second);
+
+    Py_DECREF(descr);
+}
+
 TEST_F(PyFullFeedbackTest, Copyable)
 {
     long int_start_refcnt = Py_REFCNT(this->an_int_);
@@ -530,3 +609,95 @@ TEST_F(PyFullFeedbackTest, SameMethodSameTypeDifferentObjects)
     Py_DECREF(join_meth1);
     Py_DECREF(join_meth2);
 }
+
+class PyFeedbackMapTest : public PyRuntimeFeedbackTest {
+protected:
+    PyFeedbackMap map_;
+};
+
+TEST_F(PyFeedbackMapTest, ClearKeepingMegamorphic)
+{
+    PyRuntimeFeedback &few = this->map_.GetOrCreateFeedbackEntry(0, 0);
+    few.AddObjectSeen(this->an_int_);
+    PyRuntimeFeedback &many = this->map_.GetOrCreateFeedbackEntry(1, 0);
+    many.AddObjectSeen(this->an_int_);
+    many.AddObjectSeen(this->a_list_);
+    many.AddObjectSeen(this->a_tuple_);
+    many.AddObjectSeen(this->a_dict_);
+    PyRuntimeFeedback &counters = this->map_.GetOrCreateFeedbackEntry(2, 0);
+    counters.IncCounter(0);
+    unsigned generation = this->map_.GetGeneration();
+
+    this->map_.ClearKeepingMegamorphic();
+    EXPECT_EQ(generation + 1, this->map_.GetGeneration());
+
+    SmallVector<PyObject*, 3> seen;
+    const PyRuntimeFeedback *entry = this->map_.GetFeedbackEntry(0, 0);
+    ASSERT_TRUE(entry != NULL);
+    EXPECT_EQ(PY_FDO_KIND_EMPTY, entry->GetKind());
+
+    entry = this->map_.GetFeedbackEntry(1, 0);
+    ASSERT_TRUE(entry != NULL);
+    EXPECT_TRUE(entry->ObjectsOverflowed());
+    entry->GetSeenObjectsInto(seen);
+    EXPECT_EQ(3U, seen.size());
+
+    entry = this->map_.GetFeedbackEntry(2, 0);
+    ASSERT_TRUE(entry != NULL);
+    EXPECT_EQ(PY_FDO_KIND_EMPTY, entry->GetKind());
+
+    // Clear() forgets everything.
+    this->map_.Clear();
+    entry = this->map_.GetFeedbackEntry(1, 0);
+    ASSERT_TRUE(entry != NULL);
+    EXPECT_FALSE(entry->ObjectsOverflowed());
+}
+
+TEST_F(PyFeedbackMapTest, SlotsFromBytecode)
+{
+    const unsigned char code[] = {
+        BINARY_ADD,
+        LOAD_ATTR, 0, 0,
+        EXTENDED_ARG, 1, 0,
+        CALL_FUNCTION, 2, 0,
+    };
+    PyObject *co_code =
+        PyString_FromStringAndSize((const char *)code, sizeof(code));
+    PyFeedbackMap map(co_code);
+    Py_DECREF(co_code);
+
+    // The scan made room for every entry these instructions record: two
+    // for BINARY_ADD, one for LOAD_ATTR, and the function and two argument
+    // types for CALL_FUNCTION, which the EXTENDED_ARG owns.
+    PyFeedbackMap::EntryList entries;
+    map.GetEntriesInto(entries);
+    EXPECT_EQ(6U, entries.size());
+    EXPECT_TRUE(map.GetFeedbackEntry(0, 1) != NULL);
+    EXPECT_TRUE(map.GetFeedbackEntry(1, 0) != NULL);
+    EXPECT_TRUE(map.GetFeedbackEntry(4, 2) != NULL);
+    EXPECT_TRUE(map.GetFeedbackEntry(1, 1) == NULL);
+    EXPECT_TRUE(map.GetFeedbackEntry(7, 0) == NULL);
+
+    map.GetOrCreateFeedbackEntry(0, 0).AddObjectSeen(this->an_int_);
+    map.GetOrCreateFeedbackEntry(0, 1).AddObjectSeen(this->a_list_);
+    SmallVector<PyObject*, 3> seen;
+    map.GetFeedbackEntry(0, 0)->GetSeenObjectsInto(seen);
+    ASSERT_EQ(1U, seen.size());
+    EXPECT_EQ(this->an_int_, seen[0]);
+    map.GetFeedbackEntry(0, 1)->GetSeenObjectsInto(seen);
+    ASSERT_EQ(1U, seen.size());
+    EXPECT_EQ(this->a_list_, seen[0]);
+    EXPECT_EQ(PY_FDO_KIND_EMPTY, map.GetFeedbackEntry(1, 0)->GetKind());
+
+    // Entries the scan didn't predict still work; they just take more room.
+    size_t memory = map.GetMemoryUsage();
+    map.GetOrCreateFeedbackEntry(1, 1).IncCounter(0);
+    EXPECT_EQ(1U, map.GetFeedbackEntry(1, 1)->GetCounter(0));
+    EXPECT_LT(memory, map.GetMemoryUsage());
+    map.GetEntriesInto(entries);
+    EXPECT_EQ(7U, entries.size());
+
+    map.Clear();
+    EXPECT_EQ(PY_FDO_KIND_EMPTY, map.GetFeedbackEntry(0, 0)->GetKind());
+    EXPECT_EQ(PY_FDO_KIND_EMPTY, map.GetFeedbackEntry(1, 1)->GetKind());
+}
@@ -2,33 +2,86 @@
 
 #include "Python.h"
 
-#include "Include/pystate.h"
 #include "Include/pythread.h"
 
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/MutexGuard.h"
+#include "llvm/System/Atomic.h"
 
 #include <algorithm>
-#include <numeric>
-#include <time.h>
-#include <utility>
+#include <stdio.h>
 #include <vector>
 #if defined(_M_IX86) || defined(_M_X64) /* x86 or x64 on MSVC */
 #include <intrin.h>  /* for __rdtsc() */
 #endif
+#ifdef MS_WINDOWS
+#include <windows.h>  /* for Sleep() */
+#endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 
+// Events each thread can log between flushes.  Must be a power of two.
+#define PY_TSC_BUFFER_SIZE 16384
 
-#define PY_EVENT_BUFFER_SIZE 10000
+// How long the flusher sleeps between passes over the buffers.
+#define PY_TSC_FLUSH_INTERVAL_MS 10
+
+#define PY_TSC_DUMP_VERSION 1
+
+#if defined(_MSC_VER)
+#define PY_TSC_THREAD_LOCAL __declspec(thread)
+#else
+#define PY_TSC_THREAD_LOCAL __thread
+#endif
 
 
 #ifdef WITH_TSC
 
+namespace {
+
+/// The events logged by a single thread.  The owning thread is the only one
+/// that writes events and head; the flusher is the only one that writes tail.
+/// head and tail count the events ever logged and drained, so head - tail is
+/// the number waiting even after the counters wrap.
+struct TscThreadBuffer {
+    TscThreadBuffer(unsigned id, long ident)
+        : head(0), tail(0), dropped(0), dropped_written(0), announced(false),
+          retired(false), id(id), ident(ident) {}
+
+    struct Entry {
+        tsc_t time;
+        _PyTscEventId event;
+    };
+    Entry events[PY_TSC_BUFFER_SIZE];
+    volatile unsigned head;
+    volatile unsigned tail;
+
+    // Events the owner couldn't log because the buffer was full.
+    volatile unsigned dropped;
+
+    // Flusher-only state: how many of the dropped events have been written,
+    // and whether the current trace file has a 'T' record for this thread.
+    unsigned dropped_written;
+    bool announced;
+
+    // Set when the owning thread exits.  The flusher frees the buffer once it
+    // has been drained.
+    volatile bool retired;
+
+    const unsigned id;
+    const long ident;
+};
+
+}  // anonymous namespace
+
 
-/// Timer class used to measure times between various events, such as the time
-/// between a CALL_FUNCTION opcode start and the execution of the function.
-/// At Python-shutdown, the event log is printed to stderr.  This class is
-/// declared here instead of in the header so that the header can be included
-/// by straight C files.
+/// Collects the events logged by every thread and streams them to a trace
+/// file in the format described in EventTimer.h.  Logging an event touches
+/// only the calling thread's buffer; the lock is taken once per thread, when
+/// its buffer is created.  This class is declared here instead of in the
+/// header so that the header can be included by straight C files.
 
 class _PyEventTimer {
 
@@ -38,35 +91,63 @@ public:
 
     static const char * const EventToString(_PyTscEventId event);
 
-    typedef std::vector<_PyTscEvent> EventVector;
-
     void LogEvent(_PyTscEventId event);
 
-    void PrintData();
+    // Start() and Stop() are serialized by the GIL.
+    int Start(const char *path);
+    void Stop();
 
 private:
-    // Map a system thread id (a long that takes 11 chars to print, usually)
-    // to a much shorter thread id (ideally 1 char). This is used to cut the
-    // output size by 30%, which dramatically speeds up analysis.
-    // This is not thread-safe.
-    long GetDenseThreadId(long thread_id);
+    TscThreadBuffer *RegisterThread();
 
-    // Serialize mutations of this->data_.
-    llvm::sys::Mutex lock_;
+    // Forget whatever was logged while no dump was running.
+    void DiscardPending();
 
-    // Central respository for all the data. This maps (Label, Label) pairs
-    // to a vector of times in nanoseconds (based on clock_gettime()).
-    EventVector data_;
+    static void FlusherMain(void *timer);
+    void FlushAll();
+    void WriteHeader();
+    void WriteBuffer(TscThreadBuffer *buffer);
 
-    // Map Python thread ids to our much shorter ids. The index in the vector
-    // is the new thread id. A linear search is fine since there will generally
-    // only be a few threads.
-    std::vector<long> thread_id_;
+    void PutU8(unsigned char value);
+    void PutU16(unsigned value);
+    void PutU32(unsigned value);
+    void PutU64(unsigned PY_LONG_LONG value);
+
+    // Guards buffers_ and next_thread_id_.
+    llvm::sys::Mutex lock_;
+    std::vector<TscThreadBuffer*> buffers_;
+    unsigned next_thread_id_;
+
+    // Read without locking on every event.
+    volatile bool enabled_;
+    // Tells the flusher to make one last pass and exit.
+    volatile bool stopping_;
+    // Held for as long as the flusher runs.
+    PyThread_type_lock flusher_done_;
+
+    // Owned by the flusher while it runs.
+    FILE *file_;
+    std::vector<unsigned char> out_;
 };
 
 
 static llvm::ManagedStatic< _PyEventTimer > event_timer;
 
+// The current thread's buffer, or NULL if it hasn't logged anything yet.
+static PY_TSC_THREAD_LOCAL TscThreadBuffer *this_thread_buffer;
+
+#ifdef HAVE_PTHREAD_H
+// Lets us find out when a thread with a buffer exits.
+static pthread_key_t retire_key;
+
+static void
+retire_buffer(void *buffer)
+{
+    llvm::sys::MemoryFence();
+    static_cast<TscThreadBuffer*>(buffer)->retired = true;
+}
+#endif
+
 static inline tsc_t
 read_tsc() {
     tsc_t time;
@@ -106,14 +187,30 @@ loop:
     return time;
 }
 
+static void
+sleep_ms(unsigned ms)
+{
+#ifdef MS_WINDOWS
+    Sleep(ms);
+#else
+    usleep(ms * 1000);
+#endif
+}
+
 /// _PyEventTimer
 
-_PyEventTimer::_PyEventTimer() {
-    this->data_.reserve(PY_EVENT_BUFFER_SIZE);
+_PyEventTimer::_PyEventTimer()
+    : next_thread_id_(0), enabled_(false), stopping_(false),
+      flusher_done_(NULL), file_(NULL) {
+#ifdef HAVE_PTHREAD_H
+    pthread_key_create(&retire_key, retire_buffer);
+#endif
 }
 
 _PyEventTimer::~_PyEventTimer() {
-    this->PrintData();
+    this->Stop();
+    // Daemon threads may still hold pointers to their buffers, so leave them
+    // for the OS to reclaim.
 }
 
 void
@@ -121,6 +218,16 @@ _PyLog_TscEvent(_PyTscEventId event) {
     event_timer->LogEvent(event);
 }
 
+int
+_PyTscDump_Start(const char *path) {
+    return event_timer->Start(path);
+}
+
+void
+_PyTscDump_Stop(void) {
+    event_timer->Stop();
+}
+
 // This must be kept in sync with the _PyTscEventId enum in EventTimer.h
 static const char * const event_names[] = {
     "CALL_START_EVAL",
@@ -153,52 +260,247 @@ _PyEventTimer::EventToString(_PyTscEventId event_id) {
     return event_names[(int)event_id];
 }
 
-long
-_PyEventTimer::GetDenseThreadId(long sys_thread_id) {
-    for (long idx = 0; idx < this->thread_id_.size(); idx++) {
-        if (this->thread_id_[idx] == sys_thread_id)
-            return idx;
+void
+_PyEventTimer::LogEvent(_PyTscEventId event_id) {
+    // This needs to be really low overhead: no locks and no system calls
+    // once the thread has a buffer.
+    tsc_t tsc_time = read_tsc();
+    if (!this->enabled_)
+        return;
+    TscThreadBuffer *buffer = this_thread_buffer;
+    if (buffer == NULL)
+        buffer = this->RegisterThread();
+    unsigned head = buffer->head;
+    if (head - buffer->tail >= PY_TSC_BUFFER_SIZE) {
+        // The flusher is behind.  Dropping is better than stalling the
+        // thread we're trying to measure.
+        buffer->dropped++;
+        return;
     }
-    long dense_id = this->thread_id_.size();
-    this->thread_id_.push_back(sys_thread_id);
-    return dense_id;
+    TscThreadBuffer::Entry &entry =
+        buffer->events[head & (PY_TSC_BUFFER_SIZE - 1)];
+    entry.time = tsc_time;
+    entry.event = event_id;
+    // The flusher must not see the new head before the entry itself.
+    llvm::sys::MemoryFence();
+    buffer->head = head + 1;
+}
+
+TscThreadBuffer *
+_PyEventTimer::RegisterThread() {
+    llvm::MutexGuard locked(this->lock_);
+    TscThreadBuffer *buffer = new TscThreadBuffer(this->next_thread_id_++,
+                                                  PyThread_get_thread_ident());
+    this->buffers_.push_back(buffer);
+    this_thread_buffer = buffer;
+#ifdef HAVE_PTHREAD_H
+    pthread_setspecific(retire_key, buffer);
+#endif
+    return buffer;
 }
 
 void
-_PyEventTimer::LogEvent(_PyTscEventId event_id) {
-    // This needs to try to be really low overhead.  The lock acquire down
-    // there doesn't really help.
-    tsc_t tsc_time = read_tsc();
-    PyThreadState *tstate = PyThreadState_GET();
-    if (tstate->interp->tscdump) {
-        _PyTscEvent event;
-        long thread_id = PyThread_get_thread_ident();
-        event.event_id = event_id;
-        event.time = tsc_time;
+_PyEventTimer::DiscardPending() {
+    llvm::MutexGuard locked(this->lock_);
+    std::vector<TscThreadBuffer*> live;
+    for (std::vector<TscThreadBuffer*>::iterator it = this->buffers_.begin();
+         it != this->buffers_.end(); ++it) {
+        TscThreadBuffer *buffer = *it;
+        if (buffer->retired) {
+            delete buffer;
+            continue;
+        }
+        buffer->tail = buffer->head;
+        buffer->dropped_written = buffer->dropped;
+        buffer->announced = false;
+        live.push_back(buffer);
+    }
+    this->buffers_.swap(live);
+}
+
+int
+_PyEventTimer::Start(const char *path) {
+    this->Stop();
+
+    char default_path[64];
+    if (path == NULL) {
+#ifdef HAVE_GETPID
+        PyOS_snprintf(default_path, sizeof(default_path),
+                      "tsc-%ld.dump", (long)getpid());
+#else
+        PyOS_snprintf(default_path, sizeof(default_path), "tsc.dump");
+#endif
+        path = default_path;
+    }
+    if (this->flusher_done_ == NULL) {
+        this->flusher_done_ = PyThread_allocate_lock();
+        if (this->flusher_done_ == NULL) {
+            PyErr_SetString(PyExc_RuntimeError, "can't allocate lock");
+            return -1;
+        }
+    }
+    this->file_ = fopen(path, "wb");
+    if (this->file_ == NULL) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError,
+                                       const_cast<char*>(path));
+        return -1;
+    }
+
+    this->DiscardPending();
+    this->WriteHeader();
+    this->stopping_ = false;
+    PyThread_acquire_lock(this->flusher_done_, WAIT_LOCK);
+    if (PyThread_start_new_thread(FlusherMain, this) == -1) {
+        PyThread_release_lock(this->flusher_done_);
+        fclose(this->file_);
+        this->file_ = NULL;
+        PyErr_SetString(PyExc_RuntimeError,
+                        "can't start the TSC dump thread");
+        return -1;
+    }
+    this->enabled_ = true;
+    return 0;
+}
+
+void
+_PyEventTimer::Stop() {
+    if (this->file_ == NULL)
+        return;
+    this->enabled_ = false;
+    this->stopping_ = true;
+    // Wait for the flusher's last pass.
+    PyThread_acquire_lock(this->flusher_done_, WAIT_LOCK);
+    PyThread_release_lock(this->flusher_done_);
+    fclose(this->file_);
+    this->file_ = NULL;
+}
+
+void
+_PyEventTimer::FlusherMain(void *arg) {
+    _PyEventTimer *timer = static_cast<_PyEventTimer*>(arg);
+    while (!timer->stopping_) {
+        sleep_ms(PY_TSC_FLUSH_INTERVAL_MS);
+        timer->FlushAll();
+    }
+    timer->FlushAll();
+    PyThread_release_lock(timer->flusher_done_);
+}
+
+void
+_PyEventTimer::FlushAll() {
+    std::vector<TscThreadBuffer*> buffers;
+    {
         llvm::MutexGuard locked(this->lock_);
-        event.thread_id = this->GetDenseThreadId(thread_id);
-        this->data_.push_back(event);
-        // Don't flush if we're recording the flush start event, or we'll
-        // infinite loop.
-        if (this->data_.size() >= PY_EVENT_BUFFER_SIZE - 1 &&
-            event_id != FLUSH_START) {
-            this->LogEvent(FLUSH_START);
-            this->PrintData();
-            this->LogEvent(FLUSH_END);
+        buffers = this->buffers_;
+    }
+
+    std::vector<TscThreadBuffer*> retired;
+    for (std::vector<TscThreadBuffer*>::iterator it = buffers.begin();
+         it != buffers.end(); ++it) {
+        TscThreadBuffer *buffer = *it;
+        // If the owner has exited, everything it logged is visible after
+        // this fence, so one more drain empties the buffer for good.
+        bool is_retired = buffer->retired;
+        llvm::sys::MemoryFence();
+        this->WriteBuffer(buffer);
+        if (is_retired)
+            retired.push_back(buffer);
+    }
+
+    if (!this->out_.empty()) {
+        fwrite(&this->out_[0], 1, this->out_.size(), this->file_);
+        fflush(this->file_);
+        this->out_.clear();
+    }
+
+    if (!retired.empty()) {
+        llvm::MutexGuard locked(this->lock_);
+        for (std::vector<TscThreadBuffer*>::iterator it = retired.begin();
+             it != retired.end(); ++it) {
+            this->buffers_.erase(std::find(this->buffers_.begin(),
+                                           this->buffers_.end(), *it));
+            delete *it;
         }
     }
 }
 
 void
-_PyEventTimer::PrintData() {
-    // Print the data to stderr as a tab separated file.
-    for (EventVector::iterator it = this->data_.begin();
-         it != this->data_.end(); ++it) {
-        const char * const str_name = this->EventToString(it->event_id);
-        fprintf(stderr, "%ld\t%s\t%llu\n",
-                it->thread_id, str_name, it->time);
+_PyEventTimer::WriteHeader() {
+    fwrite("PYTSCDMP", 1, 8, this->file_);
+    this->PutU32(PY_TSC_DUMP_VERSION);
+    unsigned num_events = sizeof(event_names) / sizeof(event_names[0]);
+    this->PutU32(num_events);
+    for (unsigned i = 0; i < num_events; ++i) {
+        size_t length = strlen(event_names[i]);
+        this->PutU8(length);
+        this->out_.insert(this->out_.end(), event_names[i],
+                          event_names[i] + length);
+    }
+    fwrite(&this->out_[0], 1, this->out_.size(), this->file_);
+    this->out_.clear();
+}
+
+void
+_PyEventTimer::WriteBuffer(TscThreadBuffer *buffer) {
+    unsigned head = buffer->head;
+    unsigned dropped = buffer->dropped;
+    // Read the entries only after reading the head that covers them.
+    llvm::sys::MemoryFence();
+    unsigned tail = buffer->tail;
+    if (head == tail && dropped == buffer->dropped_written)
+        return;
+
+    if (!buffer->announced) {
+        this->PutU8('T');
+        this->PutU32(buffer->id);
+        this->PutU64(buffer->ident);
+        buffer->announced = true;
     }
-    this->data_.clear();
+    if (head != tail) {
+        this->PutU8('E');
+        this->PutU32(buffer->id);
+        this->PutU32(head - tail);
+        for (unsigned i = tail; i != head; ++i) {
+            const TscThreadBuffer::Entry &entry =
+                buffer->events[i & (PY_TSC_BUFFER_SIZE - 1)];
+            this->PutU64(entry.time);
+            this->PutU16(entry.event);
+        }
+        // Finish reading the entries before the owner can overwrite them.
+        llvm::sys::MemoryFence();
+        buffer->tail = head;
+    }
+    // A thread only drops events while its buffer is full, so these were
+    // all logged after the ones we just wrote.
+    if (dropped != buffer->dropped_written) {
+        this->PutU8('D');
+        this->PutU32(buffer->id);
+        this->PutU32(dropped - buffer->dropped_written);
+        buffer->dropped_written = dropped;
+    }
+}
+
+void
+_PyEventTimer::PutU8(unsigned char value) {
+    this->out_.push_back(value);
+}
+
+void
+_PyEventTimer::PutU16(unsigned value) {
+    this->PutU8(value & 0xff);
+    this->PutU8((value >> 8) & 0xff);
+}
+
+void
+_PyEventTimer::PutU32(unsigned value) {
+    this->PutU16(value & 0xffff);
+    this->PutU16((value >> 16) & 0xffff);
+}
+
+void
+_PyEventTimer::PutU64(unsigned PY_LONG_LONG value) {
+    this->PutU32((unsigned)(value & 0xffffffffUL));
+    this->PutU32((unsigned)(value >> 32));
 }
 
 #endif  // WITH_TSC
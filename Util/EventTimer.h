@@ -3,6 +3,36 @@
 
 #include "Python.h"
 
+/* When Python is configured --with-tsc, interesting points in the VM (calls,
+   compilation, exceptions, LOAD_GLOBAL) log an event along with the current
+   timestamp counter.  Each thread appends its events to its own ring buffer
+   without taking any locks; a background thread started by
+   sys.settscdump(True) drains the buffers every few milliseconds and appends
+   them to a binary trace file.  If a thread fills its buffer faster than the
+   flusher drains it, the newest events are dropped and counted.
+   Misc/tsc_stats.py reads the trace.
+
+   Trace file format, version 1.  All integers are unsigned and little-endian.
+
+     header:  char magic[8] = "PYTSCDMP"
+              u32 version = 1
+              u32 num_events
+              num_events times: u8 length, char name[length]
+                  (the names of the _PyTscEventId values, in order)
+
+   The header is followed by records until the end of the file.  Each record
+   starts with a one-byte tag and a u32 dense thread id:
+
+     'T' u32 thread, u64 ident
+              Introduces a thread.  ident is PyThread_get_thread_ident().
+              Written before the thread's first 'E' or 'D' record.
+     'E' u32 thread, u32 count, count times: u64 tsc, u16 event
+              Events from one thread, in the order it logged them.  Records
+              for different threads are interleaved arbitrarily.
+     'D' u32 thread, u32 count
+              count events were dropped from this thread after those in its
+              previous 'E' record.
+*/
 
 #ifdef WITH_TSC
 
@@ -29,23 +59,32 @@ typedef enum {
     LOAD_GLOBAL_EXIT_LLVM,  // End of a LOAD_GLOBAL opcode in LLVM
     EVAL_COMPILE_START,     // Start of the entire compilation in eval loop
     EVAL_COMPILE_END,       // End of the entire compilation in eval loop
-    FLUSH_START,            // Start of the TSC event flush
-    FLUSH_END,              // Enf of the TSC event flush
+    FLUSH_START,            // Unused; kept so event numbers stay stable
+    FLUSH_END,              // Unused; kept so event numbers stay stable
 } _PyTscEventId;
 
 typedef unsigned PY_LONG_LONG tsc_t;
 
-typedef struct {
-    long thread_id;
-    _PyTscEventId event_id;
-    tsc_t time;
-} _PyTscEvent;
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Log an event and the TSC when it occurred.  Does nothing unless a dump
+   is in progress. */
+PyAPI_FUNC(void) _PyLog_TscEvent(_PyTscEventId event);
+
+/* Start writing events to the trace file at path, or to tsc-<pid>.dump in
+   the current directory if path is NULL.  A dump already in progress is
+   finished first.  Returns 0, or -1 with an exception set if the file can't
+   be opened or the flusher thread can't be started. */
+PyAPI_FUNC(int) _PyTscDump_Start(const char *path);
+
+/* Write out every event logged so far and close the trace file.  Does
+   nothing if no dump is in progress. */
+PyAPI_FUNC(void) _PyTscDump_Stop(void);
 
-/* Log an event and the TSC when it occurred. */
 #ifdef __cplusplus
-extern "C" PyAPI_FUNC(void) _PyLog_TscEvent(_PyTscEventId event);
-#else
-extern PyAPI_FUNC(void) _PyLog_TscEvent(_PyTscEventId event);
+}
 #endif
 
 /* Simple macro that wraps up the ifdef WITH_TSC check so that callers don't